@@ -44,6 +44,7 @@
 #define URL_PWDLEN 4096
 
 typedef struct fetchIO fetchIO;
+typedef struct fetchPipeline fetchPipeline;
 
 struct url {
 	char		 scheme[URL_SCHEMELEN + 1];
@@ -155,6 +156,13 @@ void		 fetchFreeURLList(struct url_list *);
 char		*fetchUnquotePath(struct url *);
 char		*fetchUnquoteFilename(struct url *);
 
+/* Pipelined requests */
+fetchPipeline	*fetchPipelineOpen(int, int, const char *);
+int		 fetchPipelineAdd(fetchPipeline *, const struct url *);
+fetchIO		*fetchPipelineXGet(fetchPipeline *, struct url *,
+		    struct url_stat *);
+void		 fetchPipelineClose(fetchPipeline *);
+
 /* Connection caching */
 void		 fetchConnectionCacheInit(int, int);
 void		 fetchConnectionCacheClose(void);
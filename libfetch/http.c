@@ -106,8 +106,13 @@
 
 #define HTTP_ERROR(xyz) ((xyz) > 400 && (xyz) < 599)
 
+/* most of a pipelined reply which is left unread before the next reply */
+#define HTTP_PIPE_MAX_DRAIN	65536
+
 static int http_cmd(conn_t *, const char *, ...) LIBFETCH_PRINTFLIKE(2, 3);
 
+struct pipe_conn;
+
 /*****************************************************************************
  * I/O functions for decoding chunked streams
  */
@@ -125,8 +130,11 @@ struct httpio
 	int		 error;		/* error flag */
 	size_t		 chunksize;	/* remaining size of current chunk */
 	off_t		 contentlength;	/* remaining size of the content */
+	struct pipe_conn *pipe;		/* pipeline owning the connection */
 };
 
+static void http_pipe_done(struct pipe_conn *, struct httpio *);
+
 /*
  * Get next chunk header
  */
@@ -285,7 +293,9 @@ http_closefn(void *v)
 	struct httpio *io = (struct httpio *)v;
 	conn_t *conn = io->conn;
 
-	if (io->keep_alive) {
+	if (io->pipe) {
+		http_pipe_done(io->pipe, io);
+	} else if (io->keep_alive) {
 		fetch_cache_put(conn, fetch_close);
 	} else {
 		fetch_close(conn);
@@ -299,7 +309,8 @@ http_closefn(void *v)
  * Wrap a file descriptor up
  */
 static fetchIO *
-http_funopen(conn_t *conn, int chunked, int keep_alive, off_t clength)
+http_funopen(conn_t *conn, int chunked, int keep_alive, off_t clength,
+    struct pipe_conn *pipe)
 {
 	struct httpio *io;
 	fetchIO *f;
@@ -312,6 +323,7 @@ http_funopen(conn_t *conn, int chunked, int keep_alive, off_t clength)
 	io->chunked = chunked;
 	io->contentlength = clength;
 	io->keep_alive = keep_alive;
+	io->pipe = pipe;
 	f = fetchIO_unopen(io, http_readfn, http_writefn, http_closefn);
 	if (f == NULL) {
 		fetch_syserr();
@@ -796,6 +808,88 @@ set_if_modified_since(conn_t *conn, time_t last_modified)
 	http_cmd(conn, "If-Modified-Since: %s\r\n", buf);
 }
 
+/*
+ * Send a request; the reply is read by the caller. The request is only
+ * queued, the caller uncorks the connection to get it dispatched.
+ */
+static int
+http_send_request(conn_t *conn, const char *op, struct url *URL,
+    struct url *url, struct url *purl, const char *flags, int need_auth)
+{
+	char hbuf[URL_HOSTLEN + 7], *host;
+	const char *p;
+
+	host = url->host;
+	if (strchr(url->host, ':')) {
+		snprintf(hbuf, sizeof(hbuf), "[%s]", url->host);
+		host = hbuf;
+	}
+	if (url->port != fetch_default_port(url->scheme)) {
+		if (host != hbuf) {
+			strcpy(hbuf, host);
+			host = hbuf;
+		}
+		snprintf(hbuf + strlen(hbuf),
+		    sizeof(hbuf) - strlen(hbuf), ":%d", url->port);
+	}
+
+	if (CHECK_FLAG('v'))
+		fetch_info("requesting %s://%s%s",
+		    url->scheme, host, url->doc);
+
+	if (purl && strcasecmp(URL->scheme, SCHEME_HTTPS) != 0) {
+		http_cmd(conn, "%s %s://%s%s HTTP/1.1\r\n",
+		    op, url->scheme, host, url->doc);
+	} else {
+		http_cmd(conn, "%s %s HTTP/1.1\r\n",
+		    op, url->doc);
+	}
+
+	if (CHECK_FLAG('C'))
+		http_cmd(conn, "Cache-Control: no-cache\r\n");
+	if (CHECK_FLAG('i') && url->last_modified > 0)
+		set_if_modified_since(conn, url->last_modified);
+
+	/* virtual host */
+	http_cmd(conn, "Host: %s\r\n", host);
+
+	/* proxy authorization */
+	http_proxy_authorize(conn, purl);
+
+	if (need_auth && !*url->pwd && !*url->user)
+		fetch_netrc_auth(url);
+	/* server authorization */
+	if (need_auth || *url->user || *url->pwd) {
+		if (*url->user || *url->pwd)
+			http_basic_auth(conn, "Authorization", url->user, url->pwd);
+		else if ((p = getenv("HTTP_AUTH")) != NULL && *p != '\0')
+			http_authorize(conn, "Authorization", p);
+		else if (fetchAuthMethod && fetchAuthMethod(url) == 0) {
+			http_basic_auth(conn, "Authorization", url->user, url->pwd);
+		} else {
+			http_seterr(HTTP_NEED_AUTH);
+			return (-1);
+		}
+	}
+
+	/* other headers */
+	if ((p = getenv("HTTP_REFERER")) != NULL && *p != '\0') {
+		if (strcasecmp(p, "auto") == 0)
+			http_cmd(conn, "Referer: %s://%s%s\r\n",
+			    url->scheme, host, url->doc);
+		else
+			http_cmd(conn, "Referer: %s\r\n", p);
+	}
+	if ((p = getenv("HTTP_USER_AGENT")) != NULL && *p != '\0')
+		http_cmd(conn, "User-Agent: %s\r\n", p);
+	else
+		http_cmd(conn, "User-Agent: %s\r\n", _LIBFETCH_VER);
+	if (url->offset > 0)
+		http_cmd(conn, "Range: bytes=%lld-\r\n", (long long)url->offset);
+	http_cmd(conn, "\r\n");
+	return (0);
+}
+
 
 /*****************************************************************************
  * Core
@@ -813,7 +907,7 @@ http_request(struct url *URL, const char *op, struct url_stat *us,
 {
 	conn_t *conn;
 	struct url *url, *new;
-	int chunked, direct, if_modified_since, need_auth, noredirect, nocache;
+	int chunked, direct, need_auth, noredirect;
 	int keep_alive, verbose, cached;
 	int e, i, n;
 	off_t offset, clength, length, size;
@@ -821,13 +915,10 @@ http_request(struct url *URL, const char *op, struct url_stat *us,
 	const char *p, *q;
 	fetchIO *f;
 	hdr_t h;
-	char hbuf[URL_HOSTLEN + 7], *host;
 
 	direct = CHECK_FLAG('d');
 	noredirect = CHECK_FLAG('A');
-	nocache = CHECK_FLAG('C');
 	verbose = CHECK_FLAG('v');
-	if_modified_since = CHECK_FLAG('i');
 	keep_alive = 0;
 
 	if (direct && purl) {
@@ -861,76 +952,10 @@ http_request(struct url *URL, const char *op, struct url_stat *us,
 		if ((conn = http_connect(url, purl, flags, &cached)) == NULL)
 			goto ouch;
 
-		host = url->host;
-		if (strchr(url->host, ':')) {
-			snprintf(hbuf, sizeof(hbuf), "[%s]", url->host);
-			host = hbuf;
-		}
-		if (url->port != fetch_default_port(url->scheme)) {
-			if (host != hbuf) {
-				strcpy(hbuf, host);
-				host = hbuf;
-			}
-			snprintf(hbuf + strlen(hbuf),
-			    sizeof(hbuf) - strlen(hbuf), ":%d", url->port);
-		}
-
 		/* send request */
-		if (verbose)
-			fetch_info("requesting %s://%s%s",
-			    url->scheme, host, url->doc);
-
 		http_cork(conn, 1);
-		if (purl && strcasecmp(URL->scheme, SCHEME_HTTPS) != 0) {
-			http_cmd(conn, "%s %s://%s%s HTTP/1.1\r\n",
-			    op, url->scheme, host, url->doc);
-		} else {
-			http_cmd(conn, "%s %s HTTP/1.1\r\n",
-			    op, url->doc);
-		}
-
-		if (nocache)
-			http_cmd(conn, "Cache-Control: no-cache\r\n");
-		if (if_modified_since && url->last_modified > 0)
-			set_if_modified_since(conn, url->last_modified);
-
-		/* virtual host */
-		http_cmd(conn, "Host: %s\r\n", host);
-
-		/* proxy authorization */
-		http_proxy_authorize(conn, purl);
-
-		if (need_auth && !*url->pwd && !*url->user)
-			fetch_netrc_auth(url);
-		/* server authorization */
-		if (need_auth || *url->user || *url->pwd) {
-			if (*url->user || *url->pwd)
-				http_basic_auth(conn, "Authorization", url->user, url->pwd);
-			else if ((p = getenv("HTTP_AUTH")) != NULL && *p != '\0')
-				http_authorize(conn, "Authorization", p);
-			else if (fetchAuthMethod && fetchAuthMethod(url) == 0) {
-				http_basic_auth(conn, "Authorization", url->user, url->pwd);
-			} else {
-				http_seterr(HTTP_NEED_AUTH);
-				goto ouch;
-			}
-		}
-
-		/* other headers */
-		if ((p = getenv("HTTP_REFERER")) != NULL && *p != '\0') {
-			if (strcasecmp(p, "auto") == 0)
-				http_cmd(conn, "Referer: %s://%s%s\r\n",
-				    url->scheme, host, url->doc);
-			else
-				http_cmd(conn, "Referer: %s\r\n", p);
-		}
-		if ((p = getenv("HTTP_USER_AGENT")) != NULL && *p != '\0')
-			http_cmd(conn, "User-Agent: %s\r\n", p);
-		else
-			http_cmd(conn, "User-Agent: %s\r\n", _LIBFETCH_VER);
-		if (url->offset > 0)
-			http_cmd(conn, "Range: bytes=%lld-\r\n", (long long)url->offset);
-		http_cmd(conn, "\r\n");
+		if (http_send_request(conn, op, URL, url, purl, flags, need_auth) == -1)
+			goto ouch;
 
 		/*
 		 * Force the queued request to be dispatched.  Normally, one
@@ -1158,7 +1183,7 @@ http_request(struct url *URL, const char *op, struct url_stat *us,
 	}
 
 	/* wrap it up in a fetchIO */
-	if ((f = http_funopen(conn, chunked, keep_alive, clength)) == NULL) {
+	if ((f = http_funopen(conn, chunked, keep_alive, clength, NULL)) == NULL) {
 		fetch_syserr();
 		goto ouch;
 	}
@@ -1500,3 +1525,427 @@ fetchListHTTP(struct url_list *ue, struct url *url, const char *pattern, const c
 
 	return ret;
 }
+
+
+/*****************************************************************************
+ * Pipelined requests
+ *
+ * Requests are queued with fetchPipelineAdd() and sent ahead of time, up
+ * to 'depth' outstanding requests on each of up to 'max_conns' keep-alive
+ * connections. fetchPipelineXGet() returns the replies in queue order.
+ * Each connection carries requests in queue order, so the replies arrive
+ * in the order they are read. A not modified reply and error replies
+ * with a known length are returned as errors, so conditional requests
+ * can be pipelined too. Anything else drops the connection; the requests
+ * on it are sent again and the reply is fetched on its own with
+ * fetchXGet() which handles redirects and authentication.
+ */
+
+struct pipe_conn {
+	conn_t		*conn;
+	struct url	*url;		/* scheme, host and port served */
+	int		 pending;	/* requests sent and not answered */
+	ssize_t		 last;		/* index of the last request sent */
+	int		 busy;		/* a reply body is being read */
+	int		 broken;	/* no more replies can be read */
+};
+
+struct pipe_req {
+	struct url	 *url;
+	struct pipe_conn *pc;		/* connection the request was sent on */
+};
+
+struct fetchPipeline {
+	char		 *flags;
+	int		  max_conns;
+	int		  depth;
+	struct pipe_conn *conns;
+	struct pipe_req	 *reqs;
+	size_t		  head, num, alloc;
+};
+
+static int
+pipe_same_host(const struct url *a, const struct url *b)
+{
+	return (strcasecmp(a->scheme, b->scheme) == 0 &&
+	    strcasecmp(a->host, b->host) == 0 &&
+	    a->port == b->port &&
+	    strcmp(a->user, b->user) == 0 &&
+	    strcmp(a->pwd, b->pwd) == 0);
+}
+
+static int
+pipe_same_request(const struct url *a, const struct url *b)
+{
+	return (pipe_same_host(a, b) &&
+	    strcmp(a->doc, b->doc) == 0 &&
+	    a->offset == b->offset &&
+	    a->last_modified == b->last_modified);
+}
+
+/*
+ * Close a connection; requests queued on it are sent again later. A
+ * connection with a reply still open is closed once the reply is.
+ */
+static void
+pipe_drop(fetchPipeline *pipe, struct pipe_conn *pc)
+{
+	size_t i;
+
+	for (i = pipe->head; i < pipe->num; i++)
+		if (pipe->reqs[i].pc == pc)
+			pipe->reqs[i].pc = NULL;
+	if (pc->busy) {
+		pc->broken = 1;
+		pc->pending = 0;
+		return;
+	}
+	fetch_close(pc->conn);
+	fetchFreeURL(pc->url);
+	memset(pc, 0, sizeof(*pc));
+}
+
+/*
+ * Send a queued request. A connection qualifies if it serves the host,
+ * has room and has not yet seen a request queued after this one.
+ */
+static int
+pipe_send(fetchPipeline *pipe, size_t i)
+{
+	struct pipe_req *req = &pipe->reqs[i];
+	struct pipe_conn *pc = NULL, *free_pc = NULL;
+	int j, cached;
+
+	for (j = 0; j < pipe->max_conns; j++) {
+		struct pipe_conn *c = &pipe->conns[j];
+		if (!c->conn) {
+			if (!free_pc)
+				free_pc = c;
+			continue;
+		}
+		if (c->broken || c->pending >= pipe->depth ||
+		    c->last > (ssize_t)i || !pipe_same_host(c->url, req->url))
+			continue;
+		if (!pc || c->pending < pc->pending)
+			pc = c;
+	}
+	if (!pc || (pc->pending && free_pc)) {
+		if (!free_pc)
+			return (-1);
+		free_pc->conn = http_connect(req->url, NULL, pipe->flags, &cached);
+		if (free_pc->conn) {
+			free_pc->url = fetchCopyURL(req->url);
+			free_pc->last = -1;
+			if (free_pc->url)
+				pc = free_pc;
+			else
+				pipe_drop(pipe, free_pc);
+		}
+		if (!pc)
+			return (-1);
+	}
+
+	http_cork(pc->conn, 1);
+	http_send_request(pc->conn, "GET", req->url, req->url, NULL,
+	    pipe->flags, 0);
+	http_cork(pc->conn, 0);
+	req->pc = pc;
+	pc->pending++;
+	pc->last = i;
+	return (0);
+}
+
+/*
+ * Send queued requests in order until the connections are full
+ */
+static void
+pipe_fill(fetchPipeline *pipe)
+{
+	size_t i;
+	int j;
+
+	for (j = 0; j < pipe->max_conns; j++) {
+		struct pipe_conn *pc = &pipe->conns[j];
+		if (pc->conn && pc->broken && !pc->busy)
+			pipe_drop(pipe, pc);
+	}
+	for (i = pipe->head; i < pipe->num; i++) {
+		if (pipe->reqs[i].pc)
+			continue;
+		if (pipe_send(pipe, i) == -1 || !pipe->reqs[i].pc)
+			break;
+	}
+}
+
+/*
+ * Read the reply to the oldest request sent on a connection. An error
+ * reply sets the error, returns NULL and sets *answered.
+ */
+static fetchIO *
+pipe_reply(struct pipe_conn *pc, struct url *URL, struct url_stat *us,
+    int *answered)
+{
+	conn_t *conn = pc->conn;
+	int code, chunked = 0, keep_alive;
+	off_t offset = 0, clength = -1, length = -1, size = -1;
+	time_t mtime = 0;
+	const char *p, *q;
+	fetchIO *f;
+	hdr_t h;
+
+	code = http_get_reply(conn);
+	if (code != HTTP_OK && code != HTTP_PARTIAL &&
+	    code != HTTP_NOT_MODIFIED && (!HTTP_ERROR(code) ||
+	    code == HTTP_NEED_AUTH || code == HTTP_NEED_PROXY_AUTH ||
+	    code == HTTP_BAD_RANGE))
+		return (NULL);
+	keep_alive = strncmp(conn->buf, "HTTP/1.1", 8) == 0;
+
+	do {
+		switch ((h = http_next_header(conn, &p))) {
+		case hdr_syserror:
+		case hdr_error:
+			return (NULL);
+		case hdr_connection:
+			if (strcasecmp(p, "close") == 0)
+				keep_alive = 0;
+			else if (strcasecmp(p, "keep-alive") == 0)
+				keep_alive = 1;
+			break;
+		case hdr_content_length:
+			clength = fetch_parseuint(p, &q, 10, OFF_MAX);
+			if (*q)
+				return (NULL);
+			break;
+		case hdr_content_range:
+			if (http_parse_range(p, &offset, &length, &size) < 0)
+				return (NULL);
+			break;
+		case hdr_last_modified:
+			if (http_parse_mtime(p, &mtime) < 0)
+				return (NULL);
+			break;
+		case hdr_transfer_encoding:
+			chunked = (strcasecmp(p, "chunked") == 0);
+			break;
+		default:
+			break;
+		}
+	} while (h > hdr_end);
+
+	/* a not modified reply has no body */
+	if (code == HTTP_NOT_MODIFIED) {
+		chunked = 0;
+		clength = 0;
+	}
+	/* the end of the body must be known to read the next reply */
+	if (!chunked && clength == -1)
+		return (NULL);
+	if (code != HTTP_OK && code != HTTP_PARTIAL) {
+		/* skip the body to get to the next reply, unless it is long */
+		if ((f = http_funopen(conn, chunked, keep_alive, clength, pc)) == NULL)
+			return (NULL);
+		pc->busy = 1;
+		fetchIO_close(f);
+		http_seterr(code);
+		*answered = 1;
+		return (NULL);
+	}
+	if (clength != -1 && length != -1 && clength != length)
+		return (NULL);
+	if (clength == -1)
+		clength = length;
+	if (clength != -1)
+		length = offset + clength;
+	if (length != -1 && size != -1 && length != size)
+		return (NULL);
+	if (size == -1)
+		size = length;
+	if (URL->offset > 0 && offset > URL->offset)
+		return (NULL);
+
+	if ((f = http_funopen(conn, chunked, keep_alive, clength, pc)) == NULL)
+		return (NULL);
+	if (us) {
+		us->size = size;
+		us->atime = us->mtime = mtime;
+	}
+	URL->offset = offset;
+	URL->length = clength;
+	pc->busy = 1;
+	return (f);
+}
+
+/*
+ * Called when a pipelined reply is closed. The rest of the body is read
+ * so the next reply can be parsed. If more than HTTP_PIPE_MAX_DRAIN bytes
+ * are left, the connection is broken instead, and the requests queued on
+ * it are sent again on a new connection.
+ */
+static void
+http_pipe_done(struct pipe_conn *pc, struct httpio *io)
+{
+	char buf[4096];
+	size_t drained = 0;
+	ssize_t len;
+
+	if (io->contentlength <= HTTP_PIPE_MAX_DRAIN) {
+		while (!io->error && !io->eof && io->contentlength != 0 &&
+		    drained < HTTP_PIPE_MAX_DRAIN) {
+			if ((len = http_readfn(io, buf, sizeof(buf))) <= 0)
+				break;
+			drained += len;
+		}
+	}
+	if (io->error || !io->keep_alive ||
+	    (io->chunked ? !io->eof : io->contentlength != 0))
+		pc->broken = 1;
+	pc->busy = 0;
+}
+
+/*
+ * Create a pipeline using up to max_conns connections with up to depth
+ * outstanding requests each
+ */
+fetchPipeline *
+fetchPipelineOpen(int max_conns, int depth, const char *flags)
+{
+	fetchPipeline *pipe;
+
+	if ((pipe = calloc(1, sizeof(*pipe))) == NULL)
+		goto err;
+	if ((pipe->conns = calloc(max_conns, sizeof(*pipe->conns))) == NULL)
+		goto err;
+	if (flags && (pipe->flags = strdup(flags)) == NULL)
+		goto err;
+	pipe->max_conns = max_conns;
+	pipe->depth = depth;
+	return (pipe);
+err:
+	fetch_syserr();
+	if (pipe)
+		free(pipe->conns);
+	free(pipe);
+	return (NULL);
+}
+
+/*
+ * Queue a GET request. Only direct HTTP and HTTPS requests are pipelined.
+ */
+int
+fetchPipelineAdd(fetchPipeline *pipe, const struct url *URL)
+{
+	struct pipe_req *reqs;
+	struct url *url, *purl;
+
+	if (strcasecmp(URL->scheme, SCHEME_HTTP) != 0 &&
+	    strcasecmp(URL->scheme, SCHEME_HTTPS) != 0) {
+		url_seterr(URL_BAD_SCHEME);
+		return (-1);
+	}
+	if ((url = fetchCopyURL(URL)) == NULL)
+		return (-1);
+	if (!url->port)
+		url->port = fetch_default_port(url->scheme);
+	if ((purl = http_get_proxy(url, pipe->flags)) != NULL) {
+		fetchFreeURL(purl);
+		fetchFreeURL(url);
+		return (-1);
+	}
+
+	if (pipe->head == pipe->num) {
+		int j;
+		pipe->head = pipe->num = 0;
+		for (j = 0; j < pipe->max_conns; j++)
+			pipe->conns[j].last = -1;
+	}
+	if (pipe->num == pipe->alloc) {
+		size_t alloc = pipe->alloc ? pipe->alloc * 2 : 16;
+		if ((reqs = realloc(pipe->reqs, alloc * sizeof(*reqs))) == NULL) {
+			fetch_syserr();
+			fetchFreeURL(url);
+			return (-1);
+		}
+		pipe->reqs = reqs;
+		pipe->alloc = alloc;
+	}
+	pipe->reqs[pipe->num++] = (struct pipe_req) { .url = url };
+	return (0);
+}
+
+/*
+ * Get the reply to a queued request. Requests queued before it are
+ * dropped. Requests which are not queued are fetched with fetchXGet().
+ * The fetchIO of the previous reply must be closed before calling this.
+ */
+fetchIO *
+fetchPipelineXGet(fetchPipeline *pipe, struct url *URL, struct url_stat *us)
+{
+	struct pipe_conn *pc;
+	fetchIO *f;
+	size_t i;
+	int answered = 0;
+
+	if (us != NULL) {
+		us->size = -1;
+		us->atime = us->mtime = 0;
+	}
+	if (!URL->port)
+		URL->port = fetch_default_port(URL->scheme);
+	for (i = pipe->head; i < pipe->num; i++)
+		if (pipe_same_request(pipe->reqs[i].url, URL))
+			break;
+	if (i == pipe->num)
+		return (fetchXGet(URL, us, pipe->flags));
+
+	for (; pipe->head < i; pipe->head++) {
+		struct pipe_req *req = &pipe->reqs[pipe->head];
+		if (req->pc)
+			pipe_drop(pipe, req->pc);
+		fetchFreeURL(req->url);
+	}
+	pipe_fill(pipe);
+
+	pc = pipe->reqs[i].pc;
+	fetchFreeURL(pipe->reqs[i].url);
+	pipe->head++;
+	if (pc && !pc->busy) {
+		pc->pending--;
+		if ((f = pipe_reply(pc, URL, us, &answered)) != NULL || answered)
+			return (f);
+	}
+	if (pc) {
+		pipe_drop(pipe, pc);
+		pipe_fill(pipe);
+	}
+	return (fetchXGet(URL, us, pipe->flags));
+}
+
+/*
+ * Free the pipeline. Idle connections go to the connection cache.
+ */
+void
+fetchPipelineClose(fetchPipeline *pipe)
+{
+	size_t i;
+	int j;
+
+	if (!pipe)
+		return;
+	for (j = 0; j < pipe->max_conns; j++) {
+		struct pipe_conn *pc = &pipe->conns[j];
+		if (!pc->conn)
+			continue;
+		if (!pc->broken && !pc->pending && !pc->busy)
+			fetch_cache_put(pc->conn, fetch_close);
+		else
+			fetch_close(pc->conn);
+		fetchFreeURL(pc->url);
+	}
+	for (i = pipe->head; i < pipe->num; i++)
+		fetchFreeURL(pipe->reqs[i].url);
+	free(pipe->reqs);
+	free(pipe->conns);
+	free(pipe->flags);
+	free(pipe);
+}
@@ -47,7 +47,12 @@ static void version(struct apk_out *out, const char *prefix)
 	OPT(OPT_GLOBAL_cache_max_age,		APK_OPT_ARG "cache-max-age") \
 	OPT(OPT_GLOBAL_cache_packages,		APK_OPT_BOOL "cache-packages") \
 	OPT(OPT_GLOBAL_cache_predownload,	APK_OPT_BOOL "cache-predownload") \
+	OPT(OPT_GLOBAL_cache_shared_dir,	APK_OPT_ARG "cache-shared-dir") \
 	OPT(OPT_GLOBAL_check_certificate,	APK_OPT_BOOL "check-certificate") \
+	OPT(OPT_GLOBAL_db_journal,		APK_OPT_BOOL "db-journal") \
+	OPT(OPT_GLOBAL_download_connections,	APK_OPT_ARG "download-connections") \
+	OPT(OPT_GLOBAL_download_jitter,		APK_OPT_ARG "download-jitter") \
+	OPT(OPT_GLOBAL_download_rate,		APK_OPT_ARG "download-rate") \
 	OPT(OPT_GLOBAL_force,			APK_OPT_SH("f") "force") \
 	OPT(OPT_GLOBAL_force_binary_stdout,	"force-binary-stdout") \
 	OPT(OPT_GLOBAL_force_broken_world,	"force-broken-world") \
@@ -57,6 +62,7 @@ static void version(struct apk_out *out, const char *prefix)
 	OPT(OPT_GLOBAL_force_old_apk,		"force-old-apk") \
 	OPT(OPT_GLOBAL_force_overwrite,		"force-overwrite") \
 	OPT(OPT_GLOBAL_force_refresh,		"force-refresh") \
+	OPT(OPT_GLOBAL_gunzip_threads,		APK_OPT_AUTO "gunzip-threads") \
 	OPT(OPT_GLOBAL_help,			APK_OPT_SH("h") "help") \
 	OPT(OPT_GLOBAL_interactive,		APK_OPT_AUTO APK_OPT_SH("i") "interactive") \
 	OPT(OPT_GLOBAL_keys_dir,		APK_OPT_ARG "keys-dir") \
@@ -76,8 +82,12 @@ static void version(struct apk_out *out, const char *prefix)
 	OPT(OPT_GLOBAL_repository_config,	APK_OPT_ARG "repository-config") \
 	OPT(OPT_GLOBAL_root,			APK_OPT_ARG APK_OPT_SH("p") "root") \
 	OPT(OPT_GLOBAL_root_tmpfs,		APK_OPT_AUTO "root-tmpfs") \
+	OPT(OPT_GLOBAL_solver_errors,		APK_OPT_ARG "solver-errors") \
+	OPT(OPT_GLOBAL_solver_explain,		APK_OPT_ARG "solver-explain") \
+	OPT(OPT_GLOBAL_solver_stats,		APK_OPT_ARG "solver-stats") \
 	OPT(OPT_GLOBAL_sync,			APK_OPT_AUTO "sync") \
 	OPT(OPT_GLOBAL_timeout,			APK_OPT_ARG "timeout") \
+	OPT(OPT_GLOBAL_trace_file,		APK_OPT_ARG "trace-file") \
 	OPT(OPT_GLOBAL_update_cache,		APK_OPT_SH("U") "update-cache") \
 	OPT(OPT_GLOBAL_uvol_manager,		APK_OPT_ARG "uvol-manager") \
 	OPT(OPT_GLOBAL_verbose,			APK_OPT_SH("v") "verbose") \
@@ -86,9 +96,31 @@ static void version(struct apk_out *out, const char *prefix)
 
 APK_OPTIONS(optgroup_global_desc, GLOBAL_OPTIONS);
 
+// Parses a number with an optional K, M or G suffix (powers of 1024)
+static int parse_size(const char *str, uint64_t *val)
+{
+	uint64_t v;
+	char *end;
+
+	errno = 0;
+	v = strtoull(str, &end, 10);
+	if (end == str || errno) return -EINVAL;
+	switch (*end) {
+	case 'G': case 'g': v *= 1024; // fallthrough
+	case 'M': case 'm': v *= 1024; // fallthrough
+	case 'K': case 'k': v *= 1024; end++;
+	}
+	if (*end) return -EINVAL;
+	*val = v;
+	return 0;
+}
+
 static int optgroup_global_parse(struct apk_ctx *ac, int opt, const char *optarg)
 {
 	struct apk_out *out = &ac->out;
+	uint64_t size;
+	unsigned int num;
+
 	switch (opt) {
 	case OPT_GLOBAL_allow_untrusted:
 		ac->flags |= APK_ALLOW_UNTRUSTED;
@@ -111,9 +143,27 @@ static int optgroup_global_parse(struct apk_ctx *ac, int opt, const char *optarg
 	case OPT_GLOBAL_cache_predownload:
 		ac->cache_predownload = APK_OPTARG_VAL(optarg);
 		break;
+	case OPT_GLOBAL_cache_shared_dir:
+		ac->cache_shared_dir = optarg;
+		break;
 	case OPT_GLOBAL_check_certificate:
 		apk_io_url_check_certificate(APK_OPTARG_VAL(optarg));
 		break;
+	case OPT_GLOBAL_db_journal:
+		ac->db_journal = APK_OPTARG_VAL(optarg);
+		break;
+	case OPT_GLOBAL_download_connections:
+		if (apk_opt_parse_uint(optarg, 1, 1024, &num) < 0) return -EINVAL;
+		apk_io_url_set_max_connections(num);
+		break;
+	case OPT_GLOBAL_download_jitter:
+		if (apk_opt_parse_uint(optarg, 0, 86400, &num) < 0) return -EINVAL;
+		apk_url_set_start_jitter(num);
+		break;
+	case OPT_GLOBAL_download_rate:
+		if (parse_size(optarg, &size) < 0) return -EINVAL;
+		apk_url_set_rate_limit(size);
+		break;
 	case OPT_GLOBAL_force:
 		ac->force |= APK_FORCE_OVERWRITE | APK_FORCE_OLD_APK
 			| APK_FORCE_NON_REPOSITORY | APK_FORCE_BINARY_STDOUT;
@@ -142,6 +192,9 @@ static int optgroup_global_parse(struct apk_ctx *ac, int opt, const char *optarg
 	case OPT_GLOBAL_force_missing_repositories:
 		ac->force |= APK_FORCE_MISSING_REPOSITORIES;
 		break;
+	case OPT_GLOBAL_gunzip_threads:
+		apk_io_gunzip_threaded = APK_OPTARG_VAL(optarg);
+		break;
 	case OPT_GLOBAL_help:
 		return -ENOTSUP;
 	case OPT_GLOBAL_interactive:
@@ -198,12 +251,27 @@ static int optgroup_global_parse(struct apk_ctx *ac, int opt, const char *optarg
 	case OPT_GLOBAL_root_tmpfs:
 		ac->root_tmpfs = APK_OPTARG_VAL(optarg);
 		break;
+	case OPT_GLOBAL_solver_errors:
+		ac->solver_errors_ser = apk_serializer_lookup(optarg, &apk_serializer_query);
+		if (IS_ERR(ac->solver_errors_ser)) return -EINVAL;
+		break;
+	case OPT_GLOBAL_solver_explain:
+		ac->solver_explain_ser = apk_serializer_lookup(optarg, &apk_serializer_json);
+		if (IS_ERR(ac->solver_explain_ser)) return -EINVAL;
+		break;
+	case OPT_GLOBAL_solver_stats:
+		ac->solver_stats_ser = apk_serializer_lookup(optarg, &apk_serializer_query);
+		if (IS_ERR(ac->solver_stats_ser)) return -EINVAL;
+		break;
 	case OPT_GLOBAL_sync:
 		ac->sync = APK_OPTARG_VAL(optarg);
 		break;
 	case OPT_GLOBAL_timeout:
 		apk_io_url_set_timeout(atoi(optarg));
 		break;
+	case OPT_GLOBAL_trace_file:
+		ac->trace_file = optarg;
+		break;
 	case OPT_GLOBAL_update_cache:
 		ac->cache_max_age = 0;
 		break;
@@ -231,7 +299,8 @@ static int optgroup_global_parse(struct apk_ctx *ac, int opt, const char *optarg
 	OPT(OPT_COMMIT_initramfs_diskless_boot,	"initramfs-diskless-boot") \
 	OPT(OPT_COMMIT_overlay_from_stdin,	"overlay-from-stdin") \
 	OPT(OPT_COMMIT_scripts,			APK_OPT_BOOL "scripts") \
-	OPT(OPT_COMMIT_simulate,		APK_OPT_BOOL APK_OPT_SH("s") "simulate")
+	OPT(OPT_COMMIT_simulate,		APK_OPT_BOOL APK_OPT_SH("s") "simulate") \
+	OPT(OPT_COMMIT_trigger_jobs,		APK_OPT_ARG "trigger-jobs")
 
 APK_OPTIONS(optgroup_commit_desc, COMMIT_OPTIONS);
 
@@ -259,6 +328,9 @@ static int optgroup_commit_parse(struct apk_ctx *ac, int opt, const char *optarg
 	case OPT_COMMIT_simulate:
 		apk_opt_set_flag(optarg, APK_SIMULATE, &ac->flags);
 		break;
+	case OPT_COMMIT_trigger_jobs:
+		if (apk_opt_parse_uint(optarg, 1, 1024, &ac->trigger_jobs) < 0) return -EINVAL;
+		break;
 	default:
 		return -ENOTSUP;
 	}
@@ -624,6 +696,28 @@ static void redirect_callback(int code, const char *url)
 	apk_warn(&ctx.out, "Permanently redirected to %s", url);
 }
 
+static void transfer_callback(const struct apk_url_transfer *t)
+{
+	apk_blob_t url = apk_url_sanitize(APK_BLOB_STR(t->url), &ctx.ba), size, rate;
+	uint64_t body_time = t->duration - t->latency;
+	uint64_t bytes_per_sec = body_time ? t->bytes * 1000000 / body_time : 0;
+	char sizebuf[32], ratebuf[32], name[PATH_MAX];
+
+	if (t->error < 0) {
+		apk_dbg(&ctx.out, "fetch " BLOB_FMT ": %s after %" PRIu64 " ms",
+			BLOB_PRINTF(url), apk_error_str(t->error), t->duration / 1000);
+	} else {
+		size = apk_fmt_human_size(sizebuf, sizeof sizebuf, t->bytes, 1);
+		rate = apk_fmt_human_size(ratebuf, sizeof ratebuf, bytes_per_sec, 1);
+		apk_dbg(&ctx.out, "fetch " BLOB_FMT ": " BLOB_FMT " in %" PRIu64 " ms (" BLOB_FMT "/s), first byte after %" PRIu64 " ms",
+			BLOB_PRINTF(url), BLOB_PRINTF(size), t->duration / 1000, BLOB_PRINTF(rate), t->latency / 1000);
+	}
+	if (apk_fmt(name, sizeof name, "fetch " BLOB_FMT, BLOB_PRINTF(url)) < 0) return;
+	apk_trace_end_args(&ctx.trace, t->start, "download", name,
+		"\"bytes\":%" PRIu64 ",\"latency_us\":%" PRIu64 ",\"bytes_per_sec\":%" PRIu64 ",\"error\":%d",
+		t->bytes, t->latency, bytes_per_sec, t->error);
+}
+
 int main(int argc, char **argv)
 {
 	struct apk_out *out = &ctx.out;
@@ -664,12 +758,15 @@ int main(int argc, char **argv)
 
 	r = apk_ctx_prepare(&ctx);
 	if (r != 0) goto err;
+	apk_url_set_transfer_callback(transfer_callback);
 
 	apk_out_log_argv(&ctx.out, apk_argv);
 	version(&ctx.out, APK_OUT_LOG_ONLY);
 
 	if (ctx.open_flags) {
+		uint64_t trace_start = apk_trace_begin(&ctx.trace);
 		r = apk_db_open(&db);
+		apk_trace_end(&ctx.trace, trace_start, "db", "open database");
 		if (r != 0) {
 			apk_err(out, "Failed to open apk database: %s", apk_error_str(r));
 			goto err;
@@ -678,11 +775,14 @@ int main(int argc, char **argv)
 
 	apk_io_url_set_redirect_callback(NULL);
 
+	uint64_t trace_start = apk_trace_begin(&ctx.trace);
 	r = applet->main(applet_ctx, &ctx, args);
+	apk_trace_end(&ctx.trace, trace_start, "applet", "%s", applet->name);
 	signal(SIGINT, SIG_IGN);
 	apk_db_close(&db);
 
 err:
+	apk_url_set_transfer_callback(NULL);
 	if (r == -ESHUTDOWN) r = 0;
 	if (applet_ctx) free(applet_ctx);
 
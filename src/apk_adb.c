@@ -373,6 +373,12 @@ fail:
 	return -APKE_DEPENDENCY_FORMAT;
 }
 
+const struct adb_object_schema schema_hexblob_array = {
+	.kind = ADB_KIND_ARRAY,
+	.num_fields = 32,
+	.fields = ADB_ARRAY_ITEM(scalar_hexblob),
+};
+
 const struct adb_object_schema schema_dependency = {
 	.kind = ADB_KIND_OBJECT,
 	.num_fields = ADBI_DEP_MAX,
@@ -436,6 +442,7 @@ const struct adb_object_schema schema_pkginfo = {
 		ADB_FIELD(ADBI_PI_RECOMMENDS,	"recommends",	schema_dependency_array),
 		ADB_FIELD(ADBI_PI_LAYER,	"layer",	scalar_int),
 		ADB_FIELD(ADBI_PI_TAGS,		"tags",		schema_tags_array),
+		ADB_FIELD(ADBI_PI_DELTAS,	"deltas",	schema_hexblob_array),
 	},
 };
 
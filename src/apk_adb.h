@@ -34,7 +34,8 @@
 #define ADBI_PI_RECOMMENDS	0x13
 #define ADBI_PI_LAYER		0x14
 #define ADBI_PI_TAGS		0x15
-#define ADBI_PI_MAX		0x16
+#define ADBI_PI_DELTAS		0x16
+#define ADBI_PI_MAX		0x17
 
 /* ACL entries */
 #define ADBI_ACL_MODE		0x01
@@ -97,7 +98,7 @@ extern const struct adb_object_schema
 	schema_pkginfo, schema_pkginfo_array,
 	schema_xattr_array,
 	schema_acl, schema_file, schema_file_array, schema_dir, schema_dir_array,
-	schema_string_array, schema_scripts, schema_package, schema_package_adb_array,
+	schema_string_array, schema_hexblob_array, schema_scripts, schema_package, schema_package_adb_array,
 	schema_index, schema_idb;
 
 /* */
@@ -65,6 +65,7 @@ struct apk_applet {
 void apk_applet_register(struct apk_applet *);
 struct apk_applet *apk_applet_find(const char *name);
 void apk_applet_help(struct apk_applet *applet, struct apk_out *out);
+int apk_opt_parse_uint(const char *str, unsigned int min, unsigned int max, unsigned int *val);
 
 #define APK_DEFINE_APPLET(x) \
 __attribute__((constructor)) static void __register_##x(void) { apk_applet_register(&x); }
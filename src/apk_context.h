@@ -9,6 +9,7 @@
 #pragma once
 #include "apk_blob.h"
 #include "apk_print.h"
+#include "apk_trace.h"
 #include "apk_trust.h"
 #include "apk_io.h"
 #include "apk_crypto.h"
@@ -51,6 +52,7 @@
 #define APK_OPENF_NO_CMDLINE_REPOS	0x1000
 #define APK_OPENF_USERMODE		0x2000
 #define APK_OPENF_ALLOW_ARCH		0x4000
+#define APK_OPENF_OWNER_INDEX		0x8000
 
 #define APK_OPENF_NO_REPOS	(APK_OPENF_NO_SYS_REPOS |	\
 				 APK_OPENF_NO_CMDLINE_REPOS |	\
@@ -64,15 +66,18 @@ struct apk_database;
 struct apk_ctx {
 	struct apk_balloc ba;
 	unsigned int flags, force, open_flags;
-	unsigned int lock_wait, cache_max_age;
+	unsigned int lock_wait, cache_max_age, trigger_jobs;
 	struct apk_out out;
+	struct apk_trace trace;
 	struct adb_compression_spec compspec;
 	const char *root;
 	const char *keys_dir;
 	const char *cache_dir;
+	const char *cache_shared_dir;
 	const char *repositories_file;
 	const char *uvol;
 	const char *apknew_suffix;
+	const char *trace_file;
 	apk_blob_t default_pkgname_spec;
 	apk_blob_t default_reponame_spec;
 	apk_blob_t default_cachename_spec;
@@ -88,6 +93,9 @@ struct apk_ctx {
 	struct apk_id_cache id_cache;
 	struct apk_database *db;
 	struct apk_query_spec query;
+	const struct apk_serializer_ops *solver_stats_ser;
+	const struct apk_serializer_ops *solver_errors_ser;
+	const struct apk_serializer_ops *solver_explain_ser;
 	int root_fd, dest_fd;
 	unsigned int on_tty : 1;
 	unsigned int root_set : 1;
@@ -96,6 +104,7 @@ struct apk_ctx {
 	unsigned int cache_predownload : 1;
 	unsigned int keys_loaded : 1;
 	unsigned int legacy_info : 1;
+	unsigned int db_journal : 1;
 	unsigned int interactive : 2;
 	unsigned int root_tmpfs : 2;
 	unsigned int sync : 2;
@@ -15,8 +15,13 @@
 #include "apk_balloc.h"
 #include "apk_package.h"
 #include "apk_io.h"
+#include "apk_process.h"
 #include "apk_context.h"
 #include "apk_repoparser.h"
+#include "apk_trigram.h"
+#include "apk_ownerdb.h"
+#include "apk_scriptdb.h"
+#include "apk_journal.h"
 
 #include "apk_provider_data.h"
 #include "apk_solver_data.h"
@@ -154,6 +159,17 @@ struct apk_repository {
 	apk_blob_t pkgname_spec;
 };
 
+// An alternative location for the repositories below 'prefix'. Each group
+// also has an entry with 'url' equal to 'prefix' for the primary location.
+struct apk_mirror {
+	apk_blob_t prefix;
+	apk_blob_t url;
+	apk_blob_t url_printable;
+	uint64_t bytes, usec;		// completed transfers
+	uint64_t queued;		// bytes selected but not yet transferred
+	unsigned int failures;
+};
+
 #define APK_DB_LAYER_ROOT		0
 #define APK_DB_LAYER_UVOL		1
 #define APK_DB_LAYER_NUM		2
@@ -179,14 +195,23 @@ struct apk_ipkg_creator {
 	int files_unsorted;
 };
 
+// Journal size limit before the installed database is rewritten
+#define APK_DB_JOURNAL_MIN		(256*1024)
+
+struct apk_db_journal {
+	struct apk_package_array *pkgs;	// packages in the written database
+	uint64_t len, limit;
+	unsigned int active : 1;
+};
+
 struct apk_database {
 	struct apk_ctx *ctx;
 	struct apk_balloc ba_names;
 	struct apk_balloc ba_pkgs;
 	struct apk_balloc ba_files;
 	struct apk_balloc ba_deps;
-	int root_fd, lock_fd, cache_fd;
-	unsigned num_repos, num_repo_tags;
+	int root_fd, lock_fd, cache_fd, cache_shared_fd;
+	unsigned num_repos, num_repo_tags, num_mirrors;
 	const char *cache_dir;
 	char *cache_remount_dir;
 	apk_blob_t *noarch;
@@ -223,12 +248,15 @@ struct apk_database {
 	struct apk_repoparser repoparser;
 	struct apk_repository filename_repository;
 	struct apk_repository cache_repository;
+	struct apk_repository cache_shared_repository;
 	struct apk_repository repos[APK_MAX_REPOS];
 	struct apk_repository_tag repo_tags[APK_MAX_TAGS];
+	struct apk_mirror mirrors[APK_MAX_MIRRORS];
 	struct apk_atom_pool atoms;
 	struct apk_string_array *filename_array;
 	struct apk_package_tmpl overlay_tmpl;
 	struct apk_ipkg_creator ic;
+	struct apk_executor executor;
 
 	struct {
 		unsigned stale, updated, unavailable;
@@ -238,6 +266,9 @@ struct apk_database {
 		struct apk_name_array *sorted_names;
 		struct apk_hash names;
 		struct apk_hash packages;
+		struct apk_name_array *search_names;
+		struct apk_trigram_index search_index;
+		unsigned int search_scans, search_repos;
 	} available;
 
 	struct {
@@ -246,6 +277,9 @@ struct apk_database {
 		struct list_head triggers;
 		struct apk_hash dirs;
 		struct apk_hash files;
+		struct apk_ownerdb owners[APK_DB_LAYER_NUM];
+		struct apk_scriptdb scripts[APK_DB_LAYER_NUM];
+		struct apk_db_journal journal[APK_DB_LAYER_NUM];
 		struct {
 			uint64_t bytes;
 			unsigned files;
@@ -288,6 +322,7 @@ int apk_db_write_config(struct apk_database *db);
 int apk_db_permanent(struct apk_database *db);
 int apk_db_check_world(struct apk_database *db, struct apk_dependency_array *world);
 int apk_db_fire_triggers(struct apk_database *db);
+int apk_db_start_script(struct apk_database *db, struct apk_process *p, struct apk_out *out, const char *hook_type, const char *package_name, int fd, char **argv, const char *logpfx);
 int apk_db_run_script(struct apk_database *db, const char *hook_type, const char *package_name, int fd, char **argv, const char *logpfx);
 int apk_db_cache_active(struct apk_database *db);
 static inline time_t apk_db_url_since(struct apk_database *db, time_t since) {
@@ -304,6 +339,8 @@ struct apk_package *apk_db_pkg_add(struct apk_database *db, struct apk_package_t
 struct apk_package *apk_db_get_pkg(struct apk_database *db, struct apk_digest *id);
 struct apk_package *apk_db_get_pkg_by_name(struct apk_database *db, apk_blob_t filename, ssize_t file_size, apk_blob_t pkgname_spec);
 struct apk_package *apk_db_get_file_owner(struct apk_database *db, apk_blob_t filename);
+struct apk_package *apk_db_get_indexed_owner(struct apk_database *db, apk_blob_t path);
+apk_blob_t apk_db_ipkg_script(struct apk_database *db, struct apk_installed_package *ipkg, unsigned int type);
 
 int apk_db_index_read(struct apk_database *db, struct apk_istream *is, int repo);
 int apk_db_index_read_file(struct apk_database *db, const char *file, int repo);
@@ -315,7 +352,16 @@ struct apk_repository *apk_db_select_repo(struct apk_database *db, struct apk_pa
 int apk_repo_index_cache_url(struct apk_database *db, struct apk_repository *repo, int *fd, char *buf, size_t len);
 int apk_repo_package_url(struct apk_database *db, struct apk_repository *repo, struct apk_package *pkg, int *fd, char *buf, size_t len);
 
+void apk_repo_mirror_select(struct apk_database *db, struct apk_repository *repo, uint8_t *mirror, uint64_t size);
+int apk_repo_mirror_url(struct apk_database *db, unsigned int mirror, char *buf, size_t len);
+bool apk_repo_mirror_next(struct apk_database *db, struct apk_repository *repo, uint8_t *mirror, uint64_t size,
+			  int r, uint64_t usec, uint32_t *tried);
+
 int apk_cache_download(struct apk_database *db, struct apk_repository *repo, struct apk_package *pkg, struct apk_progress *prog);
+void apk_cache_prefetch(struct apk_database *db, struct apk_repository *repo, struct apk_package *pkg);
+
+#define APK_CACHE_INDEX		"cache.idx"
+#define APK_SEARCH_INDEX	"search.idx"
 
 typedef void (*apk_cache_item_cb)(struct apk_database *db, int static_cache,
 				  int dirfd, const char *name,
@@ -325,6 +371,8 @@ int apk_db_cache_foreach_item(struct apk_database *db, apk_cache_item_cb cb);
 int apk_db_install_pkg(struct apk_database *db, struct apk_package *oldpkg, struct apk_package *newpkg, struct apk_progress *prog);
 
 struct apk_name_array *apk_db_sorted_names(struct apk_database *db);
+void apk_db_search_index_build(struct apk_database *db);
+int apk_db_search_index_load(struct apk_database *db);
 struct apk_package_array *apk_db_sorted_installed_packages(struct apk_database *db);
 
 typedef int (*apk_db_foreach_name_cb)(struct apk_database *db, const char *match, struct apk_name *name, void *ctx);
@@ -101,6 +101,8 @@ enum {
 	APKE_REPO_SYNTAX,
 	APKE_REPO_KEYWORD,
 	APKE_REPO_VARIABLE,
+	APKE_DELTA_FORMAT,
+	APKE_DELTA_MISMATCH,
 };
 
 static inline void *ERR_PTR(long error) { return (void*) error; }
@@ -144,6 +146,7 @@ static inline int IS_ERR(const void *ptr) { return (unsigned long)ptr >= (unsign
 #define APK_MAX_SCRIPT_SIZE	262144	/* package install script size 256kb */
 #define APK_MAX_REPOS		32	/* see struct apk_package */
 #define APK_MAX_TAGS		16	/* see solver; unsigned short */
+#define APK_MAX_MIRRORS		32	/* see apk_repo_mirror_next; uint32_t mask */
 
 static inline uint64_t apk_calc_installed_size(uint64_t size)
 {
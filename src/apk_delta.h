@@ -0,0 +1,45 @@
+/* apk_delta.h - Alpine Package Keeper (APK)
+ *
+ * Copyright (C) 2025 Timo Teräs <timo.teras@iki.fi>
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#pragma once
+#include "apk_defines.h"
+#include "apk_blob.h"
+#include "apk_crypto.h"
+#include "apk_io.h"
+
+// A delta rebuilds a package file byte for byte from an older version
+// of it. The header is followed by operations, each an opcode followed
+// by ULEB128 encoded arguments.
+#define APK_DELTA_MAGIC		"APKD"
+#define APK_DELTA_VERSION	1
+
+#define APK_DELTA_F_FILE_HASH	0x01	// identities are sha256 of the whole files
+
+#define APK_DELTA_OP_END	0x00	// end of delta
+#define APK_DELTA_OP_COPY	0x01	// offset, length: copy from the base
+#define APK_DELTA_OP_DATA	0x02	// length, data: literal data
+
+// Sizes are little endian. The identities are the package identities
+// with the sha256 algorithm; index entries may use a truncated prefix.
+// Deltas of other files, such as indexes, use hashes of the files.
+struct apk_delta_header {
+	char magic[4];
+	uint8_t version;
+	uint8_t flags;
+	uint8_t reserved[2];
+	uint64_t base_size;
+	uint64_t target_size;
+	uint8_t base_sha256[APK_DIGEST_LENGTH_SHA256];
+	uint8_t base_id[APK_DIGEST_LENGTH_SHA256];
+	uint8_t target_id[APK_DIGEST_LENGTH_SHA256];
+};
+
+int apk_delta_create(struct apk_ostream *os, apk_blob_t base, apk_blob_t target,
+	const struct apk_digest *base_id, const struct apk_digest *target_id, unsigned int flags);
+int apk_delta_read_header(struct apk_istream *is, struct apk_delta_header *hdr);
+struct apk_istream *apk_istream_delta(struct apk_istream *delta, int base_fd, apk_blob_t target_id);
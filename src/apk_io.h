@@ -98,6 +98,22 @@ static inline struct apk_istream *apk_istream_from_file(int atfd, const char *fi
 static inline struct apk_istream *apk_istream_from_file_mmap(int atfd, const char *file) { return __apk_istream_from_file(atfd, file, 1); }
 struct apk_istream *apk_istream_from_fd(int fd);
 struct apk_istream *apk_istream_from_fd_url_if_modified(int atfd, const char *url, time_t since);
+struct apk_istream *apk_istream_from_fd_url_offset(int atfd, const char *url, time_t since, uint64_t *offset);
+struct apk_istream *apk_istream_concat(struct apk_istream *first, struct apk_istream *second);
+void apk_url_prefetch(const char *url, time_t since);
+
+// A finished or failed URL transfer. Times are in microseconds on the
+// apk_trace_now() clock; the latency is the time to open the stream.
+struct apk_url_transfer {
+	const char *url;
+	uint64_t start, latency, duration;
+	uint64_t bytes;
+	int error;
+};
+
+void apk_url_set_rate_limit(uint64_t bytes_per_sec);
+void apk_url_set_start_jitter(unsigned int max_seconds);
+void apk_url_set_transfer_callback(void (*cb)(const struct apk_url_transfer *));
 static inline int apk_istream_error(struct apk_istream *is, int err) { if (is->err >= 0 && err) is->err = err; return is->err < 0 ? is->err : 0; }
 void apk_istream_set_progress(struct apk_istream *is, struct apk_progress *p);
 apk_blob_t apk_istream_mmap(struct apk_istream *is);
@@ -135,9 +151,13 @@ static inline int apk_istream_close_error(struct apk_istream *is, int r)
 
 void apk_io_url_init(struct apk_out *out);
 void apk_io_url_set_timeout(int timeout);
+void apk_io_url_set_max_connections(int max_conns);
 void apk_io_url_set_redirect_callback(void (*cb)(int, const char *));
 void apk_io_url_check_certificate(bool);
 struct apk_istream *apk_io_url_istream(const char *url, time_t since);
+struct apk_istream *apk_io_url_istream_offset(const char *url, time_t since, uint64_t *offset);
+void apk_io_url_prefetch(const char *url, time_t since);
+void apk_io_url_prefetch_end(void);
 
 struct apk_segment_istream {
 	struct apk_istream is;
@@ -234,6 +254,10 @@ apk_blob_t apk_id_cache_resolve_group(struct apk_id_cache *idc, gid_t gid);
 
 typedef int (*apk_multipart_cb)(void *ctx, int part, apk_blob_t data);
 
+// Inflate gzip streams on a helper thread: APK_NO (default), APK_YES, or
+// APK_AUTO if multiple CPUs are available
+extern int apk_io_gunzip_threaded;
+
 struct apk_istream *apk_istream_zlib(struct apk_istream *, int,
 				     apk_multipart_cb cb, void *ctx);
 static inline struct apk_istream *apk_istream_gunzip_mpart(struct apk_istream *is,
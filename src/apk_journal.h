@@ -0,0 +1,81 @@
+/* apk_journal.h - Alpine Package Keeper (APK)
+ *
+ * Copyright (C) 2025 Timo Teräs <timo.teras@iki.fi>
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#pragma once
+#include <sys/stat.h>
+#include "apk_defines.h"
+#include "apk_blob.h"
+#include "apk_crypto.h"
+#include "apk_io.h"
+
+// Append-only journal of installed database changes. The file is a
+// header followed by checksummed records. Each commit appends the
+// records of changed packages followed by a commit record; anything after
+// the last intact commit record is ignored. It records the identity of
+// the 'installed' database it applies to and is ignored if that does not
+// match.
+#define APK_JOURNAL_MAGIC	0x4a4b5041	// "APKJ"
+#define APK_JOURNAL_VERSION	1
+
+#define APK_JOURNAL_PKG		1	// data: installed database entry
+#define APK_JOURNAL_SCRIPT	2	// arg: script type, data: script
+#define APK_JOURNAL_DEL		3
+#define APK_JOURNAL_COMMIT	4
+
+struct apk_journal_header {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t installed_ino;
+	uint64_t installed_size;
+	uint64_t installed_mtime;
+};
+
+struct apk_journal_record {
+	uint32_t len;
+	uint32_t crc;
+	uint8_t type;
+	uint8_t arg;
+	uint16_t reserved;
+	uint8_t pkg[APK_DIGEST_LENGTH_SHA1];
+};
+
+struct apk_journal_entry {
+	uint8_t type, arg;
+	apk_blob_t pkg;
+	apk_blob_t data;
+};
+
+struct apk_journal_pkg {
+	uint8_t id[APK_DIGEST_LENGTH_SHA1];
+	uint64_t off;		// last record of the package
+};
+APK_ARRAY(apk_journal_pkg_array, struct apk_journal_pkg);
+
+struct apk_journal {
+	apk_blob_t map;
+	uint64_t committed;
+	struct apk_journal_pkg_array *pkgs;
+};
+
+int apk_journal_open(struct apk_journal *j, int atfd, const char *file, const struct stat *installed);
+void apk_journal_close(struct apk_journal *j);
+int apk_journal_next(const struct apk_journal *j, uint64_t *off, struct apk_journal_entry *e);
+const struct apk_journal_pkg *apk_journal_find(const struct apk_journal *j, apk_blob_t pkg);
+
+struct apk_journal_writer {
+	struct apk_ostream os;
+	char *buf;
+	size_t len, alloc, rec;
+};
+
+void apk_journal_writer_init(struct apk_journal_writer *w);
+void apk_journal_writer_free(struct apk_journal_writer *w);
+struct apk_ostream *apk_journal_writer_begin(struct apk_journal_writer *w, uint8_t type, uint8_t arg, apk_blob_t pkg);
+apk_blob_t apk_journal_writer_data(struct apk_journal_writer *w);
+void apk_journal_writer_end(struct apk_journal_writer *w, bool keep);
+int apk_journal_writer_commit(struct apk_journal_writer *w, int atfd, const char *file, uint64_t *committed, const struct stat *installed);
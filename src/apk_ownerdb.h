@@ -0,0 +1,82 @@
+/* apk_ownerdb.h - Alpine Package Keeper (APK)
+ *
+ * Copyright (C) 2025 Timo Teräs <timo.teras@iki.fi>
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#pragma once
+#include <sys/stat.h>
+#include "apk_defines.h"
+#include "apk_blob.h"
+#include "apk_crypto.h"
+#include "apk_balloc.h"
+#include "apk_io.h"
+
+// On-disk path to owner package index. The file is a header followed by
+// the package table, the path entries sorted by path, and a string table.
+// It records the identity of the 'installed' database it was generated
+// from and is ignored if that does not match.
+#define APK_OWNERDB_MAGIC	0x4f4b5041	// "APKO"
+#define APK_OWNERDB_VERSION	1
+
+#define APK_OWNERDB_DIR		0x0001
+
+struct apk_ownerdb_header {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t installed_ino;
+	uint64_t installed_size;
+	uint64_t installed_mtime;
+	uint32_t num_pkgs;
+	uint32_t num_entries;
+	uint32_t strings_len;
+	uint32_t reserved;
+};
+
+struct apk_ownerdb_pkg {
+	uint8_t digest_alg;
+	uint8_t digest_len;
+	uint16_t reserved;
+	uint32_t digest_off;
+};
+
+struct apk_ownerdb_entry {
+	uint32_t path_off;
+	uint16_t path_len;
+	uint16_t flags;
+	uint32_t pkg;
+};
+
+struct apk_ownerdb_item {
+	apk_blob_t path;
+	uint32_t pkg;
+	uint16_t flags;
+};
+APK_ARRAY(apk_ownerdb_item_array, struct apk_ownerdb_item);
+APK_ARRAY(apk_ownerdb_digest_array, struct apk_digest);
+
+struct apk_ownerdb_writer {
+	struct apk_balloc ba;
+	struct apk_ownerdb_digest_array *pkgs;
+	struct apk_ownerdb_item_array *items;
+};
+
+void apk_ownerdb_writer_init(struct apk_ownerdb_writer *w);
+void apk_ownerdb_writer_free(struct apk_ownerdb_writer *w);
+uint32_t apk_ownerdb_writer_add_pkg(struct apk_ownerdb_writer *w, uint8_t digest_alg, apk_blob_t digest);
+void apk_ownerdb_writer_add(struct apk_ownerdb_writer *w, uint32_t pkg, apk_blob_t path, uint16_t flags);
+int apk_ownerdb_writer_write(struct apk_ownerdb_writer *w, struct apk_ostream *os, const struct stat *installed);
+
+struct apk_ownerdb {
+	apk_blob_t map;
+	const struct apk_ownerdb_header *hdr;
+	const struct apk_ownerdb_pkg *pkgs;
+	const struct apk_ownerdb_entry *entries;
+	const char *strings;
+};
+
+int apk_ownerdb_open(struct apk_ownerdb *odb, int atfd, const char *file, const struct stat *installed);
+void apk_ownerdb_close(struct apk_ownerdb *odb);
+int apk_ownerdb_lookup(const struct apk_ownerdb *odb, apk_blob_t path, struct apk_digest *pkg);
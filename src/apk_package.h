@@ -11,6 +11,7 @@
 #include "apk_version.h"
 #include "apk_hash.h"
 #include "apk_io.h"
+#include "apk_process.h"
 #include "apk_solver_data.h"
 
 struct adb_obj;
@@ -61,6 +62,8 @@ struct apk_installed_package {
 	struct apk_string_array *pending_triggers;
 	struct apk_dependency_array *replaces;
 
+	uint8_t fdb_hash[APK_DIGEST_LENGTH_SHA1];	// of the written database entry
+
 	unsigned short replaces_priority;
 	unsigned repository_tag : 6;
 	unsigned run_all_triggers : 1;
@@ -69,6 +72,7 @@ struct apk_installed_package {
 	unsigned broken_xattr : 1;
 	unsigned sha256_160 : 1;
 	unsigned to_be_removed : 1;
+	unsigned fdb_hashed : 1;
 };
 
 struct apk_package {
@@ -76,7 +80,7 @@ struct apk_package {
 	struct apk_name *name;
 	struct apk_installed_package *ipkg;
 	struct apk_dependency_array *depends, *install_if, *provides, *recommends;
-	struct apk_blobptr_array *tags;
+	struct apk_blobptr_array *tags, *deltas;
 	apk_blob_t *version;
 	apk_blob_t *arch, *license, *origin, *maintainer, *url, *description, *commit;
 	uint64_t installed_size, size;
@@ -97,6 +101,8 @@ struct apk_package {
 	unsigned char cached_non_repository : 1;
 	unsigned char cached : 1;
 	unsigned char layer : 3;
+	unsigned char cached_shared : 1;
+	uint8_t mirror;
 	uint8_t digest_alg;
 	uint8_t digest[0];
 };
@@ -172,6 +178,18 @@ void apk_pkg_uninstall(struct apk_database *db, struct apk_package *pkg);
 
 int apk_ipkg_assign_script(struct apk_installed_package *ipkg, unsigned int type, apk_blob_t blob);
 int apk_ipkg_add_script(struct apk_installed_package *ipkg, struct apk_istream *is, unsigned int type, uint64_t size);
+struct apk_ipkg_script_run {
+	struct apk_process proc;
+	struct apk_installed_package *ipkg;
+	unsigned int type, trace_tid;
+	uint64_t trace_start;
+	bool created;
+	char fn[PATH_MAX];
+};
+
+int apk_ipkg_script_start(struct apk_ipkg_script_run *sr, struct apk_installed_package *ipkg,
+			  struct apk_database *db, unsigned int type, char **argv, struct apk_out *out);
+int apk_ipkg_script_finish(struct apk_ipkg_script_run *sr, struct apk_database *db, int r);
 int apk_ipkg_run_script(struct apk_installed_package *ipkg, struct apk_database *db, unsigned int type, char **argv);
 
 int apk_pkg_write_index_header(struct apk_package *pkg, struct apk_ostream *os);
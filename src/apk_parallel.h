@@ -0,0 +1,24 @@
+/* apk_parallel.h - Alpine Package Keeper (APK)
+ *
+ * Copyright (C) 2025 Timo Teräs <timo.teras@iki.fi>
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#pragma once
+#include "apk_defines.h"
+
+// Ordered parallel loop. The 'work' callback is run for each item from
+// a pool of worker threads, and 'done' is run in the calling thread for
+// each item in increasing order once its work has completed. At most
+// 'window' items are outstanding beyond the last completed one. A non-zero
+// return from 'done' stops issuing new work and is returned. The 'done'
+// callback is optional.
+struct apk_parallel_ops {
+	void (*work)(void *ctx, unsigned int item);
+	int (*done)(void *ctx, unsigned int item);
+};
+
+int apk_parallel_jobs(int jobs);
+int apk_parallel_run(int jobs, unsigned int num, unsigned int window, const struct apk_parallel_ops *ops, void *ctx);
@@ -21,7 +21,7 @@ struct apk_process {
 	struct apk_out *out;
 	struct apk_istream *is;
 	apk_blob_t is_blob;
-	int status;
+	int status, status_fd;
 	unsigned int is_eof : 1;
 	struct buf {
 		uint16_t len;
@@ -29,9 +29,22 @@ struct apk_process {
 	} buf_stdout, buf_stderr;
 };
 
+// Helper process forked early to run scripts without forking the full
+// apk process. It runs setup once, and then executes the requests sent
+// to it with their stdio connected to the requesting apk_process.
+struct apk_executor {
+	pid_t pid;
+	int sock;
+};
+
+int apk_executor_start(struct apk_executor *e, int (*setup)(void *ctx), void *ctx);
+void apk_executor_stop(struct apk_executor *e);
+
 int apk_process_init(struct apk_process *p, const char *argv0, const char *logpfx, struct apk_out *out, struct apk_istream *is);
 pid_t apk_process_fork(struct apk_process *p);
 int apk_process_spawn(struct apk_process *p, const char *path, char * const* argv, char * const* env);
+int apk_process_exec(struct apk_process *p, struct apk_executor *e, int fd, char * const* argv, char * const* env);
 int apk_process_run(struct apk_process *p);
+int apk_process_wait_any(struct apk_process **procs, unsigned int num);
 int apk_process_cleanup(struct apk_process *p);
 struct apk_istream *apk_process_istream(char * const* argv, struct apk_out *out, const char *argv0);
@@ -7,6 +7,7 @@ struct apk_repoparser;
 
 struct apk_repoparser_ops {
 	int (*repository)(struct apk_repoparser *rp, apk_blob_t url, const char *index_file, apk_blob_t tag);
+	int (*mirror)(struct apk_repoparser *rp, apk_blob_t url, apk_blob_t mirror);
 };
 
 struct apk_repoparser {
@@ -0,0 +1,69 @@
+/* apk_scriptdb.h - Alpine Package Keeper (APK)
+ *
+ * Copyright (C) 2025 Timo Teräs <timo.teras@iki.fi>
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#pragma once
+#include <sys/stat.h>
+#include "apk_defines.h"
+#include "apk_blob.h"
+#include "apk_crypto.h"
+#include "apk_io.h"
+
+// On-disk uncompressed script store. The file is a header followed by
+// the entries sorted by package digest and script type, and a data area
+// holding the digest and script contents of each entry. It records the
+// identity of the scripts.tar(.gz) it was generated with and is ignored
+// if that does not match.
+#define APK_SCRIPTDB_MAGIC	0x534b5041	// "APKS"
+#define APK_SCRIPTDB_VERSION	1
+
+struct apk_scriptdb_header {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t tar_ino;
+	uint64_t tar_size;
+	uint64_t tar_mtime;
+	uint64_t data_len;
+	uint32_t num_entries;
+	uint32_t reserved;
+};
+
+struct apk_scriptdb_entry {
+	uint8_t digest_alg;
+	uint8_t digest_len;
+	uint8_t type;
+	uint8_t reserved;
+	uint32_t script_len;
+	uint64_t data_off;	// digest followed by the script
+};
+
+struct apk_scriptdb_item {
+	struct apk_digest digest;
+	unsigned int type;
+	apk_blob_t script;
+};
+APK_ARRAY(apk_scriptdb_item_array, struct apk_scriptdb_item);
+
+struct apk_scriptdb_writer {
+	struct apk_scriptdb_item_array *items;
+};
+
+void apk_scriptdb_writer_init(struct apk_scriptdb_writer *w);
+void apk_scriptdb_writer_free(struct apk_scriptdb_writer *w);
+void apk_scriptdb_writer_add(struct apk_scriptdb_writer *w, uint8_t digest_alg, apk_blob_t digest, unsigned int type, apk_blob_t script);
+int apk_scriptdb_writer_write(struct apk_scriptdb_writer *w, struct apk_ostream *os, const struct stat *tar);
+
+struct apk_scriptdb {
+	apk_blob_t map;
+	const struct apk_scriptdb_header *hdr;
+	const struct apk_scriptdb_entry *entries;
+	const char *data;
+};
+
+int apk_scriptdb_open(struct apk_scriptdb *sdb, int atfd, const char *file, const struct stat *tar);
+void apk_scriptdb_close(struct apk_scriptdb *sdb);
+apk_blob_t apk_scriptdb_lookup(const struct apk_scriptdb *sdb, apk_blob_t digest, unsigned int type);
@@ -11,6 +11,22 @@
 
 struct apk_name;
 struct apk_package;
+struct apk_serializer;
+
+// Work done by the last apk_solver_solve() call. Times are in microseconds
+// and accumulate over the restarts done to drop broken world dependencies.
+struct apk_solver_stats {
+	unsigned int names_discovered;
+	unsigned int reconsider_name;
+	unsigned int apply_constraint;
+	unsigned int queue_insert;
+	unsigned int compare_providers;
+	unsigned int restarts;
+	uint64_t discover_usec;
+	uint64_t apply_world_usec;
+	uint64_t resolve_usec;
+	uint64_t changeset_usec;
+};
 
 struct apk_change {
 	struct apk_package *old_pkg;
@@ -25,6 +41,7 @@ struct apk_changeset {
 	int num_install, num_remove, num_adjust;
 	int num_total_changes;
 	struct apk_change_array *changes;
+	struct apk_solver_stats stats;
 };
 
 #define APK_SOLVERF_UPGRADE		0x0001
@@ -43,6 +60,8 @@ int apk_solver_solve(struct apk_database *db,
 		     struct apk_dependency_array *world,
 		     struct apk_changeset *changeset);
 
+int apk_solver_stats_serialize(struct apk_serializer *ser, const struct apk_solver_stats *stats);
+
 int apk_solver_precache_changeset(struct apk_database *db, struct apk_changeset *changeset, bool changes_only);
 
 int apk_solver_commit_changeset(struct apk_database *db,
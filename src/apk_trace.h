@@ -0,0 +1,37 @@
+/* apk_trace.h - Alpine Package Keeper (APK)
+ *
+ * Copyright (C) 2025 Timo Teräs <timo.teras@iki.fi>
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#pragma once
+#include <stdio.h>
+#include "apk_defines.h"
+
+// Records timestamped spans as Chrome trace event JSON, which can be
+// loaded in Perfetto or about:tracing. All calls are no-ops unless the
+// trace was opened.
+struct apk_trace {
+	FILE *f;
+	unsigned int pid;
+};
+
+int apk_trace_open(struct apk_trace *t, const char *file);
+void apk_trace_close(struct apk_trace *t);
+uint64_t apk_trace_now(void);
+void apk_trace_write(struct apk_trace *t, unsigned int tid, uint64_t start, const char *cat, const char *fmt, ...)
+	__attribute__ ((format (printf, 5, 6)));
+void apk_trace_write_args(struct apk_trace *t, uint64_t start, const char *cat, const char *name, const char *fmt, ...)
+	__attribute__ ((format (printf, 5, 6)));
+
+static inline uint64_t apk_trace_begin(struct apk_trace *t) { return t->f ? apk_trace_now() : 0; }
+
+#define apk_trace_end(t, start, cat, args...) \
+	do { if ((t)->f) apk_trace_write(t, 0, start, cat, args); } while (0)
+// Records a span with 'args' formatted as the members of a JSON object
+#define apk_trace_end_args(t, start, cat, name, args...) \
+	do { if ((t)->f) apk_trace_write_args(t, start, cat, name, args); } while (0)
+#define apk_trace_end_tid(t, tid, start, cat, args...) \
+	do { if ((t)->f) apk_trace_write(t, tid, start, cat, args); } while (0)
@@ -0,0 +1,49 @@
+/* apk_trigram.h - Alpine Package Keeper (APK)
+ *
+ * Copyright (C) 2025 Timo Teräs <timo.teras@iki.fi>
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#pragma once
+#include "apk_defines.h"
+#include "apk_blob.h"
+#include "apk_crypto.h"
+#include "apk_io.h"
+
+// On-disk index: the header followed by the finalized keys. The 'id'
+// identifies the documents the index was built from, and the file is
+// ignored if it does not match.
+#define APK_TRIGRAM_MAGIC	0x544b5041	// "APKT"
+#define APK_TRIGRAM_VERSION	1
+
+struct apk_trigram_header {
+	uint32_t magic;
+	uint32_t version;
+	uint8_t id[APK_DIGEST_LENGTH_SHA256];
+	uint32_t num_docs;
+	uint32_t num_keys;
+};
+
+APK_ARRAY(apk_trigram_key_array, uint64_t);
+APK_ARRAY(apk_trigram_doc_array, uint32_t);
+
+// Case-insensitive trigram index mapping each three byte sequence to
+// the sorted list of documents containing it. Stored as a single sorted
+// array of (trigram << 32 | document) keys.
+struct apk_trigram_index {
+	struct apk_trigram_key_array *keys;
+	uint32_t num_docs;
+	unsigned int sorted : 1;
+};
+
+void apk_trigram_index_init(struct apk_trigram_index *ti);
+void apk_trigram_index_free(struct apk_trigram_index *ti);
+void apk_trigram_index_reset(struct apk_trigram_index *ti);
+void apk_trigram_index_add(struct apk_trigram_index *ti, uint32_t doc, apk_blob_t text);
+void apk_trigram_index_finalize(struct apk_trigram_index *ti);
+int apk_trigram_index_write(struct apk_trigram_index *ti, struct apk_ostream *os, const struct apk_digest *id);
+int apk_trigram_index_check(struct apk_istream *is, const struct apk_digest *id);
+int apk_trigram_index_read(struct apk_trigram_index *ti, struct apk_istream *is, const struct apk_digest *id);
+int apk_trigram_index_query(struct apk_trigram_index *ti, const char *pattern, struct apk_trigram_doc_array **docs);
@@ -17,6 +17,7 @@
 #include "apk_database.h"
 #include "apk_extract.h"
 #include "apk_query.h"
+#include "apk_trace.h"
 
 #define FETCH_STDOUT		0x01
 #define FETCH_LINK		0x02
@@ -130,38 +131,44 @@ static int fetch_parse_option(void *ctx, struct apk_ctx *ac, int opt, const char
 	return 0;
 }
 
-static int fetch_package(struct fetch_ctx *ctx, struct apk_package *pkg)
+static void prefetch_package(struct fetch_ctx *ctx, struct apk_package *pkg)
 {
-	struct apk_out *out = &ctx->ac->out;
 	struct apk_database *db = ctx->ac->db;
-	struct apk_istream *is;
-	struct apk_ostream *os;
 	struct apk_repository *repo;
 	struct apk_file_info fi;
-	struct apk_extract_ctx ectx;
-	struct apk_progress_istream pis;
 	char pkg_url[PATH_MAX], filename[PATH_MAX];
-	int r, pkg_fd;
-
-	apk_progress_item_start(&ctx->prog, apk_progress_weight(ctx->done_bytes, ctx->done_packages), pkg->size);
+	int pkg_fd;
 
 	repo = apk_db_select_repo(db, pkg);
-	if (repo == NULL) {
-		r = -APKE_PACKAGE_NOT_FOUND;
-		goto err;
-	}
-
-	r = apk_blob_subst(filename, sizeof filename, ctx->pkgname_spec, apk_pkg_subst, pkg);
-	if (r < 0) goto err;
-
+	if (repo == NULL) return;
 	if (!(ctx->flags & FETCH_STDOUT)) {
+		if (apk_blob_subst(filename, sizeof filename, ctx->pkgname_spec, apk_pkg_subst, pkg) < 0) return;
 		if (apk_fileinfo_get(ctx->outdir_fd, filename, 0, &fi, &db->atoms) == 0 &&
 		    fi.size == pkg->size)
-			goto done;
+			return;
 	}
+	apk_repo_mirror_select(db, repo, &pkg->mirror, pkg->size);
+	if (apk_repo_package_url(db, repo, pkg, &pkg_fd, pkg_url, sizeof pkg_url) < 0 ||
+	    apk_repo_mirror_url(db, pkg->mirror, pkg_url, sizeof pkg_url) < 0)
+		return;
+	apk_url_prefetch(pkg_url, apk_db_url_since(db, 0));
+}
+
+static int fetch_package_from(struct fetch_ctx *ctx, struct apk_package *pkg, struct apk_repository *repo, const char *filename)
+{
+	struct apk_out *out = &ctx->ac->out;
+	struct apk_database *db = ctx->ac->db;
+	struct apk_istream *is;
+	struct apk_ostream *os;
+	struct apk_extract_ctx ectx;
+	struct apk_progress_istream pis;
+	char pkg_url[PATH_MAX];
+	int r, pkg_fd;
 
 	r = apk_repo_package_url(db, repo, pkg, &pkg_fd, pkg_url, sizeof pkg_url);
-	if (r < 0) goto err;
+	if (r < 0) return r;
+	r = apk_repo_mirror_url(db, pkg->mirror, pkg_url, sizeof pkg_url);
+	if (r < 0) return r;
 
 	if (ctx->flags & FETCH_URL)
 		apk_msg(out, "%s", pkg_url);
@@ -177,25 +184,56 @@ static int fetch_package(struct fetch_ctx *ctx, struct apk_package *pkg)
 			const char *urlfile = apk_url_local_file(pkg_url, PATH_MAX);
 			if (urlfile &&
 			    linkat(pkg_fd, pkg_url, ctx->outdir_fd, filename, AT_SYMLINK_FOLLOW) == 0)
-				goto done;
+				return 0;
 		}
 		os = apk_ostream_to_file_safe(ctx->outdir_fd, filename, 0644);
-		if (IS_ERR(os)) {
-			r = PTR_ERR(os);
-			goto err;
-		}
+		if (IS_ERR(os)) return PTR_ERR(os);
 	}
 
 	is = apk_istream_from_fd_url(pkg_fd, pkg_url, apk_db_url_since(db, 0));
-	if (IS_ERR(is)) {
-		r = PTR_ERR(is);
-		goto err;
-	}
 	is = apk_progress_istream(&pis, is, &ctx->prog);
 	is = apk_istream_tee(is, os, APK_ISTREAM_TEE_COPY_META);
 	apk_extract_init(&ectx, db->ctx, NULL);
 	apk_extract_verify_identity(&ectx, pkg->digest_alg, apk_pkg_digest_blob(pkg));
-	r = apk_extract(&ectx, is);
+	return apk_extract(&ectx, is);
+}
+
+static int fetch_package(struct fetch_ctx *ctx, struct apk_package *pkg)
+{
+	struct apk_out *out = &ctx->ac->out;
+	struct apk_database *db = ctx->ac->db;
+	struct apk_repository *repo;
+	struct apk_file_info fi;
+	char filename[PATH_MAX];
+	uint64_t start;
+	uint32_t tried = 0;
+	int r;
+
+	apk_progress_item_start(&ctx->prog, apk_progress_weight(ctx->done_bytes, ctx->done_packages), pkg->size);
+
+	repo = apk_db_select_repo(db, pkg);
+	if (repo == NULL) {
+		r = -APKE_PACKAGE_NOT_FOUND;
+		goto err;
+	}
+
+	r = apk_blob_subst(filename, sizeof filename, ctx->pkgname_spec, apk_pkg_subst, pkg);
+	if (r < 0) goto err;
+
+	if (!(ctx->flags & FETCH_STDOUT)) {
+		if (apk_fileinfo_get(ctx->outdir_fd, filename, 0, &fi, &db->atoms) == 0 &&
+		    fi.size == pkg->size)
+			goto done;
+	} else {
+		// data already written to stdout cannot be taken back
+		tried = ~0U;
+	}
+
+	apk_repo_mirror_select(db, repo, &pkg->mirror, pkg->size);
+	do {
+		start = apk_trace_now();
+		r = fetch_package_from(ctx, pkg, repo, filename);
+	} while (apk_repo_mirror_next(db, repo, &pkg->mirror, pkg->size, r, apk_trace_now() - start, &tried));
 	if (r == 0) goto done;
 err:
 	apk_err(out, PKG_VER_FMT ": %s", PKG_VER_PRINTF(pkg), apk_error_str(r));
@@ -269,10 +307,15 @@ static int fetch_main(void *pctx, struct apk_ctx *ac, struct apk_string_array *a
 	apk_query_matches(ac, &ac->query, args, fetch_match_package, ctx);
 	if (ctx->errors == 0) {
 		apk_array_qsort(ctx->pkgs, apk_package_array_qsort);
+		if (!(db->ctx->flags & APK_SIMULATE)) {
+			apk_array_foreach_item(pkg, ctx->pkgs)
+				prefetch_package(ctx, pkg);
+		}
 		apk_progress_start(&ctx->prog, &ac->out, "fetch", apk_progress_weight(ctx->total_bytes, apk_array_len(ctx->pkgs)));
 		apk_array_foreach_item(pkg, ctx->pkgs)
 			fetch_package(ctx, pkg);
 		apk_progress_end(&ctx->prog);
+		apk_io_url_prefetch_end();
 
 		/* Remove packages not matching download spec from the output directory */
 		if (!ctx->errors && (db->ctx->flags & APK_PURGE) &&
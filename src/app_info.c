@@ -279,7 +279,7 @@ static int info_parse_option(void *pctx, struct apk_ctx *ac, int opt, const char
 		break;
 	case OPT_INFO_who_owns:
 		ctx->who_owns = 1;
-		ac->open_flags |= APK_OPENF_NO_REPOS;
+		ac->open_flags |= APK_OPENF_NO_REPOS | APK_OPENF_OWNER_INDEX;
 		break;
 	case OPT_INFO_webpage:
 		qs->fields |= BIT(APK_Q_FIELD_URL);
@@ -0,0 +1,118 @@
+/* app_mkdelta.c - Alpine Package Keeper (APK)
+ *
+ * Copyright (C) 2025 Timo Teräs <timo.teras@iki.fi>
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include "apk_applet.h"
+#include "apk_delta.h"
+#include "apk_extract.h"
+#include "apk_print.h"
+
+struct mkdelta_ctx {
+	const char *output;
+	unsigned int index : 1;
+};
+
+#define MKDELTA_OPTIONS(OPT) \
+	OPT(OPT_MKDELTA_index,		"index") \
+	OPT(OPT_MKDELTA_output,		APK_OPT_ARG APK_OPT_SH("o") "output")
+
+APK_OPTIONS(mkdelta_options_desc, MKDELTA_OPTIONS);
+
+static int mkdelta_parse_option(void *ctx, struct apk_ctx *ac, int optch, const char *optarg)
+{
+	struct mkdelta_ctx *mctx = ctx;
+
+	switch (optch) {
+	case OPT_MKDELTA_index:
+		mctx->index = 1;
+		break;
+	case OPT_MKDELTA_output:
+		mctx->output = optarg;
+		break;
+	default:
+		return -ENOTSUP;
+	}
+	return 0;
+}
+
+static int load_file(struct apk_ctx *ac, const char *file, bool index, apk_blob_t *data, struct apk_digest *id)
+{
+	struct apk_extract_ctx ectx;
+	struct apk_istream is;
+	int r;
+
+	r = apk_blob_from_file(AT_FDCWD, file, data);
+	if (r < 0) return r;
+	if (index) return apk_digest_calc(id, APK_DIGEST_SHA256, data->ptr, data->len);
+	apk_digest_reset(id);
+	apk_extract_init(&ectx, ac, NULL);
+	apk_extract_generate_identity(&ectx, APK_DIGEST_SHA256, id);
+	return apk_extract(&ectx, apk_istream_from_blob(&is, *data));
+}
+
+static int mkdelta_main(void *pctx, struct apk_ctx *ac, struct apk_string_array *args)
+{
+	struct mkdelta_ctx *mctx = pctx;
+	struct apk_out *out = &ac->out;
+	struct apk_digest base_id, target_id;
+	apk_blob_t base = APK_BLOB_NULL, target = APK_BLOB_NULL, hex;
+	const char *output = mctx->output;
+	char buf[PATH_MAX], hexbuf[17];
+	struct stat st;
+	int r;
+
+	if (apk_array_len(args) != 2) return -EINVAL;
+	r = load_file(ac, args->item[0], mctx->index, &base, &base_id);
+	if (r < 0) {
+		apk_err(out, "%s: %s", args->item[0], apk_error_str(r));
+		goto done;
+	}
+	r = load_file(ac, args->item[1], mctx->index, &target, &target_id);
+	if (r < 0) {
+		apk_err(out, "%s: %s", args->item[1], apk_error_str(r));
+		goto done;
+	}
+	if (!output) {
+		// The name clients request the delta with
+		hex = APK_BLOB_BUF(hexbuf);
+		apk_blob_push_hexdump(&hex, APK_BLOB_PTR_LEN((char *) base_id.data, 8));
+		hex = apk_blob_pushed(APK_BLOB_BUF(hexbuf), hex);
+		r = apk_fmt(buf, sizeof buf, "%s." BLOB_FMT ".delta", args->item[1], BLOB_PRINTF(hex));
+		if (r < 0) goto done;
+		output = buf;
+	}
+
+	r = apk_delta_create(apk_ostream_to_file(AT_FDCWD, output, 0644), base, target, &base_id, &target_id,
+		mctx->index ? APK_DELTA_F_FILE_HASH : 0);
+	if (r < 0) {
+		apk_err(out, "%s: %s", output, apk_error_str(r));
+		goto done;
+	}
+	if (stat(output, &st) == 0)
+		apk_msg(out, "%s: %" PRIu64 " bytes (%d%% of the target)", output, (uint64_t) st.st_size,
+			target.len ? (int)(st.st_size * 100 / target.len) : 0);
+done:
+	free(base.ptr);
+	free(target.ptr);
+	return r < 0 ? 1 : 0;
+}
+
+static struct apk_applet apk_mkdelta = {
+	.name = "mkdelta",
+	.options_desc = mkdelta_options_desc,
+	.optgroup_generation = 1,
+	.context_size = sizeof(struct mkdelta_ctx),
+	.parse = mkdelta_parse_option,
+	.main = mkdelta_main,
+};
+
+APK_DEFINE_APPLET(apk_mkdelta);
@@ -11,32 +11,56 @@
 
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <fcntl.h>
+#include <string.h>
 #include <unistd.h>
 #include <sys/stat.h>
 
 #include "apk_adb.h"
 #include "apk_applet.h"
 #include "apk_database.h"
+#include "apk_delta.h"
 #include "apk_extract.h"
+#include "apk_parallel.h"
 #include "apk_print.h"
 
+struct mkndx_pkg {
+	struct apk_extract_ctx ectx;
+	struct adb db;
+	struct adb_obj *pkginfo;
+	adb_val_t val;
+	int old_ndx, r;
+	uint8_t new_pkg : 1;
+	uint8_t name_mismatch : 1;
+};
+
+struct mkndx_delta {
+	uint8_t target_id[APK_DIGEST_LENGTH_SHA256];
+	uint8_t base_id[APK_DIGEST_LENGTH_SHA256];
+};
+
 struct mkndx_ctx {
 	const char *index;
 	const char *output;
 	const char *description;
 	apk_blob_t pkgname_spec;
 	apk_blob_t filter_spec;
-
-	apk_blob_t r;
-	struct adb db;
-	struct adb_obj pkgs;
-	struct adb_obj pkginfo;
+	apk_blob_t lookup_spec;
+	struct apk_ctx *ac;
+	struct apk_string_array *args;
+	struct mkndx_pkg *pkg;
+	struct mkndx_delta *deltas;
+	unsigned int num_deltas;
+	time_t index_mtime;
+	unsigned int jobs;
+	int errors, newpkgs;
+
+	struct adb db, odb;
+	struct adb_obj pkgs, opkgs;
 	uint8_t hash_alg;
 	uint8_t pkgname_spec_set : 1;
 	uint8_t filter_spec_set : 1;
-
-	struct apk_extract_ctx ectx;
 };
 
 #define ALLOWED_HASH (BIT(APK_DIGEST_SHA256)|BIT(APK_DIGEST_SHA256_160))
@@ -46,6 +70,7 @@ struct mkndx_ctx {
 	OPT(OPT_MKNDX_filter_spec,	APK_OPT_ARG "filter-spec") \
 	OPT(OPT_MKNDX_hash,		APK_OPT_ARG "hash") \
 	OPT(OPT_MKNDX_index,		APK_OPT_ARG APK_OPT_SH("x") "index") \
+	OPT(OPT_MKNDX_jobs,		APK_OPT_ARG APK_OPT_SH("j") "jobs") \
 	OPT(OPT_MKNDX_output,		APK_OPT_ARG APK_OPT_SH("o") "output") \
 	OPT(OPT_MKNDX_pkgname_spec,	APK_OPT_ARG "pkgname-spec") \
 	OPT(OPT_MKNDX_rewrite_arch,	APK_OPT_ARG "rewrite-arch")
@@ -79,6 +104,9 @@ static int mkndx_parse_option(void *ctx, struct apk_ctx *ac, int optch, const ch
 	case OPT_MKNDX_index:
 		ictx->index = optarg;
 		break;
+	case OPT_MKNDX_jobs:
+		if (apk_opt_parse_uint(optarg, 1, 1024, &ictx->jobs) < 0) return -EINVAL;
+		break;
 	case OPT_MKNDX_output:
 		ictx->output = optarg;
 		break;
@@ -131,9 +159,9 @@ static int mkndx_parse_v2meta(struct apk_extract_ctx *ectx, struct apk_istream *
 		FIELD("triggers",		0),
 		FIELD("url",			ADBI_PI_URL),
 	};
-	struct mkndx_ctx *ctx = container_of(ectx, struct mkndx_ctx, ectx);
+	struct mkndx_pkg *pkg = container_of(ectx, struct mkndx_pkg, ectx);
 	struct field *f, key;
-	struct adb *db = &ctx->db;
+	struct adb *db = &pkg->db;
 	struct adb_obj deps[3];
 	apk_blob_t line, k, v, token = APK_BLOB_STR("\n"), bdep;
 	int r, e = 0, i = 0;
@@ -151,7 +179,7 @@ static int mkndx_parse_v2meta(struct apk_extract_ctx *ectx, struct apk_istream *
 		f = bsearch(&key, fields, ARRAY_SIZE(fields), sizeof(fields[0]), cmpfield);
 		if (!f || f->ndx == 0) continue;
 
-		if (adb_ro_val(&ctx->pkginfo, f->ndx) != ADB_NULL)
+		if (adb_ro_val(pkg->pkginfo, f->ndx) != ADB_NULL)
 			return -APKE_ADB_PACKAGE_FORMAT;
 
 		switch (f->ndx) {
@@ -170,13 +198,13 @@ static int mkndx_parse_v2meta(struct apk_extract_ctx *ectx, struct apk_istream *
 			}
 			continue;
 		}
-		adb_wo_pkginfo(&ctx->pkginfo, f->ndx, v);
+		adb_wo_pkginfo(pkg->pkginfo, f->ndx, v);
 	}
 	if (r != -APKE_EOF) return r;
 
-	adb_wo_arr(&ctx->pkginfo, ADBI_PI_DEPENDS, &deps[0]);
-	adb_wo_arr(&ctx->pkginfo, ADBI_PI_PROVIDES, &deps[1]);
-	adb_wo_arr(&ctx->pkginfo, ADBI_PI_REPLACES, &deps[2]);
+	adb_wo_arr(pkg->pkginfo, ADBI_PI_DEPENDS, &deps[0]);
+	adb_wo_arr(pkg->pkginfo, ADBI_PI_PROVIDES, &deps[1]);
+	adb_wo_arr(pkg->pkginfo, ADBI_PI_REPLACES, &deps[2]);
 
 	adb_wo_free(&deps[0]);
 	adb_wo_free(&deps[1]);
@@ -185,13 +213,13 @@ static int mkndx_parse_v2meta(struct apk_extract_ctx *ectx, struct apk_istream *
 	return 0;
 }
 
-static int mkndx_parse_v3meta(struct apk_extract_ctx *ectx, struct adb_obj *pkg)
+static int mkndx_parse_v3meta(struct apk_extract_ctx *ectx, struct adb_obj *obj)
 {
-	struct mkndx_ctx *ctx = container_of(ectx, struct mkndx_ctx, ectx);
+	struct mkndx_pkg *pkg = container_of(ectx, struct mkndx_pkg, ectx);
 	struct adb_obj pkginfo;
 
-	adb_ro_obj(pkg, ADBI_PKG_PKGINFO, &pkginfo);
-	adb_wo_copyobj(&ctx->pkginfo, &pkginfo);
+	adb_ro_obj(obj, ADBI_PKG_PKGINFO, &pkginfo);
+	adb_wo_copyobj(pkg->pkginfo, &pkginfo);
 
 	return 0;
 }
@@ -249,27 +277,218 @@ static int find_package(struct adb_obj *pkgs, apk_blob_t path, int64_t filesize,
 	return -APKE_PACKAGE_NOT_FOUND;
 }
 
+static int mkndx_delta_cmp(const void *a, const void *b)
+{
+	return memcmp(a, b, sizeof(struct mkndx_delta));
+}
+
+static int mkndx_read_delta(struct mkndx_ctx *ctx, const char *file)
+{
+	struct apk_delta_header hdr;
+	struct apk_istream *is;
+	struct mkndx_delta *d;
+	int r;
+
+	is = apk_istream_from_file(AT_FDCWD, file);
+	if (IS_ERR(is)) return PTR_ERR(is);
+	r = apk_delta_read_header(is, &hdr);
+	apk_istream_close(is);
+	if (r < 0) return r;
+
+	d = realloc(ctx->deltas, (ctx->num_deltas + 1) * sizeof *d);
+	if (!d) return -ENOMEM;
+	ctx->deltas = d;
+	d = &d[ctx->num_deltas++];
+	memcpy(d->target_id, hdr.target_id, sizeof d->target_id);
+	memcpy(d->base_id, hdr.base_id, sizeof d->base_id);
+	return 0;
+}
+
+// Returns the first delta for the package identity 'id', which may be
+// a truncated sha256 identity
+static struct mkndx_delta *mkndx_find_delta(struct mkndx_ctx *ctx, apk_blob_t id)
+{
+	unsigned int l = 0, h = ctx->num_deltas;
+
+	if (id.len > APK_DIGEST_LENGTH_SHA256) return NULL;
+	while (l < h) {
+		unsigned int m = l + (h - l) / 2;
+		if (memcmp(ctx->deltas[m].target_id, id.ptr, id.len) < 0) l = m + 1;
+		else h = m;
+	}
+	if (l >= ctx->num_deltas || memcmp(ctx->deltas[l].target_id, id.ptr, id.len) != 0) return NULL;
+	return &ctx->deltas[l];
+}
+
+static void mkndx_add_deltas(struct mkndx_ctx *ctx, struct adb_obj *pkginfo, apk_blob_t id)
+{
+	struct mkndx_delta *d = mkndx_find_delta(ctx, id), *end = &ctx->deltas[ctx->num_deltas];
+	struct adb_obj deltas;
+
+	if (!d) return;
+	adb_wo_alloca(&deltas, &schema_hexblob_array, pkginfo->db);
+	for (; d < end && memcmp(d->target_id, id.ptr, id.len) == 0; d++)
+		adb_wa_append(&deltas, adb_w_blob(pkginfo->db, APK_BLOB_PTR_LEN((char *) d->base_id, id.len)));
+	adb_wo_arr(pkginfo, ADBI_PI_DELTAS, &deltas);
+	adb_wo_free(&deltas);
+}
+
+#define MKNDX_PKG_BUCKETS 64
+
+static void mkndx_pkg_free(struct mkndx_pkg *pkg)
+{
+	void *buckets = pkg->db.bucket;
+	adb_free(&pkg->db);
+	free(buckets);
+}
+
+// Runs in a worker thread: the package is parsed into its own adb, and
+// the old index is only read here. Results are merged in mkndx_pkg_done.
+static void mkndx_pkg_work(void *pctx, unsigned int i)
+{
+	struct mkndx_ctx *ctx = pctx;
+	struct mkndx_pkg *pkg = &ctx->pkg[i];
+	const char *arg = ctx->args->item[i];
+	struct adb_obj pkginfo;
+	struct apk_digest digest;
+	struct apk_file_info fi;
+	int64_t file_size = 0;
+	bool use_previous = true;
+	char buf[NAME_MAX];
+	void *buckets;
+	int r;
+
+	if (!ctx->filter_spec_set) {
+		r = apk_fileinfo_get(AT_FDCWD, arg, 0, &fi, 0);
+		if (r < 0) goto err;
+		file_size = fi.size;
+		use_previous = ctx->index_mtime >= fi.mtime;
+	}
+
+	if (use_previous && ctx->index &&
+	    (r = find_package(&ctx->opkgs, APK_BLOB_STR(arg), file_size, ctx->lookup_spec)) > 0) {
+		// With delta files given, packages with deltas are reindexed
+		// so the deltas listed match the given files
+		adb_ro_obj(&ctx->opkgs, r, &pkginfo);
+		if (!ctx->num_deltas || (adb_ro_val(&pkginfo, ADBI_PI_DELTAS) == ADB_NULL &&
+		    !mkndx_find_delta(ctx, adb_ro_blob(&pkginfo, ADBI_PI_HASHES)))) {
+			pkg->old_ndx = r;
+			return;
+		}
+	}
+	if (ctx->filter_spec_set) return;
+
+	buckets = malloc(sizeof(struct list_head[MKNDX_PKG_BUCKETS]));
+	if (!buckets) {
+		r = -ENOMEM;
+		goto err;
+	}
+	adb_w_init_dynamic(&pkg->db, ADB_SCHEMA_INDEX, buckets, MKNDX_PKG_BUCKETS);
+	adb_wo_alloca(&pkginfo, &schema_pkginfo, &pkg->db);
+	pkg->pkginfo = &pkginfo;
+
+	apk_digest_reset(&digest);
+	apk_extract_init(&pkg->ectx, ctx->ac, &extract_ndxinfo_ops);
+	apk_extract_generate_identity(&pkg->ectx, ctx->hash_alg, &digest);
+	r = apk_extract(&pkg->ectx, apk_istream_from_file(AT_FDCWD, arg));
+	if (r < 0 && r != -ECANCELED) goto err_free;
+
+	adb_wo_int(&pkginfo, ADBI_PI_FILE_SIZE, file_size);
+	adb_wo_blob(&pkginfo, ADBI_PI_HASHES, APK_DIGEST_BLOB(digest));
+	mkndx_add_deltas(ctx, &pkginfo, APK_DIGEST_BLOB(digest));
+
+	if (ctx->pkgname_spec_set &&
+	    (apk_blob_subst(buf, sizeof buf, ctx->pkgname_spec, adb_s_field_subst, &pkginfo) < 0 ||
+	     strcmp(apk_last_path_segment(buf), apk_last_path_segment(arg)) != 0))
+		pkg->name_mismatch = 1;
+
+	pkg->val = adb_w_obj(&pkginfo);
+	pkg->new_pkg = 1;
+	pkg->pkginfo = NULL;
+	adb_wo_free(&pkginfo);
+	return;
+
+err_free:
+	pkg->pkginfo = NULL;
+	adb_wo_free(&pkginfo);
+	mkndx_pkg_free(pkg);
+err:
+	pkg->r = r;
+}
+
+// Runs in the main thread in command line order
+static int mkndx_pkg_done(void *pctx, unsigned int i)
+{
+	struct mkndx_ctx *ctx = pctx;
+	struct mkndx_pkg *pkg = &ctx->pkg[i];
+	struct apk_out *out = &ctx->ac->out;
+	const char *arg = ctx->args->item[i];
+	adb_val_t val = ADB_VAL_NULL;
+	int r = pkg->r;
+
+	if (r < 0) goto err;
+	if (pkg->old_ndx > 0) {
+		apk_dbg(out, "%s: indexed from old index", arg);
+		val = adb_wa_append(&ctx->pkgs, adb_w_copy(&ctx->db, &ctx->odb, adb_ro_val(&ctx->opkgs, pkg->old_ndx)));
+	} else if (pkg->new_pkg) {
+		if (pkg->name_mismatch)
+			apk_warn(out, "%s: not matching package name specification '" BLOB_FMT "'",
+				arg, BLOB_PRINTF(ctx->pkgname_spec));
+		apk_dbg(out, "%s: indexed new package", arg);
+		if (!ADB_IS_ERROR(pkg->val)) val = adb_w_copy(&ctx->db, &pkg->db, pkg->val);
+		else val = pkg->val;
+		if (!ADB_IS_ERROR(val)) val = adb_wa_append(&ctx->pkgs, val);
+		mkndx_pkg_free(pkg);
+		ctx->newpkgs++;
+	}
+	if (val == ADB_VAL_NULL || !ADB_IS_ERROR(val)) return 0;
+	r = ADB_VAL_VALUE(val);
+err:
+	apk_err(out, "%s: %s", arg, apk_error_str(r));
+	ctx->errors++;
+	return 0;
+}
+
+static const struct apk_parallel_ops mkndx_parallel_ops = {
+	.work = mkndx_pkg_work,
+	.done = mkndx_pkg_done,
+};
+
 static int mkndx_main(void *pctx, struct apk_ctx *ac, struct apk_string_array *args)
 {
 	struct mkndx_ctx *ctx = pctx;
 	struct apk_out *out = &ac->out;
 	struct apk_trust *trust = apk_ctx_get_trust(ac);
-	struct adb odb;
-	struct adb_obj oroot, opkgs, ndx;
-	struct apk_digest digest;
+	struct apk_id_cache *idc = apk_ctx_get_id_cache(ac);
+	struct apk_string_array *pkg_args;
+	struct adb_obj oroot, ndx;
 	struct apk_file_info fi;
-	apk_blob_t lookup_spec = ctx->pkgname_spec;
-	int r = -1, errors = 0, newpkgs = 0, numpkgs;
-	char buf[NAME_MAX];
-	time_t index_mtime = 0;
+	int r = -1, numpkgs, jobs;
 
-	apk_extract_init(&ctx->ectx, ac, &extract_ndxinfo_ops);
+	// Delta files are given among the packages
+	apk_string_array_init(&pkg_args);
+	apk_array_foreach_item(arg, args) {
+		if (!apk_blob_ends_with(APK_BLOB_STR(arg), APK_BLOB_STRLIT(".delta"))) {
+			apk_string_array_add(&pkg_args, arg);
+			continue;
+		}
+		r = mkndx_read_delta(ctx, arg);
+		if (r < 0) {
+			apk_err(out, "%s: %s", arg, apk_error_str(r));
+			ctx->errors++;
+		}
+	}
+	if (ctx->num_deltas) qsort(ctx->deltas, ctx->num_deltas, sizeof *ctx->deltas, mkndx_delta_cmp);
+	r = -1;
+
+	ctx->ac = ac;
+	ctx->args = args = pkg_args;
+	ctx->lookup_spec = ctx->pkgname_spec;
 
-	adb_init(&odb);
+	adb_init(&ctx->odb);
 	adb_w_init_alloca(&ctx->db, ADB_SCHEMA_INDEX, 8000);
 	adb_wo_alloca(&ndx, &schema_index, &ctx->db);
 	adb_wo_alloca(&ctx->pkgs, &schema_pkginfo_array, &ctx->db);
-	adb_wo_alloca(&ctx->pkginfo, &schema_pkginfo, &ctx->db);
 
 	if (!ctx->output) {
 		apk_err(out, "Please specify --output FILE");
@@ -280,71 +499,38 @@ static int mkndx_main(void *pctx, struct apk_ctx *ac, struct apk_string_array *a
 			apk_err(out, "--filter-spec requires --index");
 			goto done;
 		}
-		lookup_spec = ctx->filter_spec;
+		ctx->lookup_spec = ctx->filter_spec;
 	}
 	if (ctx->index) {
 		apk_fileinfo_get(AT_FDCWD, ctx->index, 0, &fi, 0);
-		index_mtime = fi.mtime;
+		ctx->index_mtime = fi.mtime;
 
-		r = adb_m_open(&odb,
+		r = adb_m_open(&ctx->odb,
 			adb_decompress(apk_istream_from_file_mmap(AT_FDCWD, ctx->index), NULL),
 			ADB_SCHEMA_INDEX, trust);
 		if (r) {
 			apk_err(out, "%s: %s", ctx->index, apk_error_str(r));
 			goto done;
 		}
-		adb_ro_obj(adb_r_rootobj(&odb, &oroot, &schema_index), ADBI_NDX_PACKAGES, &opkgs);
+		adb_ro_obj(adb_r_rootobj(&ctx->odb, &oroot, &schema_index), ADBI_NDX_PACKAGES, &ctx->opkgs);
 	}
 
-	apk_array_foreach_item(arg, args) {
-		adb_val_t val = ADB_VAL_NULL;
-		int64_t file_size = 0;
-		bool use_previous = true;
-
-		if (!ctx->filter_spec_set) {
-			r = apk_fileinfo_get(AT_FDCWD, arg, 0, &fi, 0);
-			if (r < 0) goto err_pkg;
-			file_size = fi.size;
-			use_previous = index_mtime >= fi.mtime;
-		}
+	// Load the lazily initialized lookup tables before starting workers
+	apk_id_cache_resolve_uid(idc, APK_BLOB_STRLIT("root"), 0);
+	apk_id_cache_resolve_gid(idc, APK_BLOB_STRLIT("root"), 0);
 
-		if (use_previous && (r = find_package(&opkgs, APK_BLOB_STR(arg), file_size, lookup_spec)) > 0) {
-			apk_dbg(out, "%s: indexed from old index", arg);
-			val = adb_wa_append(&ctx->pkgs, adb_w_copy(&ctx->db, &odb, adb_ro_val(&opkgs, r)));
-		}
-		if (val == ADB_VAL_NULL && !ctx->filter_spec_set) {
-			apk_digest_reset(&digest);
-			apk_extract_reset(&ctx->ectx);
-			apk_extract_generate_identity(&ctx->ectx, ctx->hash_alg, &digest);
-			r = apk_extract(&ctx->ectx, apk_istream_from_file(AT_FDCWD, arg));
-			if (r < 0 && r != -ECANCELED) {
-				adb_wo_reset(&ctx->pkginfo);
-				goto err_pkg;
-			}
-
-			adb_wo_int(&ctx->pkginfo, ADBI_PI_FILE_SIZE, file_size);
-			adb_wo_blob(&ctx->pkginfo, ADBI_PI_HASHES, APK_DIGEST_BLOB(digest));
-
-			if (ctx->pkgname_spec_set &&
-			    (apk_blob_subst(buf, sizeof buf, ctx->pkgname_spec, adb_s_field_subst, &ctx->pkginfo) < 0 ||
-			     strcmp(apk_last_path_segment(buf), apk_last_path_segment(arg)) != 0))
-				apk_warn(out, "%s: not matching package name specification '" BLOB_FMT "'",
-					arg, BLOB_PRINTF(ctx->pkgname_spec));
-
-			apk_dbg(out, "%s: indexed new package", arg);
-			val = adb_wa_append_obj(&ctx->pkgs, &ctx->pkginfo);
-			newpkgs++;
-		}
-		if (val == ADB_VAL_NULL) continue;
-		if (ADB_IS_ERROR(val)) {
-			r = ADB_VAL_VALUE(val);
-		err_pkg:
-			apk_err(out, "%s: %s", arg, apk_error_str(r));
-			errors++;
-		}
+	ctx->pkg = calloc(apk_array_len(args), sizeof *ctx->pkg);
+	if (!ctx->pkg) {
+		r = -ENOMEM;
+		goto done;
 	}
-	if (errors) {
-		apk_err(out, "%d errors, not creating index", errors);
+	jobs = apk_parallel_jobs(ctx->jobs);
+	apk_parallel_run(jobs, apk_array_len(args), 8 * jobs, &mkndx_parallel_ops, ctx);
+	free(ctx->pkg);
+	ctx->pkg = NULL;
+
+	if (ctx->errors) {
+		apk_err(out, "%d errors, not creating index", ctx->errors);
 		r = -1;
 		goto done;
 	}
@@ -360,14 +546,16 @@ static int mkndx_main(void *pctx, struct apk_ctx *ac, struct apk_string_array *a
 		&ctx->db, trust);
 
 	if (r == 0)
-		apk_msg(out, "Index has %d packages (of which %d are new)", numpkgs, newpkgs);
+		apk_msg(out, "Index has %d packages (of which %d are new)", numpkgs, ctx->newpkgs);
 	else
 		apk_err(out, "Index creation failed: %s", apk_error_str(r));
 
 done:
 	adb_wo_free(&ctx->pkgs);
 	adb_free(&ctx->db);
-	adb_free(&odb);
+	adb_free(&ctx->odb);
+	apk_string_array_free(&pkg_args);
+	free(ctx->deltas);
 
 #if 0
 	apk_hash_foreach(&db->available.names, warn_if_no_providers, &counts);
@@ -10,6 +10,7 @@
 
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/stat.h>
@@ -24,6 +25,7 @@
 #include "apk_balloc.h"
 #include "apk_print.h"
 #include "apk_xattr.h"
+#include "apk_parallel.h"
 
 struct mkpkg_hardlink_key {
 	dev_t device;
@@ -49,6 +51,28 @@ static const struct apk_hash_ops mkpkg_hardlink_hash_ops = {
 	.compare = apk_blob_compare,
 };
 
+struct mkpkg_digest {
+	apk_hash_node hash_node;
+	struct mkpkg_hardlink_key key;
+	const char *path;
+	struct apk_digest digest;
+	int r;
+};
+APK_ARRAY(mkpkg_digest_array, struct mkpkg_digest *);
+
+static apk_blob_t mkpkg_digest_get_key(apk_hash_item item)
+{
+	struct mkpkg_digest *md = item;
+	return APK_BLOB_STRUCT(md->key);
+}
+
+static const struct apk_hash_ops mkpkg_digest_hash_ops = {
+	.node_offset = offsetof(struct mkpkg_digest, hash_node),
+	.get_key = mkpkg_digest_get_key,
+	.hash_key = apk_blob_hash,
+	.compare = apk_blob_compare,
+};
+
 struct mkpkg_ctx {
 	struct apk_ctx *ac;
 	const char *files_dir, *output;
@@ -63,8 +87,11 @@ struct mkpkg_ctx {
 	uint64_t installed_size;
 	struct apk_pathbuilder pb;
 	struct apk_hash link_by_inode;
+	struct apk_hash digest_by_inode;
+	struct mkpkg_digest_array *digests;
 	struct apk_balloc ba;
-	int num_dirents;
+	int num_dirents, files_fd;
+	unsigned int jobs;
 	const char *compat;
 	unsigned has_scripts : 1;
 	unsigned output_stdout : 1;
@@ -77,6 +104,7 @@ struct mkpkg_ctx {
 	OPT(OPT_MKPKG_compat,		APK_OPT_ARG "compat") \
 	OPT(OPT_MKPKG_files,		APK_OPT_ARG APK_OPT_SH("F") "files") \
 	OPT(OPT_MKPKG_info,		APK_OPT_ARG APK_OPT_SH("I") "info") \
+	OPT(OPT_MKPKG_jobs,		APK_OPT_ARG APK_OPT_SH("j") "jobs") \
 	OPT(OPT_MKPKG_output,		APK_OPT_ARG APK_OPT_SH("o") "output") \
 	OPT(OPT_MKPKG_rootnode,		APK_OPT_BOOL "rootnode") \
 	OPT(OPT_MKPKG_script,		APK_OPT_ARG APK_OPT_SH("s") "script") \
@@ -133,6 +161,8 @@ static int mkpkg_parse_option(void *ctx, struct apk_ctx *ac, int optch, const ch
 	case APK_OPTIONS_INIT:
 		apk_balloc_init(&ictx->ba, PATH_MAX * 256);
 		apk_hash_init(&ictx->link_by_inode, &mkpkg_hardlink_hash_ops, 256);
+		apk_hash_init(&ictx->digest_by_inode, &mkpkg_digest_hash_ops, 1024);
+		mkpkg_digest_array_init(&ictx->digests);
 		apk_string_array_init(&ictx->triggers);
 		ictx->compat = "3.0.0_pre1";
 		ictx->xattrs = 1;
@@ -145,6 +175,9 @@ static int mkpkg_parse_option(void *ctx, struct apk_ctx *ac, int optch, const ch
 		break;
 	case OPT_MKPKG_info:
 		return parse_info(ictx, out, optarg);
+	case OPT_MKPKG_jobs:
+		if (apk_opt_parse_uint(optarg, 1, 1024, &ictx->jobs) < 0) return -EINVAL;
+		break;
 	case OPT_MKPKG_output:
 		ictx->output = optarg;
 		break;
@@ -214,6 +247,43 @@ done:
 	return val;
 }
 
+static void mkpkg_queue_digest(struct mkpkg_ctx *ctx, const char *entry, struct apk_file_info *fi)
+{
+	struct mkpkg_hardlink_key key = {
+		.device = fi->data_device,
+		.inode = fi->data_inode,
+	};
+	struct mkpkg_digest *md;
+
+	if (apk_hash_get(&ctx->digest_by_inode, APK_BLOB_STRUCT(key))) return;
+
+	int n = apk_pathbuilder_push(&ctx->pb, entry);
+	md = apk_balloc_new(&ctx->ba, struct mkpkg_digest);
+	*md = (struct mkpkg_digest) {
+		.key = key,
+		.path = apk_balloc_cstr(&ctx->ba, apk_pathbuilder_get(&ctx->pb)),
+	};
+	apk_pathbuilder_pop(&ctx->pb, n);
+	apk_hash_insert(&ctx->digest_by_inode, md);
+	mkpkg_digest_array_add(&ctx->digests, md);
+}
+
+static void mkpkg_digest_work(void *pctx, unsigned int i)
+{
+	struct mkpkg_ctx *ctx = pctx;
+	struct mkpkg_digest *md = ctx->digests->item[i];
+	struct apk_file_info fi;
+
+	md->r = apk_fileinfo_get(ctx->files_fd, md->path, APK_FI_NOFOLLOW | APK_FI_DIGEST(APK_DIGEST_SHA256), &fi, NULL);
+	if (md->r) return;
+	if (fi.data_device != md->key.device || fi.data_inode != md->key.inode) md->r = -ESTALE;
+	else md->digest = fi.digest;
+}
+
+static const struct apk_parallel_ops mkpkg_digest_ops = {
+	.work = mkpkg_digest_work,
+};
+
 static int mkpkg_scan_dirent(void *pctx, int dirfd, const char *path, const char *entry)
 {
 	struct mkpkg_ctx *ctx = pctx;
@@ -222,6 +292,7 @@ static int mkpkg_scan_dirent(void *pctx, int dirfd, const char *path, const char
 
 	r = apk_fileinfo_get(dirfd, entry, APK_FI_NOFOLLOW, &fi, NULL);
 	if (r) return r;
+	if (S_ISREG(fi.mode) && ctx->jobs > 1) mkpkg_queue_digest(ctx, entry, &fi);
 	if (!S_ISDIR(fi.mode)) return 0;
 
 	int n = apk_pathbuilder_push(&ctx->pb, entry);
@@ -255,6 +326,7 @@ static int mkpkg_process_dirent(void *pctx, int dirfd, const char *path, const c
 	struct apk_file_info fi;
 	struct adb_obj fio, acl;
 	struct mkpkg_hardlink *link = NULL;
+	struct mkpkg_digest *md;
 	struct mkpkg_hardlink_key key;
 	apk_blob_t name = APK_BLOB_STR(entry), target = APK_BLOB_NULL;
 	union {
@@ -271,7 +343,7 @@ static int mkpkg_process_dirent(void *pctx, int dirfd, const char *path, const c
 	int r, n;
 
 	ctx->num_dirents++;
-	r = apk_fileinfo_get(dirfd, entry, APK_FI_NOFOLLOW | APK_FI_DIGEST(APK_DIGEST_SHA256), &fi, NULL);
+	r = apk_fileinfo_get(dirfd, entry, APK_FI_NOFOLLOW, &fi, NULL);
 	if (r) return r;
 
 	switch (fi.mode & S_IFMT) {
@@ -280,6 +352,14 @@ static int mkpkg_process_dirent(void *pctx, int dirfd, const char *path, const c
 			.device = fi.data_device,
 			.inode = fi.data_inode,
 		};
+		// Use the digest calculated ahead by the workers if available
+		md = apk_hash_get(&ctx->digest_by_inode, APK_BLOB_STRUCT(key));
+		if (md && md->r == 0) {
+			fi.digest = md->digest;
+		} else {
+			r = apk_fileinfo_get(dirfd, entry, APK_FI_NOFOLLOW | APK_FI_DIGEST(APK_DIGEST_SHA256), &fi, NULL);
+			if (r) return r;
+		}
 		if (fi.num_links > 1) {
 			link = apk_hash_get(&ctx->link_by_inode, APK_BLOB_STRUCT(key));
 			if (link) break;
@@ -447,6 +527,7 @@ static int mkpkg_main(void *pctx, struct apk_ctx *ac, struct apk_string_array *a
 	apk_blob_t uid = APK_BLOB_PTR_LEN((char*)d.data, uid_len);
 
 	ctx->ac = ac;
+	ctx->jobs = apk_parallel_jobs(ctx->jobs);
 	mkpkg_setup_compat(ctx);
 	apk_string_array_init(&ctx->pathnames);
 	adb_w_init_alloca(&ctx->db, ADB_SCHEMA_PACKAGE, 40);
@@ -483,6 +564,10 @@ static int mkpkg_main(void *pctx, struct apk_ctx *ac, struct apk_string_array *a
 		if (r) goto err;
 		apk_array_qsort(ctx->pathnames, apk_string_array_qsort);
 
+		// hash the file contents in parallel ahead of building the adb
+		ctx->files_fd = dirfd;
+		apk_parallel_run(ctx->jobs, apk_array_len(ctx->digests), apk_array_len(ctx->digests), &mkpkg_digest_ops, ctx);
+
 		r = mkpkg_process_directory(ctx, dirfd, NULL);
 		if (r) goto err;
 		apk_array_foreach_item(dir, ctx->pathnames) {
@@ -583,6 +668,8 @@ err:
 	if (r) apk_err(out, "failed to create package: %s", apk_error_str(r));
 	apk_string_array_free(&ctx->triggers);
 	apk_hash_free(&ctx->link_by_inode);
+	apk_hash_free(&ctx->digest_by_inode);
+	mkpkg_digest_array_free(&ctx->digests);
 	apk_string_array_free(&ctx->pathnames);
 	apk_balloc_destroy(&ctx->ba);
 	if (dirfd >= 0) close(dirfd);
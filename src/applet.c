@@ -6,6 +6,8 @@
  * SPDX-License-Identifier: GPL-2.0-only
  */
 
+#include <errno.h>
+#include <stdlib.h>
 #include <zlib.h>
 #include "apk_applet.h"
 #include "apk_print.h"
@@ -32,6 +34,19 @@ struct apk_applet *apk_applet_find(const char *name)
 	return NULL;
 }
 
+// Parses a decimal number in the range [min, max]
+int apk_opt_parse_uint(const char *str, unsigned int min, unsigned int max, unsigned int *val)
+{
+	unsigned long v;
+	char *end;
+
+	errno = 0;
+	v = strtoul(str, &end, 10);
+	if (end == str || *end || errno || str[0] == '-' || v < min || v > max) return -EINVAL;
+	*val = v;
+	return 0;
+}
+
 #ifndef NO_HELP
 static inline int is_group(struct apk_applet *applet, const char *topic)
 {
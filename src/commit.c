@@ -7,12 +7,15 @@
  * SPDX-License-Identifier: GPL-2.0-only
  */
 
+#include <stdarg.h>
+#include <stdio.h>
 #include <unistd.h>
 #include "apk_defines.h"
 #include "apk_database.h"
 #include "apk_package.h"
 #include "apk_solver.h"
 #include "apk_print.h"
+#include "apk_serialize.h"
 
 #ifdef __linux__
 static bool running_on_host(void)
@@ -50,7 +53,7 @@ struct progress {
 
 static inline bool pkg_available(struct apk_database *db, struct apk_package *pkg)
 {
-	return (pkg->cached || pkg->filename_ndx || apk_db_pkg_available(db, pkg)) ? true : false;
+	return (pkg->cached || pkg->cached_shared || pkg->filename_ndx || apk_db_pkg_available(db, pkg)) ? true : false;
 }
 
 static bool print_change(struct apk_database *db, struct apk_change *change, struct progress *prog)
@@ -238,27 +241,207 @@ static int cmp_upgrade(struct apk_change *change)
 	return 0;
 }
 
+enum {
+	TRIGGER_PENDING = 0,
+	TRIGGER_RUNNING,
+	TRIGGER_DONE,
+};
+
+struct trigger_job {
+	struct apk_ipkg_script_run sr;
+	struct apk_out out;
+	char *buf, *logbuf;
+	size_t len, loglen;
+	int state;
+};
+
+struct trigger_sched {
+	struct apk_database *db;
+	struct apk_package_array *pkgs;
+	struct trigger_job *jobs;
+	uint8_t *after;		// [j*num + i] set if trigger j runs after trigger i
+	unsigned int num;
+};
+
+static void trigger_sched_visit(struct trigger_sched *ts, unsigned int j, struct apk_package *pkg, unsigned int genid)
+{
+	if (pkg->foreach_genid == genid) return;
+	pkg->foreach_genid = genid;
+
+	for (unsigned int i = 0; i < j; i++)
+		if (ts->pkgs->item[i] == pkg) ts->after[j * ts->num + i] = 1;
+
+	apk_array_foreach(dep, pkg->depends) {
+		if (apk_dep_conflict(dep)) continue;
+		apk_array_foreach(p, dep->name->providers) {
+			if (!p->pkg->ipkg || !apk_dep_is_provided(pkg, dep, p)) continue;
+			trigger_sched_visit(ts, j, p->pkg, genid);
+		}
+	}
+}
+
+static bool trigger_sched_ready(struct trigger_sched *ts, unsigned int j)
+{
+	for (unsigned int i = 0; i < j; i++)
+		if (ts->after[j * ts->num + i] && ts->jobs[i].state != TRIGGER_DONE) return false;
+	return true;
+}
+
+// Returns the lowest slot not used by the running triggers, used to
+// show concurrent triggers on separate tracks in the trace
+static unsigned int trigger_sched_slot(struct trigger_sched *ts, unsigned int *running_ndx, unsigned int nrunning)
+{
+	unsigned int slot, i;
+
+	for (slot = 0; ; slot++) {
+		for (i = 0; i < nrunning; i++)
+			if (ts->jobs[running_ndx[i]].sr.trace_tid == slot + 1) break;
+		if (i == nrunning) return slot;
+	}
+}
+
+static void trigger_output_begin(struct trigger_job *job, struct apk_out *out)
+{
+	job->out = (struct apk_out) {
+		.verbosity = out->verbosity,
+		.width = out->width,
+		.progress = APK_NO,
+	};
+	job->out.out = job->out.err = open_memstream(&job->buf, &job->len);
+	if (!job->out.out) {
+		job->out.out = out->out;
+		job->out.err = out->err;
+	}
+	if (out->log) {
+		job->out.log = open_memstream(&job->logbuf, &job->loglen);
+		if (!job->out.log) job->out.log = out->log;
+	}
+}
+
+static void trigger_output_end(struct trigger_job *job, struct apk_out *out)
+{
+	if (job->out.out != out->out) {
+		fclose(job->out.out);
+		if (out->need_flush) apk_out_progress_note(out, NULL);
+		fwrite(job->buf, 1, job->len, out->out);
+		fflush(out->out);
+		free(job->buf);
+	}
+	if (job->out.log && job->out.log != out->log) {
+		fclose(job->out.log);
+		fwrite(job->logbuf, 1, job->loglen, out->log);
+		fflush(out->log);
+		free(job->logbuf);
+	}
+}
+
+// Runs up to 'jobs' triggers concurrently. A trigger is started only after
+// the triggers of the packages it depends on have completed. The output of
+// each trigger is buffered and printed when it completes.
+static int run_triggers_parallel(struct apk_database *db, struct apk_package_array *pkgs, unsigned int jobs)
+{
+	struct apk_out *out = &db->ctx->out;
+	struct trigger_sched ts = {
+		.db = db,
+		.pkgs = pkgs,
+		.num = apk_array_len(pkgs),
+	};
+	struct apk_process **running;
+	unsigned int *running_ndx, nrunning = 0, ndone = 0, i, j;
+	bool progress;
+	int errors = 0, r;
+
+	ts.jobs = calloc(ts.num, sizeof *ts.jobs);
+	ts.after = calloc(ts.num, ts.num);
+	running = calloc(jobs, sizeof *running);
+	running_ndx = calloc(jobs, sizeof *running_ndx);
+	if (!ts.jobs || !ts.after || !running || !running_ndx) {
+		errors = -ENOMEM;
+		goto done;
+	}
+
+	for (j = 1; j < ts.num; j++)
+		trigger_sched_visit(&ts, j, pkgs->item[j], apk_foreach_genid());
+
+	while (ndone < ts.num) {
+		// A trigger completing at start may make earlier triggers ready
+		do {
+			progress = false;
+			for (j = 0; j < ts.num && nrunning < jobs; j++) {
+				struct trigger_job *job = &ts.jobs[j];
+				struct apk_installed_package *ipkg = pkgs->item[j]->ipkg;
+
+				if (job->state != TRIGGER_PENDING || !trigger_sched_ready(&ts, j)) continue;
+
+				trigger_output_begin(job, out);
+				r = apk_ipkg_script_start(&job->sr, ipkg, db, APK_SCRIPT_TRIGGER, ipkg->pending_triggers->item, &job->out);
+				if (r > 0) {
+					job->state = TRIGGER_RUNNING;
+					job->sr.trace_tid = trigger_sched_slot(&ts, running_ndx, nrunning) + 1;
+					running[nrunning] = &job->sr.proc;
+					running_ndx[nrunning++] = j;
+					continue;
+				}
+				trigger_output_end(job, out);
+				job->state = TRIGGER_DONE;
+				errors += r < 0;
+				ndone++;
+				progress = true;
+			}
+		} while (progress);
+		if (nrunning == 0) break;
+
+		r = apk_process_wait_any(running, nrunning);
+		i = r >= 0 ? r : 0;
+		j = running_ndx[i];
+		r = apk_process_run(&ts.jobs[j].sr.proc);
+		trigger_output_end(&ts.jobs[j], out);
+		errors += apk_ipkg_script_finish(&ts.jobs[j].sr, db, r);
+		ts.jobs[j].state = TRIGGER_DONE;
+		ndone++;
+
+		running[i] = running[--nrunning];
+		running_ndx[i] = running_ndx[nrunning];
+	}
+done:
+	free(running_ndx);
+	free(running);
+	free(ts.after);
+	free(ts.jobs);
+	return errors;
+}
+
 static int run_triggers(struct apk_database *db, struct apk_changeset *changeset)
 {
-	struct apk_installed_package *ipkg;
-	int errors = 0;
+	struct apk_package_array *pkgs;
+	int errors = -1;
 
 	if (apk_db_fire_triggers(db) == 0)
 		return 0;
 
+	apk_package_array_init(&pkgs);
 	apk_array_foreach(change, changeset->changes) {
 		struct apk_package *pkg = change->new_pkg;
 		if (pkg == NULL)
 			continue;
-		ipkg = pkg->ipkg;
-		if (ipkg == NULL || apk_array_len(ipkg->pending_triggers) == 0)
+		if (pkg->ipkg == NULL || apk_array_len(pkg->ipkg->pending_triggers) == 0)
 			continue;
 
-		apk_string_array_add(&ipkg->pending_triggers, NULL);
-		errors += apk_ipkg_run_script(ipkg, db, APK_SCRIPT_TRIGGER,
-					      ipkg->pending_triggers->item) != 0;
-		apk_string_array_free(&ipkg->pending_triggers);
+		apk_string_array_add(&pkg->ipkg->pending_triggers, NULL);
+		apk_package_array_add(&pkgs, pkg);
+	}
+
+	if (db->ctx->trigger_jobs > 1 && apk_array_len(pkgs) > 1)
+		errors = run_triggers_parallel(db, pkgs, db->ctx->trigger_jobs);
+	if (errors < 0) {
+		errors = 0;
+		apk_array_foreach_item(pkg, pkgs)
+			errors += apk_ipkg_run_script(pkg->ipkg, db, APK_SCRIPT_TRIGGER,
+						      pkg->ipkg->pending_triggers->item) != 0;
 	}
+	apk_array_foreach_item(pkg, pkgs)
+		apk_string_array_free(&pkg->ipkg->pending_triggers);
+	apk_package_array_free(&pkgs);
 	return errors;
 }
 
@@ -306,11 +489,16 @@ static int run_commit_hook(void *ctx, int dirfd, const char *path, const char *f
 static int run_commit_hooks(struct apk_database *db, int type)
 {
 	struct apk_commit_hook hook = { .db = db, .type = type };
-	return apk_dir_foreach_config_file(db->root_fd,
+	uint64_t trace_start = apk_trace_begin(&db->ctx->trace);
+	int r;
+
+	r = apk_dir_foreach_config_file(db->root_fd,
 		run_commit_hook, &hook, apk_filename_is_hidden,
 		"etc/apk/commit_hooks.d",
 		"lib/apk/commit_hooks.d",
 		NULL);
+	apk_trace_end(&db->ctx->trace, trace_start, "script", "%s hooks", type == PRE_COMMIT_HOOK ? "pre-commit" : "post-commit");
+	return r;
 }
 
 static void sync_if_needed(struct apk_database *db)
@@ -319,8 +507,10 @@ static void sync_if_needed(struct apk_database *db)
 	if (ac->flags & APK_SIMULATE) return;
 	if (ac->sync == APK_NO) return;
 	if (ac->sync == APK_AUTO && (ac->root_set || db->usermode || !running_on_host())) return;
+	uint64_t trace_start = apk_trace_begin(&ac->trace);
 	apk_out_progress_note(&ac->out, "syncing disks...");
 	sync();
+	apk_trace_end(&ac->trace, trace_start, "commit", "sync");
 }
 
 static int calc_precision(unsigned int num)
@@ -344,8 +534,9 @@ int apk_solver_precache_changeset(struct apk_database *db, struct apk_changeset
 	apk_array_foreach(change, changeset->changes) {
 		pkg = change->new_pkg;
 		if (changes_only && pkg == change->old_pkg) continue;
-		if (!pkg || pkg->cached || (pkg->repos & db->local_repos) || !pkg->installed_size) continue;
-		if (!apk_db_select_repo(db, pkg)) continue;
+		if (!pkg || pkg->cached || pkg->cached_shared || (pkg->repos & db->local_repos) || !pkg->installed_size) continue;
+		if (!(repo = apk_db_select_repo(db, pkg))) continue;
+		apk_cache_prefetch(db, repo, pkg);
 		prog.total.bytes += pkg->size;
 		prog.total.packages++;
 		prog.total.changes++;
@@ -359,7 +550,7 @@ int apk_solver_precache_changeset(struct apk_database *db, struct apk_changeset
 	apk_array_foreach(change, changeset->changes) {
 		pkg = change->new_pkg;
 		if (changes_only && pkg == change->old_pkg) continue;
-		if (!pkg || pkg->cached || (pkg->repos & db->local_repos) || !pkg->installed_size) continue;
+		if (!pkg || pkg->cached || pkg->cached_shared || (pkg->repos & db->local_repos) || !pkg->installed_size) continue;
 		if (!(repo = apk_db_select_repo(db, pkg))) continue;
 
 		apk_msg(out, "(%*i/%i) Downloading " PKG_VER_FMT,
@@ -367,8 +558,10 @@ int apk_solver_precache_changeset(struct apk_database *db, struct apk_changeset
 			prog.total.packages,
 			PKG_VER_PRINTF(pkg));
 
+		uint64_t trace_start = apk_trace_begin(&db->ctx->trace);
 		apk_progress_item_start(&prog.prog, apk_progress_weight(prog.done.bytes, prog.done.packages), pkg->size);
 		r = apk_cache_download(db, repo, pkg, &prog.prog);
+		apk_trace_end(&db->ctx->trace, trace_start, "download", PKG_VER_FMT, PKG_VER_PRINTF(pkg));
 		if (r && r != -APKE_FILE_UNCHANGED) {
 			apk_err(out, PKG_VER_FMT ": %s", PKG_VER_PRINTF(pkg), apk_error_str(r));
 			errors++;
@@ -379,6 +572,7 @@ int apk_solver_precache_changeset(struct apk_database *db, struct apk_changeset
 		prog.done.changes++;
 	}
 	apk_progress_end(&prog.prog);
+	apk_io_url_prefetch_end();
 
 	if (errors) return -errors;
 	return prog.done.packages;
@@ -392,7 +586,7 @@ int apk_solver_commit_changeset(struct apk_database *db,
 	struct progress prog = { 0 };
 	char buf[64];
 	apk_blob_t humanized;
-	uint64_t download_size = 0;
+	uint64_t download_size = 0, trace_start;
 	int64_t size_diff = 0;
 	int r, errors = 0, pkg_diff = 0;
 
@@ -486,10 +680,13 @@ int apk_solver_commit_changeset(struct apk_database *db,
 		if (print_change(db, change, &prog)) {
 			prog.pkg = change->new_pkg ?: change->old_pkg;
 			if (change->old_pkg != change->new_pkg || (change->reinstall && pkg_available(db, change->new_pkg))) {
+				uint64_t trace_start = apk_trace_begin(&db->ctx->trace);
 				apk_progress_item_start(&prog.prog, apk_progress_weight(prog.done.bytes, prog.done.packages), change_size(change));
 				if (!(db->ctx->flags & APK_SIMULATE))
 					r = apk_db_install_pkg(db, change->old_pkg, change->new_pkg, &prog.prog) != 0;
 				apk_progress_item_end(&prog.prog);
+				apk_trace_end(&db->ctx->trace, trace_start, "package", "%s " PKG_VER_FMT,
+					change->new_pkg ? "install" : "remove", PKG_VER_PRINTF(prog.pkg));
 			}
 			if (change->new_pkg && change->new_pkg->ipkg)
 				change->new_pkg->ipkg->repository_tag = change->new_repository_tag;
@@ -501,11 +698,15 @@ int apk_solver_commit_changeset(struct apk_database *db,
 	db->indent_level = 0;
 
 	errors += db->num_dir_update_errors;
+	trace_start = apk_trace_begin(&db->ctx->trace);
 	errors += run_triggers(db, changeset);
+	apk_trace_end(&db->ctx->trace, trace_start, "commit", "triggers");
 
 all_done:
 	apk_dependency_array_copy(&db->world, world);
+	trace_start = apk_trace_begin(&db->ctx->trace);
 	if (apk_db_write_config(db) != 0) errors++;
+	apk_trace_end(&db->ctx->trace, trace_start, "db", "write database");
 	run_commit_hooks(db, POST_COMMIT_HOOK);
 
 	if (!db->performing_preupgrade) {
@@ -549,30 +750,121 @@ enum {
 	STATE_MISSING		= 0x40000000,
 	STATE_VIRTUAL_ONLY	= 0x20000000,
 	STATE_INSTALLIF		= 0x10000000,
+	STATE_WALKED_PRESENT	= 0x08000000,
+	STATE_WALKED_INSTALLIF	= 0x04000000,
+	STATE_ANALYZED		= 0x02000000,
 	STATE_COUNT_MASK	= 0x0000ffff,
 };
 
+/* Limits of the --solver-errors summary */
+#define SUMMARY_MAX_ENTRIES	50
+#define SUMMARY_MAX_ITEMS	20
+
 struct print_state {
 	struct apk_database *db;
 	struct apk_dependency_array *world;
+	struct apk_serializer *ser;
 	struct apk_indent i;
+	const char *label_key;
 	const char *label;
+	const char *label_error;
 	int num_labels;
-	int match;
+	int num_items;
+	unsigned int in_entry : 1;
+	unsigned int in_list : 1;
+	unsigned int truncated : 1;
 };
 
+static void label_init(struct print_state *ps, const char *key, const char *label, const char *error)
+{
+	ps->label_key = key;
+	ps->label = label;
+	ps->label_error = error;
+}
+
+static bool label_full(struct print_state *ps)
+{
+	if (!ps->ser || ps->num_labels < SUMMARY_MAX_ENTRIES) return false;
+	ps->truncated = 1;
+	return true;
+}
+
 static void label_start(struct print_state *ps, const char *text)
 {
 	if (ps->label) {
-		apk_print_indented_line(&ps->i, "  %s:\n", ps->label);
+		if (ps->ser) {
+			apk_ser_start_object(ps->ser);
+			apk_ser_key(ps->ser, APK_BLOB_STR(ps->label_key));
+			apk_ser_string(ps->ser, APK_BLOB_STR(ps->label));
+			if (ps->label_error) {
+				apk_ser_key(ps->ser, APK_BLOB_STRLIT("error"));
+				apk_ser_string(ps->ser, APK_BLOB_STR(ps->label_error));
+			}
+			ps->in_entry = 1;
+		} else if (ps->label_error) {
+			apk_print_indented_line(&ps->i, "  %s (%s):\n", ps->label, ps->label_error);
+		} else {
+			apk_print_indented_line(&ps->i, "  %s:\n", ps->label);
+		}
 		ps->label = NULL;
 		ps->num_labels++;
 	}
-	if (!ps->i.x) apk_print_indented_group(&ps->i, 0, "    %s", text);
+	if (ps->ser) {
+		char key[32];
+		size_t n;
+
+		if (ps->in_list) return;
+		/* "masked in:" becomes key "masked-in" */
+		for (n = 0; n < sizeof key - 1 && text[n] && text[n] != ':'; n++)
+			key[n] = text[n] == ' ' ? '-' : text[n];
+		apk_ser_key(ps->ser, APK_BLOB_PTR_LEN(key, n));
+		apk_ser_start_array(ps->ser, -1);
+		ps->in_list = 1;
+		ps->num_items = 0;
+	} else if (!ps->i.x) apk_print_indented_group(&ps->i, 0, "    %s", text);
 }
 static void label_end(struct print_state *ps)
 {
-	apk_print_indented_end(&ps->i);
+	if (!ps->ser) {
+		apk_print_indented_end(&ps->i);
+	} else if (ps->in_list) {
+		apk_ser_end(ps->ser);
+		ps->in_list = 0;
+	}
+}
+static void label_finish(struct print_state *ps)
+{
+	if (!ps->in_entry) return;
+	apk_ser_end(ps->ser);
+	ps->in_entry = 0;
+}
+
+static void label_item(struct print_state *ps, apk_blob_t item)
+{
+	if (!ps->ser) {
+		apk_print_indented(&ps->i, item);
+		return;
+	}
+	if (ps->num_items++ < SUMMARY_MAX_ITEMS) apk_ser_string(ps->ser, item);
+	else ps->truncated = 1;
+}
+
+static void label_words(struct print_state *ps, const char *text)
+{
+	if (ps->ser) label_item(ps, APK_BLOB_STR(text));
+	else apk_print_indented_words(&ps->i, text);
+}
+
+static void label_fmt(struct print_state *ps, const char *fmt, ...)
+{
+	char tmp[256];
+	size_t n;
+	va_list va;
+
+	va_start(va, fmt);
+	n = vsnprintf(tmp, sizeof tmp, fmt, va);
+	va_end(va);
+	label_item(ps, APK_BLOB_PTR_LEN(tmp, min(n, sizeof tmp - 1)));
 }
 
 static void print_pinning_errors(struct print_state *ps, struct apk_package *pkg, unsigned int tag)
@@ -583,22 +875,22 @@ static void print_pinning_errors(struct print_state *ps, struct apk_package *pkg
 	if (pkg->ipkg != NULL)
 		return;
 
-	if (!apk_db_pkg_available(db, pkg) && !pkg->cached && !pkg->filename_ndx) {
+	if (!apk_db_pkg_available(db, pkg) && !pkg->cached && !pkg->cached_shared && !pkg->filename_ndx) {
 		label_start(ps, "masked in:");
-		apk_print_indented_fmt(&ps->i, "--no-network");
+		label_fmt(ps, "--no-network");
 	} else if (!(BIT(pkg->layer) & db->active_layers)) {
 		label_start(ps, "masked in:");
-		apk_print_indented_fmt(&ps->i, "layer");
+		label_fmt(ps, "layer");
 	} else if (!pkg->repos && pkg->cached) {
 		label_start(ps, "masked in:");
-		apk_print_indented_fmt(&ps->i, "cache");
+		label_fmt(ps, "cache");
 	} else {
 		if (pkg->repos & apk_db_get_pinning_mask_repos(db, APK_DEFAULT_PINNING_MASK | BIT(tag)))
 			return;
 		for (i = 0; i < db->num_repo_tags; i++) {
 			if (pkg->repos & db->repo_tags[i].allowed_repos) {
 				label_start(ps, "masked in:");
-				apk_print_indented(&ps->i, db->repo_tags[i].tag);
+				label_item(ps, db->repo_tags[i].tag);
 			}
 		}
 	}
@@ -613,7 +905,7 @@ static void print_conflicts(struct print_state *ps, struct apk_package *pkg)
 		if (p->pkg == pkg || !p->pkg->marked)
 			continue;
 		label_start(ps, "conflicts:");
-		apk_print_indented_fmt(&ps->i, PKG_VER_FMT, PKG_VER_PRINTF(p->pkg));
+		label_fmt(ps, PKG_VER_FMT, PKG_VER_PRINTF(p->pkg));
 	}
 	apk_array_foreach(d, pkg->provides) {
 		once = 1;
@@ -629,8 +921,8 @@ static void print_conflicts(struct print_state *ps, struct apk_package *pkg)
 				continue;
 			}
 			label_start(ps, "conflicts:");
-			apk_print_indented_fmt(
-				&ps->i, PKG_VER_FMT "[" DEP_FMT "]",
+			label_fmt(
+				ps, PKG_VER_FMT "[" DEP_FMT "]",
 				PKG_VER_PRINTF(p->pkg),
 				DEP_PRINTF(d));
 		}
@@ -644,9 +936,14 @@ struct matched_dep {
 };
 APK_ARRAY(matched_dep_array, struct matched_dep);
 
+struct matched_deps {
+	struct matched_dep_array *breaks, *satisfies;
+};
+
 static void match_dep(struct apk_package *pkg0, struct apk_dependency *d0, struct apk_package *pkg, void *ctx)
 {
-	struct matched_dep_array **deps = ctx;
+	struct matched_deps *m = ctx;
+	struct matched_dep_array **deps = (apk_dep_analyze(pkg0, d0, pkg) & APK_DEP_CONFLICTS) ? &m->breaks : &m->satisfies;
 	matched_dep_array_add(deps, (struct matched_dep) {
 		.pkg = pkg0,
 		.dep = d0,
@@ -675,32 +972,54 @@ static void print_mdeps(struct print_state *ps, const char *label, struct matche
 	apk_array_qsort(deps, matched_dep_sort);
 	apk_array_foreach(dep, deps) {
 		if (dep->pkg == NULL)
-			apk_print_indented_fmt(&ps->i, "world[" DEP_FMT BLOB_FMT "]", DEP_PRINTF(dep->dep),
+			label_fmt(ps, "world[" DEP_FMT BLOB_FMT "]", DEP_PRINTF(dep->dep),
 				BLOB_PRINTF(db->repo_tags[dep->dep->repository_tag].tag));
 		else
-			apk_print_indented_fmt(&ps->i, PKG_VER_FMT "[" DEP_FMT "]",
+			label_fmt(ps, PKG_VER_FMT "[" DEP_FMT "]",
 					       PKG_VER_PRINTF(dep->pkg),
 					       DEP_PRINTF(dep->dep));
 	}
 	apk_array_reset(deps);
 }
 
-static void print_deps(struct print_state *ps, struct apk_package *pkg, int match)
+static void matched_deps_init(struct matched_deps *m)
+{
+	matched_dep_array_init(&m->breaks);
+	matched_dep_array_init(&m->satisfies);
+}
+
+static void matched_deps_free(struct matched_deps *m)
+{
+	matched_dep_array_free(&m->breaks);
+	matched_dep_array_free(&m->satisfies);
+}
+
+static void print_deps(struct print_state *ps, struct apk_package *pkg)
 {
-	const char *label = (match & APK_DEP_SATISFIES) ? "satisfies:" : "breaks:";
-	struct matched_dep_array *deps;
+	struct matched_deps world, rdeps;
+	unsigned int match = APK_DEP_CONFLICTS | APK_FOREACH_MARKED | APK_FOREACH_DEP;
+
+	/* Breaking and satisfied dependencies are collected in the same walk.
+	 * The satisfied ones are shown only if the package has other problems,
+	 * and not at all in the summary. */
+	if (!ps->ser) match |= APK_DEP_SATISFIES;
 
-	matched_dep_array_init(&deps);
+	matched_deps_init(&world);
+	matched_deps_init(&rdeps);
+	apk_pkg_foreach_matching_dependency(NULL, ps->world, match|apk_foreach_genid(), pkg, match_dep, &world);
+	apk_pkg_foreach_reverse_dependency(pkg, match|apk_foreach_genid(), match_dep, &rdeps);
 
-	ps->match = match;
-	match |= APK_FOREACH_MARKED | APK_FOREACH_DEP;
-	apk_pkg_foreach_matching_dependency(NULL, ps->world, match|apk_foreach_genid(), pkg, match_dep, &deps);
-	print_mdeps(ps, label, deps);
-	apk_pkg_foreach_reverse_dependency(pkg, match|apk_foreach_genid(), match_dep, &deps);
-	print_mdeps(ps, label, deps);
+	print_mdeps(ps, "breaks:", world.breaks);
+	print_mdeps(ps, "breaks:", rdeps.breaks);
 	label_end(ps);
+	if (ps->label == NULL) {
+		print_mdeps(ps, "satisfies:", world.satisfies);
+		print_mdeps(ps, "satisfies:", rdeps.satisfies);
+		label_end(ps);
+	}
 
-	matched_dep_array_free(&deps);
+	matched_deps_free(&world);
+	matched_deps_free(&rdeps);
 }
 
 static void print_broken_deps(struct print_state *ps, struct apk_dependency_array *deps, const char *label)
@@ -708,7 +1027,7 @@ static void print_broken_deps(struct print_state *ps, struct apk_dependency_arra
 	apk_array_foreach(dep, deps) {
 		if (!dep->broken) continue;
 		label_start(ps, label);
-		apk_print_indented_fmt(&ps->i, DEP_FMT, DEP_PRINTF(dep));
+		label_fmt(ps, DEP_FMT, DEP_PRINTF(dep));
 	}
 	label_end(ps);
 }
@@ -717,15 +1036,17 @@ static void analyze_package(struct print_state *ps, struct apk_package *pkg, uns
 {
 	char pkgtext[256];
 
-	ps->label = apk_fmts(pkgtext, sizeof pkgtext, PKG_VER_FMT, PKG_VER_PRINTF(pkg));
+	if (pkg->state_int & STATE_ANALYZED) return;
+	pkg->state_int |= STATE_ANALYZED;
+	label_init(ps, "package", apk_fmts(pkgtext, sizeof pkgtext, PKG_VER_FMT, PKG_VER_PRINTF(pkg)), NULL);
 
 	if (pkg->uninstallable) {
 		label_start(ps, "error:");
-		apk_print_indented_fmt(&ps->i, "uninstallable");
+		label_fmt(ps, "uninstallable");
 		label_end(ps);
 		if (!apk_db_arch_compatible(ps->db, pkg->arch)) {
 			label_start(ps, "arch:");
-			apk_print_indented_fmt(&ps->i, BLOB_FMT, BLOB_PRINTF(*pkg->arch));
+			label_fmt(ps, BLOB_FMT, BLOB_PRINTF(*pkg->arch));
 			label_end(ps);
 		}
 		print_broken_deps(ps, pkg->depends, "depends:");
@@ -735,23 +1056,21 @@ static void analyze_package(struct print_state *ps, struct apk_package *pkg, uns
 
 	print_pinning_errors(ps, pkg, tag);
 	print_conflicts(ps, pkg);
-	print_deps(ps, pkg, APK_DEP_CONFLICTS);
-	if (ps->label == NULL)
-		print_deps(ps, pkg, APK_DEP_SATISFIES);
+	print_deps(ps, pkg);
+	label_finish(ps);
 }
 
 static void analyze_missing_name(struct print_state *ps, struct apk_name *name)
 {
 	struct apk_database *db = ps->db;
-	char label[256];
 	unsigned int genid;
 	int refs;
 
 	if (apk_array_len(name->providers) != 0) {
-		ps->label = apk_fmts(label, sizeof label, "%s (virtual)", name->name);
+		label_init(ps, "name", name->name, "virtual");
 
 		label_start(ps, "note:");
-		apk_print_indented_words(&ps->i, "please select one of the 'provided by' packages explicitly");
+		label_words(ps, "please select one of the 'provided by' packages explicitly");
 		label_end(ps);
 
 		label_start(ps, "provided by:");
@@ -762,23 +1081,23 @@ static void analyze_missing_name(struct print_state *ps, struct apk_name *name)
 			refs = (name0->state_int & STATE_COUNT_MASK);
 			if (refs == apk_array_len(name0->providers)) {
 				/* name only */
-				apk_print_indented(&ps->i, APK_BLOB_STR(name0->name));
+				label_item(ps, APK_BLOB_STR(name0->name));
 				name0->state_int &= ~STATE_COUNT_MASK;
 			} else if (refs > 0) {
 				/* individual package */
-				apk_print_indented_fmt(&ps->i, PKG_VER_FMT, PKG_VER_PRINTF(p0->pkg));
+				label_fmt(ps, PKG_VER_FMT, PKG_VER_PRINTF(p0->pkg));
 				name0->state_int--;
 			}
 		}
 		label_end(ps);
 	} else {
-		ps->label = apk_fmts(label, sizeof label, "%s (no such package)", name->name);
+		label_init(ps, "name", name->name, "no such package");
 	}
 
 	label_start(ps, "required by:");
 	apk_array_foreach(d0, ps->world) {
 		if (d0->name != name || apk_dep_conflict(d0)) continue;
-		apk_print_indented_fmt(&ps->i, "world[" DEP_FMT BLOB_FMT "]",
+		label_fmt(ps, "world[" DEP_FMT BLOB_FMT "]",
 			DEP_PRINTF(d0),
 			BLOB_PRINTF(db->repo_tags[d0->repository_tag].tag));
 	}
@@ -790,7 +1109,7 @@ static void analyze_missing_name(struct print_state *ps, struct apk_name *name)
 			p0->pkg->foreach_genid = genid;
 			apk_array_foreach(d0, p0->pkg->depends) {
 				if (d0->name != name || apk_dep_conflict(d0)) continue;
-				apk_print_indented_fmt(&ps->i,
+				label_fmt(ps,
 					PKG_VER_FMT "[" DEP_FMT "]",
 					PKG_VER_PRINTF(p0->pkg),
 					DEP_PRINTF(d0));
@@ -800,6 +1119,7 @@ static void analyze_missing_name(struct print_state *ps, struct apk_name *name)
 		next_name:;
 	}
 	label_end(ps);
+	label_finish(ps);
 }
 
 static void analyze_deps(struct print_state *ps, struct apk_dependency_array *deps)
@@ -809,6 +1129,7 @@ static void analyze_deps(struct print_state *ps, struct apk_dependency_array *de
 		if (apk_dep_conflict(d0)) continue;
 		if ((name0->state_int & (STATE_INSTALLIF | STATE_PRESENT | STATE_MISSING)) != 0)
 			continue;
+		if (label_full(ps)) return;
 		name0->state_int |= STATE_MISSING;
 		analyze_missing_name(ps, name0);
 	}
@@ -852,6 +1173,13 @@ static int is_name_concrete(struct apk_package *pkg, struct apk_name *name)
 
 static void discover_name(struct apk_name *name, int pkg_state)
 {
+	/* Walking the name again with the same state would find all of
+	 * its providers already done */
+	int walked = pkg_state == STATE_PRESENT ? STATE_WALKED_PRESENT : STATE_WALKED_INSTALLIF;
+
+	if (name->state_int & walked) return;
+	name->state_int |= walked;
+
 	apk_array_foreach(p, name->providers) {
 		int state = pkg_state;
 		if (!p->pkg->marked) continue;
@@ -890,7 +1218,8 @@ void apk_solver_print_errors(struct apk_database *db,
 			     struct apk_changeset *changeset,
 			     struct apk_dependency_array *world)
 {
-	struct apk_out *out = &db->ctx->out;
+	struct apk_ctx *ac = db->ctx;
+	struct apk_out *out = &ac->out;
 	struct print_state ps;
 
 	/* ERROR: unsatisfiable dependencies:
@@ -942,17 +1271,36 @@ void apk_solver_print_errors(struct apk_database *db,
 		.db = db,
 		.world = world,
 	};
-	apk_err(out, "unable to select packages:");
-	apk_print_indented_init(&ps.i, out, 1);
+	if (ac->solver_errors_ser) {
+		ps.ser = apk_serializer_init_alloca(ac, ac->solver_errors_ser, apk_ostream_to_fd(dup(STDERR_FILENO)));
+		if (IS_ERR(ps.ser)) ps.ser = NULL;
+	}
+	if (ps.ser) {
+		apk_ser_start_object(ps.ser);
+		apk_ser_key(ps.ser, APK_BLOB_STRLIT("problems"));
+		apk_ser_start_array(ps.ser, -1);
+	} else {
+		apk_err(out, "unable to select packages:");
+		apk_print_indented_init(&ps.i, out, 1);
+	}
 	analyze_deps(&ps, world);
 	apk_array_foreach(change, changeset->changes) {
 		struct apk_package *pkg = change->new_pkg;
 		if (!pkg) continue;
+		if (label_full(&ps)) break;
 		analyze_package(&ps, pkg, change->new_repository_tag);
 		analyze_deps(&ps, pkg->depends);
 	}
 
-	if (!ps.num_labels)
+	if (ps.ser) {
+		apk_ser_end(ps.ser);
+		if (ps.truncated) {
+			apk_ser_key(ps.ser, APK_BLOB_STRLIT("truncated"));
+			apk_ser_numeric(ps.ser, 1, 0);
+		}
+		apk_ser_end(ps.ser);
+		apk_serializer_cleanup(ps.ser);
+	} else if (!ps.num_labels)
 		apk_print_indented_line(&ps.i, "Huh? Error reporter did not find the broken constraints.\n");
 }
 
@@ -53,6 +53,7 @@ void apk_ctx_free(struct apk_ctx *ac)
 	apk_string_array_free(&ac->script_environment);
 	if (ac->root_fd >= 0) close(ac->root_fd);
 	if (ac->out.log) fclose(ac->out.log);
+	apk_trace_close(&ac->trace);
 	apk_balloc_destroy(&ac->ba);
 }
 
@@ -66,6 +67,9 @@ int apk_ctx_prepare(struct apk_ctx *ac)
 		ac->open_flags &= ~(APK_OPENF_CREATE | APK_OPENF_WRITE);
 		ac->open_flags |= APK_OPENF_READ;
 	}
+	if (ac->open_flags & APK_OPENF_OWNER_INDEX &&
+	    (ac->open_flags & (APK_OPENF_CREATE | APK_OPENF_WRITE) || ac->query.fields & BIT(APK_Q_FIELD_CONTENTS)))
+		ac->open_flags &= ~APK_OPENF_OWNER_INDEX;
 	if (ac->flags & APK_ALLOW_UNTRUSTED) ac->trust.allow_untrusted = 1;
 	if (!ac->cache_dir) ac->cache_dir = "etc/apk/cache";
 	else ac->cache_dir_set = 1;
@@ -126,6 +130,14 @@ int apk_ctx_prepare(struct apk_ctx *ac)
 		ac->out.log = fdopen(fd, "a");
 	}
 
+	if (ac->trace_file) {
+		int r = apk_trace_open(&ac->trace, ac->trace_file);
+		if (r < 0) {
+			apk_err(&ac->out, "Unable to open trace file: %s", apk_error_str(r));
+			return r;
+		}
+	}
+
 	if (ac->flags & APK_PRESERVE_ENV) {
 		for (int i = 0; environ[i]; i++)
 			if (strncmp(environ[i], "APK_", 4) != 0)
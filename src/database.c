@@ -18,6 +18,7 @@
 #include <signal.h>
 #include <fnmatch.h>
 #include <sys/file.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 
 #ifdef __linux__
@@ -25,9 +26,13 @@
 # include <mntent.h>
 # include <sys/vfs.h>
 # include <sys/wait.h>
+# include <sys/ioctl.h>
 # include <sys/mount.h>
 # include <sys/statvfs.h>
 # include <linux/magic.h>
+# ifndef FICLONE
+#  define FICLONE	_IOW(0x94, 9, int)
+# endif
 #endif
 
 #include "apk_defines.h"
@@ -35,12 +40,14 @@
 #include "apk_package.h"
 #include "apk_database.h"
 #include "apk_ctype.h"
+#include "apk_delta.h"
 #include "apk_extract.h"
 #include "apk_process.h"
 #include "apk_print.h"
 #include "apk_tar.h"
 #include "apk_adb.h"
 #include "apk_fs.h"
+#include "apk_trace.h"
 
 static const char * const apk_static_cache_dir = "var/cache/apk";
 static const char * const apk_world_file = "etc/apk/world";
@@ -597,6 +604,7 @@ struct apk_package *apk_db_pkg_add(struct apk_database *db, struct apk_package_t
 		idb->install_if = apk_array_bclone(pkg->install_if, &db->ba_deps);
 		idb->provides = apk_array_bclone(pkg->provides, &db->ba_deps);
 		idb->tags = apk_array_bclone(pkg->tags, &db->ba_deps);
+		idb->deltas = apk_array_bclone(pkg->deltas, &db->ba_deps);
 
 		apk_hash_insert(&db->available.packages, idb);
 		apk_provider_array_add(&idb->name->providers, APK_PROVIDER_FROM_PACKAGE(idb));
@@ -608,6 +616,8 @@ struct apk_package *apk_db_pkg_add(struct apk_database *db, struct apk_package_t
 		old_repos = idb->repos;
 		idb->repos |= pkg->repos;
 		if (!idb->filename_ndx) idb->filename_ndx = pkg->filename_ndx;
+		if (!apk_array_len(idb->deltas) && apk_array_len(pkg->deltas))
+			idb->deltas = apk_array_bclone(pkg->deltas, &db->ba_deps);
 	}
 	if (idb->repos && !old_repos) {
 		pkg->name->has_repository_providers = 1;
@@ -632,6 +642,9 @@ static int apk_repo_fd(struct apk_database *db, struct apk_repository *repo, int
 	if (repo == &db->cache_repository) {
 		if (db->cache_fd < 0) return db->cache_fd;
 		*fd = db->cache_fd;
+	} else if (repo == &db->cache_shared_repository) {
+		if (db->cache_shared_fd < 0) return db->cache_shared_fd;
+		*fd = db->cache_shared_fd;
 	} else *fd = AT_FDCWD;
 	return 0;
 }
@@ -675,7 +688,354 @@ int apk_repo_package_url(struct apk_database *db, struct apk_repository *repo, s
 	return 0;
 }
 
-int apk_cache_download(struct apk_database *db, struct apk_repository *repo, struct apk_package *pkg, struct apk_progress *prog)
+static bool mirror_matches(struct apk_mirror *m, apk_blob_t url)
+{
+	if (!apk_blob_starts_with(url, m->prefix)) return false;
+	return url.len == m->prefix.len || url.ptr[m->prefix.len] == '/';
+}
+
+// Transfer rate in bytes per millisecond. Mirrors without completed transfers
+// are assumed to be as fast as the best one measured in their group.
+static uint64_t mirror_rate(struct apk_mirror *m)
+{
+	return m->bytes * 1000 / (m->usec + 1) + 1;
+}
+
+static uint64_t mirror_cost(struct apk_mirror *m, uint64_t rate, uint64_t size)
+{
+	if (m->bytes) rate = mirror_rate(m);
+	return ((m->queued + size + 1) * 1000 / rate) << min(m->failures, 8);
+}
+
+static unsigned int mirror_pick(struct apk_database *db, apk_blob_t url, uint64_t size, uint32_t tried)
+{
+	struct apk_mirror *m;
+	uint64_t rate = 0, cost, best_cost = UINT64_MAX;
+	unsigned int best = 0;
+
+	for (m = &db->mirrors[0]; m < &db->mirrors[db->num_mirrors]; m++)
+		if (m->bytes && mirror_matches(m, url)) rate = max(rate, mirror_rate(m));
+	if (!rate) rate = 1;
+
+	for (m = &db->mirrors[0]; m < &db->mirrors[db->num_mirrors]; m++) {
+		unsigned int i = m - db->mirrors + 1;
+		if ((tried & BIT(i - 1)) || !mirror_matches(m, url)) continue;
+		cost = mirror_cost(m, rate, size);
+		if (cost < best_cost) {
+			best = i;
+			best_cost = cost;
+		}
+	}
+	return best;
+}
+
+// Selects the mirror for the next transfer from 'repo' if it has none yet
+void apk_repo_mirror_select(struct apk_database *db, struct apk_repository *repo, uint8_t *mirror, uint64_t size)
+{
+	if (*mirror || !db->num_mirrors) return;
+	*mirror = mirror_pick(db, repo->url_index, size, 0);
+	if (*mirror) db->mirrors[*mirror - 1].queued += size;
+}
+
+// Rewrites the url in 'buf' to point to the selected mirror
+int apk_repo_mirror_url(struct apk_database *db, unsigned int mirror, char *buf, size_t len)
+{
+	struct apk_mirror *m;
+	apk_blob_t url = APK_BLOB_STR(buf);
+	size_t tail;
+
+	if (!mirror || mirror > db->num_mirrors) return 0;
+	m = &db->mirrors[mirror - 1];
+	if (!mirror_matches(m, url) || m->url.ptr == m->prefix.ptr) return 0;
+	tail = url.len - m->prefix.len;
+	if (m->url.len + tail >= len) return -ENAMETOOLONG;
+	memmove(&buf[m->url.len], &buf[m->prefix.len], tail + 1);
+	memcpy(buf, m->url.ptr, m->url.len);
+	return 0;
+}
+
+// Accounts a finished transfer of 'size' bytes from the selected mirror.
+// On failure another untried mirror of the group is selected and true is
+// returned to indicate that the transfer should be retried.
+bool apk_repo_mirror_next(struct apk_database *db, struct apk_repository *repo, uint8_t *mirror, uint64_t size,
+			  int r, uint64_t usec, uint32_t *tried)
+{
+	struct apk_mirror *m;
+	unsigned int next;
+
+	static_assert(APK_MAX_MIRRORS <= sizeof *tried * 8, "tried mask too small");
+	if (!*mirror || *mirror > db->num_mirrors) return false;
+	m = &db->mirrors[*mirror - 1];
+	m->queued -= min(m->queued, size);
+	*tried |= BIT(*mirror - 1);
+	if (r == 0 || r == -APKE_FILE_UNCHANGED) {
+		if (r == 0 && size && !(db->ctx->flags & APK_SIMULATE)) {
+			m->bytes += size;
+			m->usec += usec;
+		}
+		return false;
+	}
+	m->failures++;
+	next = mirror_pick(db, repo->url_index, size, *tried);
+	if (!next) return false;
+	apk_warn(&db->ctx->out, BLOB_FMT ": %s, trying mirror " BLOB_FMT,
+		BLOB_PRINTF(m->url_printable), apk_error_str(r),
+		BLOB_PRINTF(db->mirrors[next - 1].url_printable));
+	*mirror = next;
+	db->mirrors[next - 1].queued += size;
+	return true;
+}
+
+static bool apk_cache_transfer_error(int r)
+{
+	switch (-r) {
+	case APKE_EOF:
+	case APKE_DNS_FAIL ... APKE_DNS_NO_NAME:
+	case APKE_HTTP_408_TIMEOUT:
+	case APKE_HTTP_500_INTERNAL_SERVER_ERROR ... APKE_HTTP_504_GATEWAY_TIMEOUT:
+		return true;
+	}
+	return -r < APKE_FIRST_VALUE;
+}
+
+// Makes a package from the shared cache available in the private cache
+// without copying it: by a hardlink, or by a reflink if the caches are
+// on different filesystems.
+static int apk_cache_link_shared(struct apk_database *db, struct apk_package *pkg)
+{
+	char cache_url[NAME_MAX], tmp_url[NAME_MAX];
+	int r, cache_fd, shared_fd;
+
+	r = apk_repo_package_url(db, &db->cache_repository, pkg, &cache_fd, cache_url, sizeof cache_url);
+	if (r < 0) return r;
+	r = apk_repo_fd(db, &db->cache_shared_repository, &shared_fd);
+	if (r < 0) return r;
+	if (linkat(shared_fd, cache_url, cache_fd, cache_url, 0) == 0 || errno == EEXIST) return 0;
+	if (errno != EXDEV) return -errno;
+#ifdef FICLONE
+	int src_fd, dst_fd;
+
+	r = apk_fmt(tmp_url, sizeof tmp_url, "%s.%d.tmp", cache_url, getpid());
+	if (r < 0) return r;
+	src_fd = openat(shared_fd, cache_url, O_RDONLY | O_CLOEXEC);
+	if (src_fd < 0) return -errno;
+	dst_fd = openat(cache_fd, tmp_url, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+	if (dst_fd < 0) {
+		r = -errno;
+		close(src_fd);
+		return r;
+	}
+	r = 0;
+	if (ioctl(dst_fd, FICLONE, src_fd) < 0 || renameat(cache_fd, tmp_url, cache_fd, cache_url) < 0) {
+		r = -errno;
+		unlinkat(cache_fd, tmp_url, 0);
+	}
+	close(dst_fd);
+	close(src_fd);
+	return r;
+#else
+	return -EXDEV;
+#endif
+}
+
+// Downloads the package via '<cache_url>.part' so an interrupted transfer can
+// be continued with a range request. The identity is verified over the kept
+// and the new data together. The partial file is kept only if the transfer
+// failed before all data was received, so corrupt data is not resumed from.
+// Returns -EAGAIN if the partial file is being written by another process.
+static int apk_cache_download_resumable(struct apk_database *db, struct apk_package *pkg, struct apk_progress *prog,
+	int download_fd, const char *download_url, int cache_fd, const char *cache_url)
+{
+	struct apk_out *out = &db->ctx->out;
+	struct apk_progress_istream pis;
+	struct apk_extract_ctx ectx;
+	struct apk_istream *is, *kept = NULL;
+	struct stat st;
+	char part_url[NAME_MAX];
+	uint64_t offset = 0;
+	int r, fd;
+
+	r = apk_fmt(part_url, sizeof part_url, "%s.part", cache_url);
+	if (r < 0) return r;
+	fd = openat(cache_fd, part_url, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (fd < 0) return -errno;
+	if (flock(fd, LOCK_EX | LOCK_NB) < 0) {
+		close(fd);
+		return -EAGAIN;
+	}
+	if (fstat(fd, &st) == 0 && st.st_size < pkg->size) offset = st.st_size;
+
+	is = apk_istream_from_fd_url_offset(download_fd, download_url, apk_db_url_since(db, 0), &offset);
+	if (IS_ERR(is)) {
+		r = PTR_ERR(is);
+		if (!offset || !apk_cache_transfer_error(r)) unlinkat(cache_fd, part_url, 0);
+		close(fd);
+		return r;
+	}
+	if (ftruncate(fd, offset) < 0) {
+		r = -errno;
+		apk_istream_close(is);
+		close(fd);
+		return r;
+	}
+	if (offset) {
+		apk_dbg(out, "%s: resuming download at %" PRIu64 " bytes", cache_url, offset);
+		kept = apk_istream_from_file_mmap(cache_fd, part_url);
+	}
+	is = apk_istream_tee(is, apk_ostream_to_fd(fd), APK_ISTREAM_TEE_COPY_META);
+	if (kept) is = apk_istream_concat(kept, is);
+	is = apk_progress_istream(&pis, is, prog);
+	apk_extract_init(&ectx, db->ctx, NULL);
+	apk_extract_verify_identity(&ectx, pkg->digest_alg, apk_pkg_digest_blob(pkg));
+	r = apk_extract(&ectx, is);
+	if (r == 0) {
+		if (renameat(cache_fd, part_url, cache_fd, cache_url) < 0) r = -errno;
+	} else if (!apk_cache_transfer_error(r) ||
+		   fstatat(cache_fd, part_url, &st, 0) < 0 || st.st_size >= pkg->size) {
+		unlinkat(cache_fd, part_url, 0);
+	}
+	return r;
+}
+
+// Returns a cached package an advertised delta can rebuild 'pkg' from
+static struct apk_package *cache_delta_base(struct apk_database *db, struct apk_package *pkg, apk_blob_t *base_id)
+{
+	struct apk_package *base;
+	struct apk_digest id;
+
+	apk_array_foreach_item(delta, pkg->deltas) {
+		if (delta->len < APK_DIGEST_LENGTH_SHA1) continue;
+		apk_digest_from_blob(&id, *delta);
+		base = apk_db_get_pkg(db, &id);
+		if (base && (base->cached || base->cached_shared)) {
+			*base_id = *delta;
+			return base;
+		}
+	}
+	return NULL;
+}
+
+// Rebuilds the package into the cache from a cached older version of it
+// and a delta from the repository. The delta is named after the package
+// file and the identity of its base. Returns -ENOENT if no advertised
+// delta has its base cached, and leaves the cache unchanged on failure.
+static int apk_cache_download_delta(struct apk_database *db, struct apk_repository *repo, struct apk_package *pkg,
+	struct apk_progress *prog)
+{
+	struct apk_out *out = &db->ctx->out;
+	struct apk_progress_istream pis;
+	struct apk_extract_ctx ectx;
+	struct apk_package *base;
+	struct apk_istream *is;
+	struct stat st;
+	apk_blob_t base_id, hex;
+	char cache_url[NAME_MAX], base_url[NAME_MAX], delta_url[PATH_MAX], buf[17];
+	int r, fd, cache_fd, base_fd, delta_fd;
+	size_t n;
+
+	base = cache_delta_base(db, pkg, &base_id);
+	if (!base) return -ENOENT;
+
+	apk_repo_mirror_select(db, repo, &pkg->mirror, pkg->size);
+	r = apk_repo_package_url(db, &db->cache_repository, pkg, &cache_fd, cache_url, sizeof cache_url);
+	if (r < 0) return r;
+	r = apk_repo_package_url(db, base->cached ? &db->cache_repository : &db->cache_shared_repository,
+		base, &base_fd, base_url, sizeof base_url);
+	if (r < 0) return r;
+	r = apk_repo_package_url(db, repo, pkg, &delta_fd, delta_url, sizeof delta_url);
+	if (r < 0) return r;
+	r = apk_repo_mirror_url(db, pkg->mirror, delta_url, sizeof delta_url);
+	if (r < 0) return r;
+	hex = APK_BLOB_BUF(buf);
+	apk_blob_push_hexdump(&hex, APK_BLOB_PTR_LEN(base_id.ptr, 8));
+	hex = apk_blob_pushed(APK_BLOB_BUF(buf), hex);
+	n = strlen(delta_url);
+	r = apk_fmt(&delta_url[n], sizeof delta_url - n, "." BLOB_FMT ".delta", BLOB_PRINTF(hex));
+	if (r < 0) return r;
+
+	fd = openat(base_fd, base_url, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return -errno;
+	is = apk_istream_delta(apk_istream_from_fd_url(delta_fd, delta_url, apk_db_url_since(db, 0)),
+		fd, apk_pkg_digest_blob(pkg));
+	if (IS_ERR(is)) return PTR_ERR(is);
+	is = apk_progress_istream(&pis, is, prog);
+	is = apk_istream_tee(is, apk_ostream_to_file_safe(cache_fd, cache_url, 0644), APK_ISTREAM_TEE_COPY_META);
+	apk_extract_init(&ectx, db->ctx, NULL);
+	apk_extract_verify_identity(&ectx, pkg->digest_alg, apk_pkg_digest_blob(pkg));
+	r = apk_extract(&ectx, is);
+	if (r < 0) return r;
+	if (fstatat(cache_fd, cache_url, &st, 0) < 0 || st.st_size != pkg->size) {
+		unlinkat(cache_fd, cache_url, 0);
+		return -APKE_DELTA_MISMATCH;
+	}
+	apk_dbg(out, PKG_VER_FMT ": rebuilt from " PKG_VER_FMT " with a delta",
+		PKG_VER_PRINTF(pkg), PKG_VER_PRINTF(base));
+	pkg->cached = 1;
+	return 0;
+}
+
+static int repo_index_url(struct apk_database *db, struct apk_repository *repo, unsigned int mirror,
+	char *buf, size_t len)
+{
+	int r = apk_fmt(buf, len, BLOB_FMT, BLOB_PRINTF(repo->url_index));
+	if (r < 0) return r;
+	return apk_repo_mirror_url(db, mirror, buf, len);
+}
+
+// The index delta is named after the index and the hash of the cached index
+static int repo_index_delta_url(struct apk_database *db, struct apk_repository *repo, unsigned int mirror,
+	int cache_fd, const char *cache_url, char *buf, size_t len)
+{
+	struct apk_file_info fi;
+	apk_blob_t hex;
+	char hexbuf[17];
+	size_t n;
+	int r;
+
+	r = apk_fileinfo_get(cache_fd, cache_url, APK_FI_DIGEST(APK_DIGEST_SHA256), &fi, NULL);
+	if (r < 0) return r;
+	r = repo_index_url(db, repo, mirror, buf, len);
+	if (r < 0) return r;
+	hex = APK_BLOB_BUF(hexbuf);
+	apk_blob_push_hexdump(&hex, APK_BLOB_PTR_LEN((char *) fi.digest.data, 8));
+	hex = apk_blob_pushed(APK_BLOB_BUF(hexbuf), hex);
+	n = strlen(buf);
+	r = apk_fmt(&buf[n], len - n, "." BLOB_FMT ".delta", BLOB_PRINTF(hex));
+	return r < 0 ? r : 0;
+}
+
+// Updates the cached index with a delta from the repository. The result
+// is verified like a downloaded index. The cached index gets the delta
+// timestamp so a later conditional fetch detects a newer index.
+static int apk_cache_download_index_delta(struct apk_database *db, struct apk_repository *repo, unsigned int mirror)
+{
+	struct apk_extract_ctx ectx;
+	struct apk_istream *is;
+	struct stat st;
+	char cache_url[NAME_MAX], delta_url[PATH_MAX];
+	int r, fd, cache_fd;
+
+	r = apk_repo_index_cache_url(db, repo, &cache_fd, cache_url, sizeof cache_url);
+	if (r < 0) return r;
+	r = repo_index_delta_url(db, repo, mirror, cache_fd, cache_url, delta_url, sizeof delta_url);
+	if (r < 0) return r;
+
+	fd = openat(cache_fd, cache_url, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return -errno;
+	is = apk_istream_delta(apk_istream_from_fd_url(AT_FDCWD, delta_url, apk_db_url_since(db, 0)),
+		fd, APK_BLOB_NULL);
+	if (IS_ERR(is)) return PTR_ERR(is);
+	is = apk_istream_tee(is, apk_ostream_to_file_safe(cache_fd, cache_url, 0644), APK_ISTREAM_TEE_COPY_META);
+	apk_extract_init(&ectx, db->ctx, NULL);
+	r = apk_extract(&ectx, is);
+	if (r < 0) return r;
+	if (fstatat(cache_fd, cache_url, &st, 0) == 0) repo->mtime = st.st_mtime;
+	apk_dbg(&db->ctx->out, BLOB_FMT ": updated with a delta", BLOB_PRINTF(repo->url_index_printable));
+	return 0;
+}
+
+static int apk_cache_download_mirror(struct apk_database *db, struct apk_repository *repo, struct apk_package *pkg,
+	struct apk_progress *prog, unsigned int mirror)
 {
 	struct apk_out *out = &db->ctx->out;
 	struct apk_progress_istream pis;
@@ -691,18 +1051,28 @@ int apk_cache_download(struct apk_database *db, struct apk_repository *repo, str
 		if (r < 0) return r;
 		r = apk_repo_package_url(db, repo, pkg, &download_fd, download_url, sizeof download_url);
 		if (r < 0) return r;
+		r = apk_repo_mirror_url(db, mirror, download_url, sizeof download_url);
+		if (r < 0) return r;
 		tee_flags = APK_ISTREAM_TEE_COPY_META;
 	} else {
 		r = apk_repo_index_cache_url(db, repo, &cache_fd, cache_url, sizeof cache_url);
 		if (r < 0) return r;
 		download_mtime = repo->mtime;
 		download_fd = AT_FDCWD;
-		r = apk_fmt(download_url, sizeof download_url, BLOB_FMT, BLOB_PRINTF(repo->url_index));
+		r = repo_index_url(db, repo, mirror, download_url, sizeof download_url);
 		if (r < 0) return r;
 		if (!prog) apk_out_progress_note(out, "fetch " BLOB_FMT, BLOB_PRINTF(repo->url_index_printable));
 	}
 	if (db->ctx->flags & APK_SIMULATE) return 0;
 
+	if (pkg && pkg->size) {
+		r = apk_cache_download_resumable(db, pkg, prog, download_fd, download_url, cache_fd, cache_url);
+		if (r != -EAGAIN) {
+			pkg->cached = 1;
+			return r;
+		}
+	}
+
 	os = apk_ostream_to_file_safe(cache_fd, cache_url, 0644);
 	if (IS_ERR(os)) return PTR_ERR(os);
 
@@ -720,6 +1090,81 @@ int apk_cache_download(struct apk_database *db, struct apk_repository *repo, str
 	return r;
 }
 
+#define APK_MAX_INDEX_DELTAS 16
+
+int apk_cache_download(struct apk_database *db, struct apk_repository *repo, struct apk_package *pkg, struct apk_progress *prog)
+{
+	uint8_t index_mirror = 0, *mirror = pkg ? &pkg->mirror : &index_mirror;
+	uint64_t size = pkg ? pkg->size : 0, start;
+	uint32_t tried = 0;
+	int r, deltas = 0;
+
+	if (pkg && apk_array_len(pkg->deltas) && !(db->ctx->flags & APK_SIMULATE)) {
+		r = apk_cache_download_delta(db, repo, pkg, prog);
+		if (r == 0) return 0;
+		if (r != -ENOENT)
+			apk_dbg(&db->ctx->out, PKG_VER_FMT ": delta not used: %s", PKG_VER_PRINTF(pkg), apk_error_str(r));
+	}
+	apk_repo_mirror_select(db, repo, mirror, size);
+	if (!pkg && !(db->ctx->flags & APK_SIMULATE)) {
+		// Follow the chain of index deltas, then fetch the index only
+		// if it changed after the last delta
+		for (; deltas < APK_MAX_INDEX_DELTAS; deltas++) {
+			r = apk_cache_download_index_delta(db, repo, *mirror);
+			if (r < 0) break;
+		}
+		if (r < 0 && r != -ENOENT)
+			apk_dbg(&db->ctx->out, BLOB_FMT ": index delta not used: %s",
+				BLOB_PRINTF(repo->url_index_printable), apk_error_str(r));
+	}
+	do {
+		start = apk_trace_now();
+		r = apk_cache_download_mirror(db, repo, pkg, prog, *mirror);
+	} while (apk_repo_mirror_next(db, repo, mirror, size, r, apk_trace_now() - start, &tried));
+	if (r == -APKE_FILE_UNCHANGED && deltas) r = 0;
+	return r;
+}
+
+// Announces the conditional requests apk_cache_download() makes to
+// revalidate the cached index, so they are sent along with the requests
+// for the other repositories.
+static void apk_cache_prefetch_index(struct apk_database *db, struct apk_repository *repo)
+{
+	char cache_url[NAME_MAX], url[PATH_MAX];
+	uint8_t mirror = 0;
+	int cache_fd;
+
+	if (db->ctx->flags & APK_SIMULATE) return;
+	apk_repo_mirror_select(db, repo, &mirror, 0);
+	if (apk_repo_index_cache_url(db, repo, &cache_fd, cache_url, sizeof cache_url) < 0) return;
+	if (repo_index_delta_url(db, repo, mirror, cache_fd, cache_url, url, sizeof url) == 0)
+		apk_url_prefetch(url, apk_db_url_since(db, 0));
+	if (repo_index_url(db, repo, mirror, url, sizeof url) == 0)
+		apk_url_prefetch(url, apk_db_url_since(db, repo->mtime));
+}
+
+// Announces a package apk_cache_download() will be called for. Downloads
+// resuming from a partial file are not announced as they need a range.
+void apk_cache_prefetch(struct apk_database *db, struct apk_repository *repo, struct apk_package *pkg)
+{
+	char cache_url[NAME_MAX], part_url[NAME_MAX], download_url[PATH_MAX];
+	apk_blob_t base_id;
+	int cache_fd, download_fd;
+
+	if ((db->ctx->flags & APK_SIMULATE) || pkg->cached_shared) return;
+	// The package is likely rebuilt from a delta instead
+	if (cache_delta_base(db, pkg, &base_id)) return;
+	if (apk_repo_package_url(db, &db->cache_repository, pkg, &cache_fd, cache_url, sizeof cache_url) < 0 ||
+	    apk_fmt(part_url, sizeof part_url, "%s.part", cache_url) < 0 ||
+	    faccessat(cache_fd, part_url, F_OK, 0) == 0)
+		return;
+	apk_repo_mirror_select(db, repo, &pkg->mirror, pkg->size);
+	if (apk_repo_package_url(db, repo, pkg, &download_fd, download_url, sizeof download_url) < 0 ||
+	    apk_repo_mirror_url(db, pkg->mirror, download_url, sizeof download_url) < 0)
+		return;
+	apk_url_prefetch(download_url, apk_db_url_since(db, 0));
+}
+
 static void apk_db_ipkg_creator_reset(struct apk_ipkg_creator *ic)
 {
 	apk_array_reset(ic->diris);
@@ -906,7 +1351,7 @@ err:
 	return apk_istream_close(is);
 }
 
-static int apk_db_fdb_read(struct apk_database *db, struct apk_istream *is, int repo, unsigned layer)
+static int apk_db_fdb_read(struct apk_database *db, struct apk_istream *is, int repo, unsigned layer, const struct apk_journal *journal)
 {
 	struct apk_out *out = &db->ctx->out;
 	struct apk_package_tmpl tmpl;
@@ -914,23 +1359,46 @@ static int apk_db_fdb_read(struct apk_database *db, struct apk_istream *is, int
 	struct apk_db_dir_instance *diri = NULL;
 	struct apk_db_file *file = NULL;
 	struct apk_db_acl *acl;
-	struct apk_digest file_digest, xattr_digest;
+	struct apk_digest file_digest, xattr_digest, entry_digest;
+	struct apk_digest_ctx dctx;
 	apk_blob_t token = APK_BLOB_STR("\n"), l;
 	mode_t mode;
 	uid_t uid;
 	gid_t gid;
 	int field, r, lineno = 0;
+	bool skip_files = repo == APK_REPO_DB_INSTALLED && db->installed.owners[layer].hdr;
+	bool hash_entries = repo == APK_REPO_DB_INSTALLED && db->installed.journal[layer].active;
+	bool skip_entry = false;
 
 	if (IS_ERR(is)) return PTR_ERR(is);
 
 	apk_pkgtmpl_init(&tmpl, db);
 	tmpl.pkg.layer = layer;
+	if (hash_entries) apk_digest_ctx_init(&dctx, APK_DIGEST_SHA1);
 
 	while (apk_istream_get_delim(is, token, &l) == 0) {
 		lineno++;
 
+		if (skip_entry) {
+			/* Entry superseded by the journal */
+			if (l.len >= 2) continue;
+			apk_pkgtmpl_reset(&tmpl);
+			tmpl.pkg.layer = layer;
+			skip_entry = false;
+			if (hash_entries) apk_digest_ctx_reset(&dctx);
+			continue;
+		}
+		if (hash_entries) {
+			/* Hash the entry as written to detect changes */
+			apk_digest_ctx_update(&dctx, l.ptr, l.len);
+			apk_digest_ctx_update(&dctx, "\n", 1);
+		}
+
 		if (l.len < 2) {
-			if (!tmpl.pkg.name) continue;
+			if (!tmpl.pkg.name) {
+				if (hash_entries) apk_digest_ctx_reset(&dctx);
+				continue;
+			}
 			if (diri) apk_db_dir_apply_diri_permissions(db, diri);
 
 			if (repo >= 0) {
@@ -941,6 +1409,12 @@ static int apk_db_fdb_read(struct apk_database *db, struct apk_istream *is, int
 				/* Installed package without files */
 				ipkg = apk_db_ipkg_create(db, &tmpl.pkg);
 			}
+			if (ipkg && hash_entries) {
+				apk_digest_ctx_final(&dctx, &entry_digest);
+				apk_digest_ctx_reset(&dctx);
+				memcpy(ipkg->fdb_hash, entry_digest.data, sizeof ipkg->fdb_hash);
+				ipkg->fdb_hashed = 1;
+			}
 			if (ipkg) apk_db_ipkg_commit(db, ipkg);
 			if (apk_db_pkg_add(db, &tmpl) == NULL)
 				goto err_fmt;
@@ -959,7 +1433,12 @@ static int apk_db_fdb_read(struct apk_database *db, struct apk_istream *is, int
 
 		/* Standard index line? */
 		r = apk_pkgtmpl_add_info(&tmpl, field, l);
-		if (r == 0) continue;
+		if (r == 0) {
+			if (field == 'C' && ipkg == NULL &&
+			    apk_journal_find(journal, APK_DIGEST_BLOB(tmpl.id)))
+				skip_entry = true;
+			continue;
+		}
 		if (r == 1 && repo == APK_REPO_DB_INSTALLED && ipkg == NULL) {
 			/* Instert to installed database; this needs to
 			 * happen after package name has been read, but
@@ -968,6 +1447,9 @@ static int apk_db_fdb_read(struct apk_database *db, struct apk_istream *is, int
 		}
 		if (repo != APK_REPO_DB_INSTALLED || ipkg == NULL) continue;
 
+		/* File ownership is answered from the owner index */
+		if (skip_files && strchr("FMRaZ", field)) continue;
+
 		/* Check FDB special entries */
 		switch (field) {
 		case 'g':
@@ -1053,13 +1535,14 @@ bad_entry:
 err_fmt:
 	is->err = -APKE_V2DB_FORMAT;
 done:
+	if (hash_entries) apk_digest_ctx_free(&dctx);
 	apk_pkgtmpl_free(&tmpl);
 	return apk_istream_close(is);
 }
 
 int apk_db_index_read(struct apk_database *db, struct apk_istream *is, int repo)
 {
-	return apk_db_fdb_read(db, is, repo, APK_DB_LAYER_ROOT);
+	return apk_db_fdb_read(db, is, repo, APK_DB_LAYER_ROOT, NULL);
 }
 
 static void apk_blob_push_db_acl(apk_blob_t *b, char field, struct apk_db_acl *acl)
@@ -1184,22 +1667,24 @@ err:
 	return r;
 }
 
-static int apk_db_scriptdb_write(struct apk_database *db, struct apk_installed_package *ipkg, struct apk_ostream *os)
+static int apk_db_scriptdb_write(struct apk_database *db, struct apk_installed_package *ipkg, struct apk_ostream *os, struct apk_scriptdb_writer *w)
 {
 	struct apk_package *pkg = ipkg->pkg;
 	struct apk_file_info fi;
 	char filename[256];
-	apk_blob_t bfn;
-	int r, i;
+	apk_blob_t bfn, script;
+	int r = 0, i;
 
 	if (IS_ERR(os)) return PTR_ERR(os);
 
 	for (i = 0; i < APK_SCRIPT_MAX; i++) {
-		if (!ipkg->script[i].ptr) continue;
+		script = apk_db_ipkg_script(db, ipkg, i);
+		if (!script.ptr) continue;
+		apk_scriptdb_writer_add(w, pkg->digest_alg, apk_pkg_digest_blob(pkg), i, script);
 
 		fi = (struct apk_file_info) {
 			.name = filename,
-			.size = ipkg->script[i].len,
+			.size = script.len,
 			.mode = 0755 | S_IFREG,
 			.mtime = pkg->build_time,
 		};
@@ -1215,7 +1700,7 @@ static int apk_db_scriptdb_write(struct apk_database *db, struct apk_installed_p
 		apk_blob_push_blob(&bfn, APK_BLOB_STR(apk_script_types[i]));
 		apk_blob_push_blob(&bfn, APK_BLOB_PTR_LEN("", 1));
 
-		r = apk_tar_write_entry(os, &fi, ipkg->script[i].ptr);
+		r = apk_tar_write_entry(os, &fi, script.ptr);
 		if (r < 0) {
 			apk_ostream_cancel(os, -APKE_V2DB_FORMAT);
 			break;
@@ -1309,9 +1794,44 @@ static int apk_db_add_trigger(struct apk_database *db, apk_blob_t l)
 	return 0;
 }
 
+static int apk_db_journal_replay(struct apk_database *db, unsigned layer, const struct apk_journal *j)
+{
+	const struct apk_journal_pkg *last;
+	struct apk_journal_entry e;
+	struct apk_package *pkg = NULL;
+	struct apk_istream is;
+	struct apk_digest id;
+	uint64_t off = sizeof(struct apk_journal_header), rec;
+	int r;
+
+	while (rec = off, (r = apk_journal_next(j, &off, &e)) > 0) {
+		switch (e.type) {
+		case APK_JOURNAL_PKG:
+			/* Only the latest record of a package is applied */
+			pkg = NULL;
+			last = apk_journal_find(j, e.pkg);
+			if (!last || last->off != rec) break;
+			r = apk_db_fdb_read(db, apk_istream_from_blob(&is, e.data), APK_REPO_DB_INSTALLED, layer, NULL);
+			if (r < 0) return r;
+			apk_digest_set(&id, APK_DIGEST_SHA1);
+			memcpy(id.data, e.pkg.ptr, id.len);
+			pkg = apk_db_get_pkg(db, &id);
+			break;
+		case APK_JOURNAL_SCRIPT:
+			if (pkg && pkg->ipkg) apk_ipkg_assign_script(pkg->ipkg, e.arg, apk_blob_dup(e.data));
+			break;
+		default:
+			pkg = NULL;
+			break;
+		}
+	}
+	return r;
+}
+
 static int apk_db_read_layer(struct apk_database *db, unsigned layer)
 {
 	apk_blob_t blob, world;
+	struct stat st;
 	int r, fd, ret = 0, flags = db->ctx->open_flags;
 
 	/* Read:
@@ -1340,19 +1860,55 @@ static int apk_db_read_layer(struct apk_database *db, unsigned layer)
 	}
 
 	if (!(flags & APK_OPENF_NO_INSTALLED)) {
-		r = apk_db_fdb_read(db, apk_istream_from_file(fd, "installed"), APK_REPO_DB_INSTALLED, layer);
+		struct apk_db_journal *dj = &db->installed.journal[layer];
+		struct apk_journal journal = {};
+
+		if (fstatat(fd, "installed", &st, 0) == 0) {
+			r = apk_journal_open(&journal, fd, "journal", &st);
+			if (r < 0 && r != -ENOENT) apk_dbg(&db->ctx->out, "%s: journal not used: %s",
+				apk_db_layer_name(layer), apk_error_str(r));
+			dj->active = db->ctx->db_journal && (flags & APK_OPENF_WRITE);
+			dj->len = journal.committed;
+			dj->limit = max(APK_DB_JOURNAL_MIN, st.st_size / 4);
+		}
+		if ((flags & APK_OPENF_OWNER_INDEX) && dj->limit && (!journal.pkgs || !apk_array_len(journal.pkgs))) {
+			r = apk_ownerdb_open(&db->installed.owners[layer], fd, "owners", &st);
+			if (r < 0) apk_dbg(&db->ctx->out, "%s: owner index not used: %s",
+				apk_db_layer_name(layer), apk_error_str(r));
+		}
+		r = apk_db_fdb_read(db, apk_istream_from_file(fd, "installed"), APK_REPO_DB_INSTALLED, layer, &journal);
 		if (!ret && r != -ENOENT) ret = r;
+		if (journal.map.ptr) {
+			r = apk_db_journal_replay(db, layer, &journal);
+			if (!ret) ret = r;
+			apk_journal_close(&journal);
+		}
+		if (dj->active) {
+			struct apk_installed_package *ipkg;
+			list_for_each_entry(ipkg, &db->installed.packages, installed_pkgs_list)
+				if (ipkg->pkg->layer == layer) apk_package_array_add(&dj->pkgs, ipkg->pkg);
+		}
 		r = apk_db_parse_istream(db, apk_istream_from_file(fd, "triggers"), apk_db_add_trigger);
 		if (!ret && r != -ENOENT) ret = r;
 	}
 
 	if (!(flags & APK_OPENF_NO_SCRIPTS)) {
-		struct apk_istream *is = apk_istream_from_file(fd, "scripts.tar");
-		if (!IS_ERR(is) || PTR_ERR(is) != -ENOENT) db->scripts_tar = 1;
-		else is = apk_istream_gunzip(apk_istream_from_file(fd, "scripts.tar.gz"));
+		struct apk_istream *is;
 
-		r = apk_tar_parse(is, apk_read_script_archive_entry, db, db->id_cache);
-		if (!ret && r != -ENOENT) ret = r;
+		if (fstatat(fd, "scripts.tar", &st, 0) == 0) db->scripts_tar = 1;
+		else if (fstatat(fd, "scripts.tar.gz", &st, 0) < 0) st.st_ino = 0;
+
+		// Scripts are looked up on demand from the uncompressed store
+		// if it matches the archive, otherwise the archive is loaded.
+		r = st.st_ino ? apk_scriptdb_open(&db->installed.scripts[layer], fd, "scripts.idx", &st) : -ENOENT;
+		if (r < 0) {
+			if (r != -ENOENT) apk_dbg(&db->ctx->out, "%s: script store not used: %s",
+				apk_db_layer_name(layer), apk_error_str(r));
+			if (db->scripts_tar) is = apk_istream_from_file(fd, "scripts.tar");
+			else is = apk_istream_gunzip(apk_istream_from_file(fd, "scripts.tar.gz"));
+			r = apk_tar_parse(is, apk_read_script_archive_entry, db, db->id_cache);
+			if (!ret && r != -ENOENT) ret = r;
+		}
 	}
 
 	close(fd);
@@ -1370,7 +1926,7 @@ static int apk_db_index_write_nr_cache(struct apk_database *db)
 	struct apk_package_array *pkgs = apk_db_sorted_installed_packages(db);
 	apk_array_foreach_item(pkg, pkgs) {
 		if (apk_db_pkg_available(db, pkg)) continue;
-		if (pkg->cached || pkg->filename_ndx || !pkg->installed_size) {
+		if (pkg->cached || pkg->cached_shared || pkg->filename_ndx || !pkg->installed_size) {
 			if (!os) {
 				os = apk_ostream_to_file(db->cache_fd, "installed", 0644);
 				if (IS_ERR(os)) return PTR_ERR(os);
@@ -1448,6 +2004,12 @@ static void mark_in_cache(struct apk_database *db, int static_cache, int dirfd,
 	pkg->cached = 1;
 }
 
+static void mark_in_shared_cache(struct apk_database *db, int static_cache, int dirfd, const char *name, struct apk_package *pkg)
+{
+	if (!pkg) return;
+	pkg->cached_shared = 1;
+}
+
 struct apkindex_ctx {
 	struct apk_database *db;
 	struct apk_extract_ctx ectx;
@@ -1519,9 +2081,15 @@ static int load_index(struct apk_database *db, struct apk_istream *is, int repo)
 		.db = db,
 		.repo = repo,
 	};
+	uint64_t trace_start;
+	int r;
+
 	if (IS_ERR(is)) return PTR_ERR(is);
+	trace_start = apk_trace_begin(&db->ctx->trace);
 	apk_extract_init(&ctx.ectx, db->ctx, &extract_index);
-	return apk_extract(&ctx.ectx, is);
+	r = apk_extract(&ctx.ectx, is);
+	apk_trace_end(&db->ctx->trace, trace_start, "repo", "load index");
+	return r;
 }
 
 static bool is_index_stale(struct apk_database *db, struct apk_repository *repo)
@@ -1532,11 +2100,12 @@ static bool is_index_stale(struct apk_database *db, struct apk_repository *repo)
 
 	if (!db->autoupdate) return false;
 	if (!repo->is_remote) return false;
-	if (!db->ctx->cache_max_age) return true;
-	if (db->ctx->force & APK_FORCE_REFRESH) return true;
 	if (apk_repo_index_cache_url(db, repo, &cache_fd, cache_url, sizeof cache_url) < 0) return true;
 	if (fstatat(cache_fd, cache_url, &st, 0) != 0) return true;
+	// The cached index is revalidated with a conditional request
 	repo->mtime = st.st_mtime;
+	if (!db->ctx->cache_max_age) return true;
+	if (db->ctx->force & APK_FORCE_REFRESH) return true;
 	return (time(NULL) - st.st_mtime) > db->ctx->cache_max_age;
 }
 
@@ -1598,8 +2167,33 @@ static int add_repository_component(struct apk_repoparser *rp, apk_blob_t url, c
 	return 0;
 }
 
+static struct apk_mirror *add_mirror_url(struct apk_database *db, apk_blob_t prefix, apk_blob_t url)
+{
+	struct apk_mirror *m;
+
+	for (m = &db->mirrors[0]; m < &db->mirrors[db->num_mirrors]; m++)
+		if (apk_blob_compare(prefix, m->prefix) == 0 && apk_blob_compare(url, m->url) == 0) return m;
+	if (db->num_mirrors >= APK_MAX_MIRRORS) return NULL;
+	m = &db->mirrors[db->num_mirrors++];
+	*m = (struct apk_mirror) {
+		.prefix = apk_balloc_dup(&db->ctx->ba, prefix),
+	};
+	m->url = apk_blob_compare(prefix, url) == 0 ? m->prefix : apk_balloc_dup(&db->ctx->ba, url);
+	m->url_printable = apk_url_sanitize(m->url, &db->ctx->ba);
+	return m;
+}
+
+static int add_mirror(struct apk_repoparser *rp, apk_blob_t url, apk_blob_t mirror)
+{
+	struct apk_database *db = container_of(rp, struct apk_database, repoparser);
+
+	if (!add_mirror_url(db, url, url) || !add_mirror_url(db, url, mirror)) return -1;
+	return 0;
+}
+
 static const struct apk_repoparser_ops db_repoparser_ops = {
 	.repository = add_repository_component,
+	.mirror = add_mirror,
 };
 
 static void open_repository(struct apk_database *db, int repo_num)
@@ -1611,6 +2205,7 @@ static void open_repository(struct apk_database *db, int repo_num)
 	unsigned int available_repos = 0;
 	char open_url[NAME_MAX];
 	int r, update_error = 0, open_fd = AT_FDCWD;
+	uint64_t trace_start = apk_trace_begin(&db->ctx->trace), update_start, update_usec;
 
 	error_action = "opening";
 	if (!(db->ctx->flags & APK_NO_NETWORK)) available_repos = repo_mask;
@@ -1618,7 +2213,15 @@ static void open_repository(struct apk_database *db, int repo_num)
 	if (repo->is_remote && !(db->ctx->flags & APK_NO_CACHE)) {
 		error_action = "opening from cache";
 		if (repo->stale) {
+			update_start = apk_trace_begin(&db->ctx->trace);
+			update_usec = apk_trace_now();
 			update_error = apk_cache_download(db, repo, NULL, NULL);
+			update_usec = apk_trace_now() - update_usec;
+			apk_trace_end(&db->ctx->trace, update_start, "download", "update index");
+			apk_dbg(out, BLOB_FMT ": %s in %" PRIu64 " ms", BLOB_PRINTF(repo->url_index_printable),
+				update_error == 0 ? "updated" :
+				update_error == -APKE_FILE_UNCHANGED ? "revalidated" : "update failed",
+				update_usec / 1000);
 			switch (update_error) {
 			case 0:
 				db->repositories.updated++;
@@ -1661,6 +2264,7 @@ err:
 		for (unsigned int tag_id = 0, mask = repo->tag_mask; mask; mask >>= 1, tag_id++)
 			if (mask & 1) db->repo_tags[tag_id].allowed_repos |= repo_mask;
 	}
+	apk_trace_end(&db->ctx->trace, trace_start, "repo", "open_repository " BLOB_FMT, BLOB_PRINTF(repo->url_printable));
 }
 
 static int add_repository(struct apk_database *db, apk_blob_t line)
@@ -1693,6 +2297,12 @@ static void setup_cache_repository(struct apk_database *db, apk_blob_t cache_dir
 		.pkgname_spec = db->ctx->default_cachename_spec,
 		.absolute_pkgname = 1,
 	};
+	db->cache_shared_repository = (struct apk_repository) {
+		.url_base = APK_BLOB_STR(db->ctx->cache_shared_dir),
+		.url_printable = APK_BLOB_STR(db->ctx->cache_shared_dir),
+		.pkgname_spec = db->ctx->default_cachename_spec,
+		.absolute_pkgname = 1,
+	};
 	db->num_repo_tags = 1;
 }
 
@@ -1986,45 +2596,449 @@ void apk_db_init(struct apk_database *db, struct apk_ctx *ac)
 	apk_string_array_init(&db->filename_array);
 	apk_blobptr_array_init(&db->arches);
 	apk_name_array_init(&db->available.sorted_names);
+	apk_name_array_init(&db->available.search_names);
+	apk_trigram_index_init(&db->available.search_index);
 	apk_package_array_init(&db->installed.sorted_packages);
+	for (int i = 0; i < APK_DB_LAYER_NUM; i++)
+		apk_package_array_init(&db->installed.journal[i].pkgs);
 	apk_repoparser_init(&db->repoparser, &ac->out, &db_repoparser_ops);
 	db->root_fd = -1;
 	db->lock_fd = -1;
 	db->cache_fd = -APKE_CACHE_NOT_AVAILABLE;
+	db->cache_shared_fd = -APKE_CACHE_NOT_AVAILABLE;
+	db->executor.sock = -1;
 	db->noarch = apk_atomize_dup(&db->atoms, APK_BLOB_STRLIT("noarch"));
 }
 
-int apk_db_open(struct apk_database *db)
+static int script_executor_setup(void *ctx)
 {
+	struct apk_database *db = ctx;
 	struct apk_ctx *ac = db->ctx;
-	struct apk_out *out = &ac->out;
-	const char *msg = NULL;
-	int r = -1, i;
 
-	apk_default_acl_dir = apk_db_acl_atomize(db, 0755, 0, 0);
-	apk_default_acl_file = apk_db_acl_atomize(db, 0644, 0, 0);
-	if (ac->open_flags == 0) {
-		msg = "Invalid open flags (internal error)";
-		goto ret_r;
+	if (db->lock_fd >= 0) close(db->lock_fd);
+	umask(0022);
+	if (fchdir(db->root_fd) != 0) return -1;
+	if (!(ac->flags & APK_NO_CHROOT)) {
+		if (db->need_unshare && unshare_mount_namespace(db) < 0) return -1;
+		if (ac->root_set && chroot(".") != 0) return -1;
 	}
-	if ((ac->open_flags & APK_OPENF_WRITE) &&
-	    !(ac->open_flags & APK_OPENF_NO_AUTOUPDATE) &&
-	    !(ac->flags & APK_NO_NETWORK))
-		db->autoupdate = 1;
-
-	setup_cache_repository(db, APK_BLOB_STR(ac->cache_dir));
-	db->root_fd = apk_ctx_fd_root(ac);
-	db->root_tmpfs = (ac->root_tmpfs == APK_AUTO) ? detect_tmpfs(db->root_fd) : ac->root_tmpfs;
-	db->usermode = !!(ac->open_flags & APK_OPENF_USERMODE);
+	return 0;
+}
 
-	if (!(ac->open_flags & APK_OPENF_CREATE)) {
-		// Autodetect usermode from the installeddb owner
-		struct stat st;
-		if (fstatat(db->root_fd, apk_db_layer_name(APK_DB_LAYER_ROOT), &st, 0) == 0 &&
-		    st.st_uid != 0)
-			db->usermode = 1;
-	}
-	if (db->usermode) db->extract_flags |= APK_FSEXTRACTF_NO_CHOWN | APK_FSEXTRACTF_NO_SYS_XATTRS | APK_FSEXTRACTF_NO_DEVICES;
+struct foreach_cache_item_ctx {
+	struct apk_database *db;
+	apk_cache_item_cb cb;
+	int static_cache;
+};
+
+static int foreach_cache_file(void *pctx, int dirfd, const char *path, const char *filename)
+{
+	struct foreach_cache_item_ctx *ctx = (struct foreach_cache_item_ctx *) pctx;
+	struct apk_database *db = ctx->db;
+	struct apk_file_info fi;
+
+	if (apk_fileinfo_get(dirfd, filename, 0, &fi, NULL) == 0) {
+		ctx->cb(db, ctx->static_cache, dirfd, filename,
+			apk_db_get_pkg_by_name(db, APK_BLOB_STR(filename),
+				fi.size, db->ctx->default_cachename_spec));
+	}
+	return 0;
+}
+
+static int foreach_static_cache_item(struct foreach_cache_item_ctx *ctx)
+{
+	struct apk_database *db = ctx->db;
+	struct stat st1, st2;
+	int r = 0;
+
+	int fd = openat(db->root_fd, apk_static_cache_dir, O_DIRECTORY | O_RDONLY | O_CLOEXEC);
+	if (fd >= 0) {
+		/* Do not handle static cache as static cache if the explicit
+		 * cache is enabled at the static cache location */
+		if (fstat(fd, &st1) == 0 && fstat(db->cache_fd, &st2) == 0 &&
+		    (st1.st_dev != st2.st_dev || st1.st_ino != st2.st_ino))
+			r = apk_dir_foreach_file(fd, NULL, foreach_cache_file, ctx, NULL);
+		close(fd);
+	}
+	return r;
+}
+
+int apk_db_cache_foreach_item(struct apk_database *db, apk_cache_item_cb cb)
+{
+	struct foreach_cache_item_ctx ctx = { .db = db, .cb = cb, .static_cache = true };
+	int r;
+
+	r = foreach_static_cache_item(&ctx);
+	if (r) return r;
+
+	ctx.static_cache = false;
+	if (db->cache_fd < 0) return db->cache_fd;
+	return apk_dir_foreach_file(db->cache_fd, NULL, foreach_cache_file, &ctx, NULL);
+}
+
+// The cache index maps the file names in the cache directory to package
+// identities, so the cached packages are found with digest lookups instead
+// of listing the directory and parsing each file name. It records the cache
+// directory mtime it was generated from. It is rewritten in place to keep
+// that mtime unchanged.
+#define APK_CACHEIDX_MAGIC	0x434b5041	// "APKC"
+#define APK_CACHEIDX_VERSION	1
+
+struct apk_cacheidx_header {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t dir_ino;
+	uint64_t dir_mtime;
+	uint32_t num_entries;
+	uint32_t strings_len;
+};
+
+struct apk_cacheidx_entry {
+	uint64_t size;
+	uint32_t name_off;
+	uint32_t digest_off;
+	uint16_t name_len;
+	uint8_t digest_alg;
+	uint8_t digest_len;	// zero if the package was not known
+	uint32_t reserved;
+};
+
+struct cacheidx_item {
+	apk_blob_t name;
+	uint64_t size;
+	struct apk_package *pkg;
+};
+APK_ARRAY(cacheidx_item_array, struct cacheidx_item);
+
+struct cacheidx_ctx {
+	struct apk_database *db;
+	apk_cache_item_cb mark;
+	struct apk_balloc ba;
+	struct cacheidx_item_array *items;
+};
+
+static uint64_t cacheidx_mtime(const struct stat *st)
+{
+	return (uint64_t) st->st_mtim.tv_sec * 1000000000ULL + st->st_mtim.tv_nsec;
+}
+
+static bool cacheidx_name_matches(struct apk_database *db, struct apk_package *pkg, apk_blob_t name)
+{
+	char buf[NAME_MAX];
+
+	if (apk_repo_package_url(db, &db->cache_repository, pkg, NULL, buf, sizeof buf) < 0) return false;
+	return apk_blob_compare(APK_BLOB_STR(buf), name) == 0;
+}
+
+static int cacheidx_mark(struct apk_database *db, apk_blob_t idx, const struct stat *dir, int dirfd, apk_cache_item_cb mark)
+{
+	const struct apk_cacheidx_header *hdr = (const void *) idx.ptr;
+	const struct apk_cacheidx_entry *entries;
+	const char *strings;
+	struct apk_package *pkg;
+	struct apk_digest d;
+	apk_blob_t name;
+
+	if (idx.len < sizeof *hdr) return -APKE_FORMAT_INVALID;
+	if (hdr->magic != APK_CACHEIDX_MAGIC || hdr->version != APK_CACHEIDX_VERSION) return -APKE_FORMAT_INVALID;
+	if (idx.len != sizeof *hdr + (uint64_t) hdr->num_entries * sizeof *entries + hdr->strings_len)
+		return -APKE_FORMAT_INVALID;
+	if (hdr->dir_ino != dir->st_ino || hdr->dir_mtime != cacheidx_mtime(dir)) return -ESTALE;
+
+	entries = (const struct apk_cacheidx_entry *) &hdr[1];
+	strings = (const char *) &entries[hdr->num_entries];
+	for (uint32_t i = 0; i < hdr->num_entries; i++) {
+		const struct apk_cacheidx_entry *e = &entries[i];
+		if ((uint64_t) e->name_off + e->name_len > hdr->strings_len ||
+		    (uint64_t) e->digest_off + e->digest_len > hdr->strings_len ||
+		    e->digest_len > APK_DIGEST_LENGTH_MAX)
+			return -APKE_FORMAT_INVALID;
+		name = APK_BLOB_PTR_LEN((char *) &strings[e->name_off], e->name_len);
+		if (e->digest_len) {
+			d = (struct apk_digest) { .alg = e->digest_alg, .len = e->digest_len };
+			memcpy(d.data, &strings[e->digest_off], e->digest_len);
+			pkg = apk_db_get_pkg(db, &d);
+			if (pkg && (pkg->size != e->size ||
+				    apk_digest_cmp_blob(&d, pkg->digest_alg, apk_pkg_digest_blob(pkg)) != 0 ||
+				    !cacheidx_name_matches(db, pkg, name)))
+				pkg = NULL;
+		} else {
+			pkg = apk_db_get_pkg_by_name(db, name, e->size, db->ctx->default_cachename_spec);
+		}
+		mark(db, false, dirfd, NULL, pkg);
+	}
+	return 0;
+}
+
+static int cacheidx_scan_file(void *pctx, int dirfd, const char *path, const char *filename)
+{
+	struct cacheidx_ctx *ctx = pctx;
+	struct apk_database *db = ctx->db;
+	struct apk_file_info fi;
+	struct apk_package *pkg;
+
+	if (strcmp(filename, APK_CACHE_INDEX) == 0 || strcmp(filename, APK_SEARCH_INDEX) == 0) return 0;
+	if (strlen(filename) > UINT16_MAX || apk_fileinfo_get(dirfd, filename, 0, &fi, NULL) != 0) return 0;
+	pkg = apk_db_get_pkg_by_name(db, APK_BLOB_STR(filename), fi.size, db->ctx->default_cachename_spec);
+	ctx->mark(db, false, dirfd, filename, pkg);
+	cacheidx_item_array_add(&ctx->items, (struct cacheidx_item) {
+		.name = apk_balloc_dup(&ctx->ba, APK_BLOB_STR(filename)),
+		.size = fi.size,
+		.pkg = pkg,
+	});
+	return 0;
+}
+
+static int cacheidx_write(struct cacheidx_ctx *ctx, int fd, const struct stat *dir)
+{
+	struct apk_cacheidx_header hdr = {
+		.magic = APK_CACHEIDX_MAGIC,
+		.version = APK_CACHEIDX_VERSION,
+		.dir_ino = dir->st_ino,
+		.dir_mtime = cacheidx_mtime(dir),
+		.num_entries = apk_array_len(ctx->items),
+	};
+	struct apk_cacheidx_entry *e;
+	apk_blob_t digest;
+	size_t size;
+	char *buf, *strings;
+	uint32_t off = 0;
+	int r = 0;
+
+	apk_array_foreach(item, ctx->items) {
+		hdr.strings_len += item->name.len;
+		if (item->pkg) hdr.strings_len += apk_pkg_digest_blob(item->pkg).len;
+	}
+	size = sizeof hdr + hdr.num_entries * sizeof *e + hdr.strings_len;
+	buf = malloc(size);
+	if (!buf) return -ENOMEM;
+
+	memcpy(buf, &hdr, sizeof hdr);
+	e = (struct apk_cacheidx_entry *) &buf[sizeof hdr];
+	strings = (char *) &e[hdr.num_entries];
+	apk_array_foreach(item, ctx->items) {
+		*e = (struct apk_cacheidx_entry) {
+			.size = item->size,
+			.name_off = off,
+			.name_len = item->name.len,
+		};
+		memcpy(&strings[off], item->name.ptr, item->name.len);
+		off += item->name.len;
+		if (item->pkg) {
+			digest = apk_pkg_digest_blob(item->pkg);
+			e->digest_alg = item->pkg->digest_alg;
+			e->digest_len = digest.len;
+			e->digest_off = off;
+			memcpy(&strings[off], digest.ptr, digest.len);
+			off += digest.len;
+		}
+		e++;
+	}
+	if (pwrite(fd, buf, size, 0) != size || ftruncate(fd, size) < 0) r = -errno ?: -EIO;
+	free(buf);
+	return r;
+}
+
+// Marks the packages found in the cache directory 'dirfd'. The cache index
+// is used if it matches the directory, or else it is regenerated. It is not
+// written if the directory was modified within the mtime granularity, as
+// a concurrent change could otherwise have the same mtime.
+static void cache_mark_dir(struct apk_database *db, int dirfd, apk_cache_item_cb mark, bool writable)
+{
+	struct cacheidx_ctx ctx = { .db = db, .mark = mark };
+	struct stat st;
+	void *map;
+	int fd = -1, r = -ENOENT;
+
+	if (writable) fd = openat(dirfd, APK_CACHE_INDEX, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		writable = false;
+		fd = openat(dirfd, APK_CACHE_INDEX, O_RDONLY | O_CLOEXEC);
+	}
+	if (fstat(dirfd, &st) < 0) goto done;
+	if (fd >= 0 && flock(fd, LOCK_SH | LOCK_NB) == 0) {
+		struct stat ist;
+		if (fstat(fd, &ist) == 0 && ist.st_size > 0) {
+			map = mmap(NULL, ist.st_size, PROT_READ, MAP_SHARED, fd, 0);
+			if (map != MAP_FAILED) {
+				r = cacheidx_mark(db, APK_BLOB_PTR_LEN(map, ist.st_size), &st, dirfd, mark);
+				munmap(map, ist.st_size);
+			}
+		}
+	}
+	if (r == 0) goto done;
+	apk_dbg(&db->ctx->out, "cache index not used: %s", apk_error_str(r));
+
+	apk_balloc_init(&ctx.ba, 16*1024);
+	cacheidx_item_array_init(&ctx.items);
+	r = apk_dir_foreach_file(dirfd, NULL, cacheidx_scan_file, &ctx, NULL);
+	if (r == 0 && writable && st.st_mtim.tv_sec < time(NULL) - 1 && flock(fd, LOCK_EX | LOCK_NB) == 0)
+		cacheidx_write(&ctx, fd, &st);
+	cacheidx_item_array_free(&ctx.items);
+	apk_balloc_destroy(&ctx.ba);
+done:
+	if (fd >= 0) close(fd);
+}
+
+static void apk_db_cache_mark(struct apk_database *db)
+{
+	struct foreach_cache_item_ctx ctx = { .db = db, .cb = mark_in_cache, .static_cache = true };
+
+	if (apk_db_cache_active(db)) {
+		foreach_static_cache_item(&ctx);
+		cache_mark_dir(db, db->cache_fd, mark_in_cache,
+			db->ctx->open_flags & (APK_OPENF_WRITE | APK_OPENF_CACHE_WRITE));
+	}
+	// The shared cache is maintained by whoever has write access to it
+	if (db->cache_shared_fd >= 0)
+		cache_mark_dir(db, db->cache_shared_fd, mark_in_shared_cache, false);
+}
+
+// The search index covers the packages of the loaded repositories. Its
+// documents are the names of these packages in sorted order.
+static void search_index_names(struct apk_database *db)
+{
+	unsigned int repos = 0;
+
+	apk_db_foreach_repository(repo, db)
+		if (repo->available) repos |= BIT(repo - db->repos);
+	db->available.search_repos = repos;
+	db->available.search_names = apk_array_reset(db->available.search_names);
+	apk_array_foreach_item(name, apk_db_sorted_names(db)) {
+		apk_array_foreach(p, name->providers) {
+			if (p->pkg->name != name || !(p->pkg->repos & repos)) continue;
+			apk_name_array_add(&db->available.search_names, name);
+			break;
+		}
+	}
+}
+
+// Identifies the loaded repository indexes by their url, and the size
+// and modification time of the file each was loaded from.
+static int search_index_id(struct apk_database *db, struct apk_digest *id)
+{
+	struct apk_digest_ctx dctx;
+	struct stat st;
+	char path[PATH_MAX];
+	const char *fn;
+	int r, fd;
+
+	r = apk_digest_ctx_init(&dctx, APK_DIGEST_SHA256);
+	if (r < 0) return r;
+	apk_db_foreach_repository(repo, db) {
+		if (!repo->available) continue;
+		fd = AT_FDCWD;
+		if (!repo->is_remote) r = apk_fmt(path, sizeof path, BLOB_FMT, BLOB_PRINTF(repo->url_index));
+		else if (!(db->ctx->flags & APK_NO_CACHE)) r = apk_repo_index_cache_url(db, repo, &fd, path, sizeof path);
+		else r = -ENOENT;
+		if (r < 0) break;
+		fn = apk_url_local_file(path, sizeof path);
+		if (!fn || fstatat(fd, fn, &st, 0) != 0) {
+			r = -ENOENT;
+			break;
+		}
+		apk_digest_ctx_update(&dctx, repo->url_index.ptr, repo->url_index.len);
+		apk_digest_ctx_update(&dctx, "", 1);
+		apk_digest_ctx_update(&dctx, &st.st_size, sizeof st.st_size);
+		apk_digest_ctx_update(&dctx, &st.st_mtim, sizeof st.st_mtim);
+	}
+	if (r >= 0) r = apk_digest_ctx_final(&dctx, id);
+	apk_digest_ctx_free(&dctx);
+	return r;
+}
+
+void apk_db_search_index_build(struct apk_database *db)
+{
+	struct apk_trigram_index *ti = &db->available.search_index;
+	struct apk_name_array *names;
+
+	search_index_names(db);
+	names = db->available.search_names;
+	apk_trigram_index_reset(ti);
+	for (uint32_t i = 0; i < apk_array_len(names); i++) {
+		struct apk_name *name = names->item[i];
+		apk_trigram_index_add(ti, i, APK_BLOB_STR(name->name));
+		apk_array_foreach(p, name->providers) {
+			if (p->pkg->name != name || !(p->pkg->repos & db->available.search_repos)) continue;
+			apk_trigram_index_add(ti, i, *p->pkg->description);
+			apk_array_foreach(dep, p->pkg->provides)
+				apk_trigram_index_add(ti, i, APK_BLOB_STR(dep->name->name));
+		}
+	}
+	ti->num_docs = apk_array_len(names);
+	apk_trigram_index_finalize(ti);
+}
+
+// Loads the search index saved in the cache directory if it was built
+// from the repository indexes now loaded
+int apk_db_search_index_load(struct apk_database *db)
+{
+	struct apk_trigram_index *ti = &db->available.search_index;
+	struct apk_digest id;
+	int r;
+
+	if (db->cache_fd < 0) return -ENOENT;
+	r = search_index_id(db, &id);
+	if (r < 0) return r;
+	r = apk_trigram_index_read(ti, apk_istream_from_file(db->cache_fd, APK_SEARCH_INDEX), &id);
+	if (r < 0) return r;
+	search_index_names(db);
+	if (ti->num_docs != apk_array_len(db->available.search_names)) {
+		apk_trigram_index_reset(ti);
+		return -APKE_FORMAT_INVALID;
+	}
+	return 0;
+}
+
+// Rebuilds the saved search index when the repository indexes it was
+// built from have changed
+static void apk_db_search_index_update(struct apk_database *db)
+{
+	struct apk_out *out = &db->ctx->out;
+	struct apk_digest id;
+	int r;
+
+	if (db->cache_fd < 0 || search_index_id(db, &id) < 0) return;
+	r = apk_trigram_index_check(apk_istream_from_file(db->cache_fd, APK_SEARCH_INDEX), &id);
+	if (r == 0) return;
+
+	apk_db_search_index_build(db);
+	r = apk_trigram_index_write(&db->available.search_index,
+		apk_ostream_to_file(db->cache_fd, APK_SEARCH_INDEX, 0644), &id);
+	if (r < 0) apk_dbg(out, "search index not written: %s", apk_error_str(r));
+}
+
+int apk_db_open(struct apk_database *db)
+{
+	struct apk_ctx *ac = db->ctx;
+	struct apk_out *out = &ac->out;
+	const char *msg = NULL;
+	int r = -1, i;
+
+	apk_default_acl_dir = apk_db_acl_atomize(db, 0755, 0, 0);
+	apk_default_acl_file = apk_db_acl_atomize(db, 0644, 0, 0);
+	if (ac->open_flags == 0) {
+		msg = "Invalid open flags (internal error)";
+		goto ret_r;
+	}
+	if ((ac->open_flags & APK_OPENF_WRITE) &&
+	    !(ac->open_flags & APK_OPENF_NO_AUTOUPDATE) &&
+	    !(ac->flags & APK_NO_NETWORK))
+		db->autoupdate = 1;
+
+	setup_cache_repository(db, APK_BLOB_STR(ac->cache_dir));
+	db->root_fd = apk_ctx_fd_root(ac);
+	db->root_tmpfs = (ac->root_tmpfs == APK_AUTO) ? detect_tmpfs(db->root_fd) : ac->root_tmpfs;
+	db->usermode = !!(ac->open_flags & APK_OPENF_USERMODE);
+
+	if (!(ac->open_flags & APK_OPENF_CREATE)) {
+		// Autodetect usermode from the installeddb owner
+		struct stat st;
+		if (fstatat(db->root_fd, apk_db_layer_name(APK_DB_LAYER_ROOT), &st, 0) == 0 &&
+		    st.st_uid != 0)
+			db->usermode = 1;
+	}
+	if (db->usermode) db->extract_flags |= APK_FSEXTRACTF_NO_CHOWN | APK_FSEXTRACTF_NO_SYS_XATTRS | APK_FSEXTRACTF_NO_DEVICES;
 
 	setup_uvol_target(db);
 
@@ -2110,6 +3124,13 @@ int apk_db_open(struct apk_database *db)
 			msg = "Unable to setup the cache";
 			goto ret_r;
 		}
+		if (ac->cache_shared_dir) {
+			db->cache_shared_fd = openat(db->root_fd, ac->cache_shared_dir, O_DIRECTORY | O_RDONLY | O_CLOEXEC);
+			if (db->cache_shared_fd < 0) {
+				apk_warn(out, "Unable to open shared cache %s: %s", ac->cache_shared_dir, apk_error_str(-errno));
+				db->cache_shared_fd = -APKE_CACHE_NOT_AVAILABLE;
+			}
+		}
 	}
 
 	if (db->ctx->flags & APK_OVERLAY_FROM_STDIN) {
@@ -2117,9 +3138,17 @@ int apk_db_open(struct apk_database *db)
 		apk_db_read_overlay(db, apk_istream_from_fd(STDIN_FILENO));
 	}
 
+	// Fork the script executor while the process is still small
+	if ((ac->open_flags & APK_OPENF_WRITE) && !(ac->flags & (APK_NO_SCRIPTS | APK_SIMULATE))) {
+		r = apk_executor_start(&db->executor, script_executor_setup, db);
+		if (r < 0) apk_dbg(out, "script executor not available: %s", apk_error_str(r));
+	}
+
 	if ((db->ctx->open_flags & APK_OPENF_NO_STATE) != APK_OPENF_NO_STATE) {
 		for (i = 0; i < APK_DB_LAYER_NUM; i++) {
+			uint64_t trace_start = apk_trace_begin(&ac->trace);
 			r = apk_db_read_layer(db, i);
+			apk_trace_end(&ac->trace, trace_start, "db", "read %s", apk_db_layer_name(i));
 			if (r) {
 				if (i != APK_DB_LAYER_ROOT) continue;
 				if (!(r == -ENOENT && (ac->open_flags & APK_OPENF_CREATE))) {
@@ -2163,7 +3192,16 @@ int apk_db_open(struct apk_database *db)
 			add_repos_from_file(db, AT_FDCWD, NULL, ac->repositories_file);
 		}
 	}
+	// Send the conditional requests of all stale indexes before loading
+	// any, so that they are all revalidated with one round trip
+	if (!(db->ctx->flags & APK_NO_CACHE)) {
+		for (i = 0; i < db->num_repos; i++) {
+			struct apk_repository *repo = &db->repos[i];
+			if (repo->is_remote && repo->stale) apk_cache_prefetch_index(db, repo);
+		}
+	}
 	for (i = 0; i < db->num_repos; i++) open_repository(db, i);
+	apk_io_url_prefetch_end();
 	apk_out_progress_note(out, NULL);
 
 	if (!(ac->open_flags & APK_OPENF_NO_SYS_REPOS) && db->repositories.updated > 0)
@@ -2171,8 +3209,12 @@ int apk_db_open(struct apk_database *db)
 
 	apk_hash_foreach(&db->available.names, apk_db_name_rdepends, db);
 
-	if (apk_db_cache_active(db) && (ac->open_flags & (APK_OPENF_NO_REPOS|APK_OPENF_NO_INSTALLED)) == 0)
-		apk_db_cache_foreach_item(db, mark_in_cache);
+	if ((apk_db_cache_active(db) || db->cache_shared_fd >= 0) &&
+	    (ac->open_flags & (APK_OPENF_NO_REPOS|APK_OPENF_NO_INSTALLED)) == 0)
+		apk_db_cache_mark(db);
+
+	if ((ac->open_flags & (APK_OPENF_WRITE | APK_OPENF_CACHE_WRITE)) && !(ac->open_flags & APK_OPENF_NO_REPOS))
+		apk_db_search_index_update(db);
 
 	db->open_complete = 1;
 
@@ -2205,16 +3247,128 @@ struct write_ctx {
 	int fd;
 };
 
+static void apk_db_owners_add(struct apk_ownerdb_writer *w, struct apk_installed_package *ipkg)
+{
+	struct apk_package *pkg = ipkg->pkg;
+	char buf[PATH_MAX];
+	uint32_t ndx;
+
+	ndx = apk_ownerdb_writer_add_pkg(w, pkg->digest_alg, apk_pkg_digest_blob(pkg));
+	apk_array_foreach_item(diri, ipkg->diris) {
+		struct apk_db_dir *dir = diri->dir;
+		if (dir->owner == diri)
+			apk_ownerdb_writer_add(w, ndx, APK_BLOB_PTR_LEN(dir->name, dir->namelen), APK_OWNERDB_DIR);
+		apk_array_foreach_item(file, diri->files) {
+			if (file->audited) continue;
+			apk_ownerdb_writer_add(w, ndx, apk_blob_fmt(buf, sizeof buf, DIR_FILE_FMT, DIR_FILE_PRINTF(dir, file)), 0);
+		}
+	}
+}
+
+static int apk_db_owners_write(struct apk_ownerdb_writer *w, int fd)
+{
+	struct stat st;
+
+	if (fstatat(fd, "installed", &st, 0) < 0) return -errno;
+	return apk_ownerdb_writer_write(w, apk_ostream_to_file(fd, "owners", 0644), &st);
+}
+
+static int apk_db_scripts_idx_write(struct apk_scriptdb_writer *w, int fd, bool scripts_tar)
+{
+	struct stat st;
+
+	if (fstatat(fd, scripts_tar ? "scripts.tar" : "scripts.tar.gz", &st, 0) < 0) return -errno;
+	return apk_scriptdb_writer_write(w, apk_ostream_to_file(fd, "scripts.idx", 0644), &st);
+}
+
+static int apk_db_journal_write(struct apk_database *db, unsigned layer, struct apk_package_array *pkgs, int fd)
+{
+	struct apk_db_journal *dj = &db->installed.journal[layer];
+	struct apk_journal_writer w;
+	struct apk_digest d;
+	struct stat st;
+	apk_blob_t script;
+	bool changed;
+	int r;
+
+	if (!dj->active) return -ENOTSUP;
+	if (fstatat(fd, "installed", &st, 0) < 0) return -errno;
+
+	apk_journal_writer_init(&w);
+	apk_array_foreach_item(pkg, dj->pkgs) {
+		if (pkg->ipkg) continue;
+		apk_journal_writer_begin(&w, APK_JOURNAL_DEL, 0, apk_pkg_hash_blob(pkg));
+		apk_journal_writer_end(&w, true);
+	}
+	apk_array_foreach_item(pkg, pkgs) {
+		struct apk_installed_package *ipkg = pkg->ipkg;
+		if (pkg->layer != layer) continue;
+
+		/* Serialize the entry and keep it only if it changed */
+		apk_db_fdb_write(db, ipkg, apk_journal_writer_begin(&w, APK_JOURNAL_PKG, 0, apk_pkg_hash_blob(pkg)));
+		apk_digest_calc(&d, APK_DIGEST_SHA1, apk_journal_writer_data(&w).ptr, apk_journal_writer_data(&w).len);
+		changed = !ipkg->fdb_hashed || memcmp(ipkg->fdb_hash, d.data, sizeof ipkg->fdb_hash) != 0;
+		apk_journal_writer_end(&w, changed);
+		if (!changed) continue;
+
+		memcpy(ipkg->fdb_hash, d.data, sizeof ipkg->fdb_hash);
+		ipkg->fdb_hashed = 1;
+		for (int i = 0; i < APK_SCRIPT_MAX; i++) {
+			script = apk_db_ipkg_script(db, ipkg, i);
+			if (!script.ptr) continue;
+			apk_ostream_write_blob(apk_journal_writer_begin(&w, APK_JOURNAL_SCRIPT, i, apk_pkg_hash_blob(pkg)), script);
+			apk_journal_writer_end(&w, true);
+		}
+	}
+
+	r = apk_ostream_error(&w.os);
+	if (r || w.len == 0) goto done;
+	if (dj->len + w.len > dj->limit) {
+		r = -EFBIG;
+		goto done;
+	}
+	r = apk_journal_writer_commit(&w, fd, "journal", &dj->len, &st);
+	if (r == 0) {
+		apk_array_truncate(dj->pkgs, 0);
+		apk_array_foreach_item(pkg, pkgs)
+			if (pkg->layer == layer) apk_package_array_add(&dj->pkgs, pkg);
+	}
+done:
+	// Entry hashes were updated above, so do not journal again on failure
+	if (r) dj->active = 0;
+	apk_journal_writer_free(&w);
+	return r;
+}
+
+static void apk_db_journal_reset(struct apk_database *db, unsigned layer, int fd)
+{
+	struct apk_db_journal *dj = &db->installed.journal[layer];
+
+	// The journal no longer matches the rewritten installed database.
+	// Entry hashes are not updated, so do not journal again.
+	if (dj->len) unlinkat(fd, "journal", 0);
+	dj->len = 0;
+	dj->active = 0;
+}
+
 static int apk_db_write_layers(struct apk_database *db)
 {
 	struct layer_data {
 		int fd;
+		bool journaled;
 		struct apk_ostream *installed, *scripts, *triggers;
+		struct apk_ownerdb_writer owners;
+		struct apk_scriptdb_writer scripts_idx;
 	} layers[APK_DB_LAYER_NUM] = {0};
 	struct apk_ostream *os;
 	struct apk_package_array *pkgs;
 	int i, r, rr = 0;
 
+	for (i = 0; i < APK_DB_LAYER_NUM; i++) {
+		apk_ownerdb_writer_init(&layers[i].owners);
+		apk_scriptdb_writer_init(&layers[i].scripts_idx);
+	}
+	pkgs = apk_db_sorted_installed_packages(db);
 	for (i = 0; i < APK_DB_LAYER_NUM; i++) {
 		struct layer_data *ld = &layers[i];
 		if (!(db->active_layers & BIT(i))) {
@@ -2224,13 +3378,13 @@ static int apk_db_write_layers(struct apk_database *db)
 
 		ld->fd = openat(db->root_fd, apk_db_layer_name(i), O_DIRECTORY | O_RDONLY | O_CLOEXEC);
 		if (ld->fd < 0) {
-			if (i == APK_DB_LAYER_ROOT) return -errno;
+			if (i == APK_DB_LAYER_ROOT) {
+				rr = -errno;
+				goto done;
+			}
 			continue;
 		}
-		ld->installed = apk_ostream_to_file(ld->fd, "installed", 0644);
 		ld->triggers  = apk_ostream_to_file(ld->fd, "triggers", 0644);
-		if (db->scripts_tar) ld->scripts = apk_ostream_to_file(ld->fd, "scripts.tar", 0644);
-		else ld->scripts = apk_ostream_gzip(apk_ostream_to_file(ld->fd, "scripts.tar.gz", 0644));
 
 		if (i == APK_DB_LAYER_ROOT)
 			os = apk_ostream_to_file(db->root_fd, apk_world_file, 0644);
@@ -2238,37 +3392,64 @@ static int apk_db_write_layers(struct apk_database *db)
 			os = apk_ostream_to_file(ld->fd, "world", 0644);
 		if (IS_ERR(os)) {
 			if (!rr) rr = PTR_ERR(os);
+		} else {
+			apk_deps_write_layer(db, db->world, os, APK_BLOB_PTR_LEN("\n", 1), i);
+			apk_ostream_write(os, "\n", 1);
+			r = apk_ostream_close(os);
+			if (!rr) rr = r;
+		}
+
+		// Append changed packages to the journal if possible,
+		// otherwise rewrite the installed database and scripts.
+		r = apk_db_journal_write(db, i, pkgs, ld->fd);
+		if (r == 0) {
+			apk_dbg(&db->ctx->out, "%s: journal updated", apk_db_layer_name(i));
+			ld->journaled = true;
 			continue;
 		}
-		apk_deps_write_layer(db, db->world, os, APK_BLOB_PTR_LEN("\n", 1), i);
-		apk_ostream_write(os, "\n", 1);
-		r = apk_ostream_close(os);
-		if (!rr) rr = r;
+		if (r != -ENOTSUP) apk_dbg(&db->ctx->out, "%s: rewriting installed database: %s",
+			apk_db_layer_name(i), apk_error_str(r));
+		ld->installed = apk_ostream_to_file(ld->fd, "installed", 0644);
+		if (db->scripts_tar) ld->scripts = apk_ostream_to_file(ld->fd, "scripts.tar", 0644);
+		else ld->scripts = apk_ostream_gzip(apk_ostream_to_file(ld->fd, "scripts.tar.gz", 0644));
 	}
 
-	pkgs = apk_db_sorted_installed_packages(db);
 	apk_array_foreach_item(pkg, pkgs) {
 		struct layer_data *ld = &layers[pkg->layer];
 		if (ld->fd < 0) continue;
-		apk_db_fdb_write(db, pkg->ipkg, ld->installed);
-		apk_db_scriptdb_write(db, pkg->ipkg, ld->scripts);
 		apk_db_triggers_write(db, pkg->ipkg, ld->triggers);
+		if (ld->journaled) continue;
+		apk_db_fdb_write(db, pkg->ipkg, ld->installed);
+		apk_db_scriptdb_write(db, pkg->ipkg, ld->scripts, &ld->scripts_idx);
+		apk_db_owners_add(&ld->owners, pkg->ipkg);
 	}
 
 	for (i = 0; i < APK_DB_LAYER_NUM; i++) {
 		struct layer_data *ld = &layers[i];
-		if (!(db->active_layers & BIT(i))) continue;
+		if (ld->fd < 0) continue;
 
-		if (!IS_ERR(ld->installed))
-			r = apk_ostream_close(ld->installed);
-		else	r = PTR_ERR(ld->installed);
-		if (!rr) rr = r;
+		if (!ld->journaled) {
+			if (!IS_ERR(ld->installed))
+				r = apk_ostream_close(ld->installed);
+			else	r = PTR_ERR(ld->installed);
+			if (!rr) rr = r;
+
+			// The owner index is keyed to the installed file written above.
+			// It is only an accelerator, so failing to write it is not fatal.
+			if (r == 0) {
+				apk_db_owners_write(&ld->owners, ld->fd);
+				apk_db_journal_reset(db, i, ld->fd);
+			}
 
-		if (!IS_ERR(ld->scripts)) {
-			apk_tar_write_entry(ld->scripts, NULL, NULL);
-			r = apk_ostream_close(ld->scripts);
-		} else	r = PTR_ERR(ld->scripts);
-		if (!rr) rr = r;
+			if (!IS_ERR(ld->scripts)) {
+				apk_tar_write_entry(ld->scripts, NULL, NULL);
+				r = apk_ostream_close(ld->scripts);
+			} else	r = PTR_ERR(ld->scripts);
+			if (!rr) rr = r;
+
+			// Likewise the script store is keyed to the scripts archive.
+			if (r == 0) apk_db_scripts_idx_write(&ld->scripts_idx, ld->fd, db->scripts_tar);
+		}
 
 		if (!IS_ERR(ld->triggers))
 			r = apk_ostream_close(ld->triggers);
@@ -2277,6 +3458,11 @@ static int apk_db_write_layers(struct apk_database *db)
 
 		close(ld->fd);
 	}
+done:
+	for (i = 0; i < APK_DB_LAYER_NUM; i++) {
+		apk_ownerdb_writer_free(&layers[i].owners);
+		apk_scriptdb_writer_free(&layers[i].scripts_idx);
+	}
 	return rr;
 }
 
@@ -2332,6 +3518,8 @@ void apk_db_close(struct apk_database *db)
 {
 	struct apk_installed_package *ipkg, *ipkgn;
 
+	apk_executor_stop(&db->executor);
+
 	list_for_each_entry_safe(ipkg, ipkgn, &db->installed.packages, installed_pkgs_list)
 		apk_pkg_uninstall(NULL, ipkg->pkg);
 	apk_protected_path_array_free(&db->protected_paths);
@@ -2345,6 +3533,13 @@ void apk_db_close(struct apk_database *db)
 
 	apk_repoparser_free(&db->repoparser);
 	apk_name_array_free(&db->available.sorted_names);
+	apk_name_array_free(&db->available.search_names);
+	apk_trigram_index_free(&db->available.search_index);
+	for (int i = 0; i < APK_DB_LAYER_NUM; i++) {
+		apk_ownerdb_close(&db->installed.owners[i]);
+		apk_scriptdb_close(&db->installed.scripts[i]);
+		apk_package_array_free(&db->installed.journal[i].pkgs);
+	}
 	apk_package_array_free(&db->installed.sorted_packages);
 	apk_hash_free(&db->available.packages);
 	apk_hash_free(&db->available.names);
@@ -2359,6 +3554,7 @@ void apk_db_close(struct apk_database *db)
 	remount_cache_ro(db);
 
 	if (db->cache_fd >= 0) close(db->cache_fd);
+	if (db->cache_shared_fd >= 0) close(db->cache_shared_fd);
 	if (db->lock_fd >= 0) close(db->lock_fd);
 }
 
@@ -2454,21 +3650,19 @@ static void env_buf_add(struct env_buf *enb, const char *key, const char *val)
 	enb->pos += n + 1;
 }
 
-int apk_db_run_script(struct apk_database *db, const char *hook_type, const char *package_name, int fd, char **argv, const char *logpfx)
+int apk_db_start_script(struct apk_database *db, struct apk_process *p, struct apk_out *out, const char *hook_type, const char *package_name, int fd, char **argv, const char *logpfx)
 {
 	struct env_buf enb;
 	struct apk_ctx *ac = db->ctx;
-	struct apk_out *out = &ac->out;
-	struct apk_process p;
 	int r, env_size_save = apk_array_len(ac->script_environment);
 	char fd_path[NAME_MAX];
 	const char *argv0 = apk_last_path_segment(argv[0]);
 	const char *path = (fd < 0) ? argv[0] : apk_fmts(fd_path, sizeof fd_path, "/proc/self/fd/%d", fd);
 
-	r = apk_process_init(&p, argv[0], logpfx, out, NULL);
+	r = apk_process_init(p, argv[0], logpfx, out, NULL);
 	if (r != 0) {
 		apk_err(out, "%s: process init: %s", argv0, apk_error_str(r));
-		goto err;
+		goto done;
 	}
 
 	enb.arr = &ac->script_environment;
@@ -2477,11 +3671,14 @@ int apk_db_run_script(struct apk_database *db, const char *hook_type, const char
 	if (package_name) env_buf_add(&enb, "APK_PACKAGE", package_name);
 	apk_string_array_add(&ac->script_environment, NULL);
 
-	pid_t pid = apk_process_fork(&p);
+	r = apk_process_exec(p, &db->executor, fd, argv, &ac->script_environment->item[0]);
+	if (r == 0) goto done;
+
+	pid_t pid = apk_process_fork(p);
 	if (pid == -1) {
 		r = -errno;
 		apk_err(out, "%s: fork: %s", argv0, apk_error_str(r));
-		goto err;
+		goto done;
 	}
 	if (pid == 0) {
 		umask(0022);
@@ -2494,57 +3691,25 @@ int apk_db_run_script(struct apk_database *db, const char *hook_type, const char
 		execve(path, argv, envp);
 		script_panic("execve");
 	}
-	r = apk_process_run(&p);
-err:
+	r = 0;
+done:
 	apk_array_truncate(ac->script_environment, env_size_save);
 	return r;
 }
 
-int apk_db_cache_active(struct apk_database *db)
-{
-	return db->cache_fd >= 0 && db->ctx->cache_packages;
-}
-
-struct foreach_cache_item_ctx {
-	struct apk_database *db;
-	apk_cache_item_cb cb;
-	int static_cache;
-};
-
-static int foreach_cache_file(void *pctx, int dirfd, const char *path, const char *filename)
+int apk_db_run_script(struct apk_database *db, const char *hook_type, const char *package_name, int fd, char **argv, const char *logpfx)
 {
-	struct foreach_cache_item_ctx *ctx = (struct foreach_cache_item_ctx *) pctx;
-	struct apk_database *db = ctx->db;
-	struct apk_file_info fi;
+	struct apk_process p;
+	int r;
 
-	if (apk_fileinfo_get(dirfd, filename, 0, &fi, NULL) == 0) {
-		ctx->cb(db, ctx->static_cache, dirfd, filename,
-			apk_db_get_pkg_by_name(db, APK_BLOB_STR(filename),
-				fi.size, db->ctx->default_cachename_spec));
-	}
-	return 0;
+	r = apk_db_start_script(db, &p, &db->ctx->out, hook_type, package_name, fd, argv, logpfx);
+	if (r != 0) return r;
+	return apk_process_run(&p);
 }
 
-int apk_db_cache_foreach_item(struct apk_database *db, apk_cache_item_cb cb)
+int apk_db_cache_active(struct apk_database *db)
 {
-	struct foreach_cache_item_ctx ctx = { .db = db, .cb = cb, .static_cache = true };
-	struct stat st1, st2;
-
-	int fd = openat(db->root_fd, apk_static_cache_dir, O_DIRECTORY | O_RDONLY | O_CLOEXEC);
-	if (fd >= 0) {
-		/* Do not handle static cache as static cache if the explicit
-		 * cache is enabled at the static cache location */
-		int r = 0;
-		if (fstat(fd, &st1) == 0 && fstat(db->cache_fd, &st2) == 0 &&
-		    (st1.st_dev != st2.st_dev || st1.st_ino != st2.st_ino))
-			r = apk_dir_foreach_file(fd, NULL, foreach_cache_file, &ctx, NULL);
-		close(fd);
-		if (r) return r;
-	}
-
-	ctx.static_cache = false;
-	if (db->cache_fd < 0) return db->cache_fd;
-	return apk_dir_foreach_file(db->cache_fd, NULL, foreach_cache_file, &ctx, NULL);
+	return db->cache_fd >= 0 && db->ctx->cache_packages;
 }
 
 int apk_db_permanent(struct apk_database *db)
@@ -2633,6 +3798,29 @@ struct apk_package *apk_db_get_file_owner(struct apk_database *db,
 	return dbf->diri->pkg;
 }
 
+struct apk_package *apk_db_get_indexed_owner(struct apk_database *db, apk_blob_t path)
+{
+	struct apk_digest id;
+	struct apk_package *pkg;
+
+	path = apk_blob_trim_start(path, '/');
+	for (int i = 0; i < APK_DB_LAYER_NUM; i++) {
+		if (apk_ownerdb_lookup(&db->installed.owners[i], path, &id) != 0) continue;
+		pkg = apk_db_get_pkg(db, &id);
+		if (pkg && pkg->ipkg) return pkg;
+	}
+	return NULL;
+}
+
+apk_blob_t apk_db_ipkg_script(struct apk_database *db, struct apk_installed_package *ipkg, unsigned int type)
+{
+	struct apk_package *pkg = ipkg->pkg;
+
+	if (type >= APK_SCRIPT_MAX) return APK_BLOB_NULL;
+	if (ipkg->script[type].ptr) return ipkg->script[type];
+	return apk_scriptdb_lookup(&db->installed.scripts[pkg->layer], apk_pkg_digest_blob(pkg), type);
+}
+
 unsigned int apk_db_get_pinning_mask_repos(struct apk_database *db, unsigned short pinning_mask)
 {
 	unsigned int repository_mask = 0;
@@ -2651,6 +3839,7 @@ struct apk_repository *apk_db_select_repo(struct apk_database *db,
 					  struct apk_package *pkg)
 {
 	if (pkg->cached) return &db->cache_repository;
+	if (pkg->cached_shared) return &db->cache_shared_repository;
 	if (pkg->filename_ndx) return &db->filename_repository;
 
 	/* Pick first repository providing this package */
@@ -3151,6 +4340,7 @@ static int apk_db_unpack_pkg(struct apk_database *db,
 	struct apk_package *pkg = ipkg->pkg;
 	char file_url[PATH_MAX], cache_url[NAME_MAX];
 	int r, file_fd = AT_FDCWD, cache_fd = AT_FDCWD;
+	uint32_t tried = 0;
 	bool need_copy = false;
 
 	repo = apk_db_select_repo(db, pkg);
@@ -3158,11 +4348,29 @@ static int apk_db_unpack_pkg(struct apk_database *db,
 		r = -APKE_PACKAGE_NOT_FOUND;
 		goto err_msg;
 	}
-	r = apk_repo_package_url(db, repo, pkg, &file_fd, file_url, sizeof file_url);
-	if (r < 0) goto err_msg;
 	if (apk_db_cache_active(db) && !pkg->cached && !(pkg->repos & db->local_repos)) need_copy = true;
+	if (need_copy && pkg->cached_shared && apk_cache_link_shared(db, pkg) == 0) {
+		pkg->cached = 1;
+		need_copy = false;
+	} else if (need_copy && apk_array_len(pkg->deltas)) {
+		r = apk_cache_download_delta(db, repo, pkg, NULL);
+		if (r == 0) {
+			need_copy = false;
+			repo = apk_db_select_repo(db, pkg);
+		} else if (r != -ENOENT) {
+			apk_dbg(out, PKG_VER_FMT ": delta not used: %s", PKG_VER_PRINTF(pkg), apk_error_str(r));
+		}
+	}
 
-	is = apk_istream_from_fd_url(file_fd, file_url, apk_db_url_since(db, 0));
+	// The data is extracted as it arrives, so mirrors can be switched
+	// only if the transfer fails to start
+	apk_repo_mirror_select(db, repo, &pkg->mirror, pkg->size);
+	do {
+		r = apk_repo_package_url(db, repo, pkg, &file_fd, file_url, sizeof file_url);
+		if (r == 0) r = apk_repo_mirror_url(db, pkg->mirror, file_url, sizeof file_url);
+		if (r < 0) goto err_msg;
+		is = apk_istream_from_fd_url(file_fd, file_url, apk_db_url_since(db, 0));
+	} while (IS_ERR(is) && apk_repo_mirror_next(db, repo, &pkg->mirror, pkg->size, PTR_ERR(is), 0, &tried));
 	if (IS_ERR(is)) {
 		r = PTR_ERR(is);
 		if (r == -ENOENT && !pkg->filename_ndx)
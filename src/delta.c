@@ -0,0 +1,306 @@
+/* delta.c - Alpine Package Keeper (APK)
+ *
+ * Copyright (C) 2025 Timo Teräs <timo.teras@iki.fi>
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <endian.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "apk_delta.h"
+
+// Matches are searched for with a rolling hash of this many bytes.
+// The base is indexed at block aligned offsets only.
+#define DELTA_BLOCK	32
+#define DELTA_MULT	0x01000193u
+
+static uint32_t block_hash(const uint8_t *p)
+{
+	uint32_t h = 0;
+	for (int i = 0; i < DELTA_BLOCK; i++) h = h * DELTA_MULT + p[i];
+	return h;
+}
+
+static int write_op(struct apk_ostream *os, uint8_t op, uint64_t a, uint64_t b, int nargs)
+{
+	uint8_t buf[1 + 2 * 10], *p = buf;
+	uint64_t args[2] = { a, b };
+
+	*p++ = op;
+	for (int i = 0; i < nargs; i++) {
+		uint64_t v = args[i];
+		do {
+			*p = v & 0x7f;
+			v >>= 7;
+			if (v) *p |= 0x80;
+			p++;
+		} while (v);
+	}
+	return apk_ostream_write(os, buf, p - buf);
+}
+
+static void write_data(struct apk_ostream *os, const uint8_t *data, size_t len)
+{
+	if (!len) return;
+	write_op(os, APK_DELTA_OP_DATA, len, 0, 1);
+	apk_ostream_write(os, data, len);
+}
+
+// Writes a delta rebuilding 'target' from 'base'. Takes ownership of 'os'.
+int apk_delta_create(struct apk_ostream *os, apk_blob_t base, apk_blob_t target,
+	const struct apk_digest *base_id, const struct apk_digest *target_id, unsigned int flags)
+{
+	const uint8_t *b = (const uint8_t *) base.ptr, *t = (const uint8_t *) target.ptr;
+	struct apk_delta_header hdr = {
+		.version = APK_DELTA_VERSION,
+		.flags = flags,
+		.base_size = htole64(base.len),
+		.target_size = htole64(target.len),
+	};
+	struct apk_digest d;
+	uint32_t *table, mask, h = 0, mult_top = 1;
+	size_t nblocks = base.len / DELTA_BLOCK, tsize = 1024, pos = 0, lit = 0;
+
+	if (IS_ERR(os)) return PTR_ERR(os);
+	if (base_id->len < APK_DIGEST_LENGTH_SHA256 || target_id->len < APK_DIGEST_LENGTH_SHA256)
+		return apk_ostream_close_error(os, -EINVAL);
+	if (apk_digest_calc(&d, APK_DIGEST_SHA256, base.ptr, base.len) < 0)
+		return apk_ostream_close_error(os, -APKE_CRYPTO_ERROR);
+	memcpy(hdr.magic, APK_DELTA_MAGIC, sizeof hdr.magic);
+	memcpy(hdr.base_sha256, d.data, sizeof hdr.base_sha256);
+	memcpy(hdr.base_id, base_id->data, sizeof hdr.base_id);
+	memcpy(hdr.target_id, target_id->data, sizeof hdr.target_id);
+	apk_ostream_write(os, &hdr, sizeof hdr);
+
+	while (tsize < 2 * nblocks) tsize <<= 1;
+	table = calloc(tsize, sizeof *table);
+	if (!table) return apk_ostream_close_error(os, -ENOMEM);
+	mask = tsize - 1;
+	for (size_t i = nblocks; i > 0; i--)
+		table[block_hash(&b[(i - 1) * DELTA_BLOCK]) & mask] = i;
+	for (int i = 1; i < DELTA_BLOCK; i++) mult_top *= DELTA_MULT;
+
+	if (target.len >= DELTA_BLOCK) h = block_hash(t);
+	while (pos + DELTA_BLOCK <= target.len) {
+		uint32_t ndx = table[h & mask];
+		if (ndx && memcmp(&b[(ndx - 1) * DELTA_BLOCK], &t[pos], DELTA_BLOCK) == 0) {
+			size_t boff = (ndx - 1) * DELTA_BLOCK, len = DELTA_BLOCK;
+			while (pos > lit && boff > 0 && b[boff - 1] == t[pos - 1]) pos--, boff--, len++;
+			while (boff + len < base.len && pos + len < target.len && b[boff + len] == t[pos + len]) len++;
+			write_data(os, &t[lit], pos - lit);
+			write_op(os, APK_DELTA_OP_COPY, boff, len, 2);
+			pos += len;
+			lit = pos;
+			if (pos + DELTA_BLOCK <= target.len) h = block_hash(&t[pos]);
+			continue;
+		}
+		if (pos + DELTA_BLOCK < target.len)
+			h = (h - t[pos] * mult_top) * DELTA_MULT + t[pos + DELTA_BLOCK];
+		pos++;
+	}
+	free(table);
+	write_data(os, &t[lit], target.len - lit);
+	write_op(os, APK_DELTA_OP_END, 0, 0, 0);
+	return apk_ostream_close(os);
+}
+
+int apk_delta_read_header(struct apk_istream *is, struct apk_delta_header *hdr)
+{
+	int r = apk_istream_read(is, hdr, sizeof *hdr);
+	if (r == -APKE_EOF) return -APKE_DELTA_FORMAT;
+	if (r < 0) return r;
+	if (memcmp(hdr->magic, APK_DELTA_MAGIC, sizeof hdr->magic) != 0 ||
+	    hdr->version != APK_DELTA_VERSION)
+		return -APKE_DELTA_FORMAT;
+	hdr->base_size = le64toh(hdr->base_size);
+	hdr->target_size = le64toh(hdr->target_size);
+	return 0;
+}
+
+struct apk_delta_istream {
+	struct apk_istream is;
+	struct apk_istream *delta;
+	apk_blob_t base;
+	uint64_t copy_offset, copy_left, data_left;
+	uint64_t target_left;
+	struct apk_digest_ctx dctx;
+	uint8_t target_hash[APK_DIGEST_LENGTH_SHA256];
+	bool done, verify_hash;
+};
+
+static int delta_get_uleb(struct apk_istream *is, uint64_t *val)
+{
+	uint8_t b;
+	int r;
+
+	*val = 0;
+	for (int shift = 0; shift < 64; shift += 7) {
+		r = apk_istream_read(is, &b, 1);
+		if (r < 0) return r == -APKE_EOF ? -APKE_DELTA_FORMAT : r;
+		*val |= (uint64_t)(b & 0x7f) << shift;
+		if (!(b & 0x80)) return 0;
+	}
+	return -APKE_DELTA_FORMAT;
+}
+
+static void delta_get_meta(struct apk_istream *is, struct apk_file_meta *meta)
+{
+	struct apk_delta_istream *dis = container_of(is, struct apk_delta_istream, is);
+	apk_istream_get_meta(dis->delta, meta);
+}
+
+static ssize_t delta_read(struct apk_istream *is, void *ptr, size_t size)
+{
+	struct apk_delta_istream *dis = container_of(is, struct apk_delta_istream, is);
+	uint64_t offset, len;
+	ssize_t n;
+	uint8_t op;
+	int r;
+
+	while (!dis->done) {
+		if (dis->copy_left) {
+			n = min(size, dis->copy_left);
+			memcpy(ptr, dis->base.ptr + dis->copy_offset, n);
+			dis->copy_offset += n;
+			dis->copy_left -= n;
+			if (dis->verify_hash) apk_digest_ctx_update(&dis->dctx, ptr, n);
+			return n;
+		}
+		if (dis->data_left) {
+			n = apk_istream_read_max(dis->delta, ptr, min(size, dis->data_left));
+			if (n == 0) return -APKE_DELTA_FORMAT;
+			if (n < 0) return n;
+			dis->data_left -= n;
+			if (dis->verify_hash) apk_digest_ctx_update(&dis->dctx, ptr, n);
+			return n;
+		}
+
+		r = apk_istream_read(dis->delta, &op, 1);
+		if (r < 0) return r == -APKE_EOF ? -APKE_DELTA_FORMAT : r;
+		switch (op) {
+		case APK_DELTA_OP_END:
+			if (dis->target_left) return -APKE_DELTA_FORMAT;
+			if (dis->verify_hash) {
+				struct apk_digest d;
+				if (apk_digest_ctx_final(&dis->dctx, &d) < 0 ||
+				    memcmp(d.data, dis->target_hash, sizeof dis->target_hash) != 0)
+					return -APKE_FILE_INTEGRITY;
+			}
+			dis->done = true;
+			break;
+		case APK_DELTA_OP_COPY:
+			if ((r = delta_get_uleb(dis->delta, &offset)) < 0 ||
+			    (r = delta_get_uleb(dis->delta, &len)) < 0)
+				return r;
+			if (offset > dis->base.len || len > dis->base.len - offset || len > dis->target_left)
+				return -APKE_DELTA_FORMAT;
+			dis->copy_offset = offset;
+			dis->copy_left = len;
+			dis->target_left -= len;
+			break;
+		case APK_DELTA_OP_DATA:
+			if ((r = delta_get_uleb(dis->delta, &len)) < 0) return r;
+			if (len > dis->target_left) return -APKE_DELTA_FORMAT;
+			dis->data_left = len;
+			dis->target_left -= len;
+			break;
+		default:
+			return -APKE_DELTA_FORMAT;
+		}
+	}
+	return 0;
+}
+
+static int delta_close(struct apk_istream *is)
+{
+	struct apk_delta_istream *dis = container_of(is, struct apk_delta_istream, is);
+	int r;
+
+	munmap(dis->base.ptr, dis->base.len);
+	if (dis->verify_hash) apk_digest_ctx_free(&dis->dctx);
+	r = apk_istream_close_error(dis->delta, is->err);
+	free(dis);
+	return r < 0 ? r : 0;
+}
+
+static const struct apk_istream_ops delta_istream_ops = {
+	.get_meta = delta_get_meta,
+	.read = delta_read,
+	.close = delta_close,
+};
+
+// Returns a stream of the package rebuilt by applying 'delta' to the
+// package file 'base_fd'. The delta is rejected unless it was made against
+// the exact base file, and is for the target identity 'target_id'. With a
+// null 'target_id' the delta must be of whole files, and the output is
+// verified against the target hash it declares.
+// Takes ownership of 'delta' and 'base_fd'.
+struct apk_istream *apk_istream_delta(struct apk_istream *delta, int base_fd, apk_blob_t target_id)
+{
+	struct apk_delta_istream *dis = NULL;
+	struct apk_delta_header hdr;
+	struct apk_digest d;
+	struct stat st;
+	void *base = MAP_FAILED;
+	int r;
+
+	if (IS_ERR(delta)) {
+		r = PTR_ERR(delta);
+		delta = NULL;
+		goto err;
+	}
+	r = apk_delta_read_header(delta, &hdr);
+	if (r < 0) goto err;
+	r = -APKE_DELTA_MISMATCH;
+	if (APK_BLOB_IS_NULL(target_id)) {
+		if (!(hdr.flags & APK_DELTA_F_FILE_HASH)) goto err;
+	} else if (target_id.len < APK_DIGEST_LENGTH_SHA1 || target_id.len > sizeof hdr.target_id ||
+		   memcmp(hdr.target_id, target_id.ptr, target_id.len) != 0) {
+		goto err;
+	}
+	if (fstat(base_fd, &st) < 0 || st.st_size != hdr.base_size || !st.st_size) goto err;
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, base_fd, 0);
+	if (base == MAP_FAILED) {
+		r = -errno;
+		goto err;
+	}
+	if (apk_digest_calc(&d, APK_DIGEST_SHA256, base, st.st_size) < 0 ||
+	    memcmp(d.data, hdr.base_sha256, sizeof hdr.base_sha256) != 0)
+		goto err;
+
+	dis = malloc(sizeof *dis + apk_io_bufsize);
+	if (!dis) {
+		r = -ENOMEM;
+		goto err;
+	}
+	*dis = (struct apk_delta_istream) {
+		.is.ops = &delta_istream_ops,
+		.is.buf = (uint8_t *)(dis + 1),
+		.is.buf_size = apk_io_bufsize,
+		.is.ptr = (uint8_t *)(dis + 1),
+		.is.end = (uint8_t *)(dis + 1),
+		.delta = delta,
+		.base = APK_BLOB_PTR_LEN(base, st.st_size),
+		.target_left = hdr.target_size,
+		.verify_hash = hdr.flags & APK_DELTA_F_FILE_HASH,
+	};
+	memcpy(dis->target_hash, hdr.target_id, sizeof dis->target_hash);
+	if (dis->verify_hash && apk_digest_ctx_init(&dis->dctx, APK_DIGEST_SHA256) < 0) {
+		free(dis);
+		r = -APKE_CRYPTO_ERROR;
+		goto err;
+	}
+	close(base_fd);
+	return &dis->is;
+err:
+	if (base != MAP_FAILED) munmap(base, st.st_size);
+	if (delta) apk_istream_close(delta);
+	close(base_fd);
+	return ERR_PTR(r);
+}
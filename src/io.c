@@ -16,6 +16,7 @@
 #include <stdarg.h>
 #include <stdint.h>
 #include <sys/mman.h>
+#include <sys/random.h>
 #include <sys/stat.h>
 #include <pwd.h>
 #include <grp.h>
@@ -24,6 +25,7 @@
 #include "apk_io.h"
 #include "apk_crypto.h"
 #include "apk_xattr.h"
+#include "apk_trace.h"
 
 #if defined(__GLIBC__) || defined(__UCLIBC__)
 #define HAVE_FGETPWENT_R
@@ -619,11 +621,259 @@ struct apk_istream *apk_istream_from_fd(int fd)
 	return &fis->is;
 }
 
+// URL transfers go through a governor that keeps the fleet of clients
+// from overloading the mirrors: the first transfer is delayed by a random
+// time, all transfers share one rate limit, and each finished transfer is
+// reported.
+static uint64_t url_rate, url_rate_start, url_rate_bytes;
+static unsigned int url_jitter;
+static void (*url_transfer_callback)(const struct apk_url_transfer *);
+
+struct apk_url_istream {
+	struct apk_istream is;
+	struct apk_istream *inner;
+	struct apk_url_transfer t;
+	char url[];
+};
+
+static void url_sleep(uint64_t usec)
+{
+	struct timespec ts = {
+		.tv_sec = usec / 1000000,
+		.tv_nsec = (usec % 1000000) * 1000,
+	};
+	while (nanosleep(&ts, &ts) < 0 && errno == EINTR);
+}
+
+static void url_start(void)
+{
+	uint32_t delay;
+
+	if (!url_jitter) return;
+	if (getrandom(&delay, sizeof delay, 0) != sizeof delay)
+		delay = getpid() ^ time(NULL);
+	url_sleep((uint64_t)(delay % (url_jitter * 1000)) * 1000);
+	url_jitter = 0;
+}
+
+static void url_throttle(size_t bytes)
+{
+	uint64_t now = apk_trace_now(), due;
+
+	// time spent idle or on a slow link does not build up credit
+	if (now > url_rate_start + url_rate_bytes * 1000000 / url_rate) {
+		url_rate_start = now;
+		url_rate_bytes = 0;
+	}
+	url_rate_bytes += bytes;
+	due = url_rate_start + url_rate_bytes * 1000000 / url_rate;
+	if (due > now) url_sleep(due - now);
+}
+
+static void url_get_meta(struct apk_istream *is, struct apk_file_meta *meta)
+{
+	struct apk_url_istream *uis = container_of(is, struct apk_url_istream, is);
+	apk_istream_get_meta(uis->inner, meta);
+}
+
+static ssize_t url_read(struct apk_istream *is, void *ptr, size_t size)
+{
+	struct apk_url_istream *uis = container_of(is, struct apk_url_istream, is);
+	ssize_t r;
+
+	// read in slices of about 1/8 s to keep the rate smooth
+	if (url_rate) size = min(size, max(url_rate / 8, 4096));
+	r = uis->inner->ops->read(uis->inner, ptr, size);
+	if (r <= 0) return r;
+	uis->t.bytes += r;
+	if (url_rate) url_throttle(r);
+	return r;
+}
+
+static int url_close(struct apk_istream *is)
+{
+	struct apk_url_istream *uis = container_of(is, struct apk_url_istream, is);
+	int r;
+
+	r = apk_istream_close_error(uis->inner, is->err);
+	uis->t.duration = apk_trace_now() - uis->t.start;
+	uis->t.error = r;
+	if (url_transfer_callback) url_transfer_callback(&uis->t);
+	free(uis);
+	return r;
+}
+
+static const struct apk_istream_ops url_istream_ops = {
+	.get_meta = url_get_meta,
+	.read = url_read,
+	.close = url_close,
+};
+
+static struct apk_istream *url_istream(const char *url, struct apk_istream *is, uint64_t start)
+{
+	struct apk_url_istream *uis;
+	struct apk_url_transfer t = {
+		.url = url,
+		.start = start,
+		.latency = apk_trace_now() - start,
+	};
+
+	if (!url_rate && !url_transfer_callback) return is;
+	if (IS_ERR(is)) {
+		t.duration = t.latency;
+		t.error = PTR_ERR(is);
+		if (url_transfer_callback) url_transfer_callback(&t);
+		return is;
+	}
+	uis = malloc(sizeof *uis + strlen(url) + 1);
+	if (!uis) {
+		apk_istream_close(is);
+		return ERR_PTR(-ENOMEM);
+	}
+	*uis = (struct apk_url_istream) {
+		.is.ops = &url_istream_ops,
+		.is.buf = is->buf,
+		.is.buf_size = is->buf_size,
+		.is.ptr = is->ptr,
+		.is.end = is->end,
+		.inner = is,
+		.t = t,
+	};
+	uis->t.url = strcpy(uis->url, url);
+	return &uis->is;
+}
+
+void apk_url_set_rate_limit(uint64_t bytes_per_sec)
+{
+	url_rate = bytes_per_sec;
+}
+
+void apk_url_set_start_jitter(unsigned int max_seconds)
+{
+	url_jitter = max_seconds;
+}
+
+void apk_url_set_transfer_callback(void (*cb)(const struct apk_url_transfer *))
+{
+	url_transfer_callback = cb;
+}
+
 struct apk_istream *apk_istream_from_fd_url_if_modified(int atfd, const char *url, time_t since)
 {
 	const char *fn = apk_url_local_file(url, PATH_MAX);
+	uint64_t start;
+
 	if (fn != NULL) return apk_istream_from_file(atfd, fn);
-	return apk_io_url_istream(url, since);
+	url_start();
+	start = apk_trace_now();
+	return url_istream(url, apk_io_url_istream(url, since), start);
+}
+
+// Requests the data starting at *offset. On return *offset is where the
+// stream actually starts, which is zero if the source does not support
+// ranges or the file is not longer than the offset.
+struct apk_istream *apk_istream_from_fd_url_offset(int atfd, const char *url, time_t since, uint64_t *offset)
+{
+	const char *fn = apk_url_local_file(url, PATH_MAX);
+	struct stat st;
+	uint64_t start;
+	int fd;
+
+	if (fn != NULL) {
+		if (atfd_error(atfd)) return ERR_PTR(atfd);
+		fd = openat(atfd, fn, O_RDONLY | O_CLOEXEC);
+		if (fd < 0) return ERR_PTR(-errno);
+		if (fstat(fd, &st) < 0 || *offset >= (uint64_t)st.st_size ||
+		    lseek(fd, *offset, SEEK_SET) < 0)
+			*offset = 0;
+		return apk_istream_from_fd(fd);
+	}
+	url_start();
+	start = apk_trace_now();
+	return url_istream(url, apk_io_url_istream_offset(url, since, offset), start);
+}
+
+// Announces that the URL is going to be opened soon, so the transfer can
+// be requested along with the preceding ones.
+void apk_url_prefetch(const char *url, time_t since)
+{
+	if (apk_url_local_file(url, PATH_MAX) != NULL) return;
+	url_start();
+	apk_io_url_prefetch(url, since);
+}
+
+struct apk_concat_istream {
+	struct apk_istream is;
+	struct apk_istream *first, *second;
+};
+
+static void concat_get_meta(struct apk_istream *is, struct apk_file_meta *meta)
+{
+	struct apk_concat_istream *cis = container_of(is, struct apk_concat_istream, is);
+	apk_istream_get_meta(cis->second, meta);
+}
+
+static ssize_t concat_read(struct apk_istream *is, void *ptr, size_t size)
+{
+	struct apk_concat_istream *cis = container_of(is, struct apk_concat_istream, is);
+	ssize_t r;
+
+	if (cis->first) {
+		r = apk_istream_read_max(cis->first, ptr, size);
+		if (r != 0) return r;
+		r = apk_istream_close(cis->first);
+		cis->first = NULL;
+		if (r < 0) return r;
+	}
+	return apk_istream_read_max(cis->second, ptr, size);
+}
+
+static int concat_close(struct apk_istream *is)
+{
+	struct apk_concat_istream *cis = container_of(is, struct apk_concat_istream, is);
+	int r;
+
+	if (cis->first) apk_istream_close(cis->first);
+	r = apk_istream_close_error(cis->second, is->err);
+	free(cis);
+	return r;
+}
+
+static const struct apk_istream_ops concat_istream_ops = {
+	.get_meta = concat_get_meta,
+	.read = concat_read,
+	.close = concat_close,
+};
+
+// Returns a stream reading 'first' and then 'second'. Takes ownership of both.
+struct apk_istream *apk_istream_concat(struct apk_istream *first, struct apk_istream *second)
+{
+	struct apk_concat_istream *cis;
+	int r;
+
+	if (IS_ERR(first) || IS_ERR(second)) {
+		r = IS_ERR(first) ? PTR_ERR(first) : PTR_ERR(second);
+		goto err;
+	}
+	cis = malloc(sizeof *cis + apk_io_bufsize);
+	if (!cis) {
+		r = -ENOMEM;
+		goto err;
+	}
+	*cis = (struct apk_concat_istream) {
+		.is.ops = &concat_istream_ops,
+		.is.buf = (uint8_t *)(cis + 1),
+		.is.buf_size = apk_io_bufsize,
+		.is.ptr = (uint8_t *)(cis + 1),
+		.is.end = (uint8_t *)(cis + 1),
+		.first = first,
+		.second = second,
+	};
+	return &cis->is;
+err:
+	if (!IS_ERR(first)) apk_istream_close(first);
+	if (!IS_ERR(second)) apk_istream_close(second);
+	return ERR_PTR(r);
 }
 
 struct apk_istream *__apk_istream_from_file(int atfd, const char *file, int try_mmap)
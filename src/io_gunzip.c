@@ -10,10 +10,14 @@
 #include <stdio.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <zlib.h>
 
 #include "apk_defines.h"
 #include "apk_io.h"
+#include "apk_nproc.h"
+
+int apk_io_gunzip_threaded = APK_NO;
 
 struct apk_gzip_istream {
 	struct apk_istream is;
@@ -152,12 +156,359 @@ static int window_bits(int window_bits, int raw)
 	return window_bits | 16;	// gzip mode
 }
 
+/* Threaded gzip input stream. A helper thread inflates the data ahead into
+ * a small ring of output chunks while the reader consumes them. All reads
+ * of the compressed input and all multipart callbacks happen in the reader
+ * thread. The member boundaries found by the inflater are recorded in the
+ * output chunks, and the callbacks are replayed when the reader reaches
+ * the chunk. This keeps the callback order and placement relative to the
+ * uncompressed data identical to the single threaded stream. */
+#define GZT_SLOTS	3
+
+struct gzt_input {
+	uint8_t *ptr;
+	size_t len;
+	uint64_t off;
+};
+
+struct gzt_output {
+	uint8_t *ptr;
+	size_t len;
+	uint64_t data_to, boundary_at;
+	int boundary, status;
+};
+
+struct apk_gzip_thread_istream {
+	struct apk_istream is;
+	struct apk_istream *zis;
+	z_stream zs;
+
+	apk_multipart_cb cb;
+	void *cbctx;
+
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond_worker, cond_reader;
+	struct gzt_input in[GZT_SLOTS];
+	struct gzt_output out[GZT_SLOTS];
+	unsigned int in_fill, in_done, in_free;
+	unsigned int out_prod, out_cons;
+	uint64_t in_off, cb_off;
+	size_t out_pos;
+	bool in_eof, abort, have_chunk;
+};
+
+static struct gzt_output *gzt_publish(struct apk_gzip_thread_istream *gis)
+{
+	gis->out_prod++;
+	pthread_cond_signal(&gis->cond_reader);
+	return NULL;
+}
+
+static void *gzt_worker(void *arg)
+{
+	struct apk_gzip_thread_istream *gis = arg;
+	struct gzt_output *out = NULL;
+	struct gzt_input *in = NULL;
+	uint64_t done_off = 0, start_to = 0, pending_at = 0;
+	bool pending = false;
+	int r;
+
+	pthread_mutex_lock(&gis->mutex);
+	while (!gis->abort) {
+		if (!out) {
+			if (gis->out_prod - gis->out_cons >= GZT_SLOTS) {
+				pthread_cond_wait(&gis->cond_worker, &gis->mutex);
+				continue;
+			}
+			out = &gis->out[gis->out_prod % GZT_SLOTS];
+			out->len = 0;
+			out->data_to = start_to = done_off;
+			out->boundary = out->status = 0;
+		}
+		if (gis->zs.avail_in == 0) {
+			if (in) {
+				done_off = out->data_to = in->off + in->len;
+				gis->in_done++;
+				in = NULL;
+				pthread_cond_signal(&gis->cond_reader);
+			}
+			if (gis->in_done == gis->in_fill) {
+				if (gis->in_eof) {
+					// A member cut short is reported as plain EOF
+					if (pending) {
+						out->boundary = APK_MPART_END;
+						out->boundary_at = pending_at;
+					}
+					out->status = 1;
+					out = gzt_publish(gis);
+					break;
+				}
+				// Hand out what we have so the reader can release input
+				if (out->len || out->boundary || (gis->cb && out->data_to != start_to))
+					out = gzt_publish(gis);
+				pthread_cond_wait(&gis->cond_worker, &gis->mutex);
+				continue;
+			}
+			in = &gis->in[gis->in_done % GZT_SLOTS];
+			gis->zs.next_in = in->ptr;
+			gis->zs.avail_in = in->len;
+		}
+		if (pending) {
+			out->boundary = APK_MPART_BOUNDARY;
+			out->boundary_at = pending_at;
+			pending = false;
+		}
+		gis->zs.next_out = out->ptr + out->len;
+		gis->zs.avail_out = apk_io_bufsize - out->len;
+		pthread_mutex_unlock(&gis->mutex);
+
+		r = inflate(&gis->zs, Z_NO_FLUSH);
+
+		pthread_mutex_lock(&gis->mutex);
+		out->len = apk_io_bufsize - gis->zs.avail_out;
+		switch (r) {
+		case Z_STREAM_END:
+			pending = true;
+			pending_at = in->off + ((uint8_t *) gis->zs.next_in - in->ptr);
+			if (inflateReset2(&gis->zs, 15+32) != Z_OK) {
+				out->status = -ENOMEM;
+				out = gzt_publish(gis);
+				goto done;
+			}
+			out = gzt_publish(gis);
+			break;
+		case Z_OK:
+		case Z_BUF_ERROR:
+			if (gis->zs.avail_out == 0) out = gzt_publish(gis);
+			break;
+		default:
+			out->status = -APKE_FORMAT_INVALID;
+			out = gzt_publish(gis);
+			goto done;
+		}
+	}
+done:
+	pthread_mutex_unlock(&gis->mutex);
+	return NULL;
+}
+
+static void gzt_get_meta(struct apk_istream *is, struct apk_file_meta *meta)
+{
+	struct apk_gzip_thread_istream *gis = container_of(is, struct apk_gzip_thread_istream, is);
+	apk_istream_get_meta(gis->zis, meta);
+}
+
+static int gzt_error(struct apk_gzip_thread_istream *gis, int r)
+{
+	pthread_mutex_lock(&gis->mutex);
+	gis->abort = true;
+	pthread_cond_signal(&gis->cond_worker);
+	pthread_mutex_unlock(&gis->mutex);
+	return apk_istream_error(&gis->is, r);
+}
+
+static int gzt_feed(struct apk_gzip_thread_istream *gis)
+{
+	struct gzt_input *in = &gis->in[gis->in_fill % GZT_SLOTS];
+	apk_blob_t blob;
+	int r;
+
+	r = apk_istream_get_max(gis->zis, apk_io_bufsize, &blob);
+	if (r >= 0) memcpy(in->ptr, blob.ptr, blob.len);
+
+	pthread_mutex_lock(&gis->mutex);
+	if (r >= 0) {
+		in->len = blob.len;
+		in->off = gis->in_off;
+		gis->in_off += blob.len;
+		gis->in_fill++;
+	} else if (r == -APKE_EOF) {
+		gis->in_eof = true;
+		r = 0;
+	}
+	pthread_cond_signal(&gis->cond_worker);
+	pthread_mutex_unlock(&gis->mutex);
+	return r < 0 ? r : 0;
+}
+
+static int gzt_deliver(struct apk_gzip_thread_istream *gis, uint64_t to)
+{
+	struct gzt_input *in;
+	size_t off, len;
+	int r;
+
+	for (unsigned int i = gis->in_free; gis->cb_off < to && i != gis->in_fill; i++) {
+		in = &gis->in[i % GZT_SLOTS];
+		if (gis->cb_off >= in->off + in->len) continue;
+		off = gis->cb_off - in->off;
+		len = min(in->len - off, to - gis->cb_off);
+		r = gis->cb(gis->cbctx, APK_MPART_DATA, APK_BLOB_PTR_LEN((char *) in->ptr + off, len));
+		if (r < 0) return r;
+		gis->cb_off += len;
+	}
+	return 0;
+}
+
+static int gzt_replay(struct apk_gzip_thread_istream *gis, struct gzt_output *out)
+{
+	int r;
+
+	if (!gis->cb) return 0;
+	if (out->boundary) {
+		r = gzt_deliver(gis, out->boundary_at);
+		if (r) return r;
+		r = gis->cb(gis->cbctx, out->boundary, APK_BLOB_NULL);
+		if (r > 0) r = -ECANCELED;
+		if (r) return r;
+	}
+	return gzt_deliver(gis, out->data_to);
+}
+
+static int gzt_next_chunk(struct apk_gzip_thread_istream *gis)
+{
+	struct gzt_input *in;
+	int r;
+
+	pthread_mutex_lock(&gis->mutex);
+	for (;;) {
+		// Release input consumed by the inflater and the callback
+		while (gis->in_free != gis->in_done) {
+			in = &gis->in[gis->in_free % GZT_SLOTS];
+			if (gis->cb && gis->cb_off < in->off + in->len) break;
+			gis->in_free++;
+		}
+		if (!gis->in_eof && gis->in_fill - gis->in_free < GZT_SLOTS) {
+			pthread_mutex_unlock(&gis->mutex);
+			r = gzt_feed(gis);
+			if (r) return gzt_error(gis, r);
+			pthread_mutex_lock(&gis->mutex);
+			continue;
+		}
+		if (gis->out_prod != gis->out_cons) break;
+		pthread_cond_wait(&gis->cond_reader, &gis->mutex);
+	}
+	gis->have_chunk = true;
+	gis->out_pos = 0;
+	pthread_mutex_unlock(&gis->mutex);
+
+	r = gzt_replay(gis, &gis->out[gis->out_cons % GZT_SLOTS]);
+	if (r) return gzt_error(gis, r);
+	return 0;
+}
+
+static ssize_t gzt_read(struct apk_istream *is, void *ptr, size_t size)
+{
+	struct apk_gzip_thread_istream *gis = container_of(is, struct apk_gzip_thread_istream, is);
+	struct gzt_output *out;
+	size_t len;
+	int r;
+
+	while (gis->is.err == 0) {
+		if (gis->have_chunk) {
+			out = &gis->out[gis->out_cons % GZT_SLOTS];
+			if (gis->out_pos < out->len) {
+				/* Stop at the chunk end so boundaries are
+				 * signalled at the start of the next read */
+				len = min(size, out->len - gis->out_pos);
+				memcpy(ptr, out->ptr + gis->out_pos, len);
+				gis->out_pos += len;
+				return len;
+			}
+			if (out->status) return apk_istream_error(&gis->is, out->status);
+
+			pthread_mutex_lock(&gis->mutex);
+			gis->have_chunk = false;
+			gis->out_cons++;
+			pthread_cond_signal(&gis->cond_worker);
+			pthread_mutex_unlock(&gis->mutex);
+		}
+		r = gzt_next_chunk(gis);
+		if (r) return r;
+	}
+	return gis->is.err < 0 ? gis->is.err : 0;
+}
+
+static int gzt_close(struct apk_istream *is)
+{
+	struct apk_gzip_thread_istream *gis = container_of(is, struct apk_gzip_thread_istream, is);
+	int r;
+
+	pthread_mutex_lock(&gis->mutex);
+	gis->abort = true;
+	pthread_cond_signal(&gis->cond_worker);
+	pthread_mutex_unlock(&gis->mutex);
+	pthread_join(gis->thread, NULL);
+
+	pthread_cond_destroy(&gis->cond_reader);
+	pthread_cond_destroy(&gis->cond_worker);
+	pthread_mutex_destroy(&gis->mutex);
+	inflateEnd(&gis->zs);
+	r = apk_istream_close_error(gis->zis, gis->is.err);
+	free(gis);
+	return r;
+}
+
+static const struct apk_istream_ops gunzip_thread_istream_ops = {
+	.get_meta = gzt_get_meta,
+	.read = gzt_read,
+	.close = gzt_close,
+};
+
+static struct apk_istream *gzt_create(struct apk_istream *is, apk_multipart_cb cb, void *ctx)
+{
+	struct apk_gzip_thread_istream *gis;
+	uint8_t *buf;
+
+	gis = malloc(sizeof(*gis) + (1 + 2*GZT_SLOTS) * apk_io_bufsize);
+	if (!gis) return NULL;
+
+	buf = (uint8_t *)(gis + 1);
+	*gis = (struct apk_gzip_thread_istream) {
+		.is.ops = &gunzip_thread_istream_ops,
+		.is.buf = buf,
+		.is.buf_size = apk_io_bufsize,
+		.is.ptr = buf,
+		.is.end = buf,
+		.zis = is,
+		.cb = cb,
+		.cbctx = ctx,
+	};
+	for (int i = 0; i < GZT_SLOTS; i++) {
+		gis->in[i].ptr = buf + (1 + i) * apk_io_bufsize;
+		gis->out[i].ptr = buf + (1 + GZT_SLOTS + i) * apk_io_bufsize;
+	}
+	if (inflateInit2(&gis->zs, window_bits(15, 0)) != Z_OK) goto err;
+
+	pthread_mutex_init(&gis->mutex, NULL);
+	pthread_cond_init(&gis->cond_worker, NULL);
+	pthread_cond_init(&gis->cond_reader, NULL);
+	if (pthread_create(&gis->thread, NULL, gzt_worker, gis) != 0) {
+		pthread_cond_destroy(&gis->cond_reader);
+		pthread_cond_destroy(&gis->cond_worker);
+		pthread_mutex_destroy(&gis->mutex);
+		inflateEnd(&gis->zs);
+		goto err;
+	}
+	return &gis->is;
+err:
+	free(gis);
+	return NULL;
+}
+
 struct apk_istream *apk_istream_zlib(struct apk_istream *is, int raw, apk_multipart_cb cb, void *ctx)
 {
 	struct apk_gzip_istream *gis;
+	struct apk_istream *tis;
 
 	if (IS_ERR(is)) return ERR_CAST(is);
 
+	if (apk_io_gunzip_threaded == APK_AUTO) apk_io_gunzip_threaded = apk_get_nproc() > 1;
+	if (!raw && apk_io_gunzip_threaded) {
+		tis = gzt_create(is, cb, ctx);
+		if (tis) return tis;
+	}
+
 	gis = malloc(sizeof(*gis) + apk_io_bufsize);
 	if (!gis) goto err;
 
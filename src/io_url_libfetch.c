@@ -127,7 +127,12 @@ static const struct apk_istream_ops fetch_istream_ops = {
 	.close = fetch_close,
 };
 
-struct apk_istream *apk_io_url_istream(const char *url, time_t since)
+// Packages announced with apk_io_url_prefetch() are requested through
+// a pipeline of keep-alive connections, several requests at a time.
+static fetchPipeline *fetch_pipeline;
+static int fetch_max_conns = 4;
+
+static struct apk_istream *fetch_istream(const char *url, time_t since, uint64_t *offset)
 {
 	struct apk_fetch_istream *fis = NULL;
 	struct url *u;
@@ -150,12 +155,19 @@ struct apk_istream *apk_io_url_istream(const char *url, time_t since)
 		u->last_modified = since;
 		flags = "i";
 	}
+	/* libfetch sends a Range request and reports back where the
+	 * returned data starts */
+	if (offset) u->offset = *offset;
 
-	io = fetchXGet(u, &fis->urlstat, flags);
+	if (fetch_pipeline && since != APK_ISTREAM_FORCE_REFRESH)
+		io = fetchPipelineXGet(fetch_pipeline, u, &fis->urlstat);
+	else
+		io = fetchXGet(u, &fis->urlstat, flags);
 	if (!io) {
 		rc = -fetch_maperror(fetchLastErrCode);
 		goto err;
 	}
+	if (offset) *offset = u->offset;
 
 	*fis = (struct apk_fetch_istream) {
 		.is.ops = &fetch_istream_ops,
@@ -176,6 +188,37 @@ err:
 	return ERR_PTR(rc);
 }
 
+struct apk_istream *apk_io_url_istream(const char *url, time_t since)
+{
+	return fetch_istream(url, since, NULL);
+}
+
+struct apk_istream *apk_io_url_istream_offset(const char *url, time_t since, uint64_t *offset)
+{
+	return fetch_istream(url, since, offset);
+}
+
+void apk_io_url_prefetch(const char *url, time_t since)
+{
+	struct url *u;
+
+	if (since == APK_ISTREAM_FORCE_REFRESH) return;
+	if (!fetch_pipeline) fetch_pipeline = fetchPipelineOpen(fetch_max_conns, 8, "i");
+	if (!fetch_pipeline) return;
+
+	u = fetchParseURL(url);
+	if (!u) return;
+	u->last_modified = since;
+	fetchPipelineAdd(fetch_pipeline, u);
+	fetchFreeURL(u);
+}
+
+void apk_io_url_prefetch_end(void)
+{
+	fetchPipelineClose(fetch_pipeline);
+	fetch_pipeline = NULL;
+}
+
 static void (*io_url_redirect_callback)(int, const char *);
 
 static void fetch_redirect(int code, const struct url *cur, const struct url *next)
@@ -202,6 +245,12 @@ void apk_io_url_set_timeout(int timeout)
 	fetchTimeout = timeout;
 }
 
+void apk_io_url_set_max_connections(int max_conns)
+{
+	fetch_max_conns = max_conns;
+	fetchConnectionCacheInit(32, max_conns);
+}
+
 void apk_io_url_set_redirect_callback(void (*cb)(int, const char *))
 {
 	fetchRedirectMethod = cb ? fetch_redirect : NULL;
@@ -210,11 +259,12 @@ void apk_io_url_set_redirect_callback(void (*cb)(int, const char *))
 
 static void apk_io_url_fini(void)
 {
+	apk_io_url_prefetch_end();
 	fetchConnectionCacheClose();
 }
 
 void apk_io_url_init(struct apk_out *out)
 {
-	fetchConnectionCacheInit(32, 4);
+	fetchConnectionCacheInit(32, fetch_max_conns);
 	atexit(apk_io_url_fini);
 }
@@ -7,14 +7,26 @@
  * SPDX-License-Identifier: GPL-2.0-only
  */
 
+#include <errno.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
 #include "apk_io.h"
 #include "apk_process.h"
 
 static char wget_timeout[16];
+static int http_timeout;
 static bool wget_no_check_certificate;
 static struct apk_out *wget_out;
 
-struct apk_istream *apk_io_url_istream(const char *url, time_t since)
+static struct apk_istream *wget_istream(const char *url)
 {
 	char *argv[16];
 	int i = 0;
@@ -32,6 +44,672 @@ struct apk_istream *apk_io_url_istream(const char *url, time_t since)
 	return apk_process_istream(argv, wget_out, "wget");
 }
 
+// Plain HTTP URLs are fetched with a built-in HTTP/1.1 client. It keeps
+// up to http_max_conns connections alive and sends the requests announced
+// with apk_io_url_prefetch() ahead of time over them. HTTPS, URLs with
+// credentials and redirects are left to wget, as is everything when a
+// proxy is configured.
+
+#define HTTP_MAX_CONNS		16	// connections kept open at most
+#define HTTP_PIPELINE_DEPTH	8	// requests sent ahead on a connection
+#define HTTP_MAX_ERROR_BODY	65536	// larger error replies close the connection
+
+struct http_url {
+	char host[256];		// host and port as in the url
+	char name[256];		// host name or address
+	char port[8];
+	const char *path;
+};
+
+struct http_conn {
+	int fd;
+	char host[256];
+	unsigned int pending;	// requests sent and not answered
+	ssize_t last;		// index of the last queued request sent
+	bool busy;		// a reply body is being read
+	bool broken;		// no more replies can be read
+	size_t pos, len;
+	char buf[4096];
+};
+
+struct http_req {
+	char *url;
+	time_t since;
+	struct http_conn *conn;	// connection the request was sent on
+};
+
+struct http_reply {
+	int code;
+	bool keep_alive, chunked;
+	int64_t length;		// body length, or -1 until the connection closes
+	uint64_t offset;
+	time_t mtime;
+};
+
+struct http_istream {
+	struct apk_istream is;
+	struct http_conn *conn;
+	struct http_reply reply;
+	uint64_t left;		// bytes left in the body or the current chunk
+	bool chunk_end, eof;
+};
+
+static struct http_conn *http_conns[HTTP_MAX_CONNS];
+static int http_max_conns = 4;
+static struct http_req *http_reqs;
+static size_t http_head, http_num, http_alloc;
+
+static bool http_parse_url(const char *url, struct http_url *u)
+{
+	const char *host, *end, *port;
+	size_t n;
+
+	if (getenv("http_proxy") || getenv("HTTP_PROXY")) return false;
+	if (strncasecmp(url, "http://", 7) != 0) return false;
+	host = url + 7;
+	end = host + strcspn(host, "/?#");
+	if (*end && *end != '/') return false;
+	n = end - host;
+	if (n == 0 || n >= sizeof u->host || memchr(host, '@', n)) return false;
+	memcpy(u->host, host, n);
+	u->host[n] = 0;
+	u->path = *end ? end : "/";
+
+	if (host[0] == '[') {
+		port = memchr(host, ']', n);
+		if (!port) return false;
+		host++;
+		n = port++ - host;
+	} else {
+		port = memchr(host, ':', n) ?: end;
+		n = port - host;
+	}
+	memcpy(u->name, host, n);
+	u->name[n] = 0;
+	if (port == end) {
+		strcpy(u->port, "80");
+	} else {
+		if (*port != ':' || end - port - 1 < 1 || end - port - 1 >= (ssize_t) sizeof u->port) return false;
+		memcpy(u->port, port + 1, end - port - 1);
+		u->port[end - port - 1] = 0;
+	}
+	return true;
+}
+
+static int http_dns_error(int ec)
+{
+	switch (ec) {
+#ifdef EAI_ADDRFAMILY
+	case EAI_ADDRFAMILY: return -APKE_DNS_ADDRESS_FAMILY;
+#endif
+#ifdef EAI_NODATA
+	case EAI_NODATA: return -APKE_DNS_NO_DATA;
+#endif
+	case EAI_AGAIN: return -APKE_DNS_AGAIN;
+	case EAI_NONAME: return -APKE_DNS_NO_NAME;
+	case EAI_SYSTEM: return -errno;
+	default: return -APKE_DNS_FAIL;
+	}
+}
+
+static int http_error(int code)
+{
+	switch (code) {
+	case 400: return -APKE_HTTP_400_BAD_REQUEST;
+	case 401: return -APKE_HTTP_401_UNAUTHORIZED;
+	case 403: return -APKE_HTTP_403_FORBIDDEN;
+	case 404: return -APKE_HTTP_404_NOT_FOUND;
+	case 405: return -APKE_HTTP_405_METHOD_NOT_ALLOWED;
+	case 406: return -APKE_HTTP_406_NOT_ACCEPTABLE;
+	case 407: return -APKE_HTTP_407_PROXY_AUTH_REQUIRED;
+	case 408: return -APKE_HTTP_408_TIMEOUT;
+	case 500: return -APKE_HTTP_500_INTERNAL_SERVER_ERROR;
+	case 501: return -APKE_HTTP_501_NOT_IMPLEMENTED;
+	case 502: return -APKE_HTTP_502_BAD_GATEWAY;
+	case 503: return -APKE_HTTP_503_SERVICE_UNAVAILABLE;
+	case 504: return -APKE_HTTP_504_GATEWAY_TIMEOUT;
+	default: return -APKE_HTTP_UNKNOWN;
+	}
+}
+
+// Closes a connection; requests queued on it are sent again later. A
+// connection with a reply still open is closed when the reply is.
+static void http_conn_close(struct http_conn *c)
+{
+	for (size_t i = http_head; i < http_num; i++)
+		if (http_reqs[i].conn == c) http_reqs[i].conn = NULL;
+	if (c->busy) {
+		c->broken = true;
+		c->pending = 0;
+		return;
+	}
+	for (int i = 0; i < HTTP_MAX_CONNS; i++)
+		if (http_conns[i] == c) http_conns[i] = NULL;
+	close(c->fd);
+	free(c);
+}
+
+// Returns a free connection slot, closing an idle connection if needed
+static struct http_conn **http_conn_slot(void)
+{
+	struct http_conn **idle = NULL;
+
+	for (int i = 0; i < http_max_conns; i++) {
+		struct http_conn *c = http_conns[i];
+		if (!c) return &http_conns[i];
+		if (!c->pending && !c->busy && !idle) idle = &http_conns[i];
+	}
+	if (idle) http_conn_close(*idle);
+	return idle;
+}
+
+static struct http_conn *http_connect(const struct http_url *u)
+{
+	struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM }, *res, *ai;
+	struct timeval tv = { .tv_sec = http_timeout };
+	struct http_conn *c;
+	int fd = -1, r;
+
+	r = getaddrinfo(u->name, u->port, &hints, &res);
+	if (r != 0) return ERR_PTR(http_dns_error(r));
+	r = -ECONNREFUSED;
+	for (ai = res; ai; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+		if (fd < 0) {
+			r = -errno;
+			continue;
+		}
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof tv);
+		if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) break;
+		r = errno == EINPROGRESS ? -ETIMEDOUT : -errno;
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
+	if (fd < 0) return ERR_PTR(r);
+
+	c = malloc(sizeof *c);
+	if (!c) {
+		close(fd);
+		return ERR_PTR(-ENOMEM);
+	}
+	*c = (struct http_conn) { .fd = fd, .last = -1 };
+	strcpy(c->host, u->host);
+	return c;
+}
+
+static int http_send(struct http_conn *c, const struct http_url *u, time_t since, uint64_t offset)
+{
+	const char *agent = getenv("HTTP_USER_AGENT");
+	char req[PATH_MAX + 1024], date[64];
+	struct tm tm;
+	size_t n = 0;
+	ssize_t r;
+
+	if (!agent || !*agent) agent = "apk-tools";
+	if (strlen(u->path) >= PATH_MAX) return -ENAMETOOLONG;
+	n += snprintf(&req[n], sizeof req - n, "GET %s HTTP/1.1\r\nHost: %s\r\nUser-Agent: %.200s\r\n",
+		u->path, u->host, agent);
+	if (since == APK_ISTREAM_FORCE_REFRESH) {
+		n += snprintf(&req[n], sizeof req - n, "Cache-Control: no-cache\r\n");
+	} else if (since > 0 && gmtime_r(&since, &tm)) {
+		strftime(date, sizeof date, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+		n += snprintf(&req[n], sizeof req - n, "If-Modified-Since: %s\r\n", date);
+	}
+	if (offset) n += snprintf(&req[n], sizeof req - n, "Range: bytes=%" PRIu64 "-\r\n", offset);
+	n += snprintf(&req[n], sizeof req - n, "\r\n");
+	if (n >= sizeof req) return -ENAMETOOLONG;
+
+	for (size_t i = 0; i < n; i += r) {
+		r = send(c->fd, &req[i], n - i, MSG_NOSIGNAL);
+		if (r < 0) {
+			if (errno == EINTR) r = 0;
+			else return errno == EAGAIN ? -ETIMEDOUT : -errno;
+		}
+	}
+	c->pending++;
+	return 0;
+}
+
+static ssize_t http_conn_fill(struct http_conn *c)
+{
+	ssize_t r;
+
+	if (c->pos) {
+		memmove(c->buf, &c->buf[c->pos], c->len - c->pos);
+		c->len -= c->pos;
+		c->pos = 0;
+	}
+	if (c->len == sizeof c->buf) return -ENOBUFS;
+	do r = recv(c->fd, &c->buf[c->len], sizeof c->buf - c->len, 0);
+	while (r < 0 && errno == EINTR);
+	if (r < 0) return errno == EAGAIN ? -ETIMEDOUT : -errno;
+	c->len += r;
+	return r;
+}
+
+static int http_conn_getline(struct http_conn *c, apk_blob_t *line)
+{
+	char *nl;
+	ssize_t r;
+
+	while (!(nl = memchr(&c->buf[c->pos], '\n', c->len - c->pos))) {
+		r = http_conn_fill(c);
+		if (r <= 0) return r ?: -ECONNRESET;
+	}
+	*line = APK_BLOB_PTR_LEN(&c->buf[c->pos], nl - &c->buf[c->pos]);
+	c->pos = nl + 1 - c->buf;
+	if (line->len && line->ptr[line->len - 1] == '\r') line->len--;
+	return 0;
+}
+
+static ssize_t http_conn_read(struct http_conn *c, void *ptr, size_t size)
+{
+	ssize_t r;
+
+	if (c->pos < c->len) {
+		r = min(size, c->len - c->pos);
+		memcpy(ptr, &c->buf[c->pos], r);
+		c->pos += r;
+		return r;
+	}
+	do r = recv(c->fd, ptr, size, 0);
+	while (r < 0 && errno == EINTR);
+	if (r < 0) return errno == EAGAIN ? -ETIMEDOUT : -errno;
+	return r;
+}
+
+static char *http_cstr(apk_blob_t b, char *buf, size_t len)
+{
+	size_t n = min(b.len, len - 1);
+
+	memcpy(buf, b.ptr, n);
+	buf[n] = 0;
+	return buf;
+}
+
+static bool http_header(apk_blob_t line, const char *name, apk_blob_t *value)
+{
+	size_t n = strlen(name);
+
+	if (line.len <= n || line.ptr[n] != ':' || strncasecmp(line.ptr, name, n) != 0) return false;
+	*value = APK_BLOB_PTR_LEN(line.ptr + n + 1, line.len - n - 1);
+	while (value->len && (value->ptr[0] == ' ' || value->ptr[0] == '\t')) value->ptr++, value->len--;
+	return true;
+}
+
+static bool http_token(apk_blob_t value, const char *token)
+{
+	size_t n = strlen(token);
+
+	for (size_t i = 0; i + n <= value.len; i++)
+		if (strncasecmp(&value.ptr[i], token, n) == 0) return true;
+	return false;
+}
+
+// Reads the status line and headers. Returns -ECONNRESET if the connection
+// was closed before a reply, so a request on a reused connection can be
+// retried.
+static int http_read_reply(struct http_conn *c, struct http_reply *rep)
+{
+	apk_blob_t line, value;
+	char tmp[64], *end;
+	struct tm tm;
+	int r;
+
+	do {
+		r = http_conn_getline(c, &line);
+		if (r < 0) return r;
+		if (line.len < 12 || memcmp(line.ptr, "HTTP/1.", 7) != 0) return -APKE_HTTP_UNKNOWN;
+		*rep = (struct http_reply) {
+			.code = strtol(http_cstr(APK_BLOB_PTR_LEN(line.ptr + 9, 3), tmp, sizeof tmp), NULL, 10),
+			.keep_alive = line.ptr[7] == '1',
+			.length = -1,
+		};
+		for (;;) {
+			r = http_conn_getline(c, &line);
+			if (r < 0) return r == -ECONNRESET ? -APKE_HTTP_UNKNOWN : r;
+			if (!line.len) break;
+			if (http_header(line, "Content-Length", &value)) {
+				rep->length = strtoll(http_cstr(value, tmp, sizeof tmp), &end, 10);
+				if (*end || rep->length < 0) return -APKE_HTTP_UNKNOWN;
+			} else if (http_header(line, "Transfer-Encoding", &value)) {
+				rep->chunked = http_token(value, "chunked");
+			} else if (http_header(line, "Connection", &value)) {
+				if (http_token(value, "close")) rep->keep_alive = false;
+				else if (http_token(value, "keep-alive")) rep->keep_alive = true;
+			} else if (http_header(line, "Last-Modified", &value)) {
+				memset(&tm, 0, sizeof tm);
+				if (strptime(http_cstr(value, tmp, sizeof tmp), "%a, %d %b %Y %H:%M:%S GMT", &tm))
+					rep->mtime = timegm(&tm);
+			} else if (http_header(line, "Content-Range", &value)) {
+				if (value.len < 6 || strncasecmp(value.ptr, "bytes ", 6) != 0) return -APKE_HTTP_UNKNOWN;
+				rep->offset = strtoull(http_cstr(APK_BLOB_PTR_LEN(value.ptr + 6, value.len - 6), tmp, sizeof tmp), NULL, 10);
+			}
+		}
+	} while (rep->code >= 100 && rep->code < 200);
+
+	if (rep->code == 204 || rep->code == 304) {
+		rep->chunked = false;
+		rep->length = 0;
+	}
+	if (rep->chunked) rep->length = -1;
+	else if (rep->length < 0) rep->keep_alive = false;
+	return 0;
+}
+
+static void http_get_meta(struct apk_istream *is, struct apk_file_meta *meta)
+{
+	struct http_istream *his = container_of(is, struct http_istream, is);
+
+	*meta = (struct apk_file_meta) {
+		.atime = his->reply.mtime,
+		.mtime = his->reply.mtime,
+	};
+}
+
+static ssize_t http_read(struct apk_istream *is, void *ptr, size_t size)
+{
+	struct http_istream *his = container_of(is, struct http_istream, is);
+	struct http_conn *c = his->conn;
+	apk_blob_t line;
+	char tmp[32], *end;
+	ssize_t r;
+
+	if (his->eof) return 0;
+	if (his->reply.chunked && !his->left) {
+		if (his->chunk_end) {
+			r = http_conn_getline(c, &line);
+			if (r < 0 || line.len) return -EIO;
+		}
+		r = http_conn_getline(c, &line);
+		if (r < 0) return -EIO;
+		his->left = strtoull(http_cstr(line, tmp, sizeof tmp), &end, 16);
+		if (end == tmp || (*end && *end != ';')) return -EIO;
+		his->chunk_end = true;
+		if (!his->left) {
+			// skip the trailer
+			do if (http_conn_getline(c, &line) < 0) return -EIO;
+			while (line.len);
+			his->eof = true;
+			return 0;
+		}
+	} else if (!his->reply.chunked && !his->left) {
+		his->eof = true;
+		return 0;
+	}
+
+	r = http_conn_read(c, ptr, min(size, his->left));
+	if (r <= 0) {
+		if (r == 0 && his->reply.length < 0 && !his->reply.chunked) {
+			his->eof = true;
+			return 0;
+		}
+		return -EIO;
+	}
+	his->left -= r;
+	if (!his->left && !his->reply.chunked) his->eof = true;
+	return r;
+}
+
+static void http_conn_done(struct http_conn *c, bool reusable)
+{
+	struct http_conn **slot;
+
+	c->busy = false;
+	if (!reusable) c->broken = true;
+	if (c->broken) {
+		http_conn_close(c);
+		return;
+	}
+	for (int i = 0; i < HTTP_MAX_CONNS; i++)
+		if (http_conns[i] == c) return;
+	slot = http_conn_slot();
+	if (slot) *slot = c;
+	else http_conn_close(c);
+}
+
+static int http_close(struct apk_istream *is)
+{
+	struct http_istream *his = container_of(is, struct http_istream, is);
+	int r = is->err;
+
+	http_conn_done(his->conn, his->eof && his->reply.keep_alive);
+	free(his);
+	return r < 0 ? r : 0;
+}
+
+static const struct apk_istream_ops http_istream_ops = {
+	.get_meta = http_get_meta,
+	.read = http_read,
+	.close = http_close,
+};
+
+// Reads the reply to the oldest request sent on the connection. Returns
+// NULL if the URL is redirected. The connection is owned by the returned
+// stream, and closed on errors before a reply.
+static struct apk_istream *http_open_reply(struct http_conn *c, uint64_t *offset)
+{
+	struct http_istream *his;
+	struct http_reply rep;
+	char buf[1024];
+	ssize_t n;
+	int r;
+
+	c->pending--;
+	r = http_read_reply(c, &rep);
+	if (r < 0) {
+		http_conn_close(c);
+		return ERR_PTR(r);
+	}
+
+	his = malloc(sizeof *his + apk_io_bufsize);
+	if (!his) {
+		http_conn_close(c);
+		return ERR_PTR(-ENOMEM);
+	}
+	*his = (struct http_istream) {
+		.is.ops = &http_istream_ops,
+		.is.buf = (uint8_t *)(his + 1),
+		.is.buf_size = apk_io_bufsize,
+		.is.ptr = (uint8_t *)(his + 1),
+		.is.end = (uint8_t *)(his + 1),
+		.conn = c,
+		.reply = rep,
+		.left = rep.chunked ? 0 : rep.length < 0 ? UINT64_MAX : rep.length,
+	};
+	c->busy = true;
+
+	switch (rep.code) {
+	case 200:
+		if (offset) *offset = 0;
+		return &his->is;
+	case 206:
+		if (offset && rep.offset <= *offset) {
+			*offset = rep.offset;
+			return &his->is;
+		}
+		r = -APKE_HTTP_UNKNOWN;
+		break;
+	case 304:
+		r = -APKE_FILE_UNCHANGED;
+		break;
+	case 301: case 302: case 303: case 307: case 308:
+		r = 0;
+		break;
+	default:
+		r = rep.code >= 400 ? http_error(rep.code) : -APKE_HTTP_UNKNOWN;
+		break;
+	}
+
+	// skip the body to keep the connection
+	if (rep.length < 0 || rep.length > HTTP_MAX_ERROR_BODY) his->reply.keep_alive = false;
+	else while ((n = apk_istream_read_max(&his->is, buf, sizeof buf)) > 0);
+	apk_istream_close(&his->is);
+	return r ? ERR_PTR(r) : NULL;
+}
+
+// Sends a request on an open connection, or a new one
+static struct apk_istream *http_request(const struct http_url *u, time_t since, uint64_t *offset)
+{
+	struct http_conn *c;
+	struct apk_istream *is;
+	bool reused;
+	int r;
+
+	for (int retry = 0; retry < 2; retry++) {
+		c = NULL;
+		for (int i = 0; i < HTTP_MAX_CONNS && !c && !retry; i++) {
+			struct http_conn *ic = http_conns[i];
+			if (ic && !ic->pending && !ic->busy && !ic->broken && strcmp(ic->host, u->host) == 0) c = ic;
+		}
+		reused = c != NULL;
+		if (!c) c = http_connect(u);
+		if (IS_ERR(c)) return ERR_CAST(c);
+
+		r = http_send(c, u, since, offset ? *offset : 0);
+		if (r < 0) {
+			http_conn_close(c);
+			is = ERR_PTR(r);
+		} else {
+			is = http_open_reply(c, offset);
+		}
+		// a kept connection may have been closed by the server
+		if (!reused || !IS_ERR(is) || (PTR_ERR(is) != -ECONNRESET && PTR_ERR(is) != -EPIPE)) return is;
+	}
+	return is;
+}
+
+// Sends the queued request 'i' ahead on a connection to its host, if
+// one has room for it. A connection carries requests in queue order.
+// Requests are spread over new connections while there are free slots.
+static int http_pipeline_send(size_t i)
+{
+	struct http_req *req = &http_reqs[i];
+	struct http_conn *c = NULL, *nc, **slot = NULL;
+	struct http_url u;
+
+	if (!http_parse_url(req->url, &u)) return -1;
+	for (int j = 0; j < http_max_conns; j++) {
+		struct http_conn *jc = http_conns[j];
+		if (!jc) {
+			if (!slot) slot = &http_conns[j];
+			continue;
+		}
+		if (jc->broken || jc->pending >= HTTP_PIPELINE_DEPTH || jc->last >= (ssize_t) i ||
+		    strcmp(jc->host, u.host) != 0)
+			continue;
+		if (!c || jc->pending < c->pending) c = jc;
+	}
+	if (!c && !slot) slot = http_conn_slot();
+	if (slot && (!c || c->pending)) {
+		nc = http_connect(&u);
+		if (!IS_ERR(nc)) *slot = c = nc;
+	}
+	if (!c) return -1;
+	if (http_send(c, &u, req->since, 0) < 0) {
+		http_conn_close(c);
+		return -1;
+	}
+	req->conn = c;
+	c->last = i;
+	return 0;
+}
+
+static void http_pipeline_fill(void)
+{
+	for (size_t i = http_head; i < http_num; i++) {
+		if (http_reqs[i].conn) continue;
+		if (http_pipeline_send(i) < 0) break;
+	}
+}
+
+// Returns NULL for URLs the built-in client does not handle
+static struct apk_istream *http_istream(const char *url, time_t since, uint64_t *offset)
+{
+	struct http_url u;
+	struct http_conn *c;
+	struct apk_istream *is;
+	size_t i;
+
+	if (!http_parse_url(url, &u)) return NULL;
+
+	for (i = http_head; i < http_num; i++)
+		if (http_reqs[i].since == since && strcmp(http_reqs[i].url, url) == 0) break;
+	if (i == http_num || (offset && *offset)) return http_request(&u, since, offset);
+
+	// replies to the requests queued before it are not read
+	for (; http_head < i; http_head++) {
+		if (http_reqs[http_head].conn) http_conn_close(http_reqs[http_head].conn);
+		free(http_reqs[http_head].url);
+	}
+	http_pipeline_fill();
+	c = http_reqs[i].conn;
+	free(http_reqs[i].url);
+	http_head++;
+	if (c && c->busy) {
+		http_conn_close(c);
+		c = NULL;
+	}
+	if (c) {
+		is = http_open_reply(c, offset);
+		if (!IS_ERR(is) || (PTR_ERR(is) != -ECONNRESET && PTR_ERR(is) != -EPIPE)) {
+			http_pipeline_fill();
+			return is;
+		}
+	}
+	return http_request(&u, since, offset);
+}
+
+struct apk_istream *apk_io_url_istream(const char *url, time_t since)
+{
+	return http_istream(url, since, NULL) ?: wget_istream(url);
+}
+
+struct apk_istream *apk_io_url_istream_offset(const char *url, time_t since, uint64_t *offset)
+{
+	struct apk_istream *is = http_istream(url, since, offset);
+	if (is) return is;
+	// wget cannot write a range to stdout, so always start over
+	*offset = 0;
+	return wget_istream(url);
+}
+
+void apk_io_url_prefetch(const char *url, time_t since)
+{
+	struct http_url u;
+	struct http_req *reqs;
+	size_t alloc;
+
+	if (since == APK_ISTREAM_FORCE_REFRESH || !http_parse_url(url, &u)) return;
+	if (http_head == http_num) {
+		http_head = http_num = 0;
+		for (int i = 0; i < HTTP_MAX_CONNS; i++)
+			if (http_conns[i]) http_conns[i]->last = -1;
+	}
+	if (http_num == http_alloc) {
+		alloc = http_alloc ? http_alloc * 2 : 16;
+		reqs = realloc(http_reqs, alloc * sizeof *reqs);
+		if (!reqs) return;
+		http_reqs = reqs;
+		http_alloc = alloc;
+	}
+	http_reqs[http_num] = (struct http_req) { .url = strdup(url), .since = since };
+	if (http_reqs[http_num].url) http_num++;
+}
+
+void apk_io_url_prefetch_end(void)
+{
+	for (; http_head < http_num; http_head++) {
+		if (http_reqs[http_head].conn) http_conn_close(http_reqs[http_head].conn);
+		free(http_reqs[http_head].url);
+	}
+	free(http_reqs);
+	http_reqs = NULL;
+	http_head = http_num = http_alloc = 0;
+}
+
 void apk_io_url_check_certificate(bool check_cert)
 {
 	wget_no_check_certificate = !check_cert;
@@ -40,13 +718,27 @@ void apk_io_url_check_certificate(bool check_cert)
 void apk_io_url_set_timeout(int timeout)
 {
 	apk_fmt(wget_timeout, sizeof wget_timeout, "%d", timeout);
+	http_timeout = timeout;
+}
+
+void apk_io_url_set_max_connections(int max_conns)
+{
+	http_max_conns = min(max_conns, HTTP_MAX_CONNS);
 }
 
 void apk_io_url_set_redirect_callback(void (*cb)(int, const char *))
 {
 }
 
+static void apk_io_url_fini(void)
+{
+	apk_io_url_prefetch_end();
+	for (int i = 0; i < HTTP_MAX_CONNS; i++)
+		if (http_conns[i]) http_conn_close(http_conns[i]);
+}
+
 void apk_io_url_init(struct apk_out *out)
 {
 	wget_out = out;
+	atexit(apk_io_url_fini);
 }
@@ -0,0 +1,296 @@
+/* journal.c - Alpine Package Keeper (APK)
+ *
+ * Copyright (C) 2025 Timo Teräs <timo.teras@iki.fi>
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <zlib.h>
+#include "apk_journal.h"
+
+static uint64_t stat_mtime(const struct stat *st)
+{
+	return (uint64_t) st->st_mtim.tv_sec * 1000000000ULL + st->st_mtim.tv_nsec;
+}
+
+static uint32_t record_crc(const struct apk_journal_record *rec, const void *data)
+{
+	struct apk_journal_record hdr = *rec;
+	uLong crc;
+
+	hdr.crc = 0;
+	crc = crc32(0, (const Bytef *) &hdr, sizeof hdr);
+	return crc32(crc, data, rec->len);
+}
+
+static const struct apk_journal_record *record_at(apk_blob_t map, uint64_t off)
+{
+	const struct apk_journal_record *rec;
+
+	if (off > map.len || map.len - off < sizeof *rec) return NULL;
+	rec = (const struct apk_journal_record *) &map.ptr[off];
+	if (rec->len > map.len - off - sizeof *rec) return NULL;
+	if (rec->crc != record_crc(rec, &rec[1])) return NULL;
+	return rec;
+}
+
+static int pkg_cmp(const void *p1, const void *p2)
+{
+	const struct apk_journal_pkg *a = p1, *b = p2;
+	int r = memcmp(a->id, b->id, sizeof a->id);
+	if (r) return r;
+	return (a->off > b->off) - (a->off < b->off);
+}
+
+static int pkg_bsearch_cmp(const void *key, const void *item)
+{
+	const struct apk_journal_pkg *p = item;
+	return memcmp(key, p->id, sizeof p->id);
+}
+
+int apk_journal_open(struct apk_journal *j, int atfd, const char *file, const struct stat *installed)
+{
+	const struct apk_journal_header *hdr;
+	const struct apk_journal_record *rec;
+	struct stat st;
+	uint64_t off;
+	void *ptr;
+	int fd, r = -APKE_FORMAT_INVALID, n;
+
+	*j = (struct apk_journal) {};
+	apk_journal_pkg_array_init(&j->pkgs);
+
+	fd = openat(atfd, file, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		r = -errno;
+		goto err;
+	}
+	if (fstat(fd, &st) < 0) {
+		r = -errno;
+		goto err_fd;
+	}
+	if (st.st_size < sizeof *hdr) goto err_fd;
+
+	ptr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (ptr == MAP_FAILED) {
+		r = -errno;
+		goto err_fd;
+	}
+	close(fd);
+	j->map = APK_BLOB_PTR_LEN(ptr, st.st_size);
+
+	hdr = ptr;
+	if (hdr->magic != APK_JOURNAL_MAGIC || hdr->version != APK_JOURNAL_VERSION) goto err;
+	if (hdr->installed_ino != installed->st_ino ||
+	    hdr->installed_size != installed->st_size ||
+	    hdr->installed_mtime != stat_mtime(installed)) {
+		r = -ESTALE;
+		goto err;
+	}
+
+	// Only records up to the last intact commit record are valid
+	j->committed = off = sizeof *hdr;
+	n = 0;
+	while ((rec = record_at(j->map, off)) != NULL) {
+		off += sizeof *rec + rec->len;
+		if (rec->type == APK_JOURNAL_PKG || rec->type == APK_JOURNAL_DEL) {
+			struct apk_journal_pkg p = { .off = off - sizeof *rec - rec->len };
+			memcpy(p.id, rec->pkg, sizeof p.id);
+			apk_journal_pkg_array_add(&j->pkgs, p);
+		} else if (rec->type == APK_JOURNAL_COMMIT) {
+			j->committed = off;
+			n = apk_array_len(j->pkgs);
+		}
+	}
+	apk_array_truncate(j->pkgs, n);
+
+	// Keep the last record of each package
+	apk_array_qsort(j->pkgs, pkg_cmp);
+	n = 0;
+	apk_array_foreach(p, j->pkgs) {
+		if (n && memcmp(j->pkgs->item[n-1].id, p->id, sizeof p->id) == 0) n--;
+		j->pkgs->item[n++] = *p;
+	}
+	apk_array_truncate(j->pkgs, n);
+	return 0;
+
+err_fd:
+	close(fd);
+err:
+	apk_journal_close(j);
+	return r;
+}
+
+void apk_journal_close(struct apk_journal *j)
+{
+	apk_journal_pkg_array_free(&j->pkgs);
+	if (j->map.ptr) munmap(j->map.ptr, j->map.len);
+	*j = (struct apk_journal) {};
+}
+
+int apk_journal_next(const struct apk_journal *j, uint64_t *off, struct apk_journal_entry *e)
+{
+	const struct apk_journal_record *rec;
+
+	if (*off >= j->committed) return 0;
+	rec = record_at(j->map, *off);
+	if (!rec) return -APKE_FORMAT_INVALID;
+
+	*e = (struct apk_journal_entry) {
+		.type = rec->type,
+		.arg = rec->arg,
+		.pkg = APK_BLOB_PTR_LEN((char *) rec->pkg, sizeof rec->pkg),
+		.data = APK_BLOB_PTR_LEN((char *) &rec[1], rec->len),
+	};
+	*off += sizeof *rec + rec->len;
+	return 1;
+}
+
+const struct apk_journal_pkg *apk_journal_find(const struct apk_journal *j, apk_blob_t pkg)
+{
+	if (!j || !j->pkgs || pkg.len < APK_DIGEST_LENGTH_SHA1) return NULL;
+	return apk_array_bsearch(j->pkgs, pkg_bsearch_cmp, pkg.ptr);
+}
+
+static int jw_reserve(struct apk_journal_writer *w, size_t size)
+{
+	size_t alloc;
+	char *buf;
+
+	if (w->alloc - w->len >= size) return 0;
+	alloc = max(w->alloc * 2, w->len + size + 4096);
+	buf = realloc(w->buf, alloc);
+	if (!buf) return -ENOMEM;
+	w->buf = buf;
+	w->alloc = alloc;
+	return 0;
+}
+
+static int jw_write(struct apk_ostream *os, const void *ptr, size_t size)
+{
+	struct apk_journal_writer *w = container_of(os, struct apk_journal_writer, os);
+	int r;
+
+	if (os->rc) return os->rc;
+	r = jw_reserve(w, size);
+	if (r) return apk_ostream_cancel(os, r);
+	memcpy(&w->buf[w->len], ptr, size);
+	w->len += size;
+	return 0;
+}
+
+static int jw_close(struct apk_ostream *os)
+{
+	return os->rc;
+}
+
+static const struct apk_ostream_ops journal_writer_ops = {
+	.write = jw_write,
+	.close = jw_close,
+};
+
+void apk_journal_writer_init(struct apk_journal_writer *w)
+{
+	*w = (struct apk_journal_writer) {
+		.os.ops = &journal_writer_ops,
+	};
+}
+
+void apk_journal_writer_free(struct apk_journal_writer *w)
+{
+	free(w->buf);
+	apk_journal_writer_init(w);
+}
+
+struct apk_ostream *apk_journal_writer_begin(struct apk_journal_writer *w, uint8_t type, uint8_t arg, apk_blob_t pkg)
+{
+	struct apk_journal_record rec = {
+		.type = type,
+		.arg = arg,
+	};
+
+	if (pkg.ptr) memcpy(rec.pkg, pkg.ptr, min(pkg.len, sizeof rec.pkg));
+	w->rec = w->len;
+	jw_write(&w->os, &rec, sizeof rec);
+	return &w->os;
+}
+
+apk_blob_t apk_journal_writer_data(struct apk_journal_writer *w)
+{
+	size_t off = w->rec + sizeof(struct apk_journal_record);
+	return APK_BLOB_PTR_LEN(&w->buf[off], w->len - off);
+}
+
+void apk_journal_writer_end(struct apk_journal_writer *w, bool keep)
+{
+	struct apk_journal_record *rec = (struct apk_journal_record *) &w->buf[w->rec];
+
+	if (!keep || w->os.rc) {
+		w->len = w->rec;
+		return;
+	}
+	rec->len = w->len - w->rec - sizeof *rec;
+	rec->crc = record_crc(rec, &rec[1]);
+}
+
+static int write_all(int fd, const void *ptr, size_t size, off_t off)
+{
+	const char *p = ptr;
+	ssize_t n;
+
+	while (size) {
+		n = pwrite(fd, p, size, off);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			return -errno;
+		}
+		p += n;
+		off += n;
+		size -= n;
+	}
+	return 0;
+}
+
+// Appends the records followed by a commit record. A new journal is started
+// if *committed is zero. A torn write is detected on read and ignored, so the
+// journal always reflects either the previous or the new commit.
+int apk_journal_writer_commit(struct apk_journal_writer *w, int atfd, const char *file, uint64_t *committed, const struct stat *installed)
+{
+	struct apk_journal_header hdr = {
+		.magic = APK_JOURNAL_MAGIC,
+		.version = APK_JOURNAL_VERSION,
+		.installed_ino = installed->st_ino,
+		.installed_size = installed->st_size,
+		.installed_mtime = stat_mtime(installed),
+	};
+	uint64_t off = *committed;
+	int fd, r;
+
+	apk_journal_writer_begin(w, APK_JOURNAL_COMMIT, 0, APK_BLOB_NULL);
+	apk_journal_writer_end(w, true);
+	if (w->os.rc) return w->os.rc;
+
+	if (off) fd = openat(atfd, file, O_WRONLY | O_CLOEXEC);
+	else fd = openat(atfd, file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) return -errno;
+
+	if (off) {
+		r = ftruncate(fd, off) < 0 ? -errno : 0;
+	} else {
+		r = write_all(fd, &hdr, sizeof hdr, 0);
+		off = sizeof hdr;
+	}
+	if (!r) r = write_all(fd, w->buf, w->len, off);
+	if (!r && fdatasync(fd) < 0) r = -errno;
+	close(fd);
+	if (r) return r;
+
+	*committed = off + w->len;
+	return 0;
+}
@@ -0,0 +1,216 @@
+/* ownerdb.c - Alpine Package Keeper (APK)
+ *
+ * Copyright (C) 2025 Timo Teräs <timo.teras@iki.fi>
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "apk_ownerdb.h"
+
+static uint64_t stat_mtime(const struct stat *st)
+{
+	return (uint64_t) st->st_mtim.tv_sec * 1000000000ULL + st->st_mtim.tv_nsec;
+}
+
+static int path_cmp(apk_blob_t a, apk_blob_t b)
+{
+	int r = memcmp(a.ptr, b.ptr, min(a.len, b.len));
+	if (r) return r;
+	return (a.len > b.len) - (a.len < b.len);
+}
+
+static int item_cmp(const void *p1, const void *p2)
+{
+	const struct apk_ownerdb_item *a = p1, *b = p2;
+	int r = path_cmp(a->path, b->path);
+	if (r) return r;
+	// directory ownership takes precedence, so sort it first
+	r = (int)(b->flags & APK_OWNERDB_DIR) - (int)(a->flags & APK_OWNERDB_DIR);
+	if (r) return r;
+	// and the first package listing a file owns it
+	return (a->pkg > b->pkg) - (a->pkg < b->pkg);
+}
+
+void apk_ownerdb_writer_init(struct apk_ownerdb_writer *w)
+{
+	apk_balloc_init(&w->ba, 64*1024);
+	apk_ownerdb_digest_array_init(&w->pkgs);
+	apk_ownerdb_item_array_init(&w->items);
+}
+
+void apk_ownerdb_writer_free(struct apk_ownerdb_writer *w)
+{
+	apk_ownerdb_item_array_free(&w->items);
+	apk_ownerdb_digest_array_free(&w->pkgs);
+	apk_balloc_destroy(&w->ba);
+}
+
+uint32_t apk_ownerdb_writer_add_pkg(struct apk_ownerdb_writer *w, uint8_t digest_alg, apk_blob_t digest)
+{
+	struct apk_digest d = { .alg = digest_alg, .len = min(digest.len, APK_DIGEST_LENGTH_MAX) };
+
+	memcpy(d.data, digest.ptr, d.len);
+	apk_ownerdb_digest_array_add(&w->pkgs, d);
+	return apk_array_len(w->pkgs) - 1;
+}
+
+void apk_ownerdb_writer_add(struct apk_ownerdb_writer *w, uint32_t pkg, apk_blob_t path, uint16_t flags)
+{
+	if (APK_BLOB_IS_NULL(path) || path.len > UINT16_MAX) return;
+	apk_ownerdb_item_array_add(&w->items, (struct apk_ownerdb_item) {
+		.path = apk_balloc_dup(&w->ba, path),
+		.pkg = pkg,
+		.flags = flags,
+	});
+}
+
+int apk_ownerdb_writer_write(struct apk_ownerdb_writer *w, struct apk_ostream *os, const struct stat *installed)
+{
+	struct apk_ownerdb_header hdr = {
+		.magic = APK_OWNERDB_MAGIC,
+		.version = APK_OWNERDB_VERSION,
+		.installed_ino = installed->st_ino,
+		.installed_size = installed->st_size,
+		.installed_mtime = stat_mtime(installed),
+		.num_pkgs = apk_array_len(w->pkgs),
+		.num_entries = apk_array_len(w->items),
+	};
+	uint32_t off = 0;
+
+	if (IS_ERR(os)) return PTR_ERR(os);
+
+	apk_array_qsort(w->items, item_cmp);
+	apk_array_foreach(d, w->pkgs) off += d->len;
+	apk_array_foreach(item, w->items) off += item->path.len;
+	hdr.strings_len = off;
+	apk_ostream_write(os, &hdr, sizeof hdr);
+
+	off = 0;
+	apk_array_foreach(d, w->pkgs) {
+		struct apk_ownerdb_pkg p = {
+			.digest_alg = d->alg,
+			.digest_len = d->len,
+			.digest_off = off,
+		};
+		apk_ostream_write(os, &p, sizeof p);
+		off += d->len;
+	}
+	apk_array_foreach(item, w->items) {
+		struct apk_ownerdb_entry e = {
+			.path_off = off,
+			.path_len = item->path.len,
+			.flags = item->flags,
+			.pkg = item->pkg,
+		};
+		apk_ostream_write(os, &e, sizeof e);
+		off += item->path.len;
+	}
+	apk_array_foreach(d, w->pkgs) apk_ostream_write_blob(os, APK_DIGEST_BLOB(*d));
+	apk_array_foreach(item, w->items) apk_ostream_write_blob(os, item->path);
+	return apk_ostream_close(os);
+}
+
+int apk_ownerdb_open(struct apk_ownerdb *odb, int atfd, const char *file, const struct stat *installed)
+{
+	const struct apk_ownerdb_header *hdr;
+	struct stat st;
+	uint64_t size;
+	void *ptr;
+	int fd, r = -APKE_FORMAT_INVALID;
+
+	*odb = (struct apk_ownerdb) {};
+
+	fd = openat(atfd, file, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return -errno;
+	if (fstat(fd, &st) < 0) {
+		r = -errno;
+		goto err_fd;
+	}
+	if (st.st_size < sizeof *hdr) goto err_fd;
+
+	ptr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (ptr == MAP_FAILED) {
+		r = -errno;
+		goto err_fd;
+	}
+	close(fd);
+	odb->map = APK_BLOB_PTR_LEN(ptr, st.st_size);
+
+	hdr = ptr;
+	if (hdr->magic != APK_OWNERDB_MAGIC || hdr->version != APK_OWNERDB_VERSION) goto err;
+	size = sizeof *hdr +
+		(uint64_t) hdr->num_pkgs * sizeof(struct apk_ownerdb_pkg) +
+		(uint64_t) hdr->num_entries * sizeof(struct apk_ownerdb_entry) +
+		hdr->strings_len;
+	if (size != st.st_size) goto err;
+	if (hdr->installed_ino != installed->st_ino ||
+	    hdr->installed_size != installed->st_size ||
+	    hdr->installed_mtime != stat_mtime(installed)) {
+		r = -ESTALE;
+		goto err;
+	}
+
+	odb->hdr = hdr;
+	odb->pkgs = (const struct apk_ownerdb_pkg *) &hdr[1];
+	odb->entries = (const struct apk_ownerdb_entry *) &odb->pkgs[hdr->num_pkgs];
+	odb->strings = (const char *) &odb->entries[hdr->num_entries];
+	return 0;
+
+err_fd:
+	close(fd);
+	return r;
+err:
+	apk_ownerdb_close(odb);
+	return r;
+}
+
+void apk_ownerdb_close(struct apk_ownerdb *odb)
+{
+	if (odb->map.ptr) munmap(odb->map.ptr, odb->map.len);
+	*odb = (struct apk_ownerdb) {};
+}
+
+static apk_blob_t entry_path(const struct apk_ownerdb *odb, const struct apk_ownerdb_entry *e)
+{
+	if ((uint64_t) e->path_off + e->path_len > odb->hdr->strings_len) return APK_BLOB_NULL;
+	return APK_BLOB_PTR_LEN((char *) &odb->strings[e->path_off], e->path_len);
+}
+
+int apk_ownerdb_lookup(const struct apk_ownerdb *odb, apk_blob_t path, struct apk_digest *pkg)
+{
+	const struct apk_ownerdb_entry *e;
+	const struct apk_ownerdb_pkg *p;
+	uint32_t l = 0, h;
+	apk_blob_t b;
+
+	if (!odb->hdr) return -ENOENT;
+
+	h = odb->hdr->num_entries;
+	while (l < h) {
+		uint32_t m = l + (h - l) / 2;
+		b = entry_path(odb, &odb->entries[m]);
+		if (APK_BLOB_IS_NULL(b)) return -APKE_FORMAT_INVALID;
+		if (path_cmp(b, path) < 0) l = m + 1;
+		else h = m;
+	}
+	if (l >= odb->hdr->num_entries) return -ENOENT;
+
+	e = &odb->entries[l];
+	if (path_cmp(entry_path(odb, e), path) != 0) return -ENOENT;
+	if (e->pkg >= odb->hdr->num_pkgs) return -APKE_FORMAT_INVALID;
+
+	p = &odb->pkgs[e->pkg];
+	if (p->digest_len > APK_DIGEST_LENGTH_MAX ||
+	    (uint64_t) p->digest_off + p->digest_len > odb->hdr->strings_len)
+		return -APKE_FORMAT_INVALID;
+	pkg->alg = p->digest_alg;
+	pkg->len = p->digest_len;
+	memcpy(pkg->data, &odb->strings[p->digest_off], p->digest_len);
+	return 0;
+}
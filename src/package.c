@@ -413,6 +413,7 @@ void apk_pkgtmpl_init(struct apk_package_tmpl *tmpl, struct apk_database *db)
 	apk_dependency_array_init(&tmpl->pkg.provides);
 	apk_dependency_array_init(&tmpl->pkg.recommends);
 	apk_blobptr_array_init(&tmpl->pkg.tags);
+	apk_blobptr_array_init(&tmpl->pkg.deltas);
 	apk_pkgtmpl_reset(tmpl);
 }
 
@@ -424,6 +425,7 @@ void apk_pkgtmpl_free(struct apk_package_tmpl *tmpl)
 	apk_dependency_array_free(&tmpl->pkg.provides);
 	apk_dependency_array_free(&tmpl->pkg.recommends);
 	apk_blobptr_array_free(&tmpl->pkg.tags);
+	apk_blobptr_array_free(&tmpl->pkg.deltas);
 }
 
 void apk_pkgtmpl_reset(struct apk_package_tmpl *tmpl)
@@ -436,6 +438,7 @@ void apk_pkgtmpl_reset(struct apk_package_tmpl *tmpl)
 			.provides = apk_array_reset(tmpl->pkg.provides),
 			.recommends = apk_array_reset(tmpl->pkg.recommends),
 			.tags = apk_array_reset(tmpl->pkg.tags),
+			.deltas = apk_array_reset(tmpl->pkg.deltas),
 			.arch = &apk_atom_null,
 			.license = &apk_atom_null,
 			.origin = &apk_atom_null,
@@ -585,6 +588,7 @@ void apk_pkgtmpl_from_adb(struct apk_package_tmpl *tmpl, struct adb_obj *pkginfo
 	apk_deps_from_adb(&pkg->install_if, db, adb_ro_obj(pkginfo, ADBI_PI_INSTALL_IF, &obj));
 	apk_deps_from_adb(&pkg->recommends, db, adb_ro_obj(pkginfo, ADBI_PI_RECOMMENDS, &obj));
 	apk_blobs_from_adb(&pkg->tags, db, adb_ro_obj(pkginfo, ADBI_PI_TAGS, &obj));
+	apk_blobs_from_adb(&pkg->deltas, db, adb_ro_obj(pkginfo, ADBI_PI_DELTAS, &obj));
 }
 
 static int read_info_line(struct read_info_ctx *ri, apk_blob_t line)
@@ -734,31 +738,38 @@ static inline int make_device_tree(struct apk_database *db)
 }
 #endif
 
-int apk_ipkg_run_script(struct apk_installed_package *ipkg,
-			struct apk_database *db,
-			unsigned int type, char **argv)
+// Returns 1 if the script was started, 0 if there is nothing to run, or
+// -1 with an error printed. A started script is completed with
+// apk_ipkg_script_finish() after running the process.
+int apk_ipkg_script_start(struct apk_ipkg_script_run *sr, struct apk_installed_package *ipkg,
+			  struct apk_database *db, unsigned int type, char **argv, struct apk_out *out)
 {
 	// When memfd_create is not available store the script in /lib/apk/exec
 	// and hope it allows executing.
 	static const char script_exec_dir[] = "lib/apk/exec";
-	struct apk_out *out = &db->ctx->out;
 	struct apk_package *pkg = ipkg->pkg;
 	const char *reason = "failed to execute: ";
-	char fn[PATH_MAX];
+	apk_blob_t script;
 	int fd = -1, root_fd = db->root_fd, ret = 0, r;
-	bool created = false;
 
-	if (type >= APK_SCRIPT_MAX || ipkg->script[type].ptr == NULL) return 0;
+	*sr = (struct apk_ipkg_script_run) {
+		.ipkg = ipkg,
+		.type = type,
+		.trace_start = apk_trace_begin(&db->ctx->trace),
+	};
+
+	script = apk_db_ipkg_script(db, ipkg, type);
+	if (script.ptr == NULL) return 0;
 	if ((db->ctx->flags & (APK_NO_SCRIPTS | APK_SIMULATE)) != 0) return 0;
 
-	r = apk_fmt(fn, sizeof fn, "%s/" PKG_VER_FMT ".%s", script_exec_dir, PKG_VER_PRINTF(pkg), apk_script_types[type]);
+	r = apk_fmt(sr->fn, sizeof sr->fn, "%s/" PKG_VER_FMT ".%s", script_exec_dir, PKG_VER_PRINTF(pkg), apk_script_types[type]);
 	if (r < 0) goto err_r;
 
-	argv[0] = fn;
+	argv[0] = sr->fn;
 
 	if (!db->memfd_failed) {
 		/* Linux kernel >= 6.3 */
-		fd = memfd_create(fn, MFD_EXEC|MFD_ALLOW_SEALING);
+		fd = memfd_create(sr->fn, MFD_EXEC|MFD_ALLOW_SEALING);
 		if (fd < 0) db->memfd_failed = 1;
 	}
 	if (!db->script_dirs_checked) {
@@ -774,15 +785,15 @@ int apk_ipkg_run_script(struct apk_installed_package *ipkg,
 		db->script_dirs_checked = 1;
 	}
 	if (fd < 0) {
-		fd = openat(root_fd, fn, O_CREAT | O_RDWR | O_TRUNC, 0755);
-		created = fd >= 0;
+		fd = openat(root_fd, sr->fn, O_CREAT | O_RDWR | O_TRUNC, 0755);
+		sr->created = fd >= 0;
 	}
 	if (fd < 0) goto err_errno;
 
-	if (write(fd, ipkg->script[type].ptr, ipkg->script[type].len) < 0)
+	if (write(fd, script.ptr, script.len) < 0)
 		goto err_errno;
 
-	if (created) {
+	if (sr->created) {
 		close(fd);
 		fd = -1;
 	} else {
@@ -795,11 +806,10 @@ int apk_ipkg_run_script(struct apk_installed_package *ipkg,
 	apk_msg(out, "%sExecuting " PKG_VER_FMT ".%s",
 		db->indent_level ? "  " : "",
 		PKG_VER_PRINTF(pkg), apk_script_types[type]);
-	if (apk_db_run_script(db, apk_script_types[type], pkg->name->name, fd, argv, db->indent_level ? "  * " : "* " ) < 0)
+	if (apk_db_start_script(db, &sr->proc, out, apk_script_types[type], pkg->name->name, fd, argv, db->indent_level ? "  * " : "* " ) != 0)
 		goto err;
 
-	/* Script may have done something that changes id cache contents */
-	apk_id_cache_reset(db->id_cache);
+	ret = 1;
 	goto cleanup;
 
 err_errno:
@@ -808,13 +818,39 @@ err_r:
 	apk_err(out, PKG_VER_FMT ".%s: %s%s", PKG_VER_PRINTF(pkg), apk_script_types[type], reason, apk_error_str(r));
 err:
 	ipkg->broken_script = 1;
-	ret = 1;
+	ret = -1;
+	if (sr->created) unlinkat(root_fd, sr->fn, 0);
 cleanup:
 	if (fd >= 0) close(fd);
-	if (created) unlinkat(root_fd, fn, 0);
 	return ret;
 }
 
+int apk_ipkg_script_finish(struct apk_ipkg_script_run *sr, struct apk_database *db, int r)
+{
+	apk_trace_end_tid(&db->ctx->trace, sr->trace_tid, sr->trace_start, "script",
+		PKG_VER_FMT ".%s", PKG_VER_PRINTF(sr->ipkg->pkg), apk_script_types[sr->type]);
+	if (sr->created) unlinkat(db->root_fd, sr->fn, 0);
+	if (r < 0) {
+		sr->ipkg->broken_script = 1;
+		return 1;
+	}
+	/* Script may have done something that changes id cache contents */
+	apk_id_cache_reset(db->id_cache);
+	return 0;
+}
+
+int apk_ipkg_run_script(struct apk_installed_package *ipkg,
+			struct apk_database *db,
+			unsigned int type, char **argv)
+{
+	struct apk_ipkg_script_run sr;
+	int r;
+
+	r = apk_ipkg_script_start(&sr, ipkg, db, type, argv, &db->ctx->out);
+	if (r <= 0) return r < 0;
+	return apk_ipkg_script_finish(&sr, db, apk_process_run(&sr.proc));
+}
+
 static int write_depends(struct apk_ostream *os, const char *field,
 			 struct apk_dependency_array *deps)
 {
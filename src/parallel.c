@@ -0,0 +1,127 @@
+/* parallel.c - Alpine Package Keeper (APK)
+ *
+ * Copyright (C) 2025 Timo Teräs <timo.teras@iki.fi>
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "apk_parallel.h"
+#include "apk_nproc.h"
+
+struct parallel_state {
+	const struct apk_parallel_ops *ops;
+	void *ctx;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond_space, cond_done;
+	unsigned int num, window, next, consumed;
+	uint8_t *finished;
+	bool abort;
+};
+
+static void *parallel_worker(void *arg)
+{
+	struct parallel_state *ps = arg;
+	unsigned int i;
+
+	pthread_mutex_lock(&ps->mutex);
+	for (;;) {
+		while (!ps->abort && ps->next < ps->num && ps->next >= ps->consumed + ps->window)
+			pthread_cond_wait(&ps->cond_space, &ps->mutex);
+		if (ps->abort || ps->next >= ps->num) break;
+		i = ps->next++;
+		pthread_mutex_unlock(&ps->mutex);
+
+		ps->ops->work(ps->ctx, i);
+
+		pthread_mutex_lock(&ps->mutex);
+		ps->finished[i] = 1;
+		pthread_cond_broadcast(&ps->cond_done);
+	}
+	pthread_mutex_unlock(&ps->mutex);
+	return NULL;
+}
+
+static int parallel_consume(struct parallel_state *ps)
+{
+	int r = 0;
+
+	for (unsigned int i = 0; i < ps->num; i++) {
+		pthread_mutex_lock(&ps->mutex);
+		while (!ps->finished[i]) pthread_cond_wait(&ps->cond_done, &ps->mutex);
+		pthread_mutex_unlock(&ps->mutex);
+
+		if (ps->ops->done) r = ps->ops->done(ps->ctx, i);
+
+		pthread_mutex_lock(&ps->mutex);
+		ps->consumed = i + 1;
+		if (r) ps->abort = true;
+		pthread_cond_broadcast(&ps->cond_space);
+		pthread_mutex_unlock(&ps->mutex);
+		if (r) break;
+	}
+	return r;
+}
+
+static int serial_run(unsigned int num, const struct apk_parallel_ops *ops, void *ctx)
+{
+	int r = 0;
+
+	for (unsigned int i = 0; i < num; i++) {
+		ops->work(ctx, i);
+		if (ops->done) r = ops->done(ctx, i);
+		if (r) break;
+	}
+	return r;
+}
+
+int apk_parallel_jobs(int jobs)
+{
+	if (jobs > 0) return jobs;
+	return apk_get_nproc();
+}
+
+int apk_parallel_run(int jobs, unsigned int num, unsigned int window, const struct apk_parallel_ops *ops, void *ctx)
+{
+	struct parallel_state ps = {
+		.ops = ops,
+		.ctx = ctx,
+		.num = num,
+		.window = window ?: 1,
+	};
+	pthread_t *threads;
+	int i, nthreads = 0, r = 0;
+
+	jobs = apk_parallel_jobs(jobs);
+	if ((unsigned int) jobs > num) jobs = num;
+	if (jobs <= 1) return serial_run(num, ops, ctx);
+
+	threads = calloc(jobs, sizeof *threads);
+	ps.finished = calloc(num, 1);
+	if (!threads || !ps.finished) goto err;
+
+	pthread_mutex_init(&ps.mutex, NULL);
+	pthread_cond_init(&ps.cond_space, NULL);
+	pthread_cond_init(&ps.cond_done, NULL);
+	for (i = 0; i < jobs; i++) {
+		if (pthread_create(&threads[nthreads], NULL, parallel_worker, &ps) != 0) break;
+		nthreads++;
+	}
+	if (nthreads) r = parallel_consume(&ps);
+	for (i = 0; i < nthreads; i++) pthread_join(threads[i], NULL);
+	pthread_cond_destroy(&ps.cond_done);
+	pthread_cond_destroy(&ps.cond_space);
+	pthread_mutex_destroy(&ps.mutex);
+	if (!nthreads) goto err;
+
+	free(ps.finished);
+	free(threads);
+	return r;
+err:
+	free(ps.finished);
+	free(threads);
+	return serial_run(num, ops, ctx);
+}
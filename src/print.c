@@ -85,6 +85,8 @@
 	func(APKE_REPO_SYNTAX,		"repositories file syntax error") \
 	func(APKE_REPO_KEYWORD,		"unsupported repositories file keyword") \
 	func(APKE_REPO_VARIABLE,	"undefined repositories file variable") \
+	func(APKE_DELTA_FORMAT,		"delta package format error") \
+	func(APKE_DELTA_MISMATCH,	"delta package does not match the packages") \
 
 const char *apk_error_str(int error)
 {
@@ -10,8 +10,10 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <spawn.h>
+#include <signal.h>
 #include <unistd.h>
 #include <sys/wait.h>
+#include <sys/socket.h>
 
 #include "apk_io.h"
 #include "apk_process.h"
@@ -60,6 +62,7 @@ int apk_process_init(struct apk_process *p, const char *argv0, const char *logpf
 		.argv0 = argv0,
 		.is = is,
 		.out = out,
+		.status_fd = -1,
 	};
 	if (IS_ERR(is)) return -PTR_ERR(is);
 
@@ -172,6 +175,234 @@ int apk_process_spawn(struct apk_process *p, const char *path, char * const* arg
 	return -r;
 }
 
+#define EXECUTOR_MSG_MAX	(64*1024)
+#define EXECUTOR_ARGS_MAX	1024
+#define EXECUTOR_FDS_MAX	5	// stdin, stdout, stderr, status, script
+
+// Request is the argv and env strings, each terminated with a NUL.
+// The stdio, status pipe and optional script fds are passed with it.
+struct executor_request {
+	uint32_t argc, envc;
+};
+
+static void exec_panic(const char *reason)
+{
+	char buf[256];
+	int n = apk_fmt(buf, sizeof buf, "%s: %s\n", reason, strerror(errno));
+	apk_write_fully(STDERR_FILENO, buf, n);
+	_exit(127);
+}
+
+static char *executor_pack_str(char *p, const char *end, const char *str)
+{
+	size_t len = strlen(str) + 1;
+	if (!p || end - p < len) return NULL;
+	memcpy(p, str, len);
+	return p + len;
+}
+
+static ssize_t executor_pack(char *buf, char * const* argv, char * const* env)
+{
+	struct executor_request req = {};
+	char *p = &buf[sizeof req], *end = &buf[EXECUTOR_MSG_MAX];
+
+	for (; argv[req.argc]; req.argc++) p = executor_pack_str(p, end, argv[req.argc]);
+	for (; env[req.envc]; req.envc++) p = executor_pack_str(p, end, env[req.envc]);
+	if (!p || req.argc + req.envc + 2 > EXECUTOR_ARGS_MAX) return -E2BIG;
+	memcpy(buf, &req, sizeof req);
+	return p - buf;
+}
+
+// Returns the environment, which follows the argv in args
+static char **executor_unpack(char *buf, size_t len, char **args)
+{
+	struct executor_request req;
+	char *p = &buf[sizeof req], *end = &buf[len], *nul;
+
+	if (len < sizeof req) return NULL;
+	memcpy(&req, buf, sizeof req);
+	if (req.argc == 0 || req.argc >= EXECUTOR_ARGS_MAX || req.envc >= EXECUTOR_ARGS_MAX ||
+	    req.argc + req.envc + 2 > EXECUTOR_ARGS_MAX)
+		return NULL;
+	for (uint32_t i = 0; i < req.argc + req.envc; i++) {
+		nul = memchr(p, 0, end - p);
+		if (!nul) return NULL;
+		args[i + (i >= req.argc)] = p;
+		p = nul + 1;
+	}
+	args[req.argc] = NULL;
+	args[req.argc + req.envc + 1] = NULL;
+	return &args[req.argc + 1];
+}
+
+// Runs in a forked child of the executor that waits for the script and
+// reports its exit status, so the executor can serve other requests.
+static void executor_run(char **argv, char **envp, int *fds, int nfds)
+{
+	char fd_path[NAME_MAX];
+	const char *path = argv[0];
+	int status = 127 << 8;
+	pid_t pid;
+
+	signal(SIGCHLD, SIG_DFL);
+	pid = fork();
+	if (pid == 0) {
+		dup2(fds[0], STDIN_FILENO);
+		dup2(fds[1], STDOUT_FILENO);
+		dup2(fds[2], STDERR_FILENO);
+		if (nfds > 4) {
+			fcntl(fds[4], F_SETFD, 0);
+			path = apk_fmts(fd_path, sizeof fd_path, "/proc/self/fd/%d", fds[4]);
+		}
+		execve(path, argv, envp);
+		exec_panic("execve");
+	}
+	if (pid > 0) while (waitpid(pid, &status, 0) < 0 && errno == EINTR);
+	apk_write_fully(fds[3], &status, sizeof status);
+	_exit(0);
+}
+
+static void executor_main(int sock)
+{
+	static char buf[EXECUTOR_MSG_MAX];
+	char *args[EXECUTOR_ARGS_MAX];
+
+	// Children are reaped automatically
+	signal(SIGCHLD, SIG_IGN);
+	for (;;) {
+		union {
+			struct cmsghdr hdr;
+			char buf[CMSG_SPACE(sizeof(int) * EXECUTOR_FDS_MAX)];
+		} cmsg;
+		struct iovec iov = { .iov_base = buf, .iov_len = sizeof buf };
+		struct msghdr msg = {
+			.msg_iov = &iov,
+			.msg_iovlen = 1,
+			.msg_control = cmsg.buf,
+			.msg_controllen = sizeof cmsg.buf,
+		};
+		struct cmsghdr *c;
+		int fds[EXECUTOR_FDS_MAX], nfds = 0;
+		char **envp;
+		ssize_t n;
+
+		n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) _exit(0);
+
+		for (c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+			if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS) continue;
+			nfds = min((c->cmsg_len - CMSG_LEN(0)) / sizeof(int), EXECUTOR_FDS_MAX);
+			memcpy(fds, CMSG_DATA(c), nfds * sizeof(int));
+		}
+		envp = nfds >= 4 ? executor_unpack(buf, n, args) : NULL;
+		if (envp && fork() == 0) {
+			close(sock);
+			executor_run(args, envp, fds, nfds);
+		}
+		for (int i = 0; i < nfds; i++) close(fds[i]);
+	}
+}
+
+int apk_executor_start(struct apk_executor *e, int (*setup)(void *ctx), void *ctx)
+{
+	int sv[2], fd, r;
+	pid_t pid;
+
+	*e = (struct apk_executor) { .sock = -1 };
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0) return -errno;
+
+	pid = fork();
+	if (pid < 0) {
+		r = -errno;
+		close(sv[0]);
+		close(sv[1]);
+		return r;
+	}
+	if (pid == 0) {
+		close(sv[0]);
+		signal(SIGINT, SIG_DFL);
+		signal(SIGWINCH, SIG_DFL);
+		fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+		if (fd > STDOUT_FILENO) {
+			dup2(fd, STDIN_FILENO);
+			dup2(fd, STDOUT_FILENO);
+			close(fd);
+		}
+		if (setup && setup(ctx) < 0) _exit(127);
+		executor_main(sv[1]);
+	}
+	close(sv[1]);
+	e->pid = pid;
+	e->sock = sv[0];
+	return 0;
+}
+
+void apk_executor_stop(struct apk_executor *e)
+{
+	if (e->pid <= 0) return;
+	close(e->sock);
+	while (waitpid(e->pid, NULL, 0) < 0 && errno == EINTR);
+	*e = (struct apk_executor) { .sock = -1 };
+}
+
+int apk_process_exec(struct apk_process *p, struct apk_executor *e, int fd, char * const* argv, char * const* env)
+{
+	int fds[EXECUTOR_FDS_MAX] = { p->pipe_stdin[0], p->pipe_stdout[1], p->pipe_stderr[1], -1, fd };
+	int status_pipe[2], nfds = fd >= 0 ? 5 : 4, r;
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(int) * EXECUTOR_FDS_MAX)];
+	} cmsg = {};
+	struct iovec iov;
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = cmsg.buf,
+		.msg_controllen = CMSG_SPACE(sizeof(int) * nfds),
+	};
+	char *buf;
+	ssize_t n;
+
+	if (e->pid <= 0) return -ENOTCONN;
+
+	buf = malloc(EXECUTOR_MSG_MAX);
+	if (!buf) return -ENOMEM;
+	n = executor_pack(buf, argv, env ?: environ);
+	if (n < 0) {
+		r = n;
+		goto err;
+	}
+	if (pipe2(status_pipe, O_CLOEXEC) < 0) {
+		r = -errno;
+		goto err;
+	}
+	fds[3] = status_pipe[1];
+
+	iov = (struct iovec) { .iov_base = buf, .iov_len = n };
+	cmsg.hdr.cmsg_level = SOL_SOCKET;
+	cmsg.hdr.cmsg_type = SCM_RIGHTS;
+	cmsg.hdr.cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+	memcpy(CMSG_DATA(&cmsg.hdr), fds, sizeof(int) * nfds);
+
+	while ((n = sendmsg(e->sock, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR);
+	r = n < 0 ? -errno : 0;
+	close(status_pipe[1]);
+	if (r < 0) {
+		close(status_pipe[0]);
+		// The executor is gone
+		if (r == -EPIPE || r == -ECONNRESET) apk_executor_stop(e);
+		goto err;
+	}
+	p->status_fd = status_pipe[0];
+	close_fd(&p->pipe_stdin[0]);
+	close_fd(&p->pipe_stdout[1]);
+	close_fd(&p->pipe_stderr[1]);
+err:
+	free(buf);
+	return r;
+}
+
 static int apk_process_handle(struct apk_process *p, bool break_on_stdout)
 {
 	struct pollfd fds[3] = {
@@ -224,6 +455,40 @@ static int apk_process_handle(struct apk_process *p, bool break_on_stdout)
 	return apk_process_cleanup(p);
 }
 
+// Handles the output of the processes until the output of one of them
+// is closed, and returns its index. The processes must not have an input
+// stream. The caller should then apk_process_cleanup() the process.
+int apk_process_wait_any(struct apk_process **procs, unsigned int num)
+{
+	struct pollfd *fds;
+	unsigned int i;
+	int ret = -1;
+
+	fds = calloc(num * 2, sizeof *fds);
+	if (!fds) return -ENOMEM;
+	while (ret < 0) {
+		for (i = 0; i < num; i++) {
+			struct apk_process *p = procs[i];
+			if (p->pipe_stdout[0] < 0 && p->pipe_stderr[0] < 0) {
+				ret = i;
+				break;
+			}
+			fds[i*2+0] = (struct pollfd) { .fd = p->pipe_stdout[0], .events = POLLIN };
+			fds[i*2+1] = (struct pollfd) { .fd = p->pipe_stderr[0], .events = POLLIN };
+		}
+		if (ret >= 0 || poll(fds, num * 2, -1) <= 0) continue;
+		for (i = 0; i < num; i++) {
+			struct apk_process *p = procs[i];
+			if (fds[i*2+0].revents && !buf_process(&p->buf_stdout, p->pipe_stdout[0], p->out, NULL, p))
+				close_fd(&p->pipe_stdout[0]);
+			if (fds[i*2+1].revents && !buf_process(&p->buf_stderr, p->pipe_stderr[0], p->out, APK_OUT_FLUSH, p))
+				close_fd(&p->pipe_stderr[0]);
+		}
+	}
+	free(fds);
+	return ret;
+}
+
 int apk_process_run(struct apk_process *p)
 {
 	return apk_process_handle(p, false);
@@ -231,15 +496,22 @@ int apk_process_run(struct apk_process *p)
 
 int apk_process_cleanup(struct apk_process *p)
 {
-	if (p->pid != 0) {
+	if (p->pid != 0 || p->status_fd >= 0) {
 		char buf[APK_EXIT_STATUS_MAX_SIZE];
 		if (p->is) apk_istream_close(p->is);
 		close_fd(&p->pipe_stdin[1]);
 		close_fd(&p->pipe_stdout[0]);
 		close_fd(&p->pipe_stderr[0]);
 
-		while (waitpid(p->pid, &p->status, 0) < 0 && errno == EINTR);
-		p->pid = 0;
+		if (p->status_fd >= 0) {
+			ssize_t n;
+			while ((n = read(p->status_fd, &p->status, sizeof p->status)) < 0 && errno == EINTR);
+			if (n != sizeof p->status) p->status = 127 << 8;
+			close_fd(&p->status_fd);
+		} else {
+			while (waitpid(p->pid, &p->status, 0) < 0 && errno == EINTR);
+			p->pid = 0;
+		}
 
 		if (apk_exit_status_str(p->status, buf, sizeof buf))
 			apk_err(p->out, "%s: %s", p->argv0, buf);
@@ -199,6 +199,7 @@ int apk_query_parse_option(struct apk_ctx *ac, int opt, const char *optarg)
 	case OPT_QUERY_match:
 		qs->match = apk_query_fields(APK_BLOB_STR(optarg), APK_Q_FIELDS_MATCHABLE);
 		if (!qs->match) return -EINVAL;
+		if (qs->match & BIT(APK_Q_FIELD_OWNER)) ac->open_flags |= APK_OPENF_OWNER_INDEX;
 		break;
 	case OPT_QUERY_recursive:
 		qs->mode.recursive = 1;
@@ -251,10 +252,10 @@ static int serialize_blobptr_array(struct apk_serializer *ser, struct apk_blobpt
 	return apk_ser_end(ser);
 }
 
-static int num_scripts(const struct apk_installed_package *ipkg)
+static int num_scripts(struct apk_database *db, struct apk_installed_package *ipkg)
 {
 	int num = 0;
-	for (int i = 0; i < ARRAY_SIZE(ipkg->script); i++) if (ipkg->script[i].len) num++;
+	for (int i = 0; i < ARRAY_SIZE(ipkg->script); i++) if (apk_db_ipkg_script(db, ipkg, i).len) num++;
 	return num;
 }
 
@@ -460,11 +461,11 @@ static int __apk_package_serialize(struct apk_package *pkg, struct pkgser_ctx *p
 			apk_ser_string(ser, APK_BLOB_STR(str));
 		apk_ser_end(ser);
 	}
-	if ((BIT(APK_Q_FIELD_SCRIPTS) & fields) && num_scripts(ipkg)) {
+	if ((BIT(APK_Q_FIELD_SCRIPTS) & fields) && num_scripts(db, ipkg)) {
 		apk_ser_key(ser, apk_query_field(APK_Q_FIELD_SCRIPTS));
-		apk_ser_start_array(ser, num_scripts(ipkg));
+		apk_ser_start_array(ser, num_scripts(db, ipkg));
 		for (int i = 0; i < ARRAY_SIZE(ipkg->script); i++) {
-			if (!ipkg->script[i].len) continue;
+			if (!apk_db_ipkg_script(db, ipkg, i).len) continue;
 			apk_ser_string(ser, APK_BLOB_STR(apk_script_types[i]));
 		}
 		apk_ser_end(ser);
@@ -512,13 +513,16 @@ int apk_query_match_serialize(struct apk_query_match *qm, struct apk_database *d
 static struct apk_package *get_owner(struct apk_database *db, apk_blob_t fn)
 {
 	struct apk_db_dir *dir;
+	struct apk_package *pkg;
 
 	apk_blob_pull_blob_match(&fn, APK_BLOB_STRLIT("/"));
 	fn = apk_blob_trim_end(fn, '/');
 
 	dir = apk_db_dir_query(db, fn);
 	if (dir && dir->owner) return dir->owner->pkg;
-	return apk_db_get_file_owner(db, fn);
+	pkg = apk_db_get_file_owner(db, fn);
+	if (pkg) return pkg;
+	return apk_db_get_indexed_owner(db, fn);
 }
 
 static int apk_query_recursive(struct apk_ctx *ac, struct apk_query_spec *qs, struct apk_string_array *args, apk_query_match_cb match, void *pctx)
@@ -752,6 +756,74 @@ static int match_name(apk_hash_item item, void *pctx)
 	return r;
 }
 
+#define APK_Q_FIELDS_SEARCH_INDEXED \
+	(BIT(APK_Q_FIELD_NAME) | BIT(APK_Q_FIELD_PROVIDES) | BIT(APK_Q_FIELD_DESCRIPTION))
+
+// The saved search index is used if it is up to date. Building it costs
+// about the same as one full scan, so otherwise it is only built in memory
+// once the same database is scanned again.
+static bool search_index_open(struct apk_database *db)
+{
+	struct apk_out *out = &db->ctx->out;
+	int r;
+
+	if (db->available.search_index.sorted) return true;
+	if (db->available.search_scans++ == 0) {
+		r = apk_db_search_index_load(db);
+		if (r == 0) return true;
+		if (r != -ENOENT) apk_dbg(out, "search index not used: %s", apk_error_str(r));
+		return false;
+	}
+	apk_db_search_index_build(db);
+	return true;
+}
+
+// The names of installed packages not in the repositories the search
+// index is built from
+static void search_index_add_installed(struct apk_database *db, struct apk_name_array **names)
+{
+	struct apk_installed_package *ipkg;
+
+	list_for_each_entry(ipkg, &db->installed.packages, installed_pkgs_list)
+		if (!(ipkg->pkg->repos & db->available.search_repos))
+			apk_name_array_add(names, ipkg->pkg->name);
+}
+
+static bool match_names_indexed(struct match_ctx *m, int *r)
+{
+	struct apk_database *db = m->db;
+	struct apk_trigram_doc_array *docs;
+	struct apk_name_array *names;
+	struct apk_name *prev = NULL;
+
+	if (m->match_mode != MATCH_WILDCARD) return false;
+	if (m->qs->match & ~APK_Q_FIELDS_SEARCH_INDEXED) return false;
+	if (!db->open_complete) return false;
+	if (!search_index_open(db)) return false;
+
+	apk_trigram_doc_array_init(&docs);
+	if (apk_trigram_index_query(&db->available.search_index, m->match, &docs) < 0) {
+		apk_trigram_doc_array_free(&docs);
+		return false;
+	}
+	apk_name_array_init(&names);
+	apk_array_foreach_item(doc, docs)
+		apk_name_array_add(&names, db->available.search_names->item[doc]);
+	search_index_add_installed(db, &names);
+	apk_array_qsort(names, apk_name_array_qsort);
+
+	*r = 0;
+	apk_array_foreach_item(name, names) {
+		if (name == prev) continue;
+		*r = match_name(name, m);
+		if (*r) break;
+		prev = name;
+	}
+	apk_name_array_free(&names);
+	apk_trigram_doc_array_free(&docs);
+	return true;
+}
+
 int apk_query_matches(struct apk_ctx *ac, struct apk_query_spec *qs, struct apk_string_array *args, apk_query_match_cb match, void *pctx)
 {
 	char buf[PATH_MAX];
@@ -821,6 +893,9 @@ int apk_query_matches(struct apk_ctx *ac, struct apk_query_spec *qs, struct apk_
 		if (qs->match == BIT(APK_Q_FIELD_NAME) && m.match_mode == MATCH_EXACT) {
 			m.dep.name = apk_db_query_name(db, bname);
 			if (m.dep.name) r = match_name(m.dep.name, &m);
+		} else if (match_names_indexed(&m, &r)) {
+			// candidates from search index, verified by match_name
+			if (r) break;
 		} else {
 			// do full scan
 			r = apk_hash_foreach(&db->available.names, match_name, &m);
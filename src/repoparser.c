@@ -146,6 +146,38 @@ static bool is_keyword(apk_blob_t word)
 	return !is_url(word);
 }
 
+static int apk_repoparser_parse_mirror(struct apk_repoparser *rp, apk_blob_t line)
+{
+	char urlbuf[PATH_MAX], mirrorbuf[PATH_MAX];
+	apk_blob_t word, url, mirror;
+	int r;
+
+	if (!get_word(&line, &word) || !line.len) return -APKE_REPO_SYNTAX;
+	r = apk_blob_subst(urlbuf, sizeof urlbuf, word, apk_repoparser_subst, rp);
+	if (r < 0) return r;
+	url = apk_blob_trim_end(APK_BLOB_PTR_LEN(urlbuf, r), '/');
+	if (!url.len || !is_url(url)) goto invalid;
+
+	while (get_word(&line, &word)) {
+		r = apk_blob_subst(mirrorbuf, sizeof mirrorbuf, word, apk_repoparser_subst, rp);
+		if (r < 0) return r;
+		mirror = apk_blob_trim_end(APK_BLOB_PTR_LEN(mirrorbuf, r), '/');
+		if (!mirror.len || !is_url(mirror)) {
+			url = mirror;
+			goto invalid;
+		}
+		if (rp->ops->mirror) {
+			r = rp->ops->mirror(rp, url, mirror);
+			if (r) return r;
+		}
+	}
+	return 0;
+invalid:
+	apk_warn(rp->out, "%s:%d: invalid url: " BLOB_FMT,
+		rp->file, rp->line, BLOB_PRINTF(url));
+	return -APKE_REPO_SYNTAX;
+}
+
 int apk_repoparser_parse(struct apk_repoparser *rp, apk_blob_t line, bool allow_keywords)
 {
 	struct apk_pathbuilder pb;
@@ -160,6 +192,8 @@ int apk_repoparser_parse(struct apk_repoparser *rp, apk_blob_t line, bool allow_
 	if (allow_keywords && is_keyword(word)) {
 		if (apk_blob_compare(word, APK_BLOB_STRLIT("set")) == 0)
 			return apk_repoparser_parse_set(rp, line);
+		if (apk_blob_compare(word, APK_BLOB_STRLIT("mirror")) == 0)
+			return apk_repoparser_parse_mirror(rp, line);
 		if (apk_blob_compare(word, APK_BLOB_STRLIT("ndx")) == 0)
 			type = APK_REPOTYPE_NDX;
 		else if (apk_blob_compare(word, APK_BLOB_STRLIT("v2")) == 0)
@@ -0,0 +1,186 @@
+/* scriptdb.c - Alpine Package Keeper (APK)
+ *
+ * Copyright (C) 2025 Timo Teräs <timo.teras@iki.fi>
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "apk_scriptdb.h"
+
+static uint64_t stat_mtime(const struct stat *st)
+{
+	return (uint64_t) st->st_mtim.tv_sec * 1000000000ULL + st->st_mtim.tv_nsec;
+}
+
+static int key_cmp(apk_blob_t a, unsigned int atype, apk_blob_t b, unsigned int btype)
+{
+	int r = memcmp(a.ptr, b.ptr, min(a.len, b.len));
+	if (r) return r;
+	r = (a.len > b.len) - (a.len < b.len);
+	if (r) return r;
+	return (atype > btype) - (atype < btype);
+}
+
+static int item_cmp(const void *p1, const void *p2)
+{
+	const struct apk_scriptdb_item *a = p1, *b = p2;
+	return key_cmp(APK_DIGEST_BLOB(a->digest), a->type, APK_DIGEST_BLOB(b->digest), b->type);
+}
+
+void apk_scriptdb_writer_init(struct apk_scriptdb_writer *w)
+{
+	apk_scriptdb_item_array_init(&w->items);
+}
+
+void apk_scriptdb_writer_free(struct apk_scriptdb_writer *w)
+{
+	apk_scriptdb_item_array_free(&w->items);
+}
+
+// The script is referenced, not copied, and must stay valid until written.
+void apk_scriptdb_writer_add(struct apk_scriptdb_writer *w, uint8_t digest_alg, apk_blob_t digest, unsigned int type, apk_blob_t script)
+{
+	struct apk_scriptdb_item item = {
+		.digest.alg = digest_alg,
+		.digest.len = min(digest.len, APK_DIGEST_LENGTH_MAX),
+		.type = type,
+		.script = script,
+	};
+
+	if (APK_BLOB_IS_NULL(script) || script.len > UINT32_MAX) return;
+	memcpy(item.digest.data, digest.ptr, item.digest.len);
+	apk_scriptdb_item_array_add(&w->items, item);
+}
+
+int apk_scriptdb_writer_write(struct apk_scriptdb_writer *w, struct apk_ostream *os, const struct stat *tar)
+{
+	struct apk_scriptdb_header hdr = {
+		.magic = APK_SCRIPTDB_MAGIC,
+		.version = APK_SCRIPTDB_VERSION,
+		.tar_ino = tar->st_ino,
+		.tar_size = tar->st_size,
+		.tar_mtime = stat_mtime(tar),
+		.num_entries = apk_array_len(w->items),
+	};
+	uint64_t off = 0;
+
+	if (IS_ERR(os)) return PTR_ERR(os);
+
+	apk_array_qsort(w->items, item_cmp);
+	apk_array_foreach(item, w->items) off += item->digest.len + item->script.len;
+	hdr.data_len = off;
+	apk_ostream_write(os, &hdr, sizeof hdr);
+
+	off = 0;
+	apk_array_foreach(item, w->items) {
+		struct apk_scriptdb_entry e = {
+			.digest_alg = item->digest.alg,
+			.digest_len = item->digest.len,
+			.type = item->type,
+			.script_len = item->script.len,
+			.data_off = off,
+		};
+		apk_ostream_write(os, &e, sizeof e);
+		off += item->digest.len + item->script.len;
+	}
+	apk_array_foreach(item, w->items) {
+		apk_ostream_write_blob(os, APK_DIGEST_BLOB(item->digest));
+		apk_ostream_write_blob(os, item->script);
+	}
+	return apk_ostream_close(os);
+}
+
+int apk_scriptdb_open(struct apk_scriptdb *sdb, int atfd, const char *file, const struct stat *tar)
+{
+	const struct apk_scriptdb_header *hdr;
+	struct stat st;
+	uint64_t size;
+	void *ptr;
+	int fd, r = -APKE_FORMAT_INVALID;
+
+	*sdb = (struct apk_scriptdb) {};
+
+	fd = openat(atfd, file, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return -errno;
+	if (fstat(fd, &st) < 0) {
+		r = -errno;
+		goto err_fd;
+	}
+	if (st.st_size < sizeof *hdr) goto err_fd;
+
+	ptr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (ptr == MAP_FAILED) {
+		r = -errno;
+		goto err_fd;
+	}
+	close(fd);
+	sdb->map = APK_BLOB_PTR_LEN(ptr, st.st_size);
+
+	hdr = ptr;
+	if (hdr->magic != APK_SCRIPTDB_MAGIC || hdr->version != APK_SCRIPTDB_VERSION) goto err;
+	size = sizeof *hdr + (uint64_t) hdr->num_entries * sizeof(struct apk_scriptdb_entry);
+	if (size > st.st_size || st.st_size - size != hdr->data_len) goto err;
+	if (hdr->tar_ino != tar->st_ino ||
+	    hdr->tar_size != tar->st_size ||
+	    hdr->tar_mtime != stat_mtime(tar)) {
+		r = -ESTALE;
+		goto err;
+	}
+
+	sdb->hdr = hdr;
+	sdb->entries = (const struct apk_scriptdb_entry *) &hdr[1];
+	sdb->data = (const char *) &sdb->entries[hdr->num_entries];
+	return 0;
+
+err_fd:
+	close(fd);
+	return r;
+err:
+	apk_scriptdb_close(sdb);
+	return r;
+}
+
+void apk_scriptdb_close(struct apk_scriptdb *sdb)
+{
+	if (sdb->map.ptr) munmap(sdb->map.ptr, sdb->map.len);
+	*sdb = (struct apk_scriptdb) {};
+}
+
+static apk_blob_t entry_digest(const struct apk_scriptdb *sdb, const struct apk_scriptdb_entry *e)
+{
+	if (e->data_off > sdb->hdr->data_len ||
+	    (uint64_t) e->digest_len + e->script_len > sdb->hdr->data_len - e->data_off)
+		return APK_BLOB_NULL;
+	return APK_BLOB_PTR_LEN((char *) &sdb->data[e->data_off], e->digest_len);
+}
+
+apk_blob_t apk_scriptdb_lookup(const struct apk_scriptdb *sdb, apk_blob_t digest, unsigned int type)
+{
+	const struct apk_scriptdb_entry *e;
+	uint32_t l = 0, h;
+	apk_blob_t b;
+
+	if (!sdb->hdr) return APK_BLOB_NULL;
+
+	h = sdb->hdr->num_entries;
+	while (l < h) {
+		uint32_t m = l + (h - l) / 2;
+		e = &sdb->entries[m];
+		b = entry_digest(sdb, e);
+		if (APK_BLOB_IS_NULL(b)) return APK_BLOB_NULL;
+		if (key_cmp(b, e->type, digest, type) < 0) l = m + 1;
+		else h = m;
+	}
+	if (l >= sdb->hdr->num_entries) return APK_BLOB_NULL;
+
+	e = &sdb->entries[l];
+	b = entry_digest(sdb, e);
+	if (APK_BLOB_IS_NULL(b) || key_cmp(b, e->type, digest, type) != 0) return APK_BLOB_NULL;
+	return APK_BLOB_PTR_LEN((char *) &sdb->data[e->data_off + e->digest_len], e->script_len);
+}
@@ -16,6 +16,7 @@
 #include "apk_solver.h"
 
 #include "apk_print.h"
+#include "apk_serialize.h"
 
 //#define DEBUG_PRINT
 
@@ -31,6 +32,9 @@
 struct apk_solver_state {
 	struct apk_database *db;
 	struct apk_changeset *changeset;
+	struct apk_solver_stats *stats;
+	struct apk_serializer *explain;
+	const char *cmp_reason;
 	struct list_head dirty_head;
 	struct list_head unresolved_head;
 	struct list_head selectable_head;
@@ -48,6 +52,82 @@ static struct apk_provider provider_none = {
 	.version = &apk_atom_null
 };
 
+/* Decision provenance for --solver-explain. Each call site checks
+ * ss->explain first so nothing is done unless it was requested. */
+static void explain_start(struct apk_solver_state *ss, const char *event)
+{
+	apk_ser_start_object(ss->explain);
+	apk_ser_key(ss->explain, APK_BLOB_STRLIT("event"));
+	apk_ser_string(ss->explain, APK_BLOB_STR(event));
+}
+
+static void explain_str(struct apk_solver_state *ss, const char *key, const char *val)
+{
+	if (key) apk_ser_key(ss->explain, APK_BLOB_STR(key));
+	apk_ser_string(ss->explain, APK_BLOB_STR(val));
+}
+
+static void explain_pkg(struct apk_solver_state *ss, const char *key, struct apk_package *pkg)
+{
+	char buf[256];
+
+	if (key) apk_ser_key(ss->explain, APK_BLOB_STR(key));
+	if (pkg) apk_ser_string(ss->explain, apk_blob_fmt(buf, sizeof buf, PKG_VER_FMT, PKG_VER_PRINTF(pkg)));
+	else apk_ser_string(ss->explain, APK_BLOB_STRLIT("none"));
+}
+
+static void explain_dep(struct apk_solver_state *ss, const char *key, struct apk_dependency *dep)
+{
+	char buf[256];
+
+	apk_ser_key(ss->explain, APK_BLOB_STR(key));
+	apk_ser_string(ss->explain, apk_blob_fmt(buf, sizeof buf, DEP_FMT, DEP_PRINTF(dep)));
+}
+
+static void explain_package(struct apk_solver_state *ss, const char *event, struct apk_package *pkg, const char *reason)
+{
+	explain_start(ss, event);
+	explain_pkg(ss, "package", pkg);
+	explain_str(ss, "reason", reason);
+	apk_ser_end(ss->explain);
+}
+
+static void explain_constraint(struct apk_solver_state *ss, struct apk_package *ppkg, struct apk_dependency *dep)
+{
+	bool rejects = false;
+
+	explain_start(ss, "constraint");
+	if (ppkg) explain_pkg(ss, "from", ppkg);
+	else explain_str(ss, "from", "world");
+	explain_dep(ss, "dependency", dep);
+	if (!ppkg && dep->repository_tag != APK_DEFAULT_REPOSITORY_TAG) {
+		apk_ser_key(ss->explain, APK_BLOB_STRLIT("pinning"));
+		apk_ser_string(ss->explain, ss->db->repo_tags[dep->repository_tag].tag);
+	}
+	apk_array_foreach(p0, dep->name->providers) {
+		if (apk_dep_is_provided(ppkg, dep, p0)) continue;
+		if (!rejects) {
+			apk_ser_key(ss->explain, APK_BLOB_STRLIT("rejects"));
+			apk_ser_start_array(ss->explain, -1);
+			rejects = true;
+		}
+		explain_pkg(ss, NULL, p0->pkg);
+	}
+	if (rejects) apk_ser_end(ss->explain);
+	apk_ser_end(ss->explain);
+}
+
+static void explain_candidate(struct apk_solver_state *ss, struct apk_package *pkg, const char *result, const char *reason)
+{
+	apk_ser_start_object(ss->explain);
+	explain_pkg(ss, "package", pkg);
+	explain_str(ss, "result", result);
+	explain_str(ss, "reason", reason);
+	apk_ser_end(ss->explain);
+}
+
+#define cmp_reason(ss, reason) do { dbg_printf("    %s\n", reason); (ss)->cmp_reason = reason; } while (0)
+
 void apk_solver_set_name_flags(struct apk_name *name,
 			       unsigned short solver_flags,
 			       unsigned short solver_flags_inheritable)
@@ -85,6 +165,7 @@ static void mark_error(struct apk_solver_state *ss, struct apk_package *pkg, con
 	if (pkg == NULL || pkg->ss.error)
 		return;
 	dbg_printf("ERROR PKG: %s: %s\n", pkg->name->name, reason);
+	if (unlikely(ss->explain)) explain_package(ss, "error", pkg, reason);
 	pkg->ss.error = 1;
 	ss->errors++;
 }
@@ -134,6 +215,7 @@ static void queue_unresolved(struct apk_solver_state *ss, struct apk_name *name,
 
 	dbg_printf("queue_unresolved: %s, requirers=%d, has_iif=%d, resolvenow=%d\n",
 		name->name, name->ss.requirers, name->ss.has_iif, name->ss.resolvenow);
+	ss->stats->queue_insert++;
 	if (name->ss.resolvenow) {
 		list_add_tail(&name->ss.unresolved_list, &ss->resolvenow_head);
 		return;
@@ -170,6 +252,7 @@ static void reevaluate_reverse_installif_pkg(struct apk_solver_state *ss, struct
 static void disqualify_package(struct apk_solver_state *ss, struct apk_package *pkg, const char *reason)
 {
 	dbg_printf("disqualify_package: " PKG_VER_FMT " (%s)\n", PKG_VER_PRINTF(pkg), reason);
+	if (unlikely(ss->explain)) explain_package(ss, "disqualify", pkg, reason);
 	pkg->ss.pkg_selectable = 0;
 	reevaluate_reverse_deps(ss, pkg->name);
 	apk_array_foreach(p, pkg->provides)
@@ -200,6 +283,7 @@ static void discover_name(struct apk_solver_state *ss, struct apk_name *name)
 
 	if (name->ss.seen) return;
 
+	ss->stats->names_discovered++;
 	name->ss.seen = 1;
 	name->ss.no_iif = 1;
 	apk_array_foreach(p, name->providers) {
@@ -214,7 +298,7 @@ static void discover_name(struct apk_solver_state *ss, struct apk_name *name)
 			pkg->ss.pkg_selectable = !pkg->uninstallable &&
 				(BIT(pkg->layer) & db->active_layers) &&
 				(pkg->ss.pkg_available ||
-				 pkg->cached || pkg->filename_ndx ||
+				 pkg->cached || pkg->cached_shared || pkg->filename_ndx ||
 				 pkg->cached_non_repository ||
 				 pkg->installed_size == 0 ||  pkg->ipkg);
 
@@ -317,9 +401,12 @@ static void apply_constraint(struct apk_solver_state *ss, struct apk_package *pp
 		apk_version_op_string(dep->op),
 		BLOB_PRINTF(*dep->version));
 
+	ss->stats->apply_constraint++;
 	if (apk_dep_conflict(dep) && ss->ignore_conflict)
 		return;
 
+	if (unlikely(ss->explain)) explain_constraint(ss, ppkg, dep);
+
 	name->ss.requirers += !apk_dep_conflict(dep);
 	if (name->ss.requirers == 1 && !apk_dep_conflict(dep))
 		name_requirers_changed(ss, name);
@@ -390,6 +477,7 @@ static void reconsider_name(struct apk_solver_state *ss, struct apk_name *name)
 	bool reevaluate = false;
 
 	dbg_printf("reconsider_name: %s\n", name->name);
+	ss->stats->reconsider_name++;
 
 	reevaluate_deps = name->ss.reevaluate_deps;
 	reevaluate_iif = name->ss.reevaluate_iif;
@@ -542,9 +630,11 @@ static int compare_providers(struct apk_solver_state *ss,
 	unsigned int solver_flags;
 	int r;
 
+	ss->stats->compare_providers++;
+
 	/* Prefer existing package */
 	if (pkgA == NULL || pkgB == NULL) {
-		dbg_printf("   prefer existing package\n");
+		cmp_reason(ss, "prefer existing package");
 		return (pkgA != NULL) - (pkgB != NULL);
 	}
 	solver_flags = pkgA->ss.solver_flags | pkgB->ss.solver_flags;
@@ -556,7 +646,7 @@ static int compare_providers(struct apk_solver_state *ss,
 		/* Prefer allowed pinning */
 		r = (int)pkgA->ss.tag_ok - (int)pkgB->ss.tag_ok;
 		if (r) {
-			dbg_printf("    prefer allowed pinning\n");
+			cmp_reason(ss, "prefer allowed pinning");
 			return r;
 		}
 
@@ -564,13 +654,13 @@ static int compare_providers(struct apk_solver_state *ss,
 		if (solver_flags & APK_SOLVERF_AVAILABLE) {
 			r = (int)pkgA->ss.pkg_available - (int)pkgB->ss.pkg_available;
 			if (r) {
-				dbg_printf("    prefer available\n");
+				cmp_reason(ss, "prefer available");
 				return r;
 			}
 		} else if (solver_flags & APK_SOLVERF_REINSTALL) {
 			r = (int)pkgA->ss.pkg_selectable - (int)pkgB->ss.pkg_selectable;
 			if (r) {
-				dbg_printf("    prefer available (reinstall)\n");
+				cmp_reason(ss, "prefer available (reinstall)");
 				return r;
 			}
 		}
@@ -578,19 +668,19 @@ static int compare_providers(struct apk_solver_state *ss,
 		/* Prefer without errors */
 		r = (int)pkgA->ss.pkg_selectable - (int)pkgB->ss.pkg_selectable;
 		if (r) {
-			dbg_printf("    prefer without errors\n");
+			cmp_reason(ss, "prefer without errors");
 			return r;
 		}
 
 		/* Prefer those that were in last dependency merging group */
 		r = (int)pkgA->ss.dependencies_used - (int)pkgB->ss.dependencies_used;
 		if (r) {
-			dbg_printf("    prefer those that were in last dependency merging group\n");
+			cmp_reason(ss, "prefer those that were in last dependency merging group");
 			return r;
 		}
 		r = pkgB->ss.conflicts - pkgA->ss.conflicts;
 		if (r) {
-			dbg_printf("    prefer those that were in last dependency merging group (#2)\n");
+			cmp_reason(ss, "prefer those that were in last dependency merging group (#2)");
 			return r;
 		}
 
@@ -599,7 +689,7 @@ static int compare_providers(struct apk_solver_state *ss,
 		    (solver_flags & APK_SOLVERF_INSTALLED)) {
 			r = (pkgA->ipkg != NULL) - (pkgB->ipkg != NULL);
 			if (r) {
-				dbg_printf("    prefer installed (preupgrade)\n");
+				cmp_reason(ss, "prefer installed (preupgrade)");
 				return r;
 			}
 		}
@@ -607,7 +697,7 @@ static int compare_providers(struct apk_solver_state *ss,
 		/* Prefer allowed pinning */
 		r = (int)pkgA->ss.tag_ok - (int)pkgB->ss.tag_ok;
 		if (r) {
-			dbg_printf("    prefer allowed pinning\n");
+			cmp_reason(ss, "prefer allowed pinning");
 			return r;
 		}
 
@@ -615,7 +705,7 @@ static int compare_providers(struct apk_solver_state *ss,
 		if (solver_flags & APK_SOLVERF_AVAILABLE) {
 			r = (int)pkgA->ss.pkg_available - (int)pkgB->ss.pkg_available;
 			if (r) {
-				dbg_printf("    prefer available\n");
+				cmp_reason(ss, "prefer available");
 				return r;
 			}
 		}
@@ -623,7 +713,7 @@ static int compare_providers(struct apk_solver_state *ss,
 		/* Prefer preferred pinning */
 		r = (int)pkgA->ss.tag_preferred - (int)pkgB->ss.tag_preferred;
 		if (r) {
-			dbg_printf("    prefer preferred pinning\n");
+			cmp_reason(ss, "prefer preferred pinning");
 			return r;
 		}
 
@@ -632,7 +722,7 @@ static int compare_providers(struct apk_solver_state *ss,
 		    (pkgA->name == pkgB->name || pA->version != &apk_atom_null || pB->version != &apk_atom_null)) {
 			r = (pkgA->ipkg != NULL) - (pkgB->ipkg != NULL);
 			if (r) {
-				dbg_printf("    prefer installed (non-upgrade)\n");
+				cmp_reason(ss, "prefer installed (non-upgrade)");
 				return r;
 			}
 		}
@@ -641,10 +731,10 @@ static int compare_providers(struct apk_solver_state *ss,
 	/* Select latest by requested name */
 	switch (apk_version_compare(*pA->version, *pB->version)) {
 	case APK_VERSION_LESS:
-		dbg_printf("    select latest by requested name (less)\n");
+		cmp_reason(ss, "select latest by requested name (less)");
 		return -1;
 	case APK_VERSION_GREATER:
-		dbg_printf("    select latest by requested name (greater)\n");
+		cmp_reason(ss, "select latest by requested name (greater)");
 		return 1;
 	}
 
@@ -652,10 +742,10 @@ static int compare_providers(struct apk_solver_state *ss,
 	if (pkgA->name == pkgB->name) {
 		switch (apk_version_compare(*pkgA->version, *pkgB->version)) {
 		case APK_VERSION_LESS:
-			dbg_printf("    select latest by principal name (less)\n");
+			cmp_reason(ss, "select latest by principal name (less)");
 			return -1;
 		case APK_VERSION_GREATER:
-			dbg_printf("    select latest by principal name (greater)\n");
+			cmp_reason(ss, "select latest by principal name (greater)");
 			return 1;
 		}
 	}
@@ -663,7 +753,7 @@ static int compare_providers(struct apk_solver_state *ss,
 	/* Prefer highest declared provider priority. */
 	r = pkgA->provider_priority - pkgB->provider_priority;
 	if (r) {
-		dbg_printf("    prefer highest declared provider priority\n");
+		cmp_reason(ss, "prefer highest declared provider priority");
 		return r;
 	}
 
@@ -671,7 +761,7 @@ static int compare_providers(struct apk_solver_state *ss,
 	if (!(solver_flags & APK_SOLVERF_REMOVE)) {
 		r = (pkgA->ipkg != NULL) - (pkgB->ipkg != NULL);
 		if (r) {
-			dbg_printf("    prefer installed (upgrading)\n");
+			cmp_reason(ss, "prefer installed (upgrading)");
 			return r;
 		}
 	}
@@ -679,12 +769,12 @@ static int compare_providers(struct apk_solver_state *ss,
 	/* Prefer without errors (mostly if --latest used, and different provider) */
 	r = (int)pkgA->ss.pkg_selectable - (int)pkgB->ss.pkg_selectable;
 	if (r) {
-		dbg_printf("    prefer without errors (#2)\n");
+		cmp_reason(ss, "prefer without errors (#2)");
 		return r;
 	}
 
 	/* Prefer lowest available repository */
-	dbg_printf("    prefer lowest available repository\n");
+	cmp_reason(ss, "prefer lowest available repository");
 	return ffs(pkgB->repos) - ffs(pkgA->repos);
 }
 
@@ -742,6 +832,12 @@ static void select_package(struct apk_solver_state *ss, struct apk_name *name)
 
 	dbg_printf("select_package: %s (requirers=%d, autosel=%d, iif=%d, order_id=%#x)\n",
 		name->name, name->ss.requirers, name->ss.has_auto_selectable, name->ss.has_iif, name->ss.order_id);
+	if (unlikely(ss->explain)) {
+		explain_start(ss, "select");
+		explain_str(ss, "name", name->name);
+		apk_ser_key(ss->explain, APK_BLOB_STRLIT("candidates"));
+		apk_ser_start_array(ss->explain, -1);
+	}
 
 	if (name->ss.requirers || name->ss.has_iif) {
 		apk_array_foreach(p, name->providers) {
@@ -757,20 +853,37 @@ static void select_package(struct apk_solver_state *ss, struct apk_name *name)
 			     !p->pkg->ss.tag_ok ||
 			     !p->pkg->ss.pkg_selectable)) {
 				dbg_printf("    ignore: invalid install-if trigger or invalid pinning\n");
+				if (unlikely(ss->explain)) explain_candidate(ss, p->pkg, "ignored", "invalid install-if trigger or invalid pinning");
 				continue;
 			}
 			if (!is_provider_auto_selectable(p)) {
 				dbg_printf("    ignore: virtual package without provider_priority\n");
+				if (unlikely(ss->explain)) explain_candidate(ss, p->pkg, "ignored", "virtual package without provider_priority");
 				continue;
 			}
 			if (compare_providers(ss, p, &chosen) > 0) {
 				dbg_printf("    choose as new provider\n");
+				if (unlikely(ss->explain)) explain_candidate(ss, p->pkg, "preferred", ss->cmp_reason);
 				chosen = *p;
+			} else if (unlikely(ss->explain)) {
+				explain_candidate(ss, p->pkg, "rejected", ss->cmp_reason);
 			}
 		}
 	}
 
 	pkg = chosen.pkg;
+	if (unlikely(ss->explain)) {
+		apk_ser_end(ss->explain);
+		explain_pkg(ss, "selected", pkg);
+		if (pkg) {
+			unsigned int tag = get_tag(ss->db, pkg->ss.pinning_allowed, get_pkg_repos(ss->db, pkg));
+			if (tag != APK_DEFAULT_REPOSITORY_TAG) {
+				apk_ser_key(ss->explain, APK_BLOB_STRLIT("pinning"));
+				apk_ser_string(ss->explain, ss->db->repo_tags[tag].tag);
+			}
+		}
+		apk_ser_end(ss->explain);
+	}
 	if (pkg) {
 		if (!pkg->ss.pkg_selectable || !pkg->ss.tag_ok) {
 			/* Selecting broken or unallowed package */
@@ -1071,6 +1184,54 @@ static struct apk_name *dequeue_next_name(struct apk_solver_state *ss)
 	return NULL;
 }
 
+int apk_solver_stats_serialize(struct apk_serializer *ser, const struct apk_solver_stats *stats)
+{
+	apk_ser_start_object(ser);
+	apk_ser_key(ser, APK_BLOB_STRLIT("names-discovered"));
+	apk_ser_numeric(ser, stats->names_discovered, 0);
+	apk_ser_key(ser, APK_BLOB_STRLIT("reconsider-name"));
+	apk_ser_numeric(ser, stats->reconsider_name, 0);
+	apk_ser_key(ser, APK_BLOB_STRLIT("apply-constraint"));
+	apk_ser_numeric(ser, stats->apply_constraint, 0);
+	apk_ser_key(ser, APK_BLOB_STRLIT("queue-insert"));
+	apk_ser_numeric(ser, stats->queue_insert, 0);
+	apk_ser_key(ser, APK_BLOB_STRLIT("compare-providers"));
+	apk_ser_numeric(ser, stats->compare_providers, 0);
+	apk_ser_key(ser, APK_BLOB_STRLIT("restarts"));
+	apk_ser_numeric(ser, stats->restarts, 0);
+	apk_ser_key(ser, APK_BLOB_STRLIT("discover-usec"));
+	apk_ser_numeric(ser, stats->discover_usec, 0);
+	apk_ser_key(ser, APK_BLOB_STRLIT("apply-world-usec"));
+	apk_ser_numeric(ser, stats->apply_world_usec, 0);
+	apk_ser_key(ser, APK_BLOB_STRLIT("resolve-usec"));
+	apk_ser_numeric(ser, stats->resolve_usec, 0);
+	apk_ser_key(ser, APK_BLOB_STRLIT("changeset-usec"));
+	apk_ser_numeric(ser, stats->changeset_usec, 0);
+	return apk_ser_end(ser);
+}
+
+static void report_stats(struct apk_database *db, const struct apk_solver_stats *stats)
+{
+	struct apk_ctx *ac = db->ctx;
+	struct apk_out *out = &ac->out;
+	struct apk_serializer *ser;
+
+	apk_dbg2(out, "solver: %u names discovered, %u reconsider_name, %u apply_constraint, "
+		"%u queue insertions, %u compare_providers, %u restarts",
+		stats->names_discovered, stats->reconsider_name, stats->apply_constraint,
+		stats->queue_insert, stats->compare_providers, stats->restarts);
+	apk_dbg2(out, "solver: discover %" PRIu64 " us, apply world %" PRIu64 " us, "
+		"resolve %" PRIu64 " us, changeset %" PRIu64 " us",
+		stats->discover_usec, stats->apply_world_usec,
+		stats->resolve_usec, stats->changeset_usec);
+
+	if (!ac->solver_stats_ser) return;
+	ser = apk_serializer_init_alloca(ac, ac->solver_stats_ser, apk_ostream_to_fd(dup(STDERR_FILENO)));
+	if (IS_ERR(ser)) return;
+	apk_solver_stats_serialize(ser, stats);
+	apk_serializer_cleanup(ser);
+}
+
 int apk_solver_solve(struct apk_database *db,
 		     unsigned short solver_flags,
 		     struct apk_dependency_array *world,
@@ -1079,13 +1240,29 @@ int apk_solver_solve(struct apk_database *db,
 	struct apk_name *name;
 	struct apk_package *pkg;
 	struct apk_solver_state ss_data, *ss = &ss_data;
+	struct apk_solver_stats *stats = &changeset->stats;
+	struct apk_serializer *explain = NULL;
+	uint64_t trace_start = apk_trace_begin(&db->ctx->trace), t;
 
 	apk_array_qsort(world, cmp_pkgname);
+	memset(stats, 0, sizeof *stats);
+
+	if (db->ctx->solver_explain_ser) {
+		explain = apk_serializer_init_alloca(db->ctx, db->ctx->solver_explain_ser, apk_ostream_to_fd(dup(STDERR_FILENO)));
+		if (IS_ERR(explain)) explain = NULL;
+	}
+	if (explain) {
+		apk_ser_start_object(explain);
+		apk_ser_key(explain, APK_BLOB_STRLIT("events"));
+		apk_ser_start_array(explain, -1);
+	}
 
 restart:
 	memset(ss, 0, sizeof(*ss));
 	ss->db = db;
 	ss->changeset = changeset;
+	ss->stats = stats;
+	ss->explain = explain;
 	ss->default_repos = apk_db_get_pinning_mask_repos(db, APK_DEFAULT_PINNING_MASK);
 	ss->ignore_conflict = !!(solver_flags & APK_SOLVERF_IGNORE_CONFLICT);
 	list_init(&ss->dirty_head);
@@ -1094,12 +1271,15 @@ restart:
 	list_init(&ss->resolvenow_head);
 
 	dbg_printf("discovering world\n");
+	t = apk_trace_now();
 	ss->solver_flags_inherit = solver_flags;
 	apk_array_foreach(d, world) {
 		if (!d->broken)
 			discover_name(ss, d->name);
 	}
+	stats->discover_usec += apk_trace_now() - t;
 	dbg_printf("applying world\n");
+	t = apk_trace_now();
 	apk_array_foreach(d, world) {
 		if (!d->broken) {
 			ss->pinning_inherit = BIT(d->repository_tag);
@@ -1108,8 +1288,10 @@ restart:
 	}
 	ss->solver_flags_inherit = 0;
 	ss->pinning_inherit = 0;
+	stats->apply_world_usec += apk_trace_now() - t;
 	dbg_printf("applying world [finished]\n");
 
+	t = apk_trace_now();
 	do {
 		while (!list_empty(&ss->dirty_head)) {
 			name = list_pop(&ss->dirty_head, struct apk_name, ss.dirty_list);
@@ -1120,8 +1302,11 @@ restart:
 			break;
 		select_package(ss, name);
 	} while (1);
+	stats->resolve_usec += apk_trace_now() - t;
 
+	t = apk_trace_now();
 	generate_changeset(ss, world);
+	stats->changeset_usec += apk_trace_now() - t;
 
 	if (ss->errors && (db->ctx->force & APK_FORCE_BROKEN_WORLD)) {
 		apk_array_foreach(d, world) {
@@ -1134,6 +1319,13 @@ restart:
 		}
 		apk_hash_foreach(&db->available.names, free_name, NULL);
 		apk_hash_foreach(&db->available.packages, free_package, NULL);
+		stats->restarts++;
+		if (explain) {
+			apk_ser_start_object(explain);
+			apk_ser_key(explain, APK_BLOB_STRLIT("event"));
+			apk_ser_string(explain, APK_BLOB_STRLIT("restart"));
+			apk_ser_end(explain);
+		}
 		goto restart;
 	}
 
@@ -1145,6 +1337,15 @@ restart:
 	apk_hash_foreach(&db->available.names, free_name, NULL);
 	apk_hash_foreach(&db->available.packages, free_package, NULL);
 	dbg_printf("solver done, errors=%d\n", ss->errors);
+	apk_trace_end(&db->ctx->trace, trace_start, "solver", "solve");
+	report_stats(db, stats);
+	if (explain) {
+		apk_ser_end(explain);
+		apk_ser_key(explain, APK_BLOB_STRLIT("errors"));
+		apk_ser_numeric(explain, ss->errors, 0);
+		apk_ser_end(explain);
+		apk_serializer_cleanup(explain);
+	}
 
 	return ss->errors;
 }
@@ -0,0 +1,89 @@
+/* trace.c - Alpine Package Keeper (APK)
+ *
+ * Copyright (C) 2025 Timo Teräs <timo.teras@iki.fi>
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+#include "apk_trace.h"
+
+uint64_t apk_trace_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int apk_trace_open(struct apk_trace *t, const char *file)
+{
+	FILE *f = fopen(file, "we");
+	if (!f) return -errno;
+
+	*t = (struct apk_trace) {
+		.f = f,
+		.pid = getpid(),
+	};
+	fprintf(f, "[\n{\"ph\":\"M\",\"pid\":%u,\"tid\":0,\"name\":\"process_name\",\"args\":{\"name\":\"apk\"}}", t->pid);
+	return 0;
+}
+
+void apk_trace_close(struct apk_trace *t)
+{
+	if (!t->f) return;
+	fputs("\n]\n", t->f);
+	fclose(t->f);
+	t->f = NULL;
+}
+
+static void trace_str(FILE *f, const char *s)
+{
+	fputc('"', f);
+	for (; *s; s++) {
+		unsigned char c = *s;
+		if (c == '"' || c == '\\') fprintf(f, "\\%c", c);
+		else if (c < 0x20) fprintf(f, "\\u%04x", c);
+		else fputc(c, f);
+	}
+	fputc('"', f);
+}
+
+static void trace_span(struct apk_trace *t, unsigned int tid, uint64_t start, const char *cat, const char *name)
+{
+	fprintf(t->f, ",\n{\"ph\":\"X\",\"pid\":%u,\"tid\":%u,\"ts\":%" PRIu64 ",\"dur\":%" PRIu64 ",\"cat\":",
+		t->pid, tid, start, apk_trace_now() - start);
+	trace_str(t->f, cat);
+	fputs(",\"name\":", t->f);
+	trace_str(t->f, name);
+}
+
+void apk_trace_write(struct apk_trace *t, unsigned int tid, uint64_t start, const char *cat, const char *fmt, ...)
+{
+	char name[256];
+	va_list va;
+
+	va_start(va, fmt);
+	vsnprintf(name, sizeof name, fmt, va);
+	va_end(va);
+
+	trace_span(t, tid, start, cat, name);
+	fputc('}', t->f);
+}
+
+void apk_trace_write_args(struct apk_trace *t, uint64_t start, const char *cat, const char *name, const char *fmt, ...)
+{
+	va_list va;
+
+	trace_span(t, 0, start, cat, name);
+	fputs(",\"args\":{", t->f);
+	va_start(va, fmt);
+	vfprintf(t->f, fmt, va);
+	va_end(va);
+	fputs("}}", t->f);
+}
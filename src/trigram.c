@@ -0,0 +1,214 @@
+/* trigram.c - Alpine Package Keeper (APK)
+ *
+ * Copyright (C) 2025 Timo Teräs <timo.teras@iki.fi>
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "apk_trigram.h"
+
+static inline uint32_t trigram(const unsigned char *p)
+{
+	return (uint32_t)tolower(p[0]) << 16 | (uint32_t)tolower(p[1]) << 8 | tolower(p[2]);
+}
+
+static int key_cmp(const void *a, const void *b)
+{
+	uint64_t ka = *(const uint64_t *) a, kb = *(const uint64_t *) b;
+	return (ka > kb) - (ka < kb);
+}
+
+static uint32_t key_lower_bound(struct apk_trigram_key_array *keys, uint64_t key)
+{
+	uint32_t l = 0, h = apk_array_len(keys);
+	while (l < h) {
+		uint32_t m = l + (h - l) / 2;
+		if (keys->item[m] < key) l = m + 1;
+		else h = m;
+	}
+	return l;
+}
+
+void apk_trigram_index_init(struct apk_trigram_index *ti)
+{
+	*ti = (struct apk_trigram_index) {};
+	apk_trigram_key_array_init(&ti->keys);
+}
+
+void apk_trigram_index_free(struct apk_trigram_index *ti)
+{
+	apk_trigram_key_array_free(&ti->keys);
+}
+
+void apk_trigram_index_reset(struct apk_trigram_index *ti)
+{
+	ti->keys = apk_array_reset(ti->keys);
+	ti->num_docs = 0;
+	ti->sorted = 0;
+}
+
+void apk_trigram_index_add(struct apk_trigram_index *ti, uint32_t doc, apk_blob_t text)
+{
+	const unsigned char *p = (const unsigned char *) text.ptr;
+
+	if (doc >= ti->num_docs) ti->num_docs = doc + 1;
+	for (long i = 0; i + 3 <= text.len; i++)
+		apk_trigram_key_array_add(&ti->keys, (uint64_t)trigram(&p[i]) << 32 | doc);
+	ti->sorted = 0;
+}
+
+void apk_trigram_index_finalize(struct apk_trigram_index *ti)
+{
+	uint32_t n = 0;
+
+	if (ti->sorted) return;
+	apk_array_qsort(ti->keys, key_cmp);
+	apk_array_foreach_item(key, ti->keys)
+		if (n == 0 || ti->keys->item[n-1] != key) ti->keys->item[n++] = key;
+	apk_array_truncate(ti->keys, n);
+	ti->sorted = 1;
+}
+
+int apk_trigram_index_write(struct apk_trigram_index *ti, struct apk_ostream *os, const struct apk_digest *id)
+{
+	struct apk_trigram_header hdr = {
+		.magic = APK_TRIGRAM_MAGIC,
+		.version = APK_TRIGRAM_VERSION,
+	};
+
+	if (IS_ERR(os)) return PTR_ERR(os);
+	if (id->alg != APK_DIGEST_SHA256) {
+		apk_ostream_cancel(os, -EINVAL);
+		return apk_ostream_close(os);
+	}
+	apk_trigram_index_finalize(ti);
+	memcpy(hdr.id, id->data, sizeof hdr.id);
+	hdr.num_docs = ti->num_docs;
+	hdr.num_keys = apk_array_len(ti->keys);
+	apk_ostream_write(os, &hdr, sizeof hdr);
+	apk_ostream_write(os, ti->keys->item, hdr.num_keys * sizeof ti->keys->item[0]);
+	return apk_ostream_close(os);
+}
+
+static int read_header(struct apk_istream *is, struct apk_trigram_header *hdr, const struct apk_digest *id)
+{
+	int r = apk_istream_read(is, hdr, sizeof *hdr);
+	if (r < 0) return r;
+	if (hdr->magic != APK_TRIGRAM_MAGIC || hdr->version != APK_TRIGRAM_VERSION) return -APKE_FORMAT_INVALID;
+	if (id->alg != APK_DIGEST_SHA256 || memcmp(hdr->id, id->data, sizeof hdr->id) != 0) return -ESTALE;
+	return 0;
+}
+
+int apk_trigram_index_check(struct apk_istream *is, const struct apk_digest *id)
+{
+	struct apk_trigram_header hdr;
+
+	if (IS_ERR(is)) return PTR_ERR(is);
+	return apk_istream_close_error(is, read_header(is, &hdr, id));
+}
+
+int apk_trigram_index_read(struct apk_trigram_index *ti, struct apk_istream *is, const struct apk_digest *id)
+{
+	struct apk_trigram_header hdr;
+	int r;
+
+	if (IS_ERR(is)) return PTR_ERR(is);
+	r = read_header(is, &hdr, id);
+	if (r < 0) goto err;
+
+	apk_trigram_index_reset(ti);
+	apk_trigram_key_array_resize(&ti->keys, hdr.num_keys, hdr.num_keys);
+	r = apk_istream_read(is, ti->keys->item, hdr.num_keys * sizeof ti->keys->item[0]);
+	if (r == 0 && apk_istream_read_max(is, &hdr, 1) != 0) r = -APKE_FORMAT_INVALID;
+	if (r < 0) {
+		apk_trigram_index_reset(ti);
+		goto err;
+	}
+	for (uint32_t i = 0; i < hdr.num_keys; i++) {
+		if ((uint32_t) ti->keys->item[i] >= hdr.num_docs ||
+		    (i && ti->keys->item[i-1] >= ti->keys->item[i])) {
+			apk_trigram_index_reset(ti);
+			r = -APKE_FORMAT_INVALID;
+			goto err;
+		}
+	}
+	ti->num_docs = hdr.num_docs;
+	ti->sorted = 1;
+err:
+	return apk_istream_close_error(is, r);
+}
+
+static void intersect_trigram(struct apk_trigram_index *ti, uint32_t tg, struct apk_trigram_doc_array **docs, bool *first)
+{
+	uint32_t b = key_lower_bound(ti->keys, (uint64_t)tg << 32);
+	uint32_t e = key_lower_bound(ti->keys, (uint64_t)(tg + 1) << 32);
+	uint32_t n = 0;
+
+	if (*first) {
+		for (uint32_t i = b; i < e; i++)
+			apk_trigram_doc_array_add(docs, (uint32_t) ti->keys->item[i]);
+		*first = false;
+		return;
+	}
+	apk_array_foreach_item(doc, *docs) {
+		while (b < e && (uint32_t) ti->keys->item[b] < doc) b++;
+		if (b < e && (uint32_t) ti->keys->item[b] == doc) (*docs)->item[n++] = doc;
+	}
+	apk_array_truncate(*docs, n);
+}
+
+static void intersect_literal(struct apk_trigram_index *ti, const unsigned char *lit, size_t len, struct apk_trigram_doc_array **docs, bool *first)
+{
+	for (size_t i = 0; i + 3 <= len; i++) {
+		intersect_trigram(ti, trigram(&lit[i]), docs, first);
+		if (apk_array_len(*docs) == 0) return;
+	}
+}
+
+/* Returns in 'docs' a sorted superset of documents possibly matching
+ * the fnmatch(3) pattern. Only the literal runs of the pattern are used,
+ * and the caller is expected to verify each candidate. Returns -ENOENT
+ * if the pattern has no literal run long enough to use the index. */
+int apk_trigram_index_query(struct apk_trigram_index *ti, const char *pattern, struct apk_trigram_doc_array **docs)
+{
+	unsigned char lit[256];
+	size_t n = 0;
+	bool first = true;
+
+	apk_trigram_index_finalize(ti);
+	*docs = apk_array_reset(*docs);
+
+	for (const unsigned char *p = (const unsigned char *) pattern; ; p++) {
+		switch (*p) {
+		case '\\':
+			if (!p[1]) goto flush;
+			p++;
+			break;
+		case '[':
+			// bracket expression: ']' right after the opening is literal
+			if (p[1] == '!' || p[1] == '^') p++;
+			if (p[1] == ']') p++;
+			p = (const unsigned char *) strchr((const char *) p + 1, ']');
+			if (!p) goto done;
+			// fallthrough
+		case 0:
+		case '*':
+		case '?':
+		flush:
+			if (n >= 3) intersect_literal(ti, lit, n, docs, &first);
+			n = 0;
+			if (!first && apk_array_len(*docs) == 0) goto done;
+			if (!*p || (*p == '\\' && !p[1])) goto done;
+			continue;
+		}
+		if (n < sizeof lit) lit[n++] = *p;
+		else n = 0;
+	}
+done:
+	return first ? -ENOENT : 0;
+}
@@ -0,0 +1,31 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include "apk_context.h"
+
+// A benchmark runs its measured loop b->n times. Setup done before the loop
+// can be excluded with bench_reset_timer(), and per iteration setup with
+// bench_stop_timer() / bench_start_timer().
+struct apk_bench {
+	uint64_t n;
+	uint64_t bytes;		// bytes processed per iteration, if meaningful
+	uint64_t start, elapsed;
+	bool running;
+	bool failed;
+};
+
+void bench_register(const char *, void (*)(struct apk_bench *));
+void bench_start_timer(struct apk_bench *b);
+void bench_stop_timer(struct apk_bench *b);
+void bench_reset_timer(struct apk_bench *b);
+void bench_fail(struct apk_bench *b, const char *fmt, ...) __attribute__ ((format (printf, 2, 3)));
+
+// Scratch directory shared by all benchmarks and removed on exit
+int bench_dirfd(void);
+const char *bench_dir(void);
+
+void bench_ctx_init(struct apk_ctx *ac, const char *root);
+
+#define APK_BENCH(bench_name) \
+	static void bench_name(struct apk_bench *); \
+	__attribute__((constructor)) static void _bench_register_##bench_name(void) { bench_register(#bench_name, bench_name); } \
+	static void bench_name(struct apk_bench *b)
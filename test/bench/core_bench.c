@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "apk_bench.h"
+#include "apk_atom.h"
+#include "apk_balloc.h"
+#include "apk_hash.h"
+#include "apk_version.h"
+
+#define NUM_KEYS 4096
+
+static const char *versions[][2] = {
+	{ "1.0", "1.0" },
+	{ "1.2.3-r0", "1.2.3-r1" },
+	{ "2.34", "0.1.0_alpha" },
+	{ "0.1.0_alpha", "0.1.3_alpha" },
+	{ "1.0_rc1", "1.0" },
+	{ "2024.01.15-r3", "2024.01.15-r12" },
+	{ "6.6.32-r0", "6.12.1-r0" },
+	{ "1.36.1_git20240506", "1.36.1_p1" },
+	{ "3.0.0_pre20250101-r2", "3.0.0_pre20250101-r10" },
+	{ "1.0a", "1.0b" },
+};
+
+static apk_blob_t *make_keys(const char *fmt)
+{
+	apk_blob_t *keys = malloc(NUM_KEYS * sizeof *keys);
+	char buf[64];
+
+	for (int i = 0; i < NUM_KEYS; i++) {
+		int n = snprintf(buf, sizeof buf, fmt, i % 97, i);
+		keys[i] = APK_BLOB_PTR_LEN(strndup(buf, n), n);
+	}
+	return keys;
+}
+
+static void free_keys(apk_blob_t *keys)
+{
+	for (int i = 0; i < NUM_KEYS; i++) free(keys[i].ptr);
+	free(keys);
+}
+
+APK_BENCH(version_compare) {
+	apk_blob_t a[ARRAY_SIZE(versions)], v[ARRAY_SIZE(versions)];
+	int sum = 0;
+
+	for (int i = 0; i < ARRAY_SIZE(versions); i++) {
+		a[i] = APK_BLOB_STR(versions[i][0]);
+		v[i] = APK_BLOB_STR(versions[i][1]);
+	}
+	for (uint64_t n = 0; n < b->n; n++)
+		for (int i = 0; i < ARRAY_SIZE(versions); i++)
+			sum += apk_version_compare(a[i], v[i]);
+	if (sum == 0) bench_fail(b, "unexpected comparison results");
+}
+
+APK_BENCH(blob_hash) {
+	apk_blob_t *keys = make_keys("usr/lib/python3.%d/site-packages/module%d.py");
+	unsigned long h = 0;
+
+	b->bytes = 0;
+	for (int i = 0; i < NUM_KEYS; i++) b->bytes += keys[i].len;
+	bench_reset_timer(b);
+	for (uint64_t n = 0; n < b->n; n++)
+		for (int i = 0; i < NUM_KEYS; i++)
+			h += apk_blob_hash(keys[i]);
+	bench_stop_timer(b);
+	free_keys(keys);
+	if (!h) bench_fail(b, "unexpected hash");
+}
+
+APK_BENCH(atom_intern) {
+	apk_blob_t *keys = make_keys("%d.%d-r0");
+	struct apk_atom_pool atoms;
+	struct apk_balloc ba;
+
+	bench_stop_timer(b);
+	for (uint64_t n = 0; n < b->n; n++) {
+		apk_balloc_init(&ba, 64*1024);
+		apk_atom_init(&atoms, &ba);
+		bench_start_timer(b);
+		// Every key is interned twice to measure both insert and hit
+		for (int j = 0; j < 2; j++)
+			for (int i = 0; i < NUM_KEYS; i++)
+				apk_atomize_dup(&atoms, keys[i]);
+		bench_stop_timer(b);
+		apk_atom_free(&atoms);
+		apk_balloc_destroy(&ba);
+	}
+	free_keys(keys);
+}
+
+struct hash_item {
+	struct hlist_node hash_node;
+	apk_blob_t key;
+};
+
+static apk_blob_t hash_item_get_key(apk_hash_item item)
+{
+	return ((struct hash_item *) item)->key;
+}
+
+static const struct apk_hash_ops hash_item_ops = {
+	.node_offset = offsetof(struct hash_item, hash_node),
+	.get_key = hash_item_get_key,
+	.hash_key = apk_blob_hash,
+	.compare = apk_blob_compare,
+};
+
+APK_BENCH(hash_lookup) {
+	apk_blob_t *keys = make_keys("name%d-%d");
+	struct hash_item *items = calloc(NUM_KEYS, sizeof *items);
+	struct apk_hash h;
+	int found = 0;
+
+	apk_hash_init(&h, &hash_item_ops, NUM_KEYS / 2);
+	for (int i = 0; i < NUM_KEYS; i++) {
+		items[i].key = keys[i];
+		apk_hash_insert(&h, &items[i]);
+	}
+	bench_reset_timer(b);
+	for (uint64_t n = 0; n < b->n; n++)
+		for (int i = 0; i < NUM_KEYS; i++)
+			found += apk_hash_get(&h, keys[i]) != NULL;
+	bench_stop_timer(b);
+	apk_hash_free(&h);
+	free(items);
+	free_keys(keys);
+	if (found != b->n * NUM_KEYS) bench_fail(b, "lookup failed");
+}
@@ -0,0 +1,210 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "apk_bench.h"
+#include "apk_database.h"
+#include "apk_solver.h"
+#include "genrepo.h"
+
+#define ROOT_INSTALLED	BIT(0)
+#define ROOT_INDEX_V2	BIT(1)
+#define ROOT_INDEX_V3	BIT(2)
+
+static const struct genrepo_spec *bench_spec(const char *name)
+{
+	static struct genrepo_spec spec;
+
+	genrepo_init(&spec);
+	spec.packages = 20000;
+	spec.depends = 6;
+	spec.world = 200;
+	spec.files = 16;
+	if (strcmp(name, "solver-complex") == 0) {
+		spec.provides = 20;
+		spec.install_if = 5;
+		spec.conflicts = 3;
+		spec.repos = 3;
+		spec.tagged = true;
+	}
+	return &spec;
+}
+
+static int write_blob(int dirfd, const char *file, apk_blob_t b)
+{
+	struct apk_ostream *os = apk_ostream_to_file(dirfd, file, 0644);
+	if (IS_ERR(os)) return PTR_ERR(os);
+	apk_ostream_write_blob(os, b);
+	free(b.ptr);
+	return apk_ostream_close(os);
+}
+
+// Creates a root under the scratch directory with the requested fixtures.
+// Fixtures are generated once and shared by the benchmarks using them.
+static const char *setup_root(struct apk_bench *b, const char *name, unsigned int what)
+{
+	static char path[PATH_MAX];
+	const struct genrepo_spec *spec = bench_spec(name);
+	char file[64];
+	apk_blob_t text;
+	int fd, r = 0;
+
+	snprintf(path, sizeof path, "%s/%s", bench_dir(), name);
+	if (access(path, F_OK) == 0) return path;
+
+	mkdirat(bench_dirfd(), name, 0755);
+	fd = openat(bench_dirfd(), name, O_DIRECTORY | O_RDONLY | O_CLOEXEC);
+	apk_make_dirs(fd, "etc/apk", 0755, 0755);
+	apk_make_dirs(fd, "lib/apk/db", 0755, 0755);
+
+	if (what & ROOT_INSTALLED) {
+		if (!r) r = genrepo_installed_text(spec, &text) ?: write_blob(fd, "lib/apk/db/installed", text);
+		if (!r) r = genrepo_world_text(spec, &text) ?: write_blob(fd, "etc/apk/world", text);
+	}
+	for (unsigned int i = 0; !r && i < spec->repos; i++) {
+		if (what & ROOT_INDEX_V2) {
+			snprintf(file, sizeof file, "repo%u.tar.gz", i);
+			r = genrepo_write_index_v2(spec, i, apk_ostream_to_file(fd, file, 0644));
+		}
+		if (!r && (what & ROOT_INDEX_V3)) {
+			snprintf(file, sizeof file, "repo%u.adb", i);
+			r = genrepo_write_index_v3(spec, i, apk_ostream_to_file(fd, file, 0644));
+		}
+	}
+	close(fd);
+
+	if (r) {
+		bench_fail(b, "%s: unable to create fixtures: %s", name, apk_error_str(r));
+		return NULL;
+	}
+	return path;
+}
+
+// Opens the database with the generated repositories whose index file name
+// ends with 'suffix', tagging them like the generated world expects
+static int open_db(struct apk_database *db, struct apk_ctx *ac, const char *root, unsigned int open_flags, const char *suffix)
+{
+	const struct genrepo_spec *spec = bench_spec(strrchr(root, '/') + 1);
+	char buf[PATH_MAX];
+	int r;
+
+	bench_ctx_init(ac, root);
+	ac->open_flags = open_flags | APK_OPENF_NO_SYS_REPOS | APK_OPENF_NO_INSTALLED_REPO | APK_OPENF_NO_AUTOUPDATE;
+	for (unsigned int i = 0; suffix && i < spec->repos; i++) {
+		if (i && spec->tagged) snprintf(buf, sizeof buf, "@r%u %s/repo%u%s", i, root, i, suffix);
+		else snprintf(buf, sizeof buf, "%s/repo%u%s", root, i, suffix);
+		apk_string_array_add(&ac->repository_list, apk_balloc_cstr(&ac->ba, APK_BLOB_STR(buf)));
+	}
+	r = apk_ctx_prepare(ac);
+	if (r) return r;
+
+	apk_db_init(db, ac);
+	r = apk_db_open(db);
+	if (r) apk_db_close(db);
+	return r;
+}
+
+static void close_db(struct apk_database *db, struct apk_ctx *ac)
+{
+	apk_db_close(db);
+	apk_ctx_free(ac);
+}
+
+static void bench_open(struct apk_bench *b, const char *root, unsigned int open_flags, const char *suffix)
+{
+	struct apk_database db;
+	struct apk_ctx ac;
+	int r;
+
+	if (!root) return;
+	bench_reset_timer(b);
+	for (uint64_t n = 0; n < b->n; n++) {
+		r = open_db(&db, &ac, root, open_flags, suffix);
+		if (r) {
+			bench_fail(b, "%s: unable to open database: %s", root, apk_error_str(r));
+			apk_ctx_free(&ac);
+			return;
+		}
+		close_db(&db, &ac);
+	}
+}
+
+APK_BENCH(installed_db_read) {
+	bench_open(b, setup_root(b, "installed", ROOT_INSTALLED),
+		APK_OPENF_READ | APK_OPENF_NO_CMDLINE_REPOS, NULL);
+}
+
+APK_BENCH(installed_db_write) {
+	const char *root = setup_root(b, "installed", ROOT_INSTALLED);
+	struct apk_database db;
+	struct apk_ctx ac;
+	int r;
+
+	if (!root) return;
+	r = open_db(&db, &ac, root, APK_OPENF_READ | APK_OPENF_WRITE | APK_OPENF_NO_CMDLINE_REPOS, NULL);
+	if (r) {
+		bench_fail(b, "%s: unable to open database: %s", root, apk_error_str(r));
+		apk_ctx_free(&ac);
+		return;
+	}
+	bench_reset_timer(b);
+	for (uint64_t n = 0; n < b->n && !r; n++)
+		r = apk_db_write_config(&db);
+	bench_stop_timer(b);
+	if (r) bench_fail(b, "unable to write database: %s", apk_error_str(r));
+	close_db(&db, &ac);
+}
+
+APK_BENCH(index_v2_load) {
+	bench_open(b, setup_root(b, "index", ROOT_INDEX_V2 | ROOT_INDEX_V3),
+		APK_OPENF_READ | APK_OPENF_NO_STATE, ".tar.gz");
+}
+
+APK_BENCH(index_v3_load) {
+	bench_open(b, setup_root(b, "index", ROOT_INDEX_V2 | ROOT_INDEX_V3),
+		APK_OPENF_READ | APK_OPENF_NO_STATE, ".adb");
+}
+
+static void bench_solve(struct apk_bench *b, const char *name, unsigned short solver_flags)
+{
+	const char *root = setup_root(b, name, ROOT_INSTALLED | ROOT_INDEX_V2);
+	struct apk_changeset changeset = {};
+	struct apk_database db;
+	struct apk_ctx ac;
+	int r;
+
+	if (!root) return;
+	r = open_db(&db, &ac, root, APK_OPENF_READ, ".tar.gz");
+	if (r) {
+		bench_fail(b, "%s: unable to open database: %s", root, apk_error_str(r));
+		apk_ctx_free(&ac);
+		return;
+	}
+	apk_change_array_init(&changeset.changes);
+	bench_reset_timer(b);
+	for (uint64_t n = 0; n < b->n; n++) {
+		r = apk_solver_solve(&db, solver_flags, db.world, &changeset);
+		if (r) {
+			bench_fail(b, "solver failed with %d errors", r);
+			break;
+		}
+	}
+	bench_stop_timer(b);
+	if (!b->failed && changeset.num_total_changes == 0) bench_fail(b, "solver found no changes");
+	apk_change_array_free(&changeset.changes);
+	close_db(&db, &ac);
+}
+
+APK_BENCH(solver_upgrade) {
+	bench_solve(b, "solver", APK_SOLVERF_UPGRADE);
+}
+
+APK_BENCH(solver_available) {
+	bench_solve(b, "solver", APK_SOLVERF_UPGRADE | APK_SOLVERF_AVAILABLE);
+}
+
+APK_BENCH(solver_upgrade_complex) {
+	bench_solve(b, "solver-complex", APK_SOLVERF_UPGRADE);
+}
@@ -0,0 +1,210 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "apk_bench.h"
+#include "apk_extract.h"
+#include "apk_fs.h"
+#include "apk_tar.h"
+
+#define NUM_FILES	64
+#define FILE_SIZE	(16*1024)
+
+static void fill_file(char *buf, size_t size, unsigned int seed)
+{
+	uint32_t x = seed * 2654435761u ?: 1;
+
+	// Mostly text like data with some noise so it compresses moderately
+	for (size_t i = 0; i < size; i++) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		buf[i] = (x & 7) ? "abcdefgh \n"[i % 10] : (char) x;
+	}
+}
+
+// Writes a pax header with the file checksum the way abuild-tar does;
+// apk_tar_write_entry() only writes plain entries.
+static int write_checksum_header(struct apk_ostream *os, const char *data, size_t size)
+{
+	struct apk_digest d;
+	char hdr[512] = {}, rec[128], hex[APK_DIGEST_LENGTH_SHA1*2+1];
+	apk_blob_t b = APK_BLOB_BUF(hex);
+	unsigned int sum = 0;
+	int len;
+
+	apk_digest_calc(&d, APK_DIGEST_SHA1, data, size);
+	apk_blob_push_hexdump(&b, APK_DIGEST_BLOB(d));
+	apk_blob_push_blob(&b, APK_BLOB_STRLIT("\0"));
+	// The record length includes its own digits
+	len = snprintf(rec, sizeof rec, "00 APK-TOOLS.checksum.SHA1=%s\n", hex);
+	snprintf(rec, sizeof rec, "%02d APK-TOOLS.checksum.SHA1=%s\n", len, hex);
+
+	strcpy(&hdr[0], "PaxHeader");
+	snprintf(&hdr[100], 8, "%07o", 0644);
+	snprintf(&hdr[108], 8, "%07o", 0);
+	snprintf(&hdr[116], 8, "%07o", 0);
+	snprintf(&hdr[124], 12, "%011o", len);
+	snprintf(&hdr[136], 12, "%011o", 0);
+	memset(&hdr[148], ' ', 8);
+	hdr[156] = 'x';
+	memcpy(&hdr[257], "ustar", 6);
+	memcpy(&hdr[263], "00", 2);
+	for (int i = 0; i < sizeof hdr; i++) sum += (unsigned char) hdr[i];
+	snprintf(&hdr[148], 8, "%06o", sum);
+
+	apk_ostream_write(os, hdr, sizeof hdr);
+	apk_ostream_write(os, rec, len);
+	return apk_tar_write_padding(os, len);
+}
+
+static int write_data(int dirfd, const char *file)
+{
+	struct apk_ostream *os = apk_ostream_gzip(apk_ostream_to_file(dirfd, file, 0644));
+	char *buf = malloc(FILE_SIZE), name[32];
+
+	if (IS_ERR(os)) {
+		free(buf);
+		return PTR_ERR(os);
+	}
+	for (int i = 0; i < NUM_FILES; i++) {
+		struct apk_file_info fi = {
+			.name = name,
+			.mode = S_IFREG | 0644,
+			.size = FILE_SIZE,
+		};
+		snprintf(name, sizeof name, "file%d", i);
+		fill_file(buf, FILE_SIZE, i + 1);
+		write_checksum_header(os, buf, FILE_SIZE);
+		apk_tar_write_entry(os, &fi, buf);
+	}
+	apk_tar_write_entry(os, NULL, NULL);
+	free(buf);
+	return apk_ostream_close(os);
+}
+
+static int write_control(int dirfd, const char *file, const char *pkginfo, size_t len)
+{
+	struct apk_ostream *os = apk_ostream_gzip(apk_ostream_to_file(dirfd, file, 0644));
+	struct apk_file_info fi = {
+		.name = ".PKGINFO",
+		.mode = S_IFREG | 0644,
+		.size = len,
+	};
+
+	if (IS_ERR(os)) return PTR_ERR(os);
+	// The control stream is not terminated, the data stream continues the archive
+	apk_tar_write_entry(os, &fi, pkginfo);
+	return apk_ostream_close(os);
+}
+
+// Writes an unsigned v2 package: the control stream with the .PKGINFO
+// holding the data stream hash, followed by the data stream.
+static int write_package(int dirfd, const char *file)
+{
+	struct apk_digest digest;
+	struct apk_ostream *os;
+	apk_blob_t control = APK_BLOB_NULL, data = APK_BLOB_NULL;
+	char pkginfo[256], hex[APK_DIGEST_LENGTH_MAX*2+1];
+	apk_blob_t b = APK_BLOB_BUF(hex);
+	int r, len;
+
+	r = write_data(dirfd, "data.tar.gz");
+	if (!r) r = apk_blob_from_file(dirfd, "data.tar.gz", &data);
+	if (r) return r;
+
+	apk_digest_calc(&digest, APK_DIGEST_SHA256, data.ptr, data.len);
+	apk_blob_push_hexdump(&b, APK_DIGEST_BLOB(digest));
+	apk_blob_push_blob(&b, APK_BLOB_STRLIT("\0"));
+	len = snprintf(pkginfo, sizeof pkginfo,
+		"pkgname = synthetic\n"
+		"pkgver = 1.0-r0\n"
+		"arch = noarch\n"
+		"size = %d\n"
+		"datahash = %s\n",
+		NUM_FILES * FILE_SIZE, hex);
+
+	r = write_control(dirfd, "control.tar.gz", pkginfo, len);
+	if (!r) r = apk_blob_from_file(dirfd, "control.tar.gz", &control);
+	if (!r) {
+		os = apk_ostream_to_file(dirfd, file, 0644);
+		if (!IS_ERR(os)) {
+			apk_ostream_write_blob(os, control);
+			apk_ostream_write_blob(os, data);
+			r = apk_ostream_close(os);
+		} else r = PTR_ERR(os);
+	}
+	free(control.ptr);
+	free(data.ptr);
+	return r;
+}
+
+struct bench_extract_ctx {
+	struct apk_extract_ctx ectx;
+	struct apk_ctx *ac;
+	unsigned int extract_flags;
+};
+
+static int extract_file(struct apk_extract_ctx *ectx, const struct apk_file_info *fi, struct apk_istream *is)
+{
+	struct bench_extract_ctx *ctx = container_of(ectx, struct bench_extract_ctx, ectx);
+	int r = apk_fs_extract(ctx->ac, fi, is, ctx->extract_flags, APK_BLOB_NULL);
+	return r > 0 ? 0 : r;
+}
+
+static const struct apk_extract_ops extract_ops = {
+	.v2meta = apk_extract_v2_meta,
+	.file = extract_file,
+};
+
+static void bench_extract(struct apk_bench *b, int gunzip_threaded)
+{
+	struct bench_extract_ctx ctx = {
+		.extract_flags = APK_FSEXTRACTF_NO_CHOWN | APK_FSEXTRACTF_NO_SYS_XATTRS,
+	};
+	struct apk_ctx ac;
+	char pkg[PATH_MAX];
+	int r;
+
+	if (faccessat(bench_dirfd(), "extract.apk", F_OK, 0) != 0) {
+		r = write_package(bench_dirfd(), "extract.apk");
+		if (r) {
+			bench_fail(b, "unable to create package: %s", apk_error_str(r));
+			return;
+		}
+		mkdirat(bench_dirfd(), "extract", 0755);
+	}
+	snprintf(pkg, sizeof pkg, "%s/extract.apk", bench_dir());
+
+	bench_ctx_init(&ac, bench_dir());
+	ac.dest_fd = openat(bench_dirfd(), "extract", O_DIRECTORY | O_RDONLY | O_CLOEXEC);
+	ac.trust.allow_untrusted = 1;
+	ctx.ac = &ac;
+	b->bytes = NUM_FILES * FILE_SIZE;
+
+	apk_io_gunzip_threaded = gunzip_threaded;
+
+	bench_reset_timer(b);
+	for (uint64_t n = 0; n < b->n; n++) {
+		apk_extract_init(&ctx.ectx, &ac, &extract_ops);
+		r = apk_extract(&ctx.ectx, apk_istream_from_file(AT_FDCWD, pkg));
+		if (r) {
+			bench_fail(b, "%s: %s", pkg, apk_error_str(r));
+			break;
+		}
+	}
+	bench_stop_timer(b);
+	apk_io_gunzip_threaded = APK_NO;
+	close(ac.dest_fd);
+	apk_ctx_free(&ac);
+}
+
+APK_BENCH(extract_package) {
+	bench_extract(b, APK_NO);
+}
+
+APK_BENCH(extract_package_threaded) {
+	bench_extract(b, APK_YES);
+}
@@ -0,0 +1,313 @@
+/* genrepo.c - Alpine Package Keeper (APK)
+ *
+ * Copyright (C) 2025 Timo Teräs <timo.teras@iki.fi>
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "adb.h"
+#include "apk_adb.h"
+#include "apk_crypto.h"
+#include "apk_tar.h"
+#include "apk_trust.h"
+#include "genrepo.h"
+
+#define INSTALLED_VERSION	"1.0-r0"
+
+enum {
+	SALT_DEPENDS,
+	SALT_PROVIDES,
+	SALT_INSTALL_IF,
+	SALT_CONFLICTS,
+	SALT_REPO,
+};
+
+void genrepo_init(struct genrepo_spec *spec)
+{
+	*spec = (struct genrepo_spec) {
+		.packages = 1000,
+		.depends = 4,
+		.repos = 1,
+		.world = 20,
+		.files = 8,
+		.seed = 1,
+	};
+}
+
+static uint32_t next_rand(uint32_t *state)
+{
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *state = x;
+}
+
+// Everything is derived from the package number only, so the indexes, the
+// installed database and the world agree with each other.
+static uint32_t pkg_rand_state(const struct genrepo_spec *spec, unsigned int pkg, unsigned int salt)
+{
+	uint32_t state = spec->seed ^ (pkg * 2654435761u) ^ (salt * 40503u);
+	if (!state) state = 1;
+	next_rand(&state);
+	return state;
+}
+
+static bool pkg_has(const struct genrepo_spec *spec, unsigned int pkg, unsigned int salt, unsigned int percentage)
+{
+	uint32_t state = pkg_rand_state(spec, pkg, salt);
+	return next_rand(&state) % 100 < percentage;
+}
+
+static unsigned int pkg_repo(const struct genrepo_spec *spec, unsigned int pkg)
+{
+	uint32_t state = pkg_rand_state(spec, pkg, SALT_REPO);
+	unsigned int r;
+
+	if (spec->repos <= 1) return 0;
+	// About half of the packages are only in the main repository
+	r = next_rand(&state) % (spec->repos * 2);
+	return r < spec->repos ? r : 0;
+}
+
+static unsigned int pkg_virtual(const struct genrepo_spec *spec, unsigned int pkg)
+{
+	return pkg % max(spec->packages / 10, 1);
+}
+
+static unsigned int pkg_depends(const struct genrepo_spec *spec, unsigned int pkg, unsigned int *deps)
+{
+	uint32_t state = pkg_rand_state(spec, pkg, SALT_DEPENDS);
+	unsigned int n = 0;
+
+	for (unsigned int i = 0; pkg && i < spec->depends; i++) {
+		unsigned int dep = next_rand(&state) % pkg;
+		bool dup = false;
+		for (unsigned int j = 0; j < n; j++) dup |= deps[j] == dep;
+		if (!dup) deps[n++] = dep;
+	}
+	return n;
+}
+
+static void write_hash(FILE *f, const char *fmt, unsigned int pkg, const char *ver, unsigned int file)
+{
+	struct apk_digest d;
+	char data[64], buf[64];
+	apk_blob_t b = APK_BLOB_BUF(buf);
+	int len = snprintf(data, sizeof data, "p%u-%s-%u", pkg, ver, file);
+
+	apk_digest_calc(&d, APK_DIGEST_SHA1, data, len);
+	apk_blob_push_hash(&b, APK_DIGEST_BLOB(d));
+	b = apk_blob_pushed(APK_BLOB_BUF(buf), b);
+	fprintf(f, fmt, BLOB_PRINTF(b));
+}
+
+static void write_dep(FILE *f, const struct genrepo_spec *spec, unsigned int pkg, unsigned int dep)
+{
+	if (!pkg_has(spec, dep, SALT_PROVIDES, spec->provides)) fprintf(f, "p%u", dep);
+	else if ((pkg + dep) & 1) fprintf(f, "so:libp%u.so.1", dep);
+	else fprintf(f, "v%u", pkg_virtual(spec, dep));
+}
+
+static void write_pkg(FILE *f, const struct genrepo_spec *spec, unsigned int pkg, const char *ver, unsigned int files)
+{
+	unsigned int deps[spec->depends ?: 1], ndeps;
+
+	write_hash(f, "C:" BLOB_FMT "\n", pkg, ver, ~0u);
+	fprintf(f,
+		"P:p%u\n"
+		"V:%s\n"
+		"A:noarch\n"
+		"S:%u\n"
+		"I:%u\n"
+		"T:synthetic package %u\n"
+		"U:https://example.org/\n"
+		"L:MIT\n"
+		"o:p%u\n",
+		pkg, ver, 1024 + pkg, 4096 + files * 512, pkg, pkg);
+
+	ndeps = pkg_depends(spec, pkg, deps);
+	if (pkg && pkg_has(spec, pkg, SALT_CONFLICTS, spec->conflicts)) {
+		uint32_t state = pkg_rand_state(spec, pkg, SALT_CONFLICTS);
+		unsigned int conflict = next_rand(&state) % pkg;
+		bool dup = false;
+		for (unsigned int i = 0; i < ndeps; i++) dup |= deps[i] == conflict;
+		// Conflict with the installed version to force an upgrade
+		if (!dup) {
+			fprintf(f, "D:!p%u<1.1", conflict);
+			for (unsigned int i = 0; i < ndeps; i++) {
+				fputc(' ', f);
+				write_dep(f, spec, pkg, deps[i]);
+			}
+			fputc('\n', f);
+			ndeps = 0;
+		}
+	}
+	if (ndeps) {
+		fputs("D:", f);
+		for (unsigned int i = 0; i < ndeps; i++) {
+			if (i) fputc(' ', f);
+			write_dep(f, spec, pkg, deps[i]);
+		}
+		fputc('\n', f);
+	}
+	// The virtual is provided without a version so that the providers do
+	// not conflict with each other, and the priority picks one of them
+	if (pkg_has(spec, pkg, SALT_PROVIDES, spec->provides))
+		fprintf(f, "p:so:libp%u.so.1=1 v%u\nk:%u\n", pkg, pkg_virtual(spec, pkg), 1 + pkg % 100);
+	if (pkg && pkg_has(spec, pkg, SALT_INSTALL_IF, spec->install_if))
+		fprintf(f, "i:p%u\n", pkg - 1);
+	if (files) {
+		fprintf(f, "F:usr/share/p%u\n", pkg);
+		for (unsigned int i = 0; i < files; i++) {
+			fprintf(f, "R:file%u\n", i);
+			write_hash(f, "Z:" BLOB_FMT "\n", pkg, ver, i);
+		}
+	}
+	fputc('\n', f);
+}
+
+static unsigned int world_first(const struct genrepo_spec *spec)
+{
+	return spec->packages - min(spec->world, spec->packages);
+}
+
+int genrepo_index_text(const struct genrepo_spec *spec, unsigned int repo, apk_blob_t *b)
+{
+	char *ptr = NULL, ver[32];
+	size_t len = 0;
+	FILE *f;
+
+	f = open_memstream(&ptr, &len);
+	if (!f) return -ENOMEM;
+	snprintf(ver, sizeof ver, "1.%u-r0", repo + 1);
+	for (unsigned int i = 0; i < spec->packages; i++)
+		if (repo == 0 || pkg_repo(spec, i) == repo) write_pkg(f, spec, i, ver, 0);
+	fclose(f);
+
+	*b = APK_BLOB_PTR_LEN(ptr, len);
+	return 0;
+}
+
+int genrepo_installed_text(const struct genrepo_spec *spec, apk_blob_t *b)
+{
+	unsigned int deps[spec->depends ?: 1], first = world_first(spec);
+	bool *marked;
+	char *ptr = NULL;
+	size_t len = 0;
+	FILE *f;
+
+	marked = calloc(spec->packages ?: 1, sizeof *marked);
+	if (!marked) return -ENOMEM;
+	// Dependencies point to lower numbered packages so one pass
+	// from the top marks the whole closure of world
+	for (unsigned int i = spec->packages; i-- > 0; ) {
+		if (i >= first) marked[i] = true;
+		if (!marked[i]) continue;
+		for (unsigned int j = 0, n = pkg_depends(spec, i, deps); j < n; j++)
+			marked[deps[j]] = true;
+	}
+
+	f = open_memstream(&ptr, &len);
+	if (!f) {
+		free(marked);
+		return -ENOMEM;
+	}
+	for (unsigned int i = 0; i < spec->packages; i++)
+		if (marked[i]) write_pkg(f, spec, i, INSTALLED_VERSION, spec->files);
+	fclose(f);
+	free(marked);
+
+	*b = APK_BLOB_PTR_LEN(ptr, len);
+	return 0;
+}
+
+int genrepo_world_text(const struct genrepo_spec *spec, apk_blob_t *b)
+{
+	char *ptr = NULL;
+	size_t len = 0;
+	FILE *f;
+
+	f = open_memstream(&ptr, &len);
+	if (!f) return -ENOMEM;
+	for (unsigned int i = world_first(spec); i < spec->packages; i++) {
+		unsigned int repo = pkg_repo(spec, i);
+		if (spec->tagged && repo) fprintf(f, "p%u@r%u\n", i, repo);
+		else fprintf(f, "p%u\n", i);
+	}
+	fclose(f);
+
+	*b = APK_BLOB_PTR_LEN(ptr, len);
+	return 0;
+}
+
+int genrepo_write_index_v2(const struct genrepo_spec *spec, unsigned int repo, struct apk_ostream *os)
+{
+	struct apk_file_info fi = {
+		.name = "APKINDEX",
+		.mode = S_IFREG | 0644,
+	};
+	apk_blob_t b;
+	int r;
+
+	if (IS_ERR(os)) return PTR_ERR(os);
+	r = genrepo_index_text(spec, repo, &b);
+	if (r) return apk_ostream_close_error(os, r);
+
+	os = apk_ostream_gzip(os);
+	if (IS_ERR(os)) {
+		free(b.ptr);
+		return PTR_ERR(os);
+	}
+	fi.size = b.len;
+	apk_tar_write_entry(os, &fi, b.ptr);
+	apk_tar_write_entry(os, NULL, NULL);
+	free(b.ptr);
+	return apk_ostream_close(os);
+}
+
+int genrepo_write_index_v3(const struct genrepo_spec *spec, unsigned int repo, struct apk_ostream *os)
+{
+	struct apk_trust trust;
+	struct adb_obj ndx, pkgs, pkginfo;
+	struct adb db;
+	apk_blob_t b, text;
+	int r, i;
+
+	if (IS_ERR(os)) return PTR_ERR(os);
+	r = genrepo_index_text(spec, repo, &text);
+	if (r) return apk_ostream_close_error(os, r);
+
+	adb_w_init_alloca(&db, ADB_SCHEMA_INDEX, 1000);
+	adb_wo_alloca(&ndx, &schema_index, &db);
+	adb_wo_alloca(&pkgs, &schema_pkginfo_array, &db);
+	adb_wo_alloca(&pkginfo, &schema_pkginfo, &db);
+
+	for (b = text; b.len; ) {
+		apk_blob_t l;
+		if (!apk_blob_split(b, APK_BLOB_STRLIT("\n"), &l, &b)) {
+			l = b;
+			b = APK_BLOB_NULL;
+		}
+		if (l.len < 2) {
+			adb_wa_append_obj(&pkgs, &pkginfo);
+			continue;
+		}
+		i = adb_pkg_field_index(l.ptr[0]);
+		if (i > 0) adb_wo_pkginfo(&pkginfo, i, APK_BLOB_PTR_LEN(l.ptr+2, l.len-2));
+	}
+	free(text.ptr);
+
+	adb_wo_obj(&ndx, ADBI_NDX_PACKAGES, &pkgs);
+	adb_w_rootobj(&ndx);
+
+	apk_trust_init(&trust);
+	r = adb_c_create(os, &db, &trust);
+	apk_trust_free(&trust);
+	adb_free(&db);
+	return r;
+}
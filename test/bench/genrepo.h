@@ -0,0 +1,46 @@
+/* genrepo.h - Alpine Package Keeper (APK)
+ *
+ * Copyright (C) 2025 Timo Teräs <timo.teras@iki.fi>
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-only
+ */
+
+#pragma once
+#include "apk_blob.h"
+#include "apk_io.h"
+
+// Synthetic repository generator. Packages are named p<N> and depend only on
+// packages with a lower number, so the low numbered packages act as widely
+// used libraries. The world is made of the highest numbered packages and the
+// installed database holds an older version of everything they pull in.
+//
+// Repository 0 holds every package. Each additional repository holds a
+// newer version of a subset of the packages and, if tagged, is named @r<N>
+// and the world entries it provides are pinned to it.
+//
+// The percentages select the packages that provide a shared library and a
+// virtual name (and are depended on through them), that have an install_if
+// on the previous package, and that conflict with old versions of a random
+// lower numbered package.
+struct genrepo_spec {
+	unsigned int packages;
+	unsigned int depends;		// dependencies per package
+	unsigned int provides;		// percentage
+	unsigned int install_if;	// percentage
+	unsigned int conflicts;		// percentage
+	unsigned int repos;
+	unsigned int world;		// packages in world
+	unsigned int files;		// files per installed package
+	unsigned int seed;
+	bool tagged;
+};
+
+void genrepo_init(struct genrepo_spec *spec);
+
+int genrepo_index_text(const struct genrepo_spec *spec, unsigned int repo, apk_blob_t *b);
+int genrepo_installed_text(const struct genrepo_spec *spec, apk_blob_t *b);
+int genrepo_world_text(const struct genrepo_spec *spec, apk_blob_t *b);
+
+int genrepo_write_index_v2(const struct genrepo_spec *spec, unsigned int repo, struct apk_ostream *os);
+int genrepo_write_index_v3(const struct genrepo_spec *spec, unsigned int repo, struct apk_ostream *os);
@@ -0,0 +1,118 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "apk_crypto.h"
+#include "apk_print.h"
+#include "genrepo.h"
+
+static int usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-3t] [-n PACKAGES] [-d DEPENDS] [-p PROVIDES%%] [-i INSTALL_IF%%]\n"
+		"       [-c CONFLICTS%%] [-r REPOS] [-w WORLD] [-f FILES] [-s SEED] DIR\n"
+		"\n"
+		"Writes repo<N> (APKINDEX text), repo<N>.adb, installed and a gen.test\n"
+		"solver test using them to DIR. Use -3 to make gen.test use the v3\n"
+		"indexes and -t to tag the additional repositories.\n",
+		prog);
+	return 1;
+}
+
+static int write_blob(int dirfd, const char *file, apk_blob_t b)
+{
+	struct apk_ostream *os = apk_ostream_to_file(dirfd, file, 0644);
+	if (IS_ERR(os)) {
+		free(b.ptr);
+		return PTR_ERR(os);
+	}
+	apk_ostream_write_blob(os, b);
+	free(b.ptr);
+	return apk_ostream_close(os);
+}
+
+static int write_test(int dirfd, const struct genrepo_spec *spec, bool v3)
+{
+	struct apk_ostream *os;
+	apk_blob_t world;
+	int r;
+
+	r = genrepo_world_text(spec, &world);
+	if (r) return r;
+	os = apk_ostream_to_file(dirfd, "gen.test", 0644);
+	if (IS_ERR(os)) {
+		free(world.ptr);
+		return PTR_ERR(os);
+	}
+
+	apk_ostream_write_string(os, "@ARGS upgrade\n");
+	for (unsigned int i = 0; i < max(spec->repos, 1); i++) {
+		if (i && spec->tagged) apk_ostream_fmt(os, "@REPO @r%u repo%u%s\n", i, i, v3 ? ".adb" : "");
+		else apk_ostream_fmt(os, "@REPO repo%u%s\n", i, v3 ? ".adb" : "");
+	}
+	apk_ostream_write_string(os, "@INSTALLED installed\n@WORLD");
+	apk_blob_foreach_token(dep, world, APK_BLOB_STRLIT("\n"))
+		apk_ostream_fmt(os, " " BLOB_FMT, BLOB_PRINTF(dep));
+	apk_ostream_write_string(os, "\n");
+	free(world.ptr);
+	return apk_ostream_close(os);
+}
+
+int main(int argc, char **argv)
+{
+	struct genrepo_spec spec;
+	char file[64];
+	apk_blob_t b;
+	bool v3 = false;
+	int opt, dirfd, r = 0;
+
+	genrepo_init(&spec);
+	while ((opt = getopt(argc, argv, "3c:d:f:i:n:p:r:s:tw:")) != -1) {
+		switch (opt) {
+		case '3': v3 = true; break;
+		case 'c': spec.conflicts = atoi(optarg); break;
+		case 'd': spec.depends = atoi(optarg); break;
+		case 'f': spec.files = atoi(optarg); break;
+		case 'i': spec.install_if = atoi(optarg); break;
+		case 'n': spec.packages = atoi(optarg); break;
+		case 'p': spec.provides = atoi(optarg); break;
+		case 'r': spec.repos = atoi(optarg); break;
+		case 's': spec.seed = atoi(optarg); break;
+		case 't': spec.tagged = true; break;
+		case 'w': spec.world = atoi(optarg); break;
+		default: return usage(argv[0]);
+		}
+	}
+	if (optind + 1 != argc) return usage(argv[0]);
+
+	apk_crypto_init();
+	mkdir(argv[optind], 0755);
+	dirfd = open(argv[optind], O_DIRECTORY | O_RDONLY | O_CLOEXEC);
+	if (dirfd < 0) {
+		perror(argv[optind]);
+		return 1;
+	}
+
+	for (unsigned int i = 0; !r && i < max(spec.repos, 1); i++) {
+		snprintf(file, sizeof file, "repo%u", i);
+		r = genrepo_index_text(&spec, i, &b) ?: write_blob(dirfd, file, b);
+		if (r) break;
+		snprintf(file, sizeof file, "repo%u.adb", i);
+		r = genrepo_write_index_v3(&spec, i, apk_ostream_to_file(dirfd, file, 0644));
+	}
+	if (!r) {
+		snprintf(file, sizeof file, "installed");
+		r = genrepo_installed_text(&spec, &b) ?: write_blob(dirfd, file, b);
+	}
+	if (!r) {
+		snprintf(file, sizeof file, "gen.test");
+		r = write_test(dirfd, &spec, v3);
+	}
+	close(dirfd);
+	if (r) {
+		fprintf(stderr, "%s/%s: %s\n", argv[optind], file, apk_error_str(r));
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,193 @@
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "apk_bench.h"
+
+#ifndef APK_VERSION
+#define APK_VERSION "unknown"
+#endif
+
+struct bench_entry {
+	const char *name;
+	void (*func)(struct apk_bench *);
+};
+
+static int num_benchs;
+static struct bench_entry all_benchs[200];
+static char scratch_dir[PATH_MAX];
+static int scratch_fd = -1;
+
+void bench_register(const char *name, void (*func)(struct apk_bench *))
+{
+	all_benchs[num_benchs++] = (struct bench_entry) {
+		.name = name,
+		.func = func,
+	};
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void bench_start_timer(struct apk_bench *b)
+{
+	if (b->running) return;
+	b->start = now_ns();
+	b->running = true;
+}
+
+void bench_stop_timer(struct apk_bench *b)
+{
+	if (!b->running) return;
+	b->elapsed += now_ns() - b->start;
+	b->running = false;
+}
+
+void bench_reset_timer(struct apk_bench *b)
+{
+	b->elapsed = 0;
+	if (b->running) b->start = now_ns();
+}
+
+void bench_fail(struct apk_bench *b, const char *fmt, ...)
+{
+	va_list va;
+
+	va_start(va, fmt);
+	vfprintf(stderr, fmt, va);
+	va_end(va);
+	fputc('\n', stderr);
+	b->failed = true;
+}
+
+int bench_dirfd(void)
+{
+	return scratch_fd;
+}
+
+const char *bench_dir(void)
+{
+	return scratch_dir;
+}
+
+void bench_ctx_init(struct apk_ctx *ac, const char *root)
+{
+	apk_ctx_init(ac);
+	ac->root = root;
+	ac->out.verbosity = 0;
+	ac->flags |= APK_NO_NETWORK | APK_NO_CACHE | APK_ALLOW_UNTRUSTED |
+		APK_NO_LOGFILE | APK_NO_SCRIPTS | APK_NO_COMMIT_HOOKS | APK_NO_CHROOT;
+	ac->interactive = 0;
+	ac->sync = 0;
+}
+
+static int remove_entry(const char *path, const struct stat *st, int type, struct FTW *ftw)
+{
+	remove(path);
+	return 0;
+}
+
+static bool selected(const char *name, int argc, char **argv)
+{
+	if (argc == 0) return true;
+	for (int i = 0; i < argc; i++)
+		if (strstr(name, argv[i])) return true;
+	return false;
+}
+
+// Grow the iteration count until a run takes at least min_ns
+static bool run_bench(struct bench_entry *e, uint64_t min_ns, struct apk_bench *b)
+{
+	uint64_t n = 1;
+
+	for (;;) {
+		*b = (struct apk_bench) { .n = n };
+		bench_start_timer(b);
+		e->func(b);
+		bench_stop_timer(b);
+		if (b->failed) return false;
+		if (b->elapsed >= min_ns || n >= 1000000000) return true;
+
+		uint64_t next = b->elapsed ? n * min_ns / b->elapsed * 6 / 5 : n * 100;
+		n = max(min(next, n * 100), n + 1);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	const char *tmpdir = getenv("TMPDIR") ?: "/tmp";
+	uint64_t min_ms = 500;
+	FILE *out = stdout;
+	bool keep = false;
+	int opt, ret = 0, num = 0;
+
+	while ((opt = getopt(argc, argv, "klo:t:")) != -1) {
+		switch (opt) {
+		case 't':
+			min_ms = strtoull(optarg, NULL, 10);
+			break;
+		case 'o':
+			out = fopen(optarg, "w");
+			if (!out) {
+				perror(optarg);
+				return 1;
+			}
+			break;
+		case 'k':
+			keep = true;
+			break;
+		case 'l':
+			for (int i = 0; i < num_benchs; i++) printf("%s\n", all_benchs[i].name);
+			return 0;
+		default:
+			fprintf(stderr, "usage: %s [-kl] [-t MIN_MSEC] [-o FILE] [FILTER...]\n", argv[0]);
+			return 1;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	apk_crypto_init();
+
+	snprintf(scratch_dir, sizeof scratch_dir, "%s/apk-bench.XXXXXX", tmpdir);
+	if (!mkdtemp(scratch_dir)) {
+		perror(scratch_dir);
+		return 1;
+	}
+	scratch_fd = open(scratch_dir, O_DIRECTORY | O_RDONLY | O_CLOEXEC);
+
+	fprintf(out, "{\n\t\"apk_version\": \"%s\",\n\t\"min_time_ms\": %llu,\n\t\"benchmarks\": [",
+		APK_VERSION, (unsigned long long) min_ms);
+	for (int i = 0; i < num_benchs; i++) {
+		struct bench_entry *e = &all_benchs[i];
+		struct apk_bench b;
+
+		if (!selected(e->name, argc, argv)) continue;
+		if (!run_bench(e, min_ms * 1000000ULL, &b)) {
+			fprintf(stderr, "%s: FAILED\n", e->name);
+			ret = 1;
+			continue;
+		}
+		fprintf(out, "%s\n\t\t{\"name\": \"%s\", \"iterations\": %llu, \"ns_per_op\": %.1f",
+			num++ ? "," : "", e->name, (unsigned long long) b.n, (double) b.elapsed / b.n);
+		if (b.bytes && b.elapsed)
+			fprintf(out, ", \"mb_per_s\": %.2f", (double) b.bytes * b.n * 1000.0 / b.elapsed);
+		fputc('}', out);
+		fflush(out);
+	}
+	fprintf(out, "\n\t]\n}\n");
+	if (out != stdout) fclose(out);
+
+	close(scratch_fd);
+	if (keep) fprintf(stderr, "fixtures kept in %s\n", scratch_dir);
+	else nftw(scratch_dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+	return ret;
+}
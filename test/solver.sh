@@ -14,6 +14,19 @@ update_repo() {
 	fi
 }
 
+repo_url() {
+	local repo="$1"
+	case "$repo" in
+	*.adb)
+		echo "test:/$repo"
+		;;
+	*)
+		update_repo "$repo"
+		echo "test:/$repo.tar.gz"
+		;;
+	esac
+}
+
 run_test() {
 	local test="$1"
 	local testfile testdir
@@ -24,7 +37,7 @@ run_test() {
 	setup_apkroot
 	mkdir -p "$TEST_ROOT/data/src"
 
-	local args="" repo run_found
+	local args="" repo run_found expect_found start end
 	exec 4> /dev/null
 	while IFS="" read -r ln; do
 		case "$ln" in
@@ -44,18 +57,17 @@ run_test() {
 			tag="${ln#* }"
 			repo="${tag#* }"
 			tag="${tag% *}"
-			update_repo "$testdir/$repo"
-			echo "$tag test:/$testdir/$repo.tar.gz" >> "$TEST_ROOT"/etc/apk/repositories
+			echo "$tag $(repo_url "$testdir/$repo")" >> "$TEST_ROOT"/etc/apk/repositories
 			;;
 		"@REPO "*)
 			repo="${ln#* }"
-			update_repo "$testdir/$repo"
-			echo "test:/$testdir/$repo.tar.gz" >> "$TEST_ROOT"/etc/apk/repositories
+			repo_url "$testdir/$repo" >> "$TEST_ROOT"/etc/apk/repositories
 			;;
 		"@CACHE "*)
 			ln -snf "$testdir/${ln#* }" "$TEST_ROOT/etc/apk/cache/installed"
 			;;
 		"@EXPECT")
+			expect_found=yes
 			exec 4> "$TEST_ROOT/data/expected"
 			;;
 		"@"*)
@@ -74,10 +86,18 @@ run_test() {
 
 	retcode=1
 	if [ "$run_found" = "yes" ]; then
+		[ -n "$timing" ] && start=$(date +%s%N)
 		# shellcheck disable=SC2086 # $args needs to be word splitted
 		$APK --allow-untrusted --simulate --root-tmpfs=no $args > "$TEST_ROOT/data/output" 2>&1
+		if [ -n "$timing" ]; then
+			end=$(date +%s%N)
+			echo "TIME: $test $(( (end - start) / 1000000 )) ms"
+		fi
 
-		if ! cmp "$TEST_ROOT/data/output" "$TEST_ROOT/data/expected" > /dev/null 2>&1; then
+		# Generated fixtures used for timing have no expected output
+		if [ -n "$timing" ] && [ -z "$expect_found" ]; then
+			retcode=0
+		elif ! cmp "$TEST_ROOT/data/output" "$TEST_ROOT/data/expected" > /dev/null 2>&1; then
 			fail=$((fail+1))
 			echo "FAIL: $test"
 			diff -ru "$TEST_ROOT/data/expected" "$TEST_ROOT/data/output"
@@ -90,6 +110,11 @@ run_test() {
 	return $retcode
 }
 
+timing=""
+if [ "$1" = "-t" ]; then
+	timing=yes
+	shift
+fi
 TEST_TO_RUN="$*"
 
 fail=0
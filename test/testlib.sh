@@ -9,6 +9,12 @@ assert() {
 	exit 1
 }
 
+# checks that FILE is valid JSON, if python3 is available to parse it
+assert_json() {
+	command -v python3 > /dev/null || return 0
+	python3 -c 'import json,sys; json.load(open(sys.argv[1]))' "$1" || assert "$1: invalid json"
+}
+
 glob_one() {
 	# shellcheck disable=SC2048 # argument is wildcard needing expansion
 	for a in $*; do
@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <unistd.h>
+
+#include "apk_test.h"
+#include "apk_delta.h"
+
+static void make_id(struct apk_digest *id, uint8_t v)
+{
+	apk_digest_set(id, APK_DIGEST_SHA256);
+	memset(id->data, v, id->len);
+}
+
+static int tmpfd(const void *data, size_t len)
+{
+	FILE *f = tmpfile();
+	int fd;
+
+	assert_non_null(f);
+	fd = dup(fileno(f));
+	fclose(f);
+	if (len) assert_int_equal(len, write(fd, data, len));
+	return fd;
+}
+
+// Creates a delta from 'base' to 'target' and returns the file it is in
+static int make_delta(apk_blob_t base, apk_blob_t target)
+{
+	struct apk_digest base_id, target_id;
+	int fd = tmpfd(NULL, 0);
+
+	make_id(&base_id, 1);
+	make_id(&target_id, 2);
+	assert_int_equal(0, apk_delta_create(apk_ostream_to_fd(dup(fd)), base, target, &base_id, &target_id, 0));
+	lseek(fd, 0, SEEK_SET);
+	return fd;
+}
+
+static struct apk_istream *open_delta(int delta_fd, apk_blob_t base, uint8_t target_id)
+{
+	struct apk_digest id;
+
+	make_id(&id, target_id);
+	return apk_istream_delta(apk_istream_from_fd(delta_fd), tmpfd(base.ptr, base.len), APK_DIGEST_BLOB(id));
+}
+
+static void fill(char *buf, size_t len, uint32_t seed)
+{
+	for (size_t i = 0; i < len; i++) {
+		seed = seed * 1103515245 + 12345;
+		buf[i] = seed >> 16;
+	}
+}
+
+APK_TEST(delta_roundtrip) {
+	static char base[65536], target[65536 + 300], out[sizeof target];
+	struct apk_istream *is;
+	apk_blob_t b = APK_BLOB_BUF(base), t = APK_BLOB_BUF(target);
+	off_t delta_size;
+	int fd;
+
+	fill(base, sizeof base, 1);
+	memcpy(target, base, 20000);
+	fill(&target[20000], 300, 2);
+	memcpy(&target[20300], &base[20000], sizeof base - 20000);
+	target[50000] ^= 0xff;
+
+	fd = make_delta(b, t);
+	delta_size = lseek(fd, 0, SEEK_END);
+	lseek(fd, 0, SEEK_SET);
+	assert_true(delta_size < 1024);
+
+	is = open_delta(fd, b, 2);
+	assert_false(IS_ERR(is));
+	assert_int_equal(0, apk_istream_read(is, out, sizeof out));
+	assert_memory_equal(out, target, sizeof target);
+	assert_int_equal(0, apk_istream_read_max(is, out, 1));
+	assert_int_equal(0, apk_istream_close(is));
+}
+
+APK_TEST(delta_mismatch) {
+	static char base[4096], target[4096];
+	struct apk_istream *is;
+	apk_blob_t b = APK_BLOB_BUF(base), t = APK_BLOB_BUF(target);
+	int fd;
+
+	fill(base, sizeof base, 3);
+	fill(target, sizeof target, 4);
+	fd = make_delta(b, t);
+	is = open_delta(dup(fd), b, 3);
+	assert_int_equal(-APKE_DELTA_MISMATCH, PTR_ERR(is));
+
+	lseek(fd, 0, SEEK_SET);
+	base[100] ^= 1;
+	is = open_delta(fd, b, 2);
+	assert_int_equal(-APKE_DELTA_MISMATCH, PTR_ERR(is));
+}
+
+APK_TEST(delta_file_hash) {
+	static char base[8192], target[8192], out[sizeof target];
+	struct apk_digest base_id, target_id;
+	struct apk_istream *is;
+	apk_blob_t b = APK_BLOB_BUF(base), t = APK_BLOB_BUF(target);
+	int fd;
+
+	fill(base, sizeof base, 5);
+	memcpy(target, base, sizeof target);
+	target[1000] ^= 0xff;
+	apk_digest_calc(&base_id, APK_DIGEST_SHA256, base, sizeof base);
+	apk_digest_calc(&target_id, APK_DIGEST_SHA256, target, sizeof target);
+
+	fd = tmpfd(NULL, 0);
+	assert_int_equal(0, apk_delta_create(apk_ostream_to_fd(dup(fd)), b, t, &base_id, &target_id, APK_DELTA_F_FILE_HASH));
+	lseek(fd, 0, SEEK_SET);
+	is = apk_istream_delta(apk_istream_from_fd(dup(fd)), tmpfd(base, sizeof base), APK_BLOB_NULL);
+	assert_false(IS_ERR(is));
+	assert_int_equal(0, apk_istream_read(is, out, sizeof out));
+	assert_memory_equal(out, target, sizeof target);
+	assert_int_equal(0, apk_istream_close(is));
+	close(fd);
+
+	// A package delta can not be applied without a target identity
+	fd = make_delta(b, t);
+	is = apk_istream_delta(apk_istream_from_fd(fd), tmpfd(base, sizeof base), APK_BLOB_NULL);
+	assert_int_equal(-APKE_DELTA_MISMATCH, PTR_ERR(is));
+}
@@ -1,4 +1,5 @@
 #include <dirent.h>
+#include <zlib.h>
 
 #include "apk_test.h"
 #include "apk_io.h"
@@ -181,3 +182,98 @@ APK_TEST(io_istream_align) {
 	apk_istream_close(is);
 	free(buf);
 }
+
+struct gzip_log {
+	char log[1024];
+	size_t pos, data_len, out_len;
+	uint32_t data_crc;
+};
+
+static int gzip_log_cb(void *ctx, int part, apk_blob_t data)
+{
+	struct gzip_log *l = ctx;
+
+	if (part == APK_MPART_DATA) {
+		l->data_crc = crc32(l->data_crc, (const Bytef *) data.ptr, data.len);
+		l->data_len += data.len;
+		return 0;
+	}
+	l->pos += snprintf(&l->log[l->pos], sizeof l->log - l->pos, "%d:%zu:%08x@%zu ",
+		part, l->data_len, l->data_crc, l->out_len);
+	l->data_len = l->data_crc = 0;
+	return 0;
+}
+
+static void gzip_member(apk_blob_t *out, size_t len, int level)
+{
+	z_stream zs = {};
+	uint8_t *data = malloc(len);
+
+	for (size_t i = 0; i < len; i++) data[i] = (i * 7 + i / 1000) % (level ? 13 : 251);
+	assert_int_equal(Z_OK, deflateInit2(&zs, level, Z_DEFLATED, 15 | 16, 8, Z_DEFAULT_STRATEGY));
+	zs.next_in = data;
+	zs.avail_in = len;
+	zs.next_out = (Bytef *) out->ptr + out->len;
+	zs.avail_out = deflateBound(&zs, len) + 64;
+	assert_int_equal(Z_STREAM_END, deflate(&zs, Z_FINISH));
+	out->len += zs.total_out;
+	deflateEnd(&zs);
+	free(data);
+}
+
+static int gzip_read(apk_blob_t input, int threaded, struct gzip_log *l, uint32_t *crc)
+{
+	struct apk_istream blob_is, *is;
+	uint8_t buf[777];
+	ssize_t r;
+
+	apk_io_gunzip_threaded = threaded;
+	*l = (struct gzip_log) {};
+	*crc = 0;
+	is = apk_istream_gunzip_mpart(apk_istream_from_blob(&blob_is, input), gzip_log_cb, l);
+	while ((r = apk_istream_read_max(is, buf, sizeof buf)) > 0) {
+		*crc = crc32(*crc, buf, r);
+		l->out_len += r;
+	}
+	return apk_istream_close_error(is, r);
+}
+
+APK_TEST(io_gunzip_threaded) {
+	size_t sizes[] = { 100, 3000, 1000000, 0, 500000 };
+	apk_blob_t input = APK_BLOB_PTR_LEN(malloc(4*1024*1024), 0);
+	struct gzip_log l1, l2;
+	uint32_t crc1, crc2;
+	int r1, r2;
+
+	for (int i = 0; i < ARRAY_SIZE(sizes); i++)
+		gzip_member(&input, sizes[i], i == 2 ? 0 : 6);
+
+	r1 = gzip_read(input, 0, &l1, &crc1);
+	r2 = gzip_read(input, 1, &l2, &crc2);
+	assert_int_equal(0, r1);
+	assert_int_equal(r1, r2);
+	assert_int_equal(crc1, crc2);
+	assert_int_equal(l1.out_len, l2.out_len);
+	assert_string_equal(l1.log, l2.log);
+
+	// truncated stream
+	input.len -= 1000;
+	r1 = gzip_read(input, 0, &l1, &crc1);
+	r2 = gzip_read(input, 1, &l2, &crc2);
+	assert_int_equal(r1, r2);
+	assert_int_equal(crc1, crc2);
+	assert_string_equal(l1.log, l2.log);
+
+	// trailing garbage
+	input.len += 1000;
+	memset(input.ptr + input.len, 0xaa, 100);
+	input.len += 100;
+	r1 = gzip_read(input, 0, &l1, &crc1);
+	r2 = gzip_read(input, 1, &l2, &crc2);
+	assert_int_equal(-APKE_FORMAT_INVALID, r1);
+	assert_int_equal(r1, r2);
+	assert_string_equal(l1.log, l2.log);
+
+	apk_io_gunzip_threaded = APK_NO;
+	free(input.ptr);
+}
@@ -3,6 +3,7 @@
 #include <signal.h>
 #include <unistd.h>
 #include "apk_test.h"
+#include "apk_crypto.h"
 
 static int num_tests;
 static struct CMUnitTest all_tests[1000];
@@ -48,6 +49,7 @@ static void init_next_funcs(void)
 int main(void)
 {
 	init_next_funcs();
+	apk_crypto_init();
 	if (access("test/unit", F_OK) == 0) chdir("test/unit");
 	signal(SIGPIPE, SIG_IGN);
 	return _cmocka_run_group_tests("unit_tests", all_tests, num_tests, NULL, NULL);
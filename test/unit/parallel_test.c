@@ -0,0 +1,52 @@
+#include "apk_test.h"
+#include "apk_parallel.h"
+
+#define NUM_ITEMS 1000
+
+struct parallel_test {
+	unsigned int result[NUM_ITEMS];
+	unsigned int next_done, stop_at;
+	bool in_order;
+};
+
+static void test_work(void *pctx, unsigned int i)
+{
+	struct parallel_test *t = pctx;
+	t->result[i] = i * 3;
+}
+
+static int test_done(void *pctx, unsigned int i)
+{
+	struct parallel_test *t = pctx;
+	if (i != t->next_done || t->result[i] != i * 3) t->in_order = false;
+	t->next_done = i + 1;
+	return i == t->stop_at ? -ECANCELED : 0;
+}
+
+static const struct apk_parallel_ops test_ops = {
+	.work = test_work,
+	.done = test_done,
+};
+
+static void run(int jobs, unsigned int window, unsigned int stop_at)
+{
+	struct parallel_test t = { .in_order = true, .stop_at = stop_at };
+	int r = apk_parallel_run(jobs, NUM_ITEMS, window, &test_ops, &t);
+
+	assert_int_equal(r, stop_at < NUM_ITEMS ? -ECANCELED : 0);
+	assert_int_equal(t.next_done, stop_at < NUM_ITEMS ? stop_at + 1 : NUM_ITEMS);
+	assert_true(t.in_order);
+}
+
+APK_TEST(parallel_ordered) {
+	run(1, 1, NUM_ITEMS);
+	run(4, 1, NUM_ITEMS);
+	run(4, 16, NUM_ITEMS);
+	run(0, 64, NUM_ITEMS);
+}
+
+APK_TEST(parallel_abort) {
+	run(1, 8, 100);
+	run(8, 8, 100);
+	run(8, 1000, 0);
+}
@@ -7,8 +7,15 @@ static int test_repository(struct apk_repoparser *rp, apk_blob_t url, const char
 	return 0;
 }
 
+static int test_mirror(struct apk_repoparser *rp, apk_blob_t url, apk_blob_t mirror)
+{
+	apk_out(rp->out, "mirror:" BLOB_FMT ":" BLOB_FMT, BLOB_PRINTF(url), BLOB_PRINTF(mirror));
+	return 0;
+}
+
 static const struct apk_repoparser_ops ops = {
 	.repository = test_repository,
+	.mirror = test_mirror,
 };
 
 static void repo_test(bool allow_keywords, const char *data, const char *expect_stderr, const char *expect_stdout)
@@ -96,3 +103,14 @@ APK_TEST(repoparser_nokeywords) {
 		"http://www.alpinelinux.org/main:APKINDEX.tar.gz:\n"
 		);
 }
+
+APK_TEST(repoparser_mirror) {
+	repo_test(true,
+		"set host=example.com\n"
+		"mirror http://dl.${host}/alpine/ http://m1.${host}/alpine http://m2.${host}/\n"
+		"mirror http://dl.example.com/alpine\n"
+		"mirror http://dl.example.com/alpine foobar\n",
+		"WARNING: repositories:4: invalid url: foobar\n",
+		"mirror:http://dl.example.com/alpine:http://m1.example.com/alpine\n"
+		"mirror:http://dl.example.com/alpine:http://m2.example.com\n");
+}
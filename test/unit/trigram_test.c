@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <unistd.h>
+
+#include "apk_test.h"
+#include "apk_trigram.h"
+
+static void build_index(struct apk_trigram_index *ti)
+{
+	static const char *docs[] = {
+		"apk-tools",
+		"Alpine Package Keeper",
+		"busybox",
+		"libapk",
+		"py3-apk",
+	};
+	apk_trigram_index_init(ti);
+	for (int i = 0; i < ARRAY_SIZE(docs); i++)
+		apk_trigram_index_add(ti, i, APK_BLOB_STR(docs[i]));
+}
+
+static void _assert_query(struct apk_trigram_index *ti, const char *pattern, int expected_r, const char *expected_docs, const char *file, int line)
+{
+	struct apk_trigram_doc_array *docs;
+	char buf[64] = "";
+	int r, n = 0;
+
+	apk_trigram_doc_array_init(&docs);
+	r = apk_trigram_index_query(ti, pattern, &docs);
+	_assert_int_equal(r, expected_r, file, line);
+	apk_array_foreach_item(doc, docs) buf[n++] = '0' + doc;
+	buf[n] = 0;
+	_assert_true(strcmp(buf, expected_docs) == 0, pattern, file, line);
+	apk_trigram_doc_array_free(&docs);
+}
+#define assert_query(ti, pattern, r, docs) _assert_query(ti, pattern, r, docs, __FILE__, __LINE__)
+
+APK_TEST(trigram_query_literal) {
+	struct apk_trigram_index ti;
+
+	build_index(&ti);
+	assert_query(&ti, "*apk*", 0, "034");
+	assert_query(&ti, "*APK*", 0, "034");
+	assert_query(&ti, "*package*", 0, "1");
+	assert_query(&ti, "*box*", 0, "2");
+	assert_query(&ti, "*notfound*", 0, "");
+	apk_trigram_index_free(&ti);
+}
+
+APK_TEST(trigram_query_wildcards) {
+	struct apk_trigram_index ti;
+
+	build_index(&ti);
+	assert_query(&ti, "*lib*apk*", 0, "3");
+	assert_query(&ti, "*ap?-tools*", 0, "0");
+	assert_query(&ti, "*py[0-9]-apk", 0, "4");
+	assert_query(&ti, "*a\\pk*", 0, "034");
+	apk_trigram_index_free(&ti);
+}
+
+APK_TEST(trigram_query_unindexed) {
+	struct apk_trigram_index ti;
+
+	build_index(&ti);
+	assert_query(&ti, "*", -ENOENT, "");
+	assert_query(&ti, "*ap*", -ENOENT, "");
+	assert_query(&ti, "a?k", -ENOENT, "");
+	apk_trigram_index_free(&ti);
+}
+
+APK_TEST(trigram_persist) {
+	struct apk_trigram_index ti, loaded;
+	struct apk_digest id, other;
+	FILE *f = tmpfile();
+	int fd;
+
+	assert_non_null(f);
+	fd = fileno(f);
+	apk_digest_calc(&id, APK_DIGEST_SHA256, "docs", 4);
+	apk_digest_calc(&other, APK_DIGEST_SHA256, "other", 5);
+	build_index(&ti);
+	assert_int_equal(0, apk_trigram_index_write(&ti, apk_ostream_to_fd(dup(fd)), &id));
+	apk_trigram_index_free(&ti);
+
+	apk_trigram_index_init(&loaded);
+	lseek(fd, 0, SEEK_SET);
+	assert_int_equal(-ESTALE, apk_trigram_index_check(apk_istream_from_fd(dup(fd)), &other));
+	lseek(fd, 0, SEEK_SET);
+	assert_int_equal(0, apk_trigram_index_check(apk_istream_from_fd(dup(fd)), &id));
+	lseek(fd, 0, SEEK_SET);
+	assert_int_equal(-ESTALE, apk_trigram_index_read(&loaded, apk_istream_from_fd(dup(fd)), &other));
+	lseek(fd, 0, SEEK_SET);
+	assert_int_equal(0, apk_trigram_index_read(&loaded, apk_istream_from_fd(dup(fd)), &id));
+	assert_int_equal(5, loaded.num_docs);
+	assert_query(&loaded, "*apk*", 0, "034");
+	assert_query(&loaded, "*package*", 0, "1");
+
+	// a truncated file is rejected
+	assert_int_equal(0, ftruncate(fd, sizeof(struct apk_trigram_header) + 4));
+	lseek(fd, 0, SEEK_SET);
+	assert_true(apk_trigram_index_read(&loaded, apk_istream_from_fd(dup(fd)), &id) < 0);
+	assert_int_equal(0, loaded.sorted);
+	apk_trigram_index_free(&loaded);
+	fclose(f);
+}
@@ -0,0 +1,300 @@
+#include <signal.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+
+#include "apk_test.h"
+#include "apk_io.h"
+
+/* a loopback HTTP/1.1 server forked for each test, serving:
+ *   /<name>      200 with the body "data-<name>"
+ *   /big         200 with a 1 MiB body
+ *   /missing     404 with a short body
+ *   /missing-big 404 with a 1 MiB body
+ *   /chunked     200 with the body "data-chunked" in two chunks
+ *   /notmod      304
+ *   /drop        200 with the body "data-drop", then closes the connection
+ * Each accepted connection is logged as one byte to a pipe. */
+struct test_server {
+	pid_t pid;
+	int port, log_fd;
+	char url[64];
+};
+
+#define BIG_SIZE (1024*1024)
+
+static void serve_reply(int fd, int code, size_t len, const char *body)
+{
+	char hdr[256], buf[4096];
+	size_t n;
+
+	if (code == 304) n = snprintf(hdr, sizeof hdr, "HTTP/1.1 304 Not Modified\r\nConnection: keep-alive\r\n\r\n");
+	else n = snprintf(hdr, sizeof hdr, "HTTP/1.1 %d %s\r\nConnection: keep-alive\r\nContent-Length: %zu\r\n\r\n",
+		code, code == 200 ? "OK" : "Not Found", len);
+	if (write(fd, hdr, n) != (ssize_t)n) return;
+	if (body) {
+		if (write(fd, body, len) != (ssize_t)len) return;
+		return;
+	}
+	memset(buf, 'x', sizeof buf);
+	for (; len; len -= n) {
+		n = len < sizeof buf ? len : sizeof buf;
+		if (write(fd, buf, n) != (ssize_t)n) return;
+	}
+}
+
+static void serve_chunked(int fd)
+{
+	static const char reply[] = "HTTP/1.1 200 OK\r\nConnection: keep-alive\r\nTransfer-Encoding: chunked\r\n\r\n"
+		"5\r\ndata-\r\n7;ext=1\r\nchunked\r\n0\r\n\r\n";
+	if (write(fd, reply, sizeof reply - 1) != sizeof reply - 1) return;
+}
+
+static void serve_conn(int fd)
+{
+	char line[512], path[256], body[300];
+	FILE *in = fdopen(fd, "r");
+
+	while (fgets(line, sizeof line, in)) {
+		if (sscanf(line, "GET %255s", path) != 1) break;
+		while (fgets(line, sizeof line, in) && strcmp(line, "\r\n") != 0)
+			;
+		if (strcmp(path, "/big") == 0)
+			serve_reply(fd, 200, BIG_SIZE, NULL);
+		else if (strcmp(path, "/missing") == 0)
+			serve_reply(fd, 404, 9, "not found");
+		else if (strcmp(path, "/missing-big") == 0)
+			serve_reply(fd, 404, BIG_SIZE, NULL);
+		else if (strcmp(path, "/chunked") == 0)
+			serve_chunked(fd);
+		else if (strcmp(path, "/notmod") == 0)
+			serve_reply(fd, 304, 0, "");
+		else if (strcmp(path, "/drop") == 0) {
+			serve_reply(fd, 200, 9, "data-drop");
+			break;
+		} else
+			serve_reply(fd, 200, snprintf(body, sizeof body, "data-%s", path + 1), body);
+	}
+	fclose(in);
+}
+
+// Serves each connection in its own process, all in one process group
+static void serve(int lfd, int log_fd)
+{
+	int fd;
+
+	setpgid(0, 0);
+	prctl(PR_SET_PDEATHSIG, SIGTERM);
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGCHLD, SIG_IGN);
+	while ((fd = accept(lfd, NULL, NULL)) >= 0) {
+		if (write(log_fd, "c", 1) != 1) break;
+		if (fork() == 0) {
+			close(lfd);
+			close(log_fd);
+			serve_conn(fd);
+			_exit(0);
+		}
+		close(fd);
+	}
+	_exit(0);
+}
+
+static void server_start(struct test_server *srv)
+{
+	struct sockaddr_in sa = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+	socklen_t salen = sizeof sa;
+	int lfd, pfd[2];
+
+	unsetenv("http_proxy");
+	unsetenv("HTTP_PROXY");
+	lfd = socket(AF_INET, SOCK_STREAM, 0);
+	assert_true(lfd >= 0);
+	assert_int_equal(0, bind(lfd, (struct sockaddr *)&sa, sizeof sa));
+	assert_int_equal(0, listen(lfd, 8));
+	assert_int_equal(0, getsockname(lfd, (struct sockaddr *)&sa, &salen));
+	assert_int_equal(0, pipe(pfd));
+
+	srv->port = ntohs(sa.sin_port);
+	srv->pid = fork();
+	assert_true(srv->pid >= 0);
+	if (srv->pid == 0) {
+		close(pfd[0]);
+		serve(lfd, pfd[1]);
+	}
+	setpgid(srv->pid, srv->pid);
+	close(lfd);
+	close(pfd[1]);
+	srv->log_fd = pfd[0];
+	apk_io_url_set_max_connections(1);
+	apk_io_url_set_timeout(5);
+}
+
+// Stops the server and returns the number of connections it accepted
+static int server_stop(struct test_server *srv)
+{
+	char buf[64];
+	int r, conns = 0;
+
+	apk_io_url_prefetch_end();
+	kill(-srv->pid, SIGTERM);
+	waitpid(srv->pid, NULL, 0);
+	while ((r = read(srv->log_fd, buf, sizeof buf)) > 0) conns += r;
+	close(srv->log_fd);
+	return conns;
+}
+
+static const char *server_url(struct test_server *srv, const char *path)
+{
+	snprintf(srv->url, sizeof srv->url, "http://127.0.0.1:%d/%s", srv->port, path);
+	return srv->url;
+}
+
+static void prefetch(struct test_server *srv, const char *path)
+{
+	apk_io_url_prefetch(server_url(srv, path), 0);
+}
+
+// Reads a reply up to the end and checks it
+static void assert_reply(struct apk_istream *is, const char *expected)
+{
+	char buf[64];
+	size_t n = 0;
+	ssize_t r;
+
+	assert_ptr_ok(is);
+	while ((r = apk_istream_read_max(is, &buf[n], sizeof buf - n)) > 0) n += r;
+	assert_int_equal(0, r);
+	assert_blob_equal(APK_BLOB_STR(expected), APK_BLOB_PTR_LEN(buf, n));
+	assert_int_equal(0, apk_istream_close(is));
+}
+
+static void assert_fetch(struct test_server *srv, const char *path, const char *expected)
+{
+	assert_reply(apk_io_url_istream(server_url(srv, path), 0), expected);
+}
+
+// Reads the start of a long reply and closes it
+static void assert_fetch_partial(struct test_server *srv, const char *path)
+{
+	struct apk_istream *is = apk_io_url_istream(server_url(srv, path), 0);
+	apk_blob_t b;
+
+	assert_ptr_ok(is);
+	assert_int_equal(0, apk_istream_get_max(is, 1, &b));
+	assert_int_equal('x', b.ptr[0]);
+	apk_istream_close(is);
+}
+
+APK_TEST(url_pipeline) {
+	struct test_server srv;
+
+	server_start(&srv);
+	prefetch(&srv, "a");
+	prefetch(&srv, "b");
+	prefetch(&srv, "c");
+	assert_fetch(&srv, "a", "data-a");
+	assert_fetch(&srv, "b", "data-b");
+	assert_fetch(&srv, "c", "data-c");
+	assert_int_equal(1, server_stop(&srv));
+}
+
+APK_TEST(url_pipeline_error_reply) {
+	struct test_server srv;
+	struct apk_istream *is;
+
+	server_start(&srv);
+	prefetch(&srv, "missing");
+	prefetch(&srv, "a");
+	is = apk_io_url_istream(server_url(&srv, "missing"), 0);
+	assert_int_equal(-APKE_HTTP_404_NOT_FOUND, PTR_ERR(is));
+	assert_fetch(&srv, "a", "data-a");
+	assert_int_equal(1, server_stop(&srv));
+}
+
+APK_TEST(url_pipeline_long_error_reply) {
+	struct test_server srv;
+	struct apk_istream *is;
+
+	/* the body is not read, the next request is sent again */
+	server_start(&srv);
+	prefetch(&srv, "missing-big");
+	prefetch(&srv, "a");
+	is = apk_io_url_istream(server_url(&srv, "missing-big"), 0);
+	assert_int_equal(-APKE_HTTP_404_NOT_FOUND, PTR_ERR(is));
+	assert_fetch(&srv, "a", "data-a");
+	assert_int_equal(2, server_stop(&srv));
+}
+
+APK_TEST(url_pipeline_early_close) {
+	struct test_server srv;
+
+	/* a long rest is not drained, the next request is sent again */
+	server_start(&srv);
+	prefetch(&srv, "big");
+	prefetch(&srv, "a");
+	assert_fetch_partial(&srv, "big");
+	assert_fetch(&srv, "a", "data-a");
+	assert_int_equal(2, server_stop(&srv));
+}
+
+APK_TEST(url_chunked_reply) {
+	struct test_server srv;
+
+	server_start(&srv);
+	prefetch(&srv, "chunked");
+	prefetch(&srv, "a");
+	assert_fetch(&srv, "chunked", "data-chunked");
+	assert_fetch(&srv, "a", "data-a");
+	assert_int_equal(1, server_stop(&srv));
+}
+
+APK_TEST(url_not_modified) {
+	struct test_server srv;
+	struct apk_istream *is;
+
+	server_start(&srv);
+	apk_io_url_prefetch(server_url(&srv, "notmod"), 1000);
+	prefetch(&srv, "a");
+	is = apk_io_url_istream(server_url(&srv, "notmod"), 1000);
+	assert_int_equal(-APKE_FILE_UNCHANGED, PTR_ERR(is));
+	assert_fetch(&srv, "a", "data-a");
+	assert_int_equal(1, server_stop(&srv));
+}
+
+APK_TEST(url_keepalive_reuse) {
+	struct test_server srv;
+
+	server_start(&srv);
+	assert_fetch(&srv, "a", "data-a");
+	assert_fetch(&srv, "b", "data-b");
+	assert_fetch(&srv, "c", "data-c");
+	assert_int_equal(1, server_stop(&srv));
+}
+
+APK_TEST(url_reconnect) {
+	struct test_server srv;
+
+	/* the kept connection is found closed, the request is retried */
+	server_start(&srv);
+	assert_fetch(&srv, "drop", "data-drop");
+	assert_fetch(&srv, "a", "data-a");
+	assert_int_equal(2, server_stop(&srv));
+}
+
+APK_TEST(url_busy_connection) {
+	struct test_server srv;
+	struct apk_istream *is;
+
+	/* the connection of an open reply is closed only with the reply */
+	server_start(&srv);
+	prefetch(&srv, "a");
+	prefetch(&srv, "b");
+	is = apk_io_url_istream(server_url(&srv, "a"), 0);
+	assert_ptr_ok(is);
+	assert_fetch(&srv, "b", "data-b");
+	assert_reply(is, "data-a");
+	assert_int_equal(2, server_stop(&srv));
+}
@@ -0,0 +1,36 @@
+#!/bin/sh
+
+TESTDIR=$(realpath "${TESTDIR:-"$(dirname "$0")"/..}")
+. "$TESTDIR"/testlib.sh
+
+setup_apkroot
+APK="$APK --allow-untrusted --no-interactive --force-no-chroot"
+CACHE="$TEST_ROOT/etc/apk/cache"
+
+mkdir a b
+touch a/a b/b
+
+$APK mkpkg -I name:test-a -I version:1.0 -F a -o test-a-1.0.apk
+$APK mkpkg -I name:test-b -I version:1.0 -F b -o test-b-1.0.apk
+$APK add --initdb $TEST_USERMODE test-a-1.0.apk test-b-1.0.apk > /dev/null
+rm test-a-1.0.apk test-b-1.0.apk
+
+# the index is written only if the directory was not modified just now
+$APK add -vv 2>&1 | grep -q "cache index not used" || assert "cache index used before written"
+touch -d "1 hour ago" "$CACHE"
+$APK add > /dev/null
+[ -s "$CACHE"/cache.idx ] || assert "cache index not written"
+$APK add -vv 2>&1 | grep -q "cache index not used" && assert "cache index not used"
+$APK fix --reinstall test-a > /dev/null || assert "package not found from indexed cache"
+
+$APK cache clean
+[ -f "$CACHE"/cache.idx ] || assert "cache index deleted"
+
+touch "$CACHE"/test-c-1.0.apk
+$APK add -vv 2>&1 | grep -q "cache index not used" || assert "stale cache index used"
+
+echo garbage > "$CACHE"/cache.idx
+touch -d "1 hour ago" "$CACHE"
+$APK fix --reinstall test-b > /dev/null || assert "package not found with invalid cache index"
+$APK add -vv 2>&1 | grep -q "cache index not used" && assert "cache index not regenerated"
+exit 0
@@ -0,0 +1,43 @@
+#!/bin/sh
+
+TESTDIR=$(realpath "${TESTDIR:-"$(dirname "$0")"/..}")
+. "$TESTDIR"/testlib.sh
+
+setup_apkroot
+APK="$APK --allow-untrusted --no-interactive --force-no-chroot"
+CACHE="$TEST_ROOT/etc/apk/cache"
+
+mkdir -p files/usr/share
+head -c 100000 /dev/urandom > files/usr/share/big
+$APK mkpkg -I name:foo -I version:1.0 -F files -o foo-1.0.apk
+$APK mkndx -o index.adb foo-1.0.apk > /dev/null
+$APK add --initdb $TEST_USERMODE > /dev/null
+mkdir -p "$CACHE"
+echo "test:/$PWD/index.adb" > "$TEST_ROOT"/etc/apk/repositories
+$APK update > /dev/null
+$APK cache download foo > /dev/null || assert "download failed"
+CACHED=$(glob_one "$CACHE/foo-1.0.*.apk")
+cmp -s "$CACHED" foo-1.0.apk || assert "cached package differs"
+
+# an interrupted download is continued from the partial file
+rm "$CACHED"
+head -c 30000 foo-1.0.apk > "$CACHED".part
+$APK cache download -vv foo 2>&1 | grep -q "resuming download at 30000 bytes" || assert "download not resumed"
+cmp -s "$CACHED" foo-1.0.apk || assert "resumed package differs"
+[ -e "$CACHED".part ] && assert "partial file not renamed"
+
+# a partial file with corrupt data is removed, not resumed again
+rm "$CACHED"
+head -c 30000 /dev/urandom > "$CACHED".part
+$APK cache download foo > /dev/null 2>&1 && assert "corrupt partial file accepted"
+[ -e "$CACHED".part ] && assert "corrupt partial file kept"
+[ -e "$CACHED" ] && assert "corrupt package cached"
+$APK cache download foo > /dev/null || assert "download after corrupt partial file failed"
+cmp -s "$CACHED" foo-1.0.apk || assert "cached package differs"
+
+# no empty partial file is left behind if the transfer does not start
+rm "$CACHED"
+mv foo-1.0.apk foo-1.0.full
+$APK cache download foo > /dev/null 2>&1 && assert "missing package downloaded"
+[ -e "$CACHED".part ] && assert "empty partial file kept"
+exit 0
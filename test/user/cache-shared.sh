@@ -0,0 +1,35 @@
+#!/bin/sh
+
+TESTDIR=$(realpath "${TESTDIR:-"$(dirname "$0")"/..}")
+. "$TESTDIR"/testlib.sh
+
+setup_apkroot
+APK="$APK --allow-untrusted --no-interactive --force-no-chroot"
+SHARED="$PWD/shared"
+CACHE="$TEST_ROOT/etc/apk/cache"
+
+mkdir a b "$SHARED"
+touch a/a b/b
+
+$APK mkpkg -I name:test-a -I version:1.0 -F a -o test-a-1.0.apk
+$APK mkpkg -I name:test-b -I version:1.0 -I depends:test-a -F b -o test-b-1.0.apk
+$APK mkndx -o index.adb test-a-1.0.apk test-b-1.0.apk > /dev/null
+$APK add --initdb $TEST_USERMODE > /dev/null
+echo "test:/$PWD/index.adb" > "$TEST_ROOT"/etc/apk/repositories
+
+# populate the shared cache and make the repository unreachable
+$APK --cache-dir "$SHARED" update > /dev/null
+$APK --cache-dir "$SHARED" cache download test-b > /dev/null || assert "cache download failed"
+rm test-a-1.0.apk test-b-1.0.apk
+ls "$SHARED"/test-b-1.0.*.apk > /dev/null || assert "shared cache not populated"
+mkdir -p "$CACHE"
+cp "$SHARED"/APKINDEX.* "$CACHE"/
+
+$APK --cache-shared-dir "$SHARED" --no-network add test-b > /dev/null || assert "install from shared cache failed"
+[ -f "$TEST_ROOT"/b ] || assert "package not installed"
+[ "$(stat -c %i "$CACHE"/test-b-1.0.*.apk)" = "$(stat -c %i "$SHARED"/test-b-1.0.*.apk)" ] || assert "private cache not linked"
+
+find "$SHARED" -printf '%f %s %T@\n' > shared.before
+$APK --cache-shared-dir "$SHARED" cache clean > /dev/null
+find "$SHARED" -printf '%f %s %T@\n' | diff -u shared.before - > /dev/null || assert "shared cache modified"
+exit 0
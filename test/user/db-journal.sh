@@ -0,0 +1,76 @@
+#!/bin/sh
+
+TESTDIR=$(realpath "${TESTDIR:-"$(dirname "$0")"/..}")
+. "$TESTDIR"/testlib.sh
+
+create_pkg() {
+	local pkg="$1" ver="$2"
+	local pkgdir="files/"${pkg}-${ver}""
+	shift 2
+
+	mkdir -p "$pkgdir"/files "$pkgdir"/"$pkg"
+	echo "$pkg" > "$pkgdir"/files/test-file
+	echo "$pkg" > "$pkgdir"/"$pkg"/own-file
+	cat <<EOF > "$pkg".sh
+#!/bin/sh
+echo Hello from $pkg
+EOF
+
+	$APK mkpkg -I "name:${pkg}" -I "version:${ver}" -s "pre-deinstall:$pkg.sh" "$@" -F "$pkgdir" -o "${pkg}-${ver}.apk"
+}
+
+check_installed() {
+	local val
+	val=$($APK info -e a b c | tr "\n" " ") || true
+	[ "$val" = "$1" ] || assert "installed '$1' expected, got '$val'"
+}
+
+check_owner() {
+	local val
+	val=$($APK info -q -W "$1" 2>&1) || true
+	[ "$val" = "$2" ] || assert "$1: owner '$2' expected, got '$val'"
+}
+
+setup_apkroot
+APK="$APK --allow-untrusted --no-interactive --force-no-chroot"
+DB="$TEST_ROOT"/lib/apk/db
+
+create_pkg a 1.0
+create_pkg b 1.0 -I "replaces:a"
+create_pkg c 1.0 -I "replaces:a b"
+
+$APK add --initdb $TEST_USERMODE a-1.0.apk
+cp "$DB"/installed installed.orig
+$APK --db-journal add b-1.0.apk > /dev/null
+[ -f "$DB"/journal ] || assert "journal not written"
+cmp -s "$DB"/installed installed.orig || assert "installed database rewritten"
+check_installed "a b "
+check_owner files/test-file b
+check_owner a/own-file a
+
+# a torn commit is ignored
+cp "$DB"/journal journal.good
+cp "$TEST_ROOT"/etc/apk/world world.good
+$APK --db-journal add c-1.0.apk > /dev/null
+check_installed "a b c "
+head -c $(( $(stat -c %s "$DB"/journal) - 10 )) "$DB"/journal > journal.torn
+cp journal.torn "$DB"/journal
+check_installed "a b "
+cp journal.good "$DB"/journal
+cp world.good "$TEST_ROOT"/etc/apk/world
+
+$APK --db-journal del b > apk-stdout.log 2>&1
+grep -q "Hello from b" apk-stdout.log || assert "script not run"
+check_installed "a "
+check_owner files/test-file "ERROR: files/test-file: Could not find owner package"
+
+# a full write removes the journal
+$APK add c-1.0.apk > /dev/null
+[ -f "$DB"/journal ] && assert "journal not removed"
+check_installed "a c "
+
+# a stale journal is ignored
+$APK --db-journal del c > /dev/null
+[ -f "$DB"/journal ] || assert "journal not written"
+touch -d "2001-01-01" "$DB"/installed
+check_installed "a c "
@@ -0,0 +1,43 @@
+#!/bin/sh
+
+TESTDIR=$(realpath "${TESTDIR:-"$(dirname "$0")"/..}")
+. "$TESTDIR"/testlib.sh
+
+setup_apkroot
+APK="$APK --allow-untrusted --no-interactive --force-no-chroot"
+CACHE="$TEST_ROOT/etc/apk/cache"
+
+mkdir -p files/usr/share
+head -c 100000 /dev/urandom > files/usr/share/big
+echo 1 > files/usr/share/small
+$APK mkpkg -I name:foo -I version:1.0-r0 -F files -o foo-1.0-r0.apk
+echo 2 > files/usr/share/small
+$APK mkpkg -I name:foo -I version:1.0-r1 -F files -o foo-1.0-r1.apk
+$APK mkdelta foo-1.0-r0.apk foo-1.0-r1.apk > /dev/null || assert "mkdelta failed"
+
+$APK mkndx -o index.adb foo-1.0-r0.apk > /dev/null
+$APK add --initdb $TEST_USERMODE > /dev/null
+mkdir -p "$CACHE"
+echo "test:/$PWD/index.adb" > "$TEST_ROOT"/etc/apk/repositories
+$APK update > /dev/null
+$APK add foo > /dev/null || assert "install failed"
+
+$APK mkndx -o index.adb foo-1.0-r0.apk foo-1.0-r1.apk foo-1.0-r1.apk.*.delta > /dev/null
+$APK adbdump index.adb | grep -q "deltas:" || assert "deltas not indexed"
+$APK update > /dev/null
+
+# the package is rebuilt from the cached one without downloading it
+mv foo-1.0-r1.apk foo-1.0-r1.full
+$APK upgrade -vv 2>&1 | grep -q "rebuilt from foo-1.0-r0 with a delta" || assert "delta not used"
+[ "$(cat "$TEST_ROOT"/usr/share/small)" = 2 ] || assert "package not upgraded"
+cmp -s "$CACHE"/foo-1.0-r1.*.apk foo-1.0-r1.full || assert "rebuilt package differs"
+
+# a corrupt delta falls back to downloading the package
+$APK add foo=1.0-r0 > /dev/null
+$APK add foo > /dev/null
+rm "$CACHE"/foo-1.0-r1.*.apk
+mv foo-1.0-r1.full foo-1.0-r1.apk
+printf 'XXXX' | dd of="$(echo foo-1.0-r1.apk.*.delta)" bs=1 seek=1000 conv=notrunc 2> /dev/null
+$APK upgrade > /dev/null || assert "fallback download failed"
+[ "$(cat "$TEST_ROOT"/usr/share/small)" = 2 ] || assert "package not upgraded"
+exit 0
@@ -0,0 +1,25 @@
+#!/bin/sh
+
+TESTDIR=$(realpath "${TESTDIR:-"$(dirname "$0")"/..}")
+. "$TESTDIR"/testlib.sh
+
+setup_apkroot
+APK="$APK --allow-untrusted --no-interactive --force-no-chroot"
+
+for opt in "--download-rate 1X" "--download-rate K" "--download-connections 0" "--download-connections 2x" \
+	   "--download-connections abc" "--download-jitter -1" "--download-jitter 5s" "--download-jitter 86401"; do
+	# shellcheck disable=SC2086 # word splitting is intended
+	case "$($APK $opt info 2>&1 >/dev/null)" in
+	*'invalid argument'*) ;;
+	*) assert "$opt: expected invalid argument error" ;;
+	esac
+done
+
+mkdir -p files/a
+echo a > files/a/file
+$APK mkpkg -I "name:a" -I "version:1.0" -F files -o a-1.0.apk
+
+# local files are not governed, so nothing is delayed or throttled
+$APK add --initdb $TEST_USERMODE --download-rate 1 --download-jitter 3600 --download-connections 1 a-1.0.apk > /dev/null || assert "add failed"
+[ -e "$TEST_ROOT"/a/file ] || assert "file not installed"
+exit 0
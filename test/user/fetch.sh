@@ -43,3 +43,12 @@ assert_downloaded meta_1.0_noarch.pkg hello_1.0_noarch.pkg
 
 $APK fetch --arch strange --recursive strange
 assert_downloaded strange-1.0.apk
+
+mkdir -p mirror
+cp repo/*.apk repo/index.adb mirror/
+rm repo/hello-1.0.apk
+$APK fetch --recursive --repository-config "mirror test:/$PWD/repo test:/$PWD/mirror" meta 2> mirror.log ||
+	assert "mirror failover failed"
+grep -q "trying mirror test:/$PWD/mirror" mirror.log || assert "mirror failover not reported"
+rm mirror.log
+assert_downloaded meta-1.0.apk hello-1.0.apk
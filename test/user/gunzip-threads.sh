@@ -0,0 +1,50 @@
+#!/bin/sh
+
+TESTDIR=$(realpath "${TESTDIR:-"$(dirname "$0")"/..}")
+. "$TESTDIR"/testlib.sh
+
+# the v2 package is built with the pax headers of GNU tar
+tar --version 2>/dev/null | grep -q "GNU tar" || exit 0
+
+setup_apkroot
+APK="$APK --allow-untrusted --no-interactive --force-no-chroot"
+
+# Writes an unsigned v2 package with the file usr/share/test/big
+make_v2_package() {
+	mkdir -p data/usr/share/test control
+	head -c 300000 /dev/urandom > data/usr/share/test/big
+	tar --format=pax -b 1 -C data --no-recursion \
+		--pax-option="delete=atime,delete=ctime,APK-TOOLS.checksum.SHA1:=$(sha1sum data/usr/share/test/big | cut -d' ' -f1)" \
+		-c usr usr/share usr/share/test usr/share/test/big | gzip -n > data.tar.gz
+	cat > control/.PKGINFO <<EOT
+pkgname = test-v2
+pkgver = 1.0-r0
+arch = noarch
+size = 300000
+datahash = $(sha256sum data.tar.gz | cut -d' ' -f1)
+EOT
+	# the control stream is not terminated, the data stream follows it
+	tar --format=ustar -b 1 -C control -c .PKGINFO > control.tar
+	head -c $(($(wc -c < control.tar) - 1024)) control.tar | gzip -n > control.tar.gz
+	cat control.tar.gz data.tar.gz > "$1"
+}
+
+make_v2_package test-v2-1.0-r0.apk
+head -c 200000 test-v2-1.0-r0.apk > truncated.apk
+cp test-v2-1.0-r0.apk corrupt.apk
+printf 'x' | dd of=corrupt.apk bs=1 seek=100000 conv=notrunc 2> /dev/null
+$APK add --initdb $TEST_USERMODE > /dev/null
+$APK index -o APKINDEX.tar.gz test-v2-1.0-r0.apk > /dev/null
+
+for opt in --no-gunzip-threads --gunzip-threads; do
+	$APK $opt verify test-v2-1.0-r0.apk > /dev/null || assert "$opt: verify failed"
+	$APK $opt verify truncated.apk > /dev/null 2>&1 && assert "$opt: truncated package verified"
+	$APK $opt verify corrupt.apk > /dev/null 2>&1 && assert "$opt: corrupt package verified"
+
+	$APK $opt add --repository "$PWD"/APKINDEX.tar.gz test-v2 > /dev/null || assert "$opt: install failed"
+	cmp -s "$TEST_ROOT"/usr/share/test/big data/usr/share/test/big || assert "$opt: installed file differs"
+	$APK $opt audit --system | grep -q . && assert "$opt: audit found changes"
+	$APK del test-v2 > /dev/null
+	[ -e "$TEST_ROOT"/usr/share/test/big ] && assert "$opt: file not removed"
+done
+exit 0
@@ -0,0 +1,38 @@
+#!/bin/sh
+
+TESTDIR=$(realpath "${TESTDIR:-"$(dirname "$0")"/..}")
+. "$TESTDIR"/testlib.sh
+
+setup_apkroot
+APK="$APK --allow-untrusted --no-interactive --force-no-chroot"
+
+for v in 1 2 3; do
+	$APK mkpkg -I name:foo -I version:$v -o foo-$v.apk
+	$APK mkpkg -I name:bar -I version:$v -o bar-$v.apk
+done
+$APK mkndx -o index.adb foo-1.apk bar-1.apk > /dev/null
+cp index.adb index-1.adb
+$APK add --initdb $TEST_USERMODE > /dev/null
+echo "test:/$PWD/index.adb" > "$TEST_ROOT"/etc/apk/repositories
+$APK update > /dev/null
+
+# each published index comes with a delta from the previous one
+$APK mkndx -o index-2.adb foo-2.apk bar-1.apk > /dev/null
+$APK mkdelta --index -o index.adb.d1 index-1.adb index-2.adb > /dev/null || assert "mkdelta failed"
+$APK mkndx -o index-3.adb foo-2.apk bar-2.apk > /dev/null
+$APK mkdelta --index index-2.adb index-3.adb > /dev/null || assert "mkdelta failed"
+mv index-3.adb.*.delta "$(echo index-3.adb.*.delta | sed 's/index-3/index/')"
+mv index.adb.d1 "index.adb.$(sha256sum index-1.adb | cut -c1-16).delta"
+cp index-3.adb index.adb
+touch -d "2000-01-01" index.adb
+touch -d "2000-01-02" index.adb.*.delta
+
+# the deltas are applied in turn and the index is not downloaded
+$APK update -vv 2>&1 | grep -c "updated with a delta" | grep -qx 2 || assert "deltas not used"
+cmp -s "$TEST_ROOT"/etc/apk/cache/APKINDEX.*.tar.gz index-3.adb || assert "index not updated"
+$APK search bar | grep -q "bar-2" || assert "updated index not loaded"
+
+# an index published without a delta is downloaded
+$APK mkndx -o index.adb foo-3.apk bar-3.apk > /dev/null
+$APK update > /dev/null || assert "update failed"
+$APK search foo | grep -q "foo-3" || assert "index not downloaded"
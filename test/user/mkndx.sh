@@ -80,3 +80,8 @@ $APK query --format yaml --repository index.adb --fields name,tags --match tags
     - tagB
     - tagC=2
 EOF
+
+for jobs in 0 x 1x -1 1025; do
+	$APK mkndx -j "$jobs" -o index-jobs.adb test-a-1.0.apk > /dev/null 2>&1 && assert "invalid --jobs $jobs accepted"
+done
+$APK mkndx -q -j 2 -o index-jobs.adb test-a-1.0.apk || assert "valid --jobs rejected"
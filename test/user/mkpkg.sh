@@ -75,3 +75,12 @@ paths: # 1 items
       user: root
       group: root
 EOF
+
+for i in 1 2 3 4 5 6 7 8; do echo "file $i" > files/usr/share/foo/file$i; done
+ln files/usr/share/foo/file1 files/usr/share/foo/bar/hardlink
+for jobs in 0 x 1x -1 1025; do
+	$APK --root=. mkpkg -j "$jobs" -I name:jobs -I version:1.0 -o jobs-bad.apk > /dev/null 2>&1 && assert "invalid --jobs $jobs accepted"
+done
+$APK --root=. mkpkg --no-xattrs -j1 -I name:jobs -I version:1.0 -F files -o jobs-1.apk
+$APK --root=. mkpkg --no-xattrs -j4 -I name:jobs -I version:1.0 -F files -o jobs-4.apk
+cmp -s jobs-1.apk jobs-4.apk || assert "output differs with parallel hashing"
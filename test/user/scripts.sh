@@ -44,3 +44,24 @@ $APK add --preserve-env $TEST_USERMODE scripts-1.0.apk 2> /dev/null | diff -u /d
   * Hello from post-install / post-install / test
 OK: 1 B in 1 packages
 EOF
+
+cat <<'EOF' > deinstall.sh
+#!/bin/sh
+echo Hello from pre-deinstall
+EOF
+$APK mkpkg -I name:deinstall -I version:1.0 -s pre-deinstall:deinstall.sh -o deinstall-1.0.apk
+$APK add $TEST_USERMODE deinstall-1.0.apk > /dev/null 2>&1
+[ -f "$TEST_ROOT"/lib/apk/db/scripts.idx ] || assert "script store not written"
+$APK query --fields scripts deinstall 2>&1 | diff -u /dev/fd/4 4<<EOF - || assert "wrong query result"
+Scripts: pre-deinstall
+EOF
+$APK del -vv deinstall > apk-stdout.log 2>&1
+grep -q "script store not used" apk-stdout.log && assert "script store not used"
+grep -q "Hello from pre-deinstall" apk-stdout.log || assert "script not run"
+
+# stale store is ignored and the archive is used instead
+$APK add $TEST_USERMODE deinstall-1.0.apk > /dev/null 2>&1
+touch -d "2001-01-01" "$TEST_ROOT"/lib/apk/db/scripts.tar*
+$APK del -vv deinstall > apk-stdout.log 2>&1
+grep -q "script store not used" apk-stdout.log || assert "stale script store used"
+grep -q "Hello from pre-deinstall" apk-stdout.log || assert "script not run"
@@ -0,0 +1,46 @@
+#!/bin/sh
+
+TESTDIR=$(realpath "${TESTDIR:-"$(dirname "$0")"/..}")
+. "$TESTDIR"/testlib.sh
+
+setup_apkroot
+APK="$APK --allow-untrusted --no-interactive --force-no-chroot"
+CACHE="$TEST_ROOT/etc/apk/cache"
+
+for p in alpha beta gamma delta; do
+	$APK mkpkg -I "name:test-$p" -I version:1.0 -I "description:the $p package" -o "test-$p-1.0.apk"
+done
+$APK mkndx -o index.adb test-alpha-1.0.apk test-beta-1.0.apk
+$APK add --initdb $TEST_USERMODE > /dev/null
+APK="$APK --repository $PWD/index.adb"
+
+# a search does not write the index
+rm -f "$CACHE"/search.idx
+[ "$($APK search -d 'beta pack')" = "test-beta-1.0" ] || assert "wrong result"
+[ -e "$CACHE"/search.idx ] && assert "search index written by search"
+
+# it is written when the repositories are loaded for writing
+$APK update > /dev/null
+[ -s "$CACHE"/search.idx ] || assert "search index not written"
+$APK search -vv -d 'beta pack' 2>&1 | grep -q "search index not used" && assert "search index not used"
+[ "$($APK search -d 'alpha pack')" = "test-alpha-1.0" ] || assert "wrong result from saved index"
+
+# installed packages not in the repositories are found
+$APK add test-delta-1.0.apk > /dev/null
+$APK query --fields name --match description --search 'delta pack' | grep -q "test-delta" || assert "installed package not found"
+
+# a changed repository invalidates it
+touch -d '-1 hour' index.adb
+$APK search -vv -d 'gamma pack' 2>&1 | grep -q "search index not used" || assert "stale search index used"
+$APK mkndx -o index.adb test-alpha-1.0.apk test-beta-1.0.apk test-gamma-1.0.apk
+[ "$($APK search -d 'gamma pack')" = "test-gamma-1.0" ] || assert "wrong result after update"
+$APK update > /dev/null
+$APK search -vv -d 'gamma pack' 2>&1 | grep -q "search index not used" && assert "updated search index not used"
+[ "$($APK search -d 'gamma pack')" = "test-gamma-1.0" ] || assert "wrong result from updated index"
+
+echo garbage > "$CACHE"/search.idx
+[ "$($APK search -d 'gamma pack')" = "test-gamma-1.0" ] || assert "wrong result with invalid index"
+
+$APK cache clean
+[ -f "$CACHE"/search.idx ] || assert "search index deleted"
+exit 0
@@ -0,0 +1,39 @@
+#!/bin/sh
+
+TESTDIR=$(realpath "${TESTDIR:-"$(dirname "$0")"/..}")
+. "$TESTDIR"/testlib.sh
+
+setup_apkroot
+APK="$APK --allow-untrusted --no-interactive --force-no-chroot"
+
+$APK mkpkg -I "name:a" -I "version:1.0" -I "depends:b>=2 missing" -o a-1.0.apk
+$APK mkpkg -I "name:b" -I "version:1.0" -o b-1.0.apk
+$APK mkndx -o index.adb a-1.0.apk b-1.0.apk > /dev/null
+$APK add --initdb $TEST_USERMODE > /dev/null
+APK="$APK --repository index.adb"
+
+$APK add --simulate a b > errors.txt 2>&1 && assert "errors not reported"
+diff -u - errors.txt <<EOF || assert "wrong error report"
+ERROR: unable to select packages:
+  b-1.0:
+    breaks: a-1.0[b>=2]
+    satisfies: world[b]
+  missing (no such package):
+    required by: a-1.0[missing]
+EOF
+
+$APK add --simulate --solver-errors yaml a b 2> errors.yaml > /dev/null && assert "errors not reported"
+diff -u - errors.yaml <<EOF || assert "wrong error summary"
+problems:
+  - package: b-1.0
+    breaks:
+      - a-1.0[b>=2]
+  - name: missing
+    error: no such package
+    required-by:
+      - a-1.0[missing]
+EOF
+
+$APK add --simulate --solver-errors json a b 2> errors.json > /dev/null && assert "errors not reported"
+assert_json errors.json
+exit 0
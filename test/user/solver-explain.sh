@@ -0,0 +1,37 @@
+#!/bin/sh
+
+TESTDIR=$(realpath "${TESTDIR:-"$(dirname "$0")"/..}")
+. "$TESTDIR"/testlib.sh
+
+setup_apkroot
+APK="$APK --allow-untrusted --no-interactive --force-no-chroot"
+
+$APK mkpkg -I "name:a" -I "version:1.0" -I "depends:b" -o a-1.0.apk
+$APK mkpkg -I "name:a" -I "version:2.0" -I "depends:b" -o a-2.0.apk
+$APK mkpkg -I "name:b" -I "version:1.0" -o b-1.0.apk
+$APK mkndx -o main.adb a-1.0.apk b-1.0.apk > /dev/null
+$APK mkndx -o testing.adb a-2.0.apk > /dev/null
+$APK add --initdb $TEST_USERMODE > /dev/null
+echo "$PWD/main.adb" > "$TEST_ROOT"/etc/apk/repositories
+echo "@testing $PWD/testing.adb" >> "$TEST_ROOT"/etc/apk/repositories
+
+$APK add --simulate --solver-explain yaml a@testing 2> explain.yaml > /dev/null
+sed -n '/name: a$/,/^  - /p' explain.yaml | diff -u - /dev/fd/4 4<<EOF || assert "wrong explanation"
+    name: a
+    candidates:
+      - package: a-1.0
+        result: preferred
+        reason: prefer existing package
+      - package: a-2.0
+        result: preferred
+        reason: prefer preferred pinning
+    selected: a-2.0
+    pinning: '@testing'
+  - event: disqualify
+EOF
+
+$APK add --simulate --solver-explain json a@testing 2> explain.json > /dev/null
+grep -q '"from": "world"' explain.json || assert "world constraint missing"
+grep -q '"from": "a-2.0"' explain.json || assert "dependency constraint missing"
+assert_json explain.json
+exit 0
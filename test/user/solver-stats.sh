@@ -0,0 +1,19 @@
+#!/bin/sh
+
+TESTDIR=$(realpath "${TESTDIR:-"$(dirname "$0")"/..}")
+. "$TESTDIR"/testlib.sh
+
+setup_apkroot
+APK="$APK --allow-untrusted --no-interactive --force-no-chroot"
+
+$APK mkpkg -I "name:a" -I "version:1.0" -I "depends:b" -o a-1.0.apk
+$APK mkpkg -I "name:b" -I "version:1.0" -o b-1.0.apk
+
+$APK add --initdb $TEST_USERMODE --simulate --solver-stats json a-1.0.apk b-1.0.apk 2> stats.json > /dev/null
+grep -q '"names-discovered": 2' stats.json || assert "stats: names-discovered wrong"
+grep -q '"resolve-usec"' stats.json || assert "stats: resolve-usec missing"
+assert_json stats.json
+
+$APK add --simulate -vv a-1.0.apk b-1.0.apk | grep -q "^solver: 2 names discovered" || assert "stats: not printed with -vv"
+$APK add --simulate --solver-stats xml a-1.0.apk > /dev/null 2>&1 && assert "stats: invalid format accepted"
+exit 0
@@ -0,0 +1,20 @@
+#!/bin/sh
+
+TESTDIR=$(realpath "${TESTDIR:-"$(dirname "$0")"/..}")
+. "$TESTDIR"/testlib.sh
+
+setup_apkroot
+APK="$APK --allow-untrusted --no-interactive --force-no-chroot"
+
+mkdir -p files/a
+echo a > files/a/file
+$APK mkpkg -I "name:a" -I "version:1.0" -F files -o a-1.0.apk
+
+$APK add --initdb $TEST_USERMODE --trace-file trace.json a-1.0.apk > /dev/null
+for phase in '"open database"' '"solve"' '"install a-1.0"' '"write database"' '"add"'; do
+	grep -q "\"name\":$phase" trace.json || assert "trace: $phase missing"
+done
+assert_json trace.json
+
+$APK info --trace-file /nonexistent/trace.json > /dev/null 2>&1 && assert "trace: open error not reported"
+exit 0
@@ -0,0 +1,41 @@
+#!/bin/sh
+
+TESTDIR=$(realpath "${TESTDIR:-"$(dirname "$0")"/..}")
+. "$TESTDIR"/testlib.sh
+
+create_pkg() {
+	local pkg="$1" script="$2"
+	local pkgdir="files/$pkg"
+	shift 2
+
+	mkdir -p "$pkgdir"/usr/lib/"$pkg"
+	echo "$pkg" > "$pkgdir"/usr/lib/"$pkg"/file
+	printf '#!/bin/sh\n%s\n' "$script" > "$pkg".trigger
+	$APK mkpkg -I "name:$pkg" -I "version:1.0" -s "trigger:$pkg.trigger" -t "/usr/share/data" "$@" -F "$pkgdir" -o "$pkg-1.0.apk"
+}
+
+setup_apkroot
+APK="$APK --allow-untrusted --no-interactive --force-no-chroot"
+
+create_pkg a 'touch a.start; sleep 1; touch a.done; echo "a done"'
+create_pkg b '[ -f a.done ] && echo "b after a"' -I "depends:a"
+create_pkg c 'for i in 1 2 3 4 5 6 7 8 9 10; do [ -f a.start ] && break; sleep 0.2; done; [ -f a.done ] || echo "c concurrent"'
+mkdir -p files/data/usr/share/data
+echo data > files/data/usr/share/data/file
+$APK mkpkg -I name:data -I version:1.0 -F files/data -o data-1.0.apk
+
+$APK add --initdb $TEST_USERMODE a-1.0.apk b-1.0.apk c-1.0.apk > /dev/null
+for jobs in 0 -1 abc; do
+	$APK add --trigger-jobs "$jobs" data-1.0.apk > /dev/null 2>&1 && assert "--trigger-jobs $jobs accepted"
+done
+$APK add --trigger-jobs 3 data-1.0.apk > apk-stdout.log 2>&1
+diff -u - apk-stdout.log <<EOF2 || assert "wrong scripts result"
+(1/1) Installing data (1.0)
+Executing c-1.0.trigger
+* c concurrent
+Executing a-1.0.trigger
+* a done
+Executing b-1.0.trigger
+* b after a
+OK: 11 B in 4 packages
+EOF2
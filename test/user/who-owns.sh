@@ -0,0 +1,51 @@
+#!/bin/sh
+
+TESTDIR=$(realpath "${TESTDIR:-"$(dirname "$0")"/..}")
+. "$TESTDIR"/testlib.sh
+
+create_pkg() {
+	local pkg="$1" ver="$2"
+	local pkgdir="files/"${pkg}-${ver}""
+	shift 2
+
+	mkdir -p "$pkgdir"/files "$pkgdir"/"$pkg"
+	echo "$pkg" > "$pkgdir"/files/test-file
+	echo "$pkg" > "$pkgdir"/"$pkg"/own-file
+
+	$APK mkpkg -I "name:${pkg}" -I "version:${ver}" "$@" -F "$pkgdir" -o "${pkg}-${ver}.apk"
+}
+
+check_owner() {
+	local val
+	val=$($APK info -q -W "$1" 2>&1) || true
+	[ "$val" = "$2" ] || assert "$1: owner '$2' expected, got '$val'"
+}
+
+setup_apkroot
+APK="$APK --allow-untrusted --no-interactive"
+
+create_pkg a 1.0
+create_pkg b 1.0 -I "replaces:a"
+
+$APK add --initdb $TEST_USERMODE a-1.0.apk b-1.0.apk
+[ -f "$TEST_ROOT"/lib/apk/db/owners ] || assert "owner index not written"
+
+$APK info -vv -W a/own-file 2>&1 | grep -q "owner index not used" && assert "owner index not used"
+check_owner a/own-file a
+check_owner b/own-file b
+check_owner b b
+check_owner files/test-file b
+check_owner not-found "ERROR: not-found: Could not find owner package"
+$APK query --match owner --fields name /a/own-file 2>&1 | diff -u /dev/fd/4 4<<EOF - || assert "wrong query result"
+Name: a
+EOF
+
+# stale index is ignored
+touch -d "2001-01-01" "$TEST_ROOT"/lib/apk/db/installed
+$APK info -vv -W a/own-file 2>&1 | grep -q "owner index not used" || assert "stale owner index used"
+check_owner a/own-file a
+check_owner files/test-file b
+
+$APK del b
+check_owner files/test-file "ERROR: files/test-file: Could not find owner package"
+check_owner a/own-file a